@@ -1,4 +1,4 @@
-﻿
+
 -- LOAD '$libdir/plugins/pgsiftorder.so';
 -- LOAD 'pgsiftorder.so';
 
@@ -13,31 +13,80 @@ $BODY$ BEGIN
     RETURN b;
 END; $BODY$
   LANGUAGE plpgsql IMMUTABLE STRICT;
-ALTER FUNCTION array_debug(real[], real[])
-  OWNER TO tidb;  
 
 
 -- Real vector (array) funs
 ------------------------------
 
+-- Moving (window) accumulator - ΣAi, ΣAi^2, Σi, -i in double precision[], the rows leaving the frame are subtracted
+-- (MSFUNC, MINVFUNC of array_sum, array_accumulate, array_avg and array_std - O(dim) per row OVER (ROWS n PRECEDING))
+DROP FUNCTION IF EXISTS array_macc_real(double precision[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_macc_real(double precision[], real[]) RETURNS double precision[]
+AS 'pgsiftorder.so', 'c_array_macc_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_macc_real(double precision[], real[]) IS 'Moving accumulator transition - ΣAi, ΣAi^2, Σi, -i
+@param elements0 double precision[]  // INOUT
+@param elements1 real[]  // IN';
+
+DROP FUNCTION IF EXISTS array_macc_inv_real(double precision[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_macc_inv_real(double precision[], real[]) RETURNS double precision[]
+AS 'pgsiftorder.so', 'c_array_macc_inv_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_macc_inv_real(double precision[], real[]) IS 'Moving accumulator inverse transition - subtracts the row leaving the window frame
+@param elements0 double precision[]  // INOUT
+@param elements1 real[]  // IN';
+
+DROP FUNCTION IF EXISTS array_macc_sum_final(double precision[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_macc_sum_final(double precision[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_macc_sum_final'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_macc_sum_final(double precision[]) IS 'Moving sum of vectors final - ΣAi';
+
+DROP FUNCTION IF EXISTS array_macc_acc_final(double precision[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_macc_acc_final(double precision[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_macc_acc_final'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_macc_acc_final(double precision[]) IS 'Moving accumulator final - ΣAi, ΣAi^2, Σi, -i as real[]';
+
+DROP FUNCTION IF EXISTS array_macc_avg_final(double precision[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_macc_avg_final(double precision[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_macc_avg_final'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_macc_avg_final(double precision[]) IS 'Moving average of vectors final';
+
+DROP FUNCTION IF EXISTS array_macc_std_final(double precision[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_macc_std_final(double precision[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_macc_std_final'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_macc_std_final(double precision[]) IS 'Moving standard deviation of vectors final';
+
 -- Addition of vectors by elements - ΣAi + Bi
 DROP FUNCTION IF EXISTS array_add(real[], real[]) CASCADE;
 CREATE OR REPLACE FUNCTION array_add(real[], real[]) RETURNS real[]
 AS 'pgsiftorder.so', 'c_array_add_real'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 COMMENT ON FUNCTION array_add(real[], real[]) IS 'Addition of vectors by elements - ΣAi + Bi
 @param elements0 real[]  // INOUT
 @param elements1 real[]  // IN';
 
 CREATE AGGREGATE array_add_agg(real[]) (
   SFUNC=array_add,
-  STYPE=real[]
+  STYPE=real[],
+  COMBINEFUNC=array_add,
+  PARALLEL=SAFE
 );
 COMMENT ON FUNCTION array_add_agg(real[]) IS 'Addition of vectors by elements - ΣAi';
 
 CREATE AGGREGATE array_sum(real[]) (
   SFUNC=array_add,
-  STYPE=real[]
+  STYPE=real[],
+  COMBINEFUNC=array_add,
+  MSFUNC=array_macc_real,
+  MINVFUNC=array_macc_inv_real,
+  MSTYPE=double precision[],
+  MFINALFUNC=array_macc_sum_final,
+  MINITCOND='{}',
+  PARALLEL=SAFE
 );
 COMMENT ON FUNCTION array_sum(real[]) IS 'Addition of vectors by elements - ΣAi';
 
@@ -60,20 +109,22 @@ COMMENT ON FUNCTION array_sub_agg(real[]) IS 'Subtraction of vectors by elements
 DROP FUNCTION IF EXISTS array_mul(real[], real[]) CASCADE;
 CREATE OR REPLACE FUNCTION array_mul(real[], real[]) RETURNS real[]
 AS 'pgsiftorder.so', 'c_array_mul_real'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 COMMENT ON FUNCTION array_mul(real[], real[]) IS 'Multiplication of vectors by elements - ΣAi * Bi
 @param elements0 real[]  // INOUT
 @param elements1 real[]  // IN';
 
 CREATE AGGREGATE array_mul_agg(real[]) (
-  SFUNC=model_avg_real,
+  SFUNC=array_mul,
   STYPE=real[]
 );
 COMMENT ON FUNCTION array_mul_agg(real[]) IS 'Multiplication of vectors by elements - ∏Ai';
 
 CREATE AGGREGATE array_product(real[]) (
   SFUNC=array_mul,
-  STYPE=real[]
+  STYPE=real[],
+  COMBINEFUNC=array_mul,
+  PARALLEL=SAFE
 );
 COMMENT ON FUNCTION array_product(real[]) IS 'Multiplication of vectors by elements - ∏Ai';
 
@@ -113,6 +164,39 @@ COMMENT ON FUNCTION array_sqrt(real[]) IS 'Sqare root of the vector by elements
 WARNING: May return NaN!
 @param elements0 real[]  // INOUT';
 
+-- Fused operations - one pass and one result array instead of a chain of array_* calls (and their copies)
+DROP FUNCTION IF EXISTS array_axpy(real, real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_axpy(alpha real, x real[], y real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_axpy_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_axpy(real, real[], real[]) IS 'Fused scaled addition of vectors - Σalpha * Xi + Yi';
+
+DROP FUNCTION IF EXISTS array_fma(real[], real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_fma(real[], real[], real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_fma_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_fma(real[], real[], real[]) IS 'Fused multiplication and addition of vectors by elements - ΣAi * Bi + Ci';
+
+-- WARNING: May return NaN!
+DROP FUNCTION IF EXISTS array_standardize(real[], real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_standardize(real[], mean real[], stdev real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_standardize_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_standardize(real[], real[], real[]) IS 'Standardization of the vector by elements - Σ(Ai - Mi) / Si (array_div(array_sub(a, m), s) in one pass)
+WARNING: May return NaN!';
+
+DROP FUNCTION IF EXISTS array_clamp(real[], real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_clamp(real[], lo real[], hi real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_clamp_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_clamp(real[], real[], real[]) IS 'Clamping of the vector by elements - Σmin(max(Ai, LOi), HIi) (array_least(array_greatest(a, lo), hi) in one pass)';
+
+DROP FUNCTION IF EXISTS array_clamp(real[], real, real) CASCADE;
+CREATE OR REPLACE FUNCTION array_clamp(real[], lo real, hi real) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_clamp_scalar_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_clamp(real[], real, real) IS 'Clamping of the vector by elements to a range - Σmin(max(Ai, lo), hi)';
+
 --------------------------------
 -- TODO: ARRAY min && ARRAY MAX
 --------------------------------
@@ -121,14 +205,41 @@ WARNING: May return NaN!
 DROP FUNCTION IF EXISTS array_acc_real(real[], real[]) CASCADE;
 CREATE OR REPLACE FUNCTION array_acc_real(real[], real[]) RETURNS real[]
 AS 'pgsiftorder.so', 'c_array_acc_real'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 COMMENT ON FUNCTION array_acc_real(real[], real[]) IS 'Average and standard deviation accumulator - ΣAi, ΣAi^2, Σi, -i (~ length checksum)
 @param elements0 real[]  // INOUT
 @param elements1 real[]  // IN';
 
+-- Combine two average and standard deviation accumulators (parallel aggregation) - ΣAi, ΣAi^2, Σi
+DROP FUNCTION IF EXISTS array_acc_combine_real(real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_acc_combine_real(real[], real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_acc_combine_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_acc_combine_real(real[], real[]) IS 'Combine two average and standard deviation accumulators (parallel aggregation) - ΣAi, ΣAi^2, Σi
+Both of them are accumulators or ''{}'' (no rows), accumulators of different vector sizes raise an error.
+@param elements0 real[]  // INOUT
+@param elements1 real[]  // IN';
+
+-- Average and standard deviation accumulator final - NULL of no rows
+DROP FUNCTION IF EXISTS array_acc_final(real[]) CASCADE;
+CREATE OR REPLACE FUNCTION array_acc_final(real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_array_acc_final'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION array_acc_final(real[]) IS 'Average and standard deviation accumulator final - NULL of no rows
+@param elements0 real[]    // IN';
+
 CREATE AGGREGATE array_accumulate(real[]) (
   SFUNC=array_acc_real,
-  STYPE=real[]
+  STYPE=real[],
+  FINALFUNC=array_acc_final,
+  INITCOND='{}',             -- the state is always an accumulator (combined unambiguously)
+  COMBINEFUNC=array_acc_combine_real,
+  MSFUNC=array_macc_real,
+  MINVFUNC=array_macc_inv_real,
+  MSTYPE=double precision[],
+  MFINALFUNC=array_macc_acc_final,
+  MINITCOND='{}',
+  PARALLEL=SAFE
 );
 COMMENT ON FUNCTION array_accumulate(real[]) IS 'Average and standard deviation accumulator - ΣAi, ΣAi^2, Σi, -i (~ length checksum)';
 
@@ -136,14 +247,22 @@ COMMENT ON FUNCTION array_accumulate(real[]) IS 'Average and standard deviation
 DROP FUNCTION IF EXISTS array_avg_final(real[]) CASCADE;
 CREATE OR REPLACE FUNCTION array_avg_final(real[]) RETURNS real[]
 AS 'pgsiftorder.so', 'c_array_avg_final'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 COMMENT ON FUNCTION array_avg_final(real[]) IS 'Average of vectors final
 @param elements0 real[]    // INOUT';
 
 CREATE AGGREGATE array_avg(real[]) (
   SFUNC=array_acc_real,
   STYPE=real[],
-  FINALFUNC=array_avg_final
+  FINALFUNC=array_avg_final,
+  INITCOND='{}',
+  COMBINEFUNC=array_acc_combine_real,
+  MSFUNC=array_macc_real,
+  MINVFUNC=array_macc_inv_real,
+  MSTYPE=double precision[],
+  MFINALFUNC=array_macc_avg_final,
+  MINITCOND='{}',
+  PARALLEL=SAFE
 );
 COMMENT ON FUNCTION array_avg(real[]) IS 'Average of vectors ΣAi';
 
@@ -151,211 +270,886 @@ COMMENT ON FUNCTION array_avg(real[]) IS 'Average of vectors ΣAi';
 DROP FUNCTION IF EXISTS array_std_final(real[]) CASCADE;
 CREATE OR REPLACE FUNCTION array_std_final(real[]) RETURNS real[]
 AS 'pgsiftorder.so', 'c_array_std_final'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 COMMENT ON FUNCTION array_std_final(real[]) IS 'Standard deviation of vectors final
 @param elements0 real[]    // INOUT';
 
 CREATE AGGREGATE array_std(real[]) (
   SFUNC=array_acc_real,
   STYPE=real[],
-  FINALFUNC=array_std_final
+  FINALFUNC=array_std_final,
+  INITCOND='{}',
+  COMBINEFUNC=array_acc_combine_real,
+  MSFUNC=array_macc_real,
+  MINVFUNC=array_macc_inv_real,
+  MSTYPE=double precision[],
+  MFINALFUNC=array_macc_std_final,
+  MINITCOND='{}',
+  PARALLEL=SAFE
 );
 COMMENT ON FUNCTION array_std(real[]) IS 'Standard deviation of vectors ΣAi';
 
 
 
--- ASNM Funs
----------------
-
--- DROP FUNCTION IF EXISTS model_sum_real(real[], real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_sum_real(real[], real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_sum_real(double precision[], real[]) CASCADE;
-CREATE OR REPLACE FUNCTION model_sum_real(real[], real[]) RETURNS real[]
-AS 'pgsiftorder.so', 'c_model_sum_real'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_sum_real(real[], real[]) IS 'Sum of model vectors - 5*add [5*sqr]
-@param elements0 real[]  // INOUT
-@param elements1 real[]  // IN';
-
--- DROP FUNCTION IF EXISTS model_sum_final(real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_sum_final(real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_sum_final(double precision[]) CASCADE;
-CREATE OR REPLACE FUNCTION model_sum_final(real[]) RETURNS real[]
-AS 'pgsiftorder.so', 'c_model_sum_final'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_sum_final(real[]) IS 'Sum of model vectors final - 5*void [5*sqrt]
- * @param elements0 real[]    // INOUT';
-
--- DROP AGGREGATE IF EXISTS model_sum(real[]);
-CREATE AGGREGATE model_sum(real[]) (
-  SFUNC=model_sum_real, --array_debug, --
-  STYPE=real[],
-  FINALFUNC=model_sum_final,
-  initcond = '{0,0,0,0,0,0,0,0,0,0}'
-);
-COMMENT ON FUNCTION model_sum(real[]) IS 'Sum of model vectors - (5*add [sqrt(5*sqr)]) / count';
-
-
-
--- DROP FUNCTION IF EXISTS model_avg_real(real[], real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_real(real[], real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_real(double precision[], real[]) CASCADE;
-CREATE OR REPLACE FUNCTION model_avg_real(real[], real[]) RETURNS real[]
-AS 'pgsiftorder.so', 'c_model_avg_real'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_avg_real(real[], real[]) IS 'Sum of model vectors - 5*add; [5*sqr;] 5*++
-@param elements0 real[15]    // INOUT
-@param elements1 real[5-10]  // IN';
-
--- DROP FUNCTION IF EXISTS model_avg_std_real(real[], real[], real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_std_real(real[], real[], real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_std_real(double precision[], real[], real[]) CASCADE;
-CREATE OR REPLACE FUNCTION model_avg_std_real(real[], real[], real[]) RETURNS real[]
-AS 'pgsiftorder.so', 'c_model_avg_std_real'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_avg_std_real(real[], real[], real[]) IS 'Sum of model vectors - 5*add; 5*sqr; 5*++
-@param elements0 real[15]    // INOUT
-@param elements1 real[5-10]  // IN
-@param elements1 real[5+]    // IN';
-
--- DROP FUNCTION IF EXISTS model_avg_final(real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_final(real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_final(double precision[]) CASCADE;
-CREATE OR REPLACE FUNCTION model_avg_final(real[]) RETURNS real[]
-AS 'pgsiftorder.so', 'c_model_avg_final'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_avg_final(real[]) IS 'Compute average and standard deviation for the training vector:
-
-real std_dev2(real a[], int n) {
-   if(n == 0)
-        return 0.0;
-    real sum = 0;
-    real sq_sum = 0;
-    for(int i = 0; i < n; ++i) {
-       sum += a[i];
-       sq_sum += a[i] * a[i];
-    }
-    real mean = sum / n;
-    real variance = sq_sum / n - mean * mean; // > 0!
-    return sqrt(variance);
-}
-
-@param elements0 real[]    // INOUT';
-
--- DROP FUNCTION IF EXISTS model_avg_std_final(real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_std_final(real[]) CASCADE;
-DROP FUNCTION IF EXISTS model_avg_std_final(double precision[]) CASCADE;
-CREATE OR REPLACE FUNCTION model_avg_std_final(real[]) RETURNS real[]
-AS 'pgsiftorder.so', 'c_model_avg_std_final'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_avg_std_final(real[]) IS 'Compute average and standard deviation for the model vector where stds were given
-5* div n; sqrt(5*sqr); 5*==
-@param elements0 real[]    // INOUT';
-
-
--- DROP AGGREGATE model_avg(real[]);
-CREATE AGGREGATE model_avg(real[]) (
-  SFUNC=model_avg_real,
-  STYPE=real[],
-  FINALFUNC=model_avg_final,
-  initcond = '{0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}'
-);
-COMMENT ON FUNCTION model_avg(real[]) IS 'Compute average and standard deviation for the training vector[15]';
-
--- DROP AGGREGATE model_avg_std(real[]);
-CREATE AGGREGATE model_avg_std(real[]) (
-  SFUNC=model_avg_real,
-  STYPE=real[],
-  FINALFUNC=model_avg_std_final,
-  initcond = '{0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}'
-);
-COMMENT ON FUNCTION model_avg_std(real[]) IS 'Compute average and standard deviation for the training vector[15] where stds were given';
-
--- DROP AGGREGATE model_avg(real[], real[]);
-CREATE AGGREGATE model_avg(real[], real[]) (
-  SFUNC=model_avg_std_real,
-  STYPE=real[],
-  FINALFUNC=model_avg_final,
-  initcond = '{0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}'
-);
-COMMENT ON FUNCTION model_avg(real[], real[]) IS 'Compute WEIGHTED average and standard deviation for the training vector[15]';
-
--- DROP AGGREGATE model_avg_std(real[], real[]);
-CREATE AGGREGATE model_avg_std(real[], real[]) (
-  SFUNC=model_avg_std_real,
-  STYPE=real[],
-  FINALFUNC=model_avg_std_final,
-  initcond = '{0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}'
-);
-COMMENT ON FUNCTION model_avg_std(real[], real[]) IS 'Compute WEIGHTED average and standard deviation for the training vector[15] where stds were given';
-
-
-
-
--- Comparison of event (host, subnet {services}) to model vectors (event[5], model[10], emin, emax, emul, sigma):
--- (event > EMAX AND event > EMUL*model.avg) 
--- OR (model.avg > 0 AND model.std > 0 AND event > EMIN 
---     AND event > EMUL*model.avg      AND event > model.avg + SIGMA*model.std)
-DROP FUNCTION IF EXISTS model_compare(real[], real[], real, real, real, real) CASCADE;
-CREATE OR REPLACE FUNCTION model_compare(real[], real[], real, real, real, real) RETURNS real[] -- real[11]
-AS 'pgsiftorder.so', 'c_model_compare'
-LANGUAGE C IMMUTABLE STRICT;
-COMMENT ON FUNCTION model_compare(real[], real[], real, real, real, real) IS 'Comparison of event (host, subnet {services}) to model vectors:
-(event > EMAX AND event > EMUL*model.avg) 
-OR (model.avg > 0 AND model.std > 0 AND event > EMIN 
-    AND event > EMUL*model.avg      AND event > model.avg + SIGMA*model.std)';
-
-
-
-
-
-
-
-
-
-
+-- COST is in cpu_operator_cost units, estimated for ~128-dimensional vectors (SIFT) and ~100 term documents
 
+-- the planner support of the ratings - the per-call cost by the array lengths (the query, the average width of the
+-- column); WHERE rating_*(column, query) > 0 also gets the index paths of column && query if the column has a GIN
+-- index (pgsiftorder.rating_overlap)
+-- DROP FUNCTION rating_support(internal);
+CREATE OR REPLACE FUNCTION rating_support(internal) RETURNS internal
+AS 'pgsiftorder.so', 'c_rating_support'
+LANGUAGE C STRICT;
 
 -- DROP FUNCTION rating_cosine_norm(int[], real[], real, int[], real[], real);
 CREATE OR REPLACE FUNCTION rating_cosine_norm(int[], real[], real, int[], real[], real) RETURNS real
 AS 'pgsiftorder.so', 'c_rating_cosine_norm'
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20 SUPPORT rating_support;
 
 -- DROP FUNCTION rating_normalize_vect(real[]);
 CREATE OR REPLACE FUNCTION rating_normalize_vect(real[]) RETURNS real
 AS 'pgsiftorder.so', 'c_rating_normalize_vect'
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 -- DROP FUNCTION rating_cosine(int[], real[], int[], real[]);
 CREATE OR REPLACE FUNCTION rating_cosine(int[], real[], int[], real[]) RETURNS real
 AS 'pgsiftorder.so', 'c_rating_cosine'
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20 SUPPORT rating_support;
 
 -- DROP FUNCTION rating_boolean_int(int[], int[]);
 CREATE OR REPLACE FUNCTION rating_boolean_int(int[], int[]) RETURNS int
 AS 'pgsiftorder.so', 'c_rating_boolean_int'   -- the second parameter might be omited in case of the same name
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10 SUPPORT rating_support;
 
 -- DROP FUNCTION rating_boolean(anyarray, anyarray);
 CREATE OR REPLACE FUNCTION rating_boolean(anyarray, anyarray) RETURNS int
 AS 'pgsiftorder.so', 'c_rating_boolean'
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50 SUPPORT rating_support;
+COMMENT ON FUNCTION rating_boolean(anyarray, anyarray) IS 'Boolean rating of two sorted arrays (the number of common elements) - inline merges of int2, int4, int8, oid, float4 and float8, the btree comparison of the rest';
+
+-- text tokens as int8 term ids (a 64 bit hash) - sorted and distinct, so the text retrieval runs on the integer
+-- intersection instead of the collation aware rating_boolean(text[], text[])
+-- DROP FUNCTION term_id(text);
+CREATE OR REPLACE FUNCTION term_id(text) RETURNS int8
+AS 'pgsiftorder.so', 'c_term_id'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION term_id(text) IS 'The int8 id (64 bit hash) of a text token';
+
+-- DROP FUNCTION term_ids(text[]);
+CREATE OR REPLACE FUNCTION term_ids(tokens text[]) RETURNS int8[]
+AS 'pgsiftorder.so', 'c_term_ids'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION term_ids(text[]) IS 'The sorted distinct int8 ids of the tokens (NULLs skipped), an error on a collision of two tokens';
+
+-- DROP FUNCTION term_counts(text[]);
+CREATE OR REPLACE FUNCTION term_counts(tokens text[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_term_counts'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION term_counts(text[]) IS 'The occurrences of the tokens in the order of term_ids (the term frequency weights)';
+
+-- DROP FUNCTION rating_boolean_int8(int8[], int8[]);
+CREATE OR REPLACE FUNCTION rating_boolean_int8(int8[], int8[]) RETURNS int
+AS 'pgsiftorder.so', 'c_rating_boolean_int8'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10 SUPPORT rating_support;
+COMMENT ON FUNCTION rating_boolean_int8(int8[], int8[]) IS 'Boolean rating of two sorted int8 term id arrays (the number of common ids)';
+
+-- DROP FUNCTION rating_cosine(int8[], real[], int8[], real[]);
+CREATE OR REPLACE FUNCTION rating_cosine(int8[], real[], int8[], real[]) RETURNS real
+AS 'pgsiftorder.so', 'c_rating_cosine_int8'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20 SUPPORT rating_support;
+COMMENT ON FUNCTION rating_cosine(int8[], real[], int8[], real[]) IS 'Cosine rating of two int8 term vectors (ids, weights)';
+
+-- DROP FUNCTION rating_cosine_norm(int8[], real[], real, int8[], real[], real);
+CREATE OR REPLACE FUNCTION rating_cosine_norm(int8[], real[], real, int8[], real[], real) RETURNS real
+AS 'pgsiftorder.so', 'c_rating_cosine_norm_int8'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20 SUPPORT rating_support;
+COMMENT ON FUNCTION rating_cosine_norm(int8[], real[], real, int8[], real[], real) IS 'Cosine rating of two int8 term vectors using the pre-counted norms';
+
+-- the persistent term dictionary - the tokens of the ids (term_register), a collision of two tokens across
+-- the documents is an error
+CREATE TABLE IF NOT EXISTS term_dictionary (
+  id int8 PRIMARY KEY,
+  term text NOT NULL UNIQUE
+);
+
+CREATE OR REPLACE FUNCTION term_register(tokens text[]) RETURNS int8[] AS
+$BODY$ DECLARE
+    collision record;
+BEGIN
+    INSERT INTO term_dictionary (id, term)
+        SELECT DISTINCT term_id(t), t FROM unnest(tokens) AS t WHERE t IS NOT NULL
+        ON CONFLICT DO NOTHING;
+    SELECT d.term AS stored, t AS token INTO collision
+        FROM unnest(tokens) AS t JOIN term_dictionary d ON d.id = term_id(t)
+        WHERE d.term <> t LIMIT 1;
+    IF FOUND THEN
+        RAISE EXCEPTION 'term id collision of "%" and "%"', collision.stored, collision.token;
+    END IF;
+    RETURN term_ids(tokens);
+END; $BODY$
+  LANGUAGE plpgsql VOLATILE STRICT;
+COMMENT ON FUNCTION term_register(text[]) IS 'term_ids of the tokens stored in term_dictionary, an error on a collision with a stored token';
 
 -- DROP FUNCTION distance_square_int(int[], int[]);
 CREATE OR REPLACE FUNCTION distance_square_int(int[], int[]) RETURNS int8
 AS 'pgsiftorder.so', 'c_distance_square_int'
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 -- DROP FUNCTION distance_square_real(int[], int[]);
 DROP FUNCTION IF EXISTS distance_square_real(real[], real[]) CASCADE;
 CREATE OR REPLACE FUNCTION distance_square_real(real[], real[]) RETURNS real
 AS 'pgsiftorder.so', 'c_distance_square_real'
-LANGUAGE C STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+-- DROP FUNCTION distance_square_bounded(int[], int[], int8);
+DROP FUNCTION IF EXISTS distance_square_bounded(int[], int[], int8) CASCADE;
+CREATE OR REPLACE FUNCTION distance_square_bounded(int[], int[], bound int8) RETURNS int8
+AS 'pgsiftorder.so', 'c_distance_square_bounded_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_bounded(int[], int[], int8) IS 'Square distance of two vectors, NULL once it exceeds the bound (early abandoning, the kNN re-ranking)';
+
+DROP FUNCTION IF EXISTS distance_square_bounded(int[], int[], int8, int[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_square_bounded(int[], int[], bound int8, dimensions int[]) RETURNS int8
+AS 'pgsiftorder.so', 'c_distance_square_bounded_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_bounded(int[], int[], int8, int[]) IS 'Square distance of two vectors, NULL once it exceeds the bound - the dimensions visited in the given order (see dimension_order)';
+
+-- DROP FUNCTION distance_square_bounded(real[], real[], real);
+DROP FUNCTION IF EXISTS distance_square_bounded(real[], real[], real) CASCADE;
+CREATE OR REPLACE FUNCTION distance_square_bounded(real[], real[], bound real) RETURNS real
+AS 'pgsiftorder.so', 'c_distance_square_bounded_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_bounded(real[], real[], real) IS 'Square distance of two vectors, NULL once it exceeds the bound (early abandoning, the kNN re-ranking)';
+
+DROP FUNCTION IF EXISTS distance_square_bounded(real[], real[], real, int[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_square_bounded(real[], real[], bound real, dimensions int[]) RETURNS real
+AS 'pgsiftorder.so', 'c_distance_square_bounded_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_bounded(real[], real[], real, int[]) IS 'Square distance of two vectors, NULL once it exceeds the bound - the dimensions visited in the given order (see dimension_order)';
+
+-- DROP FUNCTION dimension_order(real[]);
+DROP FUNCTION IF EXISTS dimension_order(real[]) CASCADE;
+CREATE OR REPLACE FUNCTION dimension_order(stdev real[]) RETURNS int[]
+AS 'pgsiftorder.so', 'c_dimension_order'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION dimension_order(real[]) IS 'The dimensions (1 based) by the deviations descending - the order of distance_square_bounded';
+
+-- DROP FUNCTION distance_square_batch(real[], real[]);
+DROP FUNCTION IF EXISTS distance_square_batch(real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_square_batch(query real[], candidates real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_distance_square_batch'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+COMMENT ON FUNCTION distance_square_batch(real[], real[]) IS 'Square distances of the query to each row of the candidates real[count][length] - one call per candidate block';
+
+-- DROP FUNCTION distance_square_topk(real[], real[], int);
+DROP FUNCTION IF EXISTS distance_square_topk(real[], real[], int) CASCADE;
+CREATE OR REPLACE FUNCTION distance_square_topk(query real[], candidates real[], k int, OUT index int, OUT distance real) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_distance_square_topk'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000 ROWS 100;
+COMMENT ON FUNCTION distance_square_topk(real[], real[], int) IS 'The k rows of the candidates real[count][length] nearest to the query (1 based row index, square distance)';
 
 -- DROP FUNCTION distance_mahalanobis_int(int[], int[], real[]);
 DROP FUNCTION IF EXISTS distance_mahalanobis_int(int[], int[], real[]) CASCADE;
 CREATE OR REPLACE FUNCTION distance_mahalanobis_int(int[], int[], real[]) RETURNS real
 AS 'pgsiftorder.so', 'c_distance_mahalanobis_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+
+
+
+-- DROP FUNCTION distance_manhattan_int(int[], int[]);
+DROP FUNCTION IF EXISTS distance_manhattan_int(int[], int[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_manhattan_int(int[], int[]) RETURNS int8
+AS 'pgsiftorder.so', 'c_distance_manhattan_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+-- DROP FUNCTION distance_chessboard_int(int[], int[]);
+DROP FUNCTION IF EXISTS distance_chessboard_int(int[], int[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_chessboard_int(int[], int[]) RETURNS int8
+AS 'pgsiftorder.so', 'c_distance_chessboard_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+-- DROP FUNCTION distance_manhattan_real(real[], real[]);
+DROP FUNCTION IF EXISTS distance_manhattan_real(real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_manhattan_real(real[], real[]) RETURNS real
+AS 'pgsiftorder.so', 'c_distance_manhattan_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_manhattan_real(real[], real[]) IS 'Manhattan distance (L1) of two vectors';
+
+-- DROP FUNCTION distance_cosine_real(real[], real[]);
+DROP FUNCTION IF EXISTS distance_cosine_real(real[], real[]) CASCADE;
+CREATE OR REPLACE FUNCTION distance_cosine_real(real[], real[]) RETURNS real
+AS 'pgsiftorder.so', 'c_distance_cosine_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 8;
+COMMENT ON FUNCTION distance_cosine_real(real[], real[]) IS 'Cosine distance (1 - cosine similarity) of two dense vectors';
+
+-- DROP FUNCTION pgsiftorder_simd();
+CREATE OR REPLACE FUNCTION pgsiftorder_simd() RETURNS text
+AS 'pgsiftorder.so', 'c_pgsiftorder_simd'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION pgsiftorder_simd() IS 'Instruction set of the dense distance kernels (scalar, sse4.2, avx2, avx512), see SET pgsiftorder.simd';
+
+-- runtime statistics of the functions (pgsiftorder must be in shared_preload_libraries, see SET pgsiftorder.stats)
+DROP VIEW IF EXISTS pgsiftorder_stats;
+-- DROP FUNCTION pgsiftorder_stats();
+CREATE OR REPLACE FUNCTION pgsiftorder_stats(
+    OUT function text, OUT calls bigint, OUT elements bigint, OUT matches bigint, OUT hit_rate float8,
+    OUT detoast_cycles bigint, OUT cycles bigint, OUT cycles_per_call float8, OUT stats_reset timestamptz)
+RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_pgsiftorder_stats'
+LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION pgsiftorder_stats() IS 'Calls, elements, intersection hits (matches / elements of the shorter side) and CPU cycles (detoasting included) of the functions since the last reset';
+
+CREATE VIEW pgsiftorder_stats AS SELECT * FROM pgsiftorder_stats();
+
+-- DROP FUNCTION pgsiftorder_stats_reset();
+CREATE OR REPLACE FUNCTION pgsiftorder_stats_reset() RETURNS void
+AS 'pgsiftorder.so', 'c_pgsiftorder_stats_reset'
+LANGUAGE C VOLATILE STRICT;
+COMMENT ON FUNCTION pgsiftorder_stats_reset() IS 'Zeroes the pgsiftorder_stats';
+REVOKE ALL ON FUNCTION pgsiftorder_stats_reset() FROM PUBLIC;
+
+
+
+-- Dense vector type fvec(n)
+-------------------------------
+-- varlena header + float4 payload, the dimension is fixed by the typmod: fvec(128), fvec(31), ...
+
+DROP TYPE IF EXISTS fvec CASCADE;
+CREATE TYPE fvec;
+
+CREATE OR REPLACE FUNCTION fvec_in(cstring, oid, int4) RETURNS fvec
+AS 'pgsiftorder.so', 'c_fvec_in'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec_out(fvec) RETURNS cstring
+AS 'pgsiftorder.so', 'c_fvec_out'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec_typmod_in(cstring[]) RETURNS int4
+AS 'pgsiftorder.so', 'c_fvec_typmod_in'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec_typmod_out(int4) RETURNS cstring
+AS 'pgsiftorder.so', 'c_fvec_typmod_out'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec_recv(internal, oid, int4) RETURNS fvec
+AS 'pgsiftorder.so', 'c_fvec_recv'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec_send(fvec) RETURNS bytea
+AS 'pgsiftorder.so', 'c_fvec_send'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE fvec (
+  INPUT = fvec_in,
+  OUTPUT = fvec_out,
+  TYPMOD_IN = fvec_typmod_in,
+  TYPMOD_OUT = fvec_typmod_out,
+  RECEIVE = fvec_recv,
+  SEND = fvec_send,
+  INTERNALLENGTH = VARIABLE,
+  ALIGNMENT = int4,
+  STORAGE = extended
+);
+COMMENT ON TYPE fvec IS 'Dense float4 vector of a fixed dimension (typmod), e.g. fvec(128)';
+
+CREATE OR REPLACE FUNCTION fvec(fvec, int4, bool) RETURNS fvec
+AS 'pgsiftorder.so', 'c_fvec_typmod'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec(real[], int4, bool) RETURNS fvec
+AS 'pgsiftorder.so', 'c_fvec_from_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec(int[], int4, bool) RETURNS fvec
+AS 'pgsiftorder.so', 'c_fvec_from_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fvec_to_real(fvec) RETURNS real[]
+AS 'pgsiftorder.so', 'c_fvec_to_real'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE CAST (fvec AS fvec) WITH FUNCTION fvec(fvec, int4, bool) AS IMPLICIT;
+CREATE CAST (real[] AS fvec) WITH FUNCTION fvec(real[], int4, bool) AS ASSIGNMENT;
+CREATE CAST (int[] AS fvec) WITH FUNCTION fvec(int[], int4, bool) AS ASSIGNMENT;
+CREATE CAST (fvec AS real[]) WITH FUNCTION fvec_to_real(fvec) AS IMPLICIT;
+
+CREATE OR REPLACE FUNCTION distance_square_real(fvec, fvec) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_square'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_real(fvec, fvec) IS 'Square (Euclidean without sqrt) distance of two vectors';
+
+CREATE OR REPLACE FUNCTION distance_square_bounded(fvec, fvec, bound real) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_square_bounded'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_bounded(fvec, fvec, real) IS 'Square distance of two vectors, NULL once it exceeds the bound (early abandoning, the kNN re-ranking)';
+
+CREATE OR REPLACE FUNCTION distance_square_bounded(fvec, fvec, bound real, dimensions int[]) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_square_bounded'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_square_bounded(fvec, fvec, real, int[]) IS 'Square distance of two vectors, NULL once it exceeds the bound - the dimensions visited in the given order (see dimension_order)';
+
+CREATE OR REPLACE FUNCTION distance_manhattan_real(fvec, fvec) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_manhattan'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_manhattan_real(fvec, fvec) IS 'Manhattan distance (L1) of two vectors';
+
+CREATE OR REPLACE FUNCTION distance_chessboard_real(fvec, fvec) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_chessboard'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+COMMENT ON FUNCTION distance_chessboard_real(fvec, fvec) IS 'Chebyshev (chessboard, Lmax) distance of two vectors';
+
+CREATE OR REPLACE FUNCTION distance_mahalanobis_real(fvec, fvec, fvec) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_mahalanobis'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+COMMENT ON FUNCTION distance_mahalanobis_real(fvec, fvec, fvec) IS 'Mahalanobis distance (without sqrt) of two vectors given the standard deviations';
+
+CREATE OR REPLACE FUNCTION distance_cosine_real(fvec, fvec) RETURNS real
+AS 'pgsiftorder.so', 'c_fvec_distance_cosine'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 8;
+COMMENT ON FUNCTION distance_cosine_real(fvec, fvec) IS 'Cosine distance (1 - cosine similarity) of two vectors';
+
+
+
+--------------------------------------------------------------------------------
+-- Distance operators (ORDER BY features <-> query, see the sift_ivf index)
+--------------------------------------------------------------------------------
+-- <-> square (Euclidean without sqrt), <+> Manhattan (L1), <=> cosine distance
+
+DROP OPERATOR IF EXISTS <-> (int[], int[]) CASCADE;
+CREATE OPERATOR <-> (
+  LEFTARG = int[],
+  RIGHTARG = int[],
+  PROCEDURE = distance_square_int,
+  COMMUTATOR = '<->'
+);
+COMMENT ON OPERATOR <-> (int[], int[]) IS 'Square (Euclidean without sqrt) distance';
+
+DROP OPERATOR IF EXISTS <-> (real[], real[]) CASCADE;
+CREATE OPERATOR <-> (
+  LEFTARG = real[],
+  RIGHTARG = real[],
+  PROCEDURE = distance_square_real,
+  COMMUTATOR = '<->'
+);
+COMMENT ON OPERATOR <-> (real[], real[]) IS 'Square (Euclidean without sqrt) distance';
+
+DROP OPERATOR IF EXISTS <-> (fvec, fvec) CASCADE;
+CREATE OPERATOR <-> (
+  LEFTARG = fvec,
+  RIGHTARG = fvec,
+  PROCEDURE = distance_square_real,
+  COMMUTATOR = '<->'
+);
+COMMENT ON OPERATOR <-> (fvec, fvec) IS 'Square (Euclidean without sqrt) distance';
+
+DROP OPERATOR IF EXISTS <+> (int[], int[]) CASCADE;
+CREATE OPERATOR <+> (
+  LEFTARG = int[],
+  RIGHTARG = int[],
+  PROCEDURE = distance_manhattan_int,
+  COMMUTATOR = '<+>'
+);
+COMMENT ON OPERATOR <+> (int[], int[]) IS 'Manhattan distance (L1)';
+
+DROP OPERATOR IF EXISTS <+> (real[], real[]) CASCADE;
+CREATE OPERATOR <+> (
+  LEFTARG = real[],
+  RIGHTARG = real[],
+  PROCEDURE = distance_manhattan_real,
+  COMMUTATOR = '<+>'
+);
+COMMENT ON OPERATOR <+> (real[], real[]) IS 'Manhattan distance (L1)';
+
+DROP OPERATOR IF EXISTS <+> (fvec, fvec) CASCADE;
+CREATE OPERATOR <+> (
+  LEFTARG = fvec,
+  RIGHTARG = fvec,
+  PROCEDURE = distance_manhattan_real,
+  COMMUTATOR = '<+>'
+);
+COMMENT ON OPERATOR <+> (fvec, fvec) IS 'Manhattan distance (L1)';
+
+DROP OPERATOR IF EXISTS <=> (real[], real[]) CASCADE;
+CREATE OPERATOR <=> (
+  LEFTARG = real[],
+  RIGHTARG = real[],
+  PROCEDURE = distance_cosine_real,
+  COMMUTATOR = '<=>'
+);
+COMMENT ON OPERATOR <=> (real[], real[]) IS 'Cosine distance (1 - cosine similarity)';
+
+DROP OPERATOR IF EXISTS <=> (fvec, fvec) CASCADE;
+CREATE OPERATOR <=> (
+  LEFTARG = fvec,
+  RIGHTARG = fvec,
+  PROCEDURE = distance_cosine_real,
+  COMMUTATOR = '<=>'
+);
+COMMENT ON OPERATOR <=> (fvec, fvec) IS 'Cosine distance (1 - cosine similarity)';
+
+
+--------------------------------------------------------------------------------
+-- IVF-flat kNN index (sift_ivf) for ORDER BY features <-> query LIMIT k
+--------------------------------------------------------------------------------
+-- CREATE INDEX ... USING sift_ivf (features) WITH (lists = 100); SET pgsiftorder.ivf_probes = 10;
+
+CREATE OR REPLACE FUNCTION sift_ivf_handler(internal) RETURNS index_am_handler
+AS 'pgsiftorder.so', 'c_ivf_handler'
 LANGUAGE C STRICT;
 
+DROP ACCESS METHOD IF EXISTS sift_ivf CASCADE;
+CREATE ACCESS METHOD sift_ivf TYPE INDEX HANDLER sift_ivf_handler;
+COMMENT ON ACCESS METHOD sift_ivf IS 'IVF-flat (k-means inverted lists) approximate kNN index, see SET pgsiftorder.ivf_probes';
+
+CREATE OPERATOR CLASS sift_ivf_int_ops
+DEFAULT FOR TYPE int[] USING sift_ivf AS
+  OPERATOR 1 <-> (int[], int[]) FOR ORDER BY integer_ops,
+  OPERATOR 2 <+> (int[], int[]) FOR ORDER BY integer_ops;
+
+CREATE OPERATOR CLASS sift_ivf_real_ops
+DEFAULT FOR TYPE real[] USING sift_ivf AS
+  OPERATOR 1 <-> (real[], real[]) FOR ORDER BY float_ops,
+  OPERATOR 2 <+> (real[], real[]) FOR ORDER BY float_ops,
+  OPERATOR 3 <=> (real[], real[]) FOR ORDER BY float_ops;
+
+CREATE OPERATOR CLASS sift_ivf_fvec_ops
+DEFAULT FOR TYPE fvec USING sift_ivf AS
+  OPERATOR 1 <-> (fvec, fvec) FOR ORDER BY float_ops,
+  OPERATOR 2 <+> (fvec, fvec) FOR ORDER BY float_ops,
+  OPERATOR 3 <=> (fvec, fvec) FOR ORDER BY float_ops;
+
+
+
+--------------------------------------------------------------------------------
+-- Byte vector type bvec(n)
+--------------------------------------------------------------------------------
+-- a uint8 per dimension (SIFT descriptors 0..255): bvec(128) takes 129 bytes on disk, int[] ~530
+
+DROP TYPE IF EXISTS bvec CASCADE;
+CREATE TYPE bvec;
+
+CREATE OR REPLACE FUNCTION bvec_in(cstring, oid, int4) RETURNS bvec
+AS 'pgsiftorder.so', 'c_bvec_in'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec_out(bvec) RETURNS cstring
+AS 'pgsiftorder.so', 'c_bvec_out'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec_typmod_in(cstring[]) RETURNS int4
+AS 'pgsiftorder.so', 'c_bvec_typmod_in'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec_typmod_out(int4) RETURNS cstring
+AS 'pgsiftorder.so', 'c_fvec_typmod_out'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec_recv(internal, oid, int4) RETURNS bvec
+AS 'pgsiftorder.so', 'c_bvec_recv'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec_send(bvec) RETURNS bytea
+AS 'pgsiftorder.so', 'c_bvec_send'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE bvec (
+  INPUT = bvec_in,
+  OUTPUT = bvec_out,
+  TYPMOD_IN = bvec_typmod_in,
+  TYPMOD_OUT = bvec_typmod_out,
+  RECEIVE = bvec_recv,
+  SEND = bvec_send,
+  INTERNALLENGTH = VARIABLE,
+  ALIGNMENT = char,
+  STORAGE = extended
+);
+COMMENT ON TYPE bvec IS 'Byte (uint8) vector of a fixed dimension (typmod), e.g. bvec(128) for SIFT descriptors';
+
+CREATE OR REPLACE FUNCTION bvec(bvec, int4, bool) RETURNS bvec
+AS 'pgsiftorder.so', 'c_bvec_typmod'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec(int[], int4, bool) RETURNS bvec
+AS 'pgsiftorder.so', 'c_bvec_from_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION bvec_to_int(bvec) RETURNS int[]
+AS 'pgsiftorder.so', 'c_bvec_to_int'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE CAST (bvec AS bvec) WITH FUNCTION bvec(bvec, int4, bool) AS IMPLICIT;
+CREATE CAST (int[] AS bvec) WITH FUNCTION bvec(int[], int4, bool) AS ASSIGNMENT;
+CREATE CAST (bvec AS int[]) WITH FUNCTION bvec_to_int(bvec) AS IMPLICIT;
+
+CREATE OR REPLACE FUNCTION quantize(real[], lo real DEFAULT 0, hi real DEFAULT 255) RETURNS bvec
+AS 'pgsiftorder.so', 'c_bvec_quantize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION quantize(real[], real, real) IS 'Quantize a vector to bvec - lo..hi maps linearly to 0..255 (rounded, clamped)';
+
+CREATE OR REPLACE FUNCTION dequantize(bvec, lo real DEFAULT 0, hi real DEFAULT 255) RETURNS real[]
+AS 'pgsiftorder.so', 'c_bvec_dequantize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION dequantize(bvec, real, real) IS 'Dequantize bvec - 0..255 maps linearly to lo..hi';
+
+CREATE OR REPLACE FUNCTION distance_square_int(bvec, bvec) RETURNS int8
+AS 'pgsiftorder.so', 'c_bvec_distance_square'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 2;
+COMMENT ON FUNCTION distance_square_int(bvec, bvec) IS 'Square (Euclidean without sqrt) distance of two byte vectors';
+
+CREATE OR REPLACE FUNCTION distance_manhattan_int(bvec, bvec) RETURNS int8
+AS 'pgsiftorder.so', 'c_bvec_distance_manhattan'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 2;
+COMMENT ON FUNCTION distance_manhattan_int(bvec, bvec) IS 'Manhattan distance (L1) of two byte vectors';
+
+CREATE OR REPLACE FUNCTION rating_dot_int(bvec, bvec) RETURNS int8
+AS 'pgsiftorder.so', 'c_bvec_dot'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 2;
+COMMENT ON FUNCTION rating_dot_int(bvec, bvec) IS 'Dot (inner) product of two byte vectors';
+
+DROP OPERATOR IF EXISTS <-> (bvec, bvec) CASCADE;
+CREATE OPERATOR <-> (
+  LEFTARG = bvec,
+  RIGHTARG = bvec,
+  PROCEDURE = distance_square_int,
+  COMMUTATOR = '<->'
+);
+COMMENT ON OPERATOR <-> (bvec, bvec) IS 'Square (Euclidean without sqrt) distance';
+
+DROP OPERATOR IF EXISTS <+> (bvec, bvec) CASCADE;
+CREATE OPERATOR <+> (
+  LEFTARG = bvec,
+  RIGHTARG = bvec,
+  PROCEDURE = distance_manhattan_int,
+  COMMUTATOR = '<+>'
+);
+COMMENT ON OPERATOR <+> (bvec, bvec) IS 'Manhattan distance (L1)';
+
+
+
+--------------------------------------------------------------------------------
+-- Sparse vector type sparsevec
+--------------------------------------------------------------------------------
+-- ids (sorted, delta + varbyte coded), real weights and the L2 norm in one value - replaces the int[], real[]
+-- (and the norm) columns of rating_cosine(_norm), '{2:0.7,5:0.7}'
+
+DROP TYPE IF EXISTS sparsevec CASCADE;
+CREATE TYPE sparsevec;
+
+CREATE OR REPLACE FUNCTION sparsevec_in(cstring, oid, int4) RETURNS sparsevec
+AS 'pgsiftorder.so', 'c_sparsevec_in'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sparsevec_out(sparsevec) RETURNS cstring
+AS 'pgsiftorder.so', 'c_sparsevec_out'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
+CREATE OR REPLACE FUNCTION sparsevec_recv(internal, oid, int4) RETURNS sparsevec
+AS 'pgsiftorder.so', 'c_sparsevec_recv'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION sparsevec_send(sparsevec) RETURNS bytea
+AS 'pgsiftorder.so', 'c_sparsevec_send'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE sparsevec (
+  INPUT = sparsevec_in,
+  OUTPUT = sparsevec_out,
+  RECEIVE = sparsevec_recv,
+  SEND = sparsevec_send,
+  INTERNALLENGTH = VARIABLE,
+  ALIGNMENT = int4,
+  STORAGE = extended
+);
+COMMENT ON TYPE sparsevec IS 'Sparse vector - sorted int ids with real weights and the precomputed L2 norm';
+
+CREATE OR REPLACE FUNCTION sparsevec(int[], real[]) RETURNS sparsevec
+AS 'pgsiftorder.so', 'c_sparsevec_from_arrays'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION sparsevec(int[], real[]) IS 'Sparse vector of the ids and their weights';
+
+CREATE OR REPLACE FUNCTION sparsevec_ids(sparsevec) RETURNS int[]
+AS 'pgsiftorder.so', 'c_sparsevec_ids'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION sparsevec_ids(sparsevec) IS 'Ids of the sparse vector (sorted)';
+
+CREATE OR REPLACE FUNCTION sparsevec_weights(sparsevec) RETURNS real[]
+AS 'pgsiftorder.so', 'c_sparsevec_weights'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION sparsevec_weights(sparsevec) IS 'Weights of the sparse vector (in the order of ids)';
+
+CREATE OR REPLACE FUNCTION sparsevec_norm(sparsevec) RETURNS real
+AS 'pgsiftorder.so', 'c_sparsevec_norm'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION sparsevec_norm(sparsevec) IS 'L2 norm of the weights (stored in the value)';
+
+CREATE OR REPLACE FUNCTION rating_cosine(sparsevec, sparsevec) RETURNS real
+AS 'pgsiftorder.so', 'c_sparsevec_cosine'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 15;
+COMMENT ON FUNCTION rating_cosine(sparsevec, sparsevec) IS 'Cosine rating of two sparse vectors (the stored norms)';
+
+CREATE OR REPLACE FUNCTION rating_dot(sparsevec, sparsevec) RETURNS real
+AS 'pgsiftorder.so', 'c_sparsevec_dot'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 15;
+COMMENT ON FUNCTION rating_dot(sparsevec, sparsevec) IS 'Dot product of the weights of common ids';
+
+CREATE OR REPLACE FUNCTION rating_boolean(sparsevec, sparsevec) RETURNS int
+AS 'pgsiftorder.so', 'c_sparsevec_boolean'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+COMMENT ON FUNCTION rating_boolean(sparsevec, sparsevec) IS 'Boolean rating of two sparse vectors (the number of common ids)';
+
+-- multi-query ratings - a document against many queries in one pass (the ratings in the order of the queries)
+CREATE OR REPLACE FUNCTION rating_cosine_multi(int[], real[], queries sparsevec[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_rating_cosine_multi'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION rating_cosine_multi(int[], real[], sparsevec[]) IS 'Cosine ratings of the document (ids, weights) against each of the queries, one pass over the document';
+
+CREATE OR REPLACE FUNCTION rating_cosine_multi(sparsevec, queries sparsevec[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_sparsevec_cosine_multi'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION rating_cosine_multi(sparsevec, sparsevec[]) IS 'Cosine ratings of the sparse vector against each of the queries, one pass over the document';
+
+CREATE OR REPLACE FUNCTION rating_boolean_multi(int[], queries int[]) RETURNS int[]
+AS 'pgsiftorder.so', 'c_rating_boolean_multi'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION rating_boolean_multi(int[], int[]) IS 'Boolean ratings of the document against each query - a row of int[][] (NULL padded)';
+
+CREATE OR REPLACE FUNCTION rating_boolean_multi(int[], queries sparsevec[]) RETURNS int[]
+AS 'pgsiftorder.so', 'c_rating_boolean_multi'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION rating_boolean_multi(int[], sparsevec[]) IS 'Boolean ratings of the document against each of the queries (their ids)';
+
+CREATE OR REPLACE FUNCTION rating_boolean_multi(sparsevec, queries int[]) RETURNS int[]
+AS 'pgsiftorder.so', 'c_sparsevec_boolean_multi'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION rating_boolean_multi(sparsevec, int[]) IS 'Boolean ratings of the sparse vector against each query - a row of int[][] (NULL padded)';
+
+CREATE OR REPLACE FUNCTION rating_boolean_multi(sparsevec, queries sparsevec[]) RETURNS int[]
+AS 'pgsiftorder.so', 'c_sparsevec_boolean_multi'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION rating_boolean_multi(sparsevec, sparsevec[]) IS 'Boolean ratings of the sparse vector against each of the queries (their ids)';
+
+
+
+--------------------------------------------------------------------------------
+-- Product quantization (PQ) codes
+--------------------------------------------------------------------------------
+-- codebook real[m][k][ds] (m subspaces of ds dimensions, k <= 256 centroids), code bytea of m bytes
+
+CREATE OR REPLACE FUNCTION pq_train_accum(internal, real[], int, int) RETURNS internal
+AS 'pgsiftorder.so', 'c_pq_train_accum'
+LANGUAGE C IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION pq_train_final(internal) RETURNS real[]
+AS 'pgsiftorder.so', 'c_pq_train_final'
+LANGUAGE C IMMUTABLE;
+
+DROP AGGREGATE IF EXISTS pq_codebook(real[], int, int) CASCADE;
+CREATE AGGREGATE pq_codebook(vector real[], m int, k int) (
+  SFUNC = pq_train_accum,
+  STYPE = internal,
+  FINALFUNC = pq_train_final
+);
+COMMENT ON AGGREGATE pq_codebook(real[], int, int) IS 'Train a PQ codebook real[m][k][ds] - k-means of each of the m subspaces (a sample of k*64 vectors)';
+
+CREATE OR REPLACE FUNCTION pq_encode(vector real[], codebook real[]) RETURNS bytea
+AS 'pgsiftorder.so', 'c_pq_encode'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION pq_encode(real[], real[]) IS 'PQ code of the vector - the nearest centroid of each subspace';
+
+CREATE OR REPLACE FUNCTION pq_decode(code bytea, codebook real[]) RETURNS real[]
+AS 'pgsiftorder.so', 'c_pq_decode'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION pq_decode(bytea, real[]) IS 'Approximate vector of the PQ code (the centroids)';
+
+CREATE OR REPLACE FUNCTION pq_distance(query real[], code bytea, codebook real[]) RETURNS real
+AS 'pgsiftorder.so', 'c_pq_distance'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 2;
+COMMENT ON FUNCTION pq_distance(real[], bytea, real[]) IS 'Asymmetric square distance of the query to the PQ code (the query lookup table is cached for the scan)';
+
+
+
+--------------------------------------------------------------------------------
+-- Binary signatures (Hamming distance)
+--------------------------------------------------------------------------------
+-- the sign-of-projection signature bytea (bit r ~ the projection on the row r exceeds the threshold r),
+-- a cheap filter before the exact distances; the Hamming distance is counted by POPCNT (AVX-512 VPOPCNTDQ)
+
+CREATE OR REPLACE FUNCTION signature_projection(bits int, length int, seed int DEFAULT 0) RETURNS real[]
+AS 'pgsiftorder.so', 'c_signature_projection'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION signature_projection(int, int, int) IS 'Random projection real[bits][length] of N(0,1) elements - the same for the same seed';
+
+CREATE OR REPLACE FUNCTION signature(vector real[], projection real[]) RETURNS bytea
+AS 'pgsiftorder.so', 'c_signature'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION signature(real[], real[]) IS 'Binary signature of the vector - the signs of its projections (the projection is cached for the scan)';
+
+CREATE OR REPLACE FUNCTION signature(vector real[], projection real[], thresholds real[]) RETURNS bytea
+AS 'pgsiftorder.so', 'c_signature'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION signature(real[], real[], real[]) IS 'Binary signature of the vector - its projections above the thresholds (Hamming embedding with the medians)';
+
+CREATE OR REPLACE FUNCTION signature(vector int[], projection real[]) RETURNS bytea
+AS 'pgsiftorder.so', 'c_signature'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION signature(int[], real[]) IS 'Binary signature of the vector - the signs of its projections (the projection is cached for the scan)';
+
+CREATE OR REPLACE FUNCTION signature(vector int[], projection real[], thresholds real[]) RETURNS bytea
+AS 'pgsiftorder.so', 'c_signature'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 50;
+COMMENT ON FUNCTION signature(int[], real[], real[]) IS 'Binary signature of the vector - its projections above the thresholds (Hamming embedding with the medians)';
+
+CREATE OR REPLACE FUNCTION signature_to_bit(bytea) RETURNS bit varying
+AS 'pgsiftorder.so', 'c_signature_to_bit'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+COMMENT ON FUNCTION signature_to_bit(bytea) IS 'The signature as bit varying (to store it as bit(n))';
+
+CREATE OR REPLACE FUNCTION hamming_distance(bytea, bytea) RETURNS int
+AS 'pgsiftorder.so', 'c_hamming_distance'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 2;
+COMMENT ON FUNCTION hamming_distance(bytea, bytea) IS 'Hamming distance of two signatures (the number of different bits)';
+
+CREATE OR REPLACE FUNCTION hamming_distance(bit varying, bit varying) RETURNS int
+AS 'pgsiftorder.so', 'c_hamming_distance_bit'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 2;
+COMMENT ON FUNCTION hamming_distance(bit varying, bit varying) IS 'Hamming distance of two bit strings of the same length';
+
+CREATE OR REPLACE FUNCTION hamming_distance_batch(query bytea, candidates bytea[]) RETURNS int[]
+AS 'pgsiftorder.so', 'c_hamming_distance_batch'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+COMMENT ON FUNCTION hamming_distance_batch(bytea, bytea[]) IS 'Hamming distances of the query signature to each of the candidates';
+
+DROP FUNCTION IF EXISTS hamming_topk(bytea, bytea[], int) CASCADE;
+CREATE OR REPLACE FUNCTION hamming_topk(query bytea, candidates bytea[], k int, OUT index int, OUT distance int) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_hamming_topk'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100 ROWS 100;
+COMMENT ON FUNCTION hamming_topk(bytea, bytea[], int) IS 'The k candidate signatures nearest to the query (1 based index, Hamming distance)';
+
+
+
+--------------------------------------------------------------------------------
+-- Top-k aggregates (instead of ORDER BY score DESC LIMIT k)
+--------------------------------------------------------------------------------
+-- a heap of the k best rows - O(k) memory, no sort of all the scored rows; the result are the ids, the best first
+
+CREATE OR REPLACE FUNCTION topk_accum(internal, bigint, real, int) RETURNS internal
+AS 'pgsiftorder.so', 'c_topk_accum'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION topk_distance_accum(internal, bigint, real, int) RETURNS internal
+AS 'pgsiftorder.so', 'c_topk_distance_accum'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION topk_combine(internal, internal) RETURNS internal
+AS 'pgsiftorder.so', 'c_topk_combine'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION topk_serialize(internal) RETURNS bytea
+AS 'pgsiftorder.so', 'c_topk_serialize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION topk_deserialize(bytea, internal) RETURNS internal
+AS 'pgsiftorder.so', 'c_topk_deserialize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION topk_final(internal) RETURNS bigint[]
+AS 'pgsiftorder.so', 'c_topk_final'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS topk(bigint, real, int) CASCADE;
+CREATE AGGREGATE topk(id bigint, score real, k int) (
+  SFUNC = topk_accum,
+  STYPE = internal,
+  FINALFUNC = topk_final,
+  COMBINEFUNC = topk_combine,
+  SERIALFUNC = topk_serialize,
+  DESERIALFUNC = topk_deserialize,
+  PARALLEL = SAFE
+);
+COMMENT ON AGGREGATE topk(bigint, real, int) IS 'Ids of the k rows of the largest score (rating_*), the best first';
+
+DROP AGGREGATE IF EXISTS topk_distance(bigint, real, int) CASCADE;
+CREATE AGGREGATE topk_distance(id bigint, distance real, k int) (
+  SFUNC = topk_distance_accum,
+  STYPE = internal,
+  FINALFUNC = topk_final,
+  COMBINEFUNC = topk_combine,
+  SERIALFUNC = topk_serialize,
+  DESERIALFUNC = topk_deserialize,
+  PARALLEL = SAFE
+);
+COMMENT ON AGGREGATE topk_distance(bigint, real, int) IS 'Ids of the k rows of the smallest distance (distance_square_*), the nearest first';
+
+
+--------------------------------------------------------------------------------
+-- Ranked retrieval over a GIN index (WAND) - the k best rows without rating every candidate
+--------------------------------------------------------------------------------
+-- CREATE INDEX ON docs USING gin (ids); SELECT * FROM sift_search('docs', 'ids', query_ids, query_weights, 10, 'weights');
+
+DROP FUNCTION IF EXISTS sift_search(regclass, name, int[], real[], int, name) CASCADE;
+CREATE OR REPLACE FUNCTION sift_search(relation regclass, ids_column name, query int[], weights real[], k int, weights_column name DEFAULT NULL, OUT ctid tid, OUT score real) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_sift_search'
+LANGUAGE C STABLE PARALLEL RESTRICTED COST 10000 ROWS 100;
+COMMENT ON FUNCTION sift_search(regclass, name, int[], real[], int, name) IS 'The k rows of the relation of the best rating_cosine (weights_column given) or weighted rating_boolean of the int[] column, the best first (needs a GIN index of the column)';
+
+
+--------------------------------------------------------------------------------
+-- Bulk import and export of the .fvecs, .bvecs and .ivecs datasets (server-side files)
+--------------------------------------------------------------------------------
+-- superuser or pg_read_server_files (import) / pg_write_server_files (export), like COPY
+-- INSERT INTO sift_base SELECT id, vector FROM fvecs_read('/data/sift/sift_base.fvecs');
+
+DROP FUNCTION IF EXISTS fvecs_read(text, bigint, bigint) CASCADE;
+DROP FUNCTION IF EXISTS fvecs_read(text, bigint, bigint, int) CASCADE;
+CREATE OR REPLACE FUNCTION fvecs_read(path text, start bigint DEFAULT 0, count bigint DEFAULT NULL, dim int DEFAULT NULL, OUT id bigint, OUT vector real[]) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_fvecs_read'
+LANGUAGE C VOLATILE PARALLEL RESTRICTED COST 10 ROWS 1000000;
+COMMENT ON FUNCTION fvecs_read(text, bigint, bigint, int) IS 'The vectors of a server-side .fvecs file (0 based id), from start, count of them (NULL all), dim of all of them (NULL any, given jumps to start)';
+
+DROP FUNCTION IF EXISTS fvecs_read_fvec(text, bigint, bigint) CASCADE;
+DROP FUNCTION IF EXISTS fvecs_read_fvec(text, bigint, bigint, int) CASCADE;
+CREATE OR REPLACE FUNCTION fvecs_read_fvec(path text, start bigint DEFAULT 0, count bigint DEFAULT NULL, dim int DEFAULT NULL, OUT id bigint, OUT vector fvec) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_fvecs_read_fvec'
+LANGUAGE C VOLATILE PARALLEL RESTRICTED COST 10 ROWS 1000000;
+COMMENT ON FUNCTION fvecs_read_fvec(text, bigint, bigint, int) IS 'The vectors of a server-side .fvecs file as fvec (0 based id)';
+
+DROP FUNCTION IF EXISTS bvecs_read(text, bigint, bigint) CASCADE;
+DROP FUNCTION IF EXISTS bvecs_read(text, bigint, bigint, int) CASCADE;
+CREATE OR REPLACE FUNCTION bvecs_read(path text, start bigint DEFAULT 0, count bigint DEFAULT NULL, dim int DEFAULT NULL, OUT id bigint, OUT vector int[]) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_bvecs_read'
+LANGUAGE C VOLATILE PARALLEL RESTRICTED COST 10 ROWS 1000000;
+COMMENT ON FUNCTION bvecs_read(text, bigint, bigint, int) IS 'The vectors of a server-side .bvecs file as int[] (0 based id)';
+
+DROP FUNCTION IF EXISTS bvecs_read_bvec(text, bigint, bigint) CASCADE;
+DROP FUNCTION IF EXISTS bvecs_read_bvec(text, bigint, bigint, int) CASCADE;
+CREATE OR REPLACE FUNCTION bvecs_read_bvec(path text, start bigint DEFAULT 0, count bigint DEFAULT NULL, dim int DEFAULT NULL, OUT id bigint, OUT vector bvec) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_bvecs_read_bvec'
+LANGUAGE C VOLATILE PARALLEL RESTRICTED COST 10 ROWS 1000000;
+COMMENT ON FUNCTION bvecs_read_bvec(text, bigint, bigint, int) IS 'The vectors of a server-side .bvecs file as bvec (0 based id)';
+
+DROP FUNCTION IF EXISTS ivecs_read(text, bigint, bigint) CASCADE;
+DROP FUNCTION IF EXISTS ivecs_read(text, bigint, bigint, int) CASCADE;
+CREATE OR REPLACE FUNCTION ivecs_read(path text, start bigint DEFAULT 0, count bigint DEFAULT NULL, dim int DEFAULT NULL, OUT id bigint, OUT vector int[]) RETURNS SETOF record
+AS 'pgsiftorder.so', 'c_ivecs_read'
+LANGUAGE C VOLATILE PARALLEL RESTRICTED COST 10 ROWS 1000000;
+COMMENT ON FUNCTION ivecs_read(text, bigint, bigint, int) IS 'The vectors of a server-side .ivecs file, e.g. the ground truth (0 based id)';
+
+DROP FUNCTION IF EXISTS fvecs_write(text, text) CASCADE;
+CREATE OR REPLACE FUNCTION fvecs_write(path text, query text) RETURNS bigint
+AS 'pgsiftorder.so', 'c_fvecs_write'
+LANGUAGE C VOLATILE STRICT PARALLEL UNSAFE;
+COMMENT ON FUNCTION fvecs_write(text, text) IS 'Writes the first column of the query (real[], int[] or fvec) to a server-side .fvecs file, returns the number of vectors';
+
+DROP FUNCTION IF EXISTS bvecs_write(text, text) CASCADE;
+CREATE OR REPLACE FUNCTION bvecs_write(path text, query text) RETURNS bigint
+AS 'pgsiftorder.so', 'c_bvecs_write'
+LANGUAGE C VOLATILE STRICT PARALLEL UNSAFE;
+COMMENT ON FUNCTION bvecs_write(text, text) IS 'Writes the first column of the query (int[] of 0..255 or bvec) to a server-side .bvecs file, returns the number of vectors';
+
+DROP FUNCTION IF EXISTS ivecs_write(text, text) CASCADE;
+CREATE OR REPLACE FUNCTION ivecs_write(path text, query text) RETURNS bigint
+AS 'pgsiftorder.so', 'c_ivecs_write'
+LANGUAGE C VOLATILE STRICT PARALLEL UNSAFE;
+COMMENT ON FUNCTION ivecs_write(text, text) IS 'Writes the first column of the query (int[]) to a server-side .ivecs file, returns the number of vectors';
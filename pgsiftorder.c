@@ -11,18 +11,25 @@
 // debugging? uncomment this...
 // #define _DEBUG
 
-/* PostgreSQL version as a number */
-#define PG_VERSION_NUM 90400
-
 #include <math.h>
+#include <ctype.h>
+#include <errno.h>
 #include <postgres.h>           // general Postgres declarations
 #include <fmgr.h>               // function manager and function-call interface
 #include <catalog/pg_type.h>    // definition of "type" relation (pg_type)
 #include <utils/array.h>        // declarations for Postgres arrays.
 #include <utils/typcache.h>     // for Type cache definitions
 #include <access/tupmacs.h>     // Tuple macros used by both index tuples and heap tuples
+#include <utils/builtins.h>     // cstring_to_text
+#include <utils/guc.h>          // custom configuration variables (pgsiftorder.simd)
+#include <libpq/pqformat.h>     // binary send/recv of the types
+#include <funcapi.h>            // set returning functions
+#include <access/htup_details.h> // heap_form_tuple
+#include <utils/memutils.h>     // MaxAllocSize
+#include <utils/varbit.h>       // bit(n) signatures
 
 #include "abbrevs.h"
+#include "pgsiftorder.h"
 
 
 // identification... its me :)
@@ -30,6 +37,8 @@
 PG_MODULE_MAGIC;
 #endif
 
+void _PG_init(void);
+
 
 /*
  * The macro PG_ARGISNULL(n) allows a function to test whether each input is null. (Of course, 
@@ -74,6 +83,23 @@ ArrayType* array_new_real(int num) {
     return array_new(num, FLOAT4OID);
 }
 
+/* Create a new float8 array for "num" elements (zeroed) */
+static ArrayType* array_new_double(int num) {
+    ArrayType  *r;
+    int nbytes = ARR_OVERHEAD_NONULLS(1) + sizeof(float8) * num;
+
+    r = (ArrayType *) palloc0(nbytes);
+
+    SET_VARSIZE(r, nbytes);
+    ARR_NDIM(r) = 1;
+    r->dataoffset = 0;			/* marker for no null bitmap */
+    ARR_ELEMTYPE(r) = FLOAT8OID;
+    ARR_DIMS(r)[0] = num;
+    ARR_LBOUND(r)[0] = 1;
+
+    return r;
+}
+
 
 ArrayType* array_resize_real(ArrayType *a, int num)
 {
@@ -114,6 +140,22 @@ ArrayType * array_copy_real(ArrayType *a)
 
 
 
+/*
+ * The first (INOUT) vector safe for writing into. Called as an aggregate transition function it is
+ * the transition value itself - it already lives in the aggregate memory context and Postgres allows
+ * it to be modified in place (see Section 34.10, User-Defined Aggregates), so no per row copy is done.
+ * Otherwise (or if the state is toasted) it is a copy, like PG_GETARG_ARRAYTYPE_P_COPY(0).
+ */
+static ArrayType* array_inout_real(FunctionCallInfo fcinfo) {
+    Datum       state = PG_GETARG_DATUM(0);
+
+    if (AggCheckCallContext(fcinfo, NULL) && !VARATT_IS_EXTENDED(DatumGetPointer(state)))
+        return (ArrayType*) DatumGetPointer(state);
+
+    return PG_GETARG_ARRAYTYPE_P_COPY(0);
+}
+
+
 PG_FUNCTION_INFO_V1(c_array_greatest_real);
 /****************************************************************************************************
  * Addition of vectors by elements - Σimax(Ai, Bi)
@@ -121,18 +163,15 @@ PG_FUNCTION_INFO_V1(c_array_greatest_real);
  * @param elements1 real[]  // IN OUT?
  */
 Datum c_array_greatest_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // result
+    ArrayType*  vector0 = array_inout_real(fcinfo); // result (the aggregate state is updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len  = MIN(ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)),   // array lengths
                            ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1)));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] =  MAX(ptr0[pos], ptr1[pos]);
-    }
+    vector_greatest_real(ptr0, ptr1, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -145,18 +184,15 @@ PG_FUNCTION_INFO_V1(c_array_least_real);
  * @param elements1 real[]  // IN OUT?
  */
 Datum c_array_least_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // result
+    ArrayType*  vector0 = array_inout_real(fcinfo); // result (the aggregate state is updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len  = MIN(ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)),   // array lengths
                            ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1)));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] =  MIN(ptr0[pos], ptr1[pos]);
-    }
+    vector_least_real(ptr0, ptr1, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -170,18 +206,15 @@ PG_FUNCTION_INFO_V1(c_array_add_real);
  * @param elements1 real[]  // IN
  */
 Datum c_array_add_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // result
+    ArrayType*  vector0 = array_inout_real(fcinfo); // result (the aggregate state is updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len  = MIN(ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)),   // array lengths
                            ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1)));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] +=  ptr1[pos];
-    }
+    vector_add_real(ptr0, ptr1, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -194,18 +227,15 @@ PG_FUNCTION_INFO_V1(c_array_sub_real);
  * @param elements1 real[]  // IN
  */
 Datum c_array_sub_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // result
+    ArrayType*  vector0 = array_inout_real(fcinfo); // result (the aggregate state is updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len  = MIN(ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)),   // array lengths
                            ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1)));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] -=  ptr1[pos];
-    }
+    vector_sub_real(ptr0, ptr1, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -218,18 +248,15 @@ PG_FUNCTION_INFO_V1(c_array_mul_real);
  * @param elements1 real[]  // IN
  */
 Datum c_array_mul_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // result
+    ArrayType*  vector0 = array_inout_real(fcinfo); // result (the aggregate state is updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len  = MIN(ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)),   // array lengths
                            ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1)));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] *=  ptr1[pos];
-    }
+    vector_mul_real(ptr0, ptr1, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -243,18 +270,15 @@ PG_FUNCTION_INFO_V1(c_array_div_real);
  * @param elements1 real[]  // IN
  */
 Datum c_array_div_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // result
+    ArrayType*  vector0 = array_inout_real(fcinfo); // result (the aggregate state is updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len  = MIN(ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)),   // array lengths
                            ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1)));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] /=  ptr1[pos];
-    }
+    vector_div_real(ptr0, ptr1, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -270,11 +294,8 @@ Datum c_array_sqr_real(PG_FUNCTION_ARGS) {
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     int         len  = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] *=  ptr0[pos];
-    }
+    vector_sqr_real(ptr0, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
@@ -291,17 +312,167 @@ Datum c_array_sqrt_real(PG_FUNCTION_ARGS) {
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     int         len  = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));
-    int         pos  = 0;           // array position
 
-    for (pos = 0; pos < len; pos++) {
-        ptr0[pos] =  (float4)sqrt(ptr0[pos]);
-    }
+    vector_sqrt_real(ptr0, len);
     
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
 
 
 
+
+/*
+ * An operand of the fused operations - the data of the real[] argument without NULLs, of the length of
+ * the leading operand (set by it if negative)
+ */
+static const float4* array_operand_real(FunctionCallInfo fcinfo, int arg, int* length) {
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(arg);
+    int         len = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+
+    if (*length < 0) *length = len;
+    if (ARR_HASNULL(vector) || len != *length) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("arrays must be of the same size (%d) without NULLs", *length)));
+    }
+    return (const float4*) ARR_DATA_PTR(vector);
+}
+
+
+PG_FUNCTION_INFO_V1(c_array_axpy_real);
+/****************************************************************************************************
+ * Fused scaled addition of vectors - Σalpha * Xi + Yi (one pass, one result array)
+ * @param alpha real
+ * @param elements1 real[]
+ * @param elements2 real[]
+ */
+Datum c_array_axpy_real(PG_FUNCTION_ARGS) {
+    float4      alpha = PG_GETARG_FLOAT4(0);
+    int         len = -1;
+    const float4* x = array_operand_real(fcinfo, 1, &len);
+    const float4* y = array_operand_real(fcinfo, 2, &len);
+    ArrayType*  result;
+
+    if (len == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(len);
+    vector_axpy_real((float4*) ARR_DATA_PTR(result), alpha, x, y, len);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_array_fma_real);
+/****************************************************************************************************
+ * Fused multiplication and addition of vectors by elements - ΣAi * Bi + Ci
+ * @param elements0 real[]
+ * @param elements1 real[]
+ * @param elements2 real[]
+ */
+Datum c_array_fma_real(PG_FUNCTION_ARGS) {
+    int         len = -1;
+    const float4* a = array_operand_real(fcinfo, 0, &len);
+    const float4* b = array_operand_real(fcinfo, 1, &len);
+    const float4* c = array_operand_real(fcinfo, 2, &len);
+    ArrayType*  result;
+
+    if (len == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(len);
+    vector_fma_real((float4*) ARR_DATA_PTR(result), a, b, c, len);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_array_standardize_real);
+/****************************************************************************************************
+ * Standardization of the vector by elements - Σ(Ai - Mi) / Si, e.g. by array_avg() and array_std()
+ * WARNING: May return NaN!
+ * @param elements0 real[]
+ * @param mean real[]
+ * @param stdev real[]
+ */
+Datum c_array_standardize_real(PG_FUNCTION_ARGS) {
+    int         len = -1;
+    const float4* a = array_operand_real(fcinfo, 0, &len);
+    const float4* mean = array_operand_real(fcinfo, 1, &len);
+    const float4* stdev = array_operand_real(fcinfo, 2, &len);
+    ArrayType*  result;
+
+    if (len == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(len);
+    vector_standardize_real((float4*) ARR_DATA_PTR(result), a, mean, stdev, len);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_array_clamp_real);
+/****************************************************************************************************
+ * Clamping of the vector by elements - Σmin(max(Ai, LOi), HIi)
+ * @param elements0 real[]
+ * @param lo real[]
+ * @param hi real[]
+ */
+Datum c_array_clamp_real(PG_FUNCTION_ARGS) {
+    int         len = -1;
+    const float4* a = array_operand_real(fcinfo, 0, &len);
+    const float4* lo = array_operand_real(fcinfo, 1, &len);
+    const float4* hi = array_operand_real(fcinfo, 2, &len);
+    ArrayType*  result;
+
+    if (len == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(len);
+    vector_clamp_real((float4*) ARR_DATA_PTR(result), a, lo, hi, 1, len);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_array_clamp_scalar_real);
+/****************************************************************************************************
+ * Clamping of the vector by elements to a range - Σmin(max(Ai, lo), hi)
+ * @param elements0 real[]
+ * @param lo real
+ * @param hi real
+ */
+Datum c_array_clamp_scalar_real(PG_FUNCTION_ARGS) {
+    int         len = -1;
+    const float4* a = array_operand_real(fcinfo, 0, &len);
+    float4      lo = PG_GETARG_FLOAT4(1);
+    float4      hi = PG_GETARG_FLOAT4(2);
+    ArrayType*  result;
+
+    if (len == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(len);
+    vector_clamp_real((float4*) ARR_DATA_PTR(result), a, &lo, &hi, 0, len);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/*
+ * New accumulator (3*len +1) of a single vector - ΣAi, ΣAi^2, Σi, -len (~ length checksum)
+ */
+static ArrayType* array_acc_init_real(const float4* ptr, int len) {
+    ArrayType*  acc = array_new_real(3*len +1);
+    float4*     ptr0 = (float4*) ARR_DATA_PTR(acc);
+    int         pos;
+
+    // create a checksum number
+    ptr0[3*len] = -len;
+
+    for (pos = 0; pos < len; pos++) {
+        ptr0[pos         ] = ptr[pos];
+        ptr0[pos +   len] = ptr[pos]*ptr[pos];
+        ptr0[pos + 2*len] = 1;
+    }
+    return acc;
+}
+
+
 PG_FUNCTION_INFO_V1(c_array_acc_real);
 /****************************************************************************************************
  * Average and standard deviation accumulator - ΣAi, ΣAi^2, Σi, -i (~ length checksum)
@@ -309,41 +480,37 @@ PG_FUNCTION_INFO_V1(c_array_acc_real);
  * @param elements1 real[]  // IN
  */
 Datum c_array_acc_real(PG_FUNCTION_ARGS) {
-    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P_COPY(0); // accumulated value
+    uint64      started = STATS_CLOCK();            // pgsiftorder.stats
+    ArrayType*  vector0 = array_inout_real(fcinfo); // accumulated value (updated in place)
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
+    uint64      detoasted = STATS_CLOCK();
     
     float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
     int         len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));   // array lengths
     int         len1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));
-    int         pos  = 0;           // array position
     
     //#ifdef _DEBUG
     //    ereport(NOTICE, (111111, errmsg("c_array_avg_std_acc_real() len0: %d; len1: %d", len0, len1)));
     //#endif
         
-    // len0 should be 3*len1 +1 ... if not, make it happen :)
+    // the aggregates start from '{}' (INITCOND) - the first row makes the accumulator
+    // (once per group - a new array, the aggregate state must not be repalloc'ed under the executor)
+    if (len0 == 0) {
+        vector0 = array_acc_init_real(ptr1, len1);
+        STATS_COUNT(STAT_ARRAY_ACC_REAL, started, detoasted, len1, 0, 0);
+        PG_RETURN_ARRAYTYPE_P(vector0);
+    }
+    // len0 should be 3*len1 +1 ... if not, make it happen :) (a single vector called directly)
     if (len0 == len1) {
-        vector0 = array_resize_real(vector0, 3*len0 +1);
+        vector0 = array_acc_init_real(ptr0, len1);
         ptr0 = (float4*) ARR_DATA_PTR(vector0);
-        len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));
-        
-        // create a checksum number
-        ptr0[len0 -1] = -len1;
-        
-        // init the std and counts 
-        for(pos = 0; pos < len1; pos++) {
-            ptr0[pos +   len1] = ptr0[pos]*ptr0[pos];
-            ptr0[pos + 2*len1] = 1;
-        }
+        len0 = 3*len1 +1;
     }
     
     if (len0 == 3*len1 +1) {
-        for (pos = 0; pos < len1; pos++) {
-            ptr0[pos         ] += ptr1[pos];
-            ptr0[pos +   len1] += ptr1[pos]*ptr1[pos];
-            ptr0[pos + 2*len1] ++;
-        }
+        vector_acc_real(ptr0, ptr1, len1);
+        STATS_COUNT(STAT_ARRAY_ACC_REAL, started, detoasted, len1, 0, 0);
     }
     else {
         #ifdef _DEBUG
@@ -354,6 +521,52 @@ Datum c_array_acc_real(PG_FUNCTION_ARGS) {
     PG_RETURN_ARRAYTYPE_P(vector0);
 }
 
+PG_FUNCTION_INFO_V1(c_array_acc_combine_real);
+/****************************************************************************************************
+ * Combine two average and standard deviation accumulators - ΣAi, ΣAi^2, Σi (parallel aggregation)
+ * Both of them are accumulators (3*len +1) or '{}' (INITCOND) of a partial aggregate without rows.
+ * @param elements0 real[]  // INOUT
+ * @param elements1 real[]  // IN
+ */
+Datum c_array_acc_combine_real(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = array_inout_real(fcinfo); // accumulated value (updated in place)
+    ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // partial accumulated value
+    
+    float4*     ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
+    float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);
+    int         len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));   // array lengths
+    int         len1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));
+    int         dim = (len0 -1) / 3;    // vector dimension
+
+    // a partial aggregate without rows
+    if (len1 == 0) PG_RETURN_ARRAYTYPE_P(vector0);
+    if (len0 == 0) PG_RETURN_ARRAYTYPE_P(vector1);
+
+    // both are accumulators of the same dimension (the checksums tell) - ΣAi, ΣAi^2 and Σi add up
+    if (len0 != len1 || (len0 -1) % 3 != 0
+     || -(int)ROUND(ptr0[len0 -1]) != dim || -(int)ROUND(ptr1[len1 -1]) != dim)
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("accumulators must be of the same vector size (lengths %d and %d)", len0, len1)));
+
+    vector_add_real(ptr0, ptr1, 3*dim);
+    
+    PG_RETURN_ARRAYTYPE_P(vector0);
+}
+
+
+PG_FUNCTION_INFO_V1(c_array_acc_final);
+/****************************************************************************************************
+ * Average and standard deviation accumulator final - NULL of no rows ('{}')
+ * @param elements0 real[]    // IN
+  */
+Datum 
+c_array_acc_final(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P(0); 
+
+    if (ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0)) == 0) PG_RETURN_NULL();
+
+    PG_RETURN_ARRAYTYPE_P(vector0);
+}
 
 
 PG_FUNCTION_INFO_V1(c_array_avg_final);
@@ -368,9 +581,12 @@ c_array_avg_final(PG_FUNCTION_ARGS) {
     
     float4*   ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     int       len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));   // array lengths
-    int       len1 = -(int)ROUND(ptr0[len0 -1]);
+    int       len1 = (len0 > 0) ? -(int)ROUND(ptr0[len0 -1]) : 0;
     int       pos;           // array position
 
+    // no rows ('{}' INITCOND)
+    if (len0 == 0) PG_RETURN_NULL();
+
     // if there is the proper size
     if ((len0 -1)/3 == len1 && len1 > 0) {
         result = array_new_real(len1);
@@ -404,9 +620,12 @@ c_array_std_final(PG_FUNCTION_ARGS) {
     
     float4*   ptr0 = (float4*) ARR_DATA_PTR(vector0);         // array data pointers
     int       len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));   // array lengths
-    int       len1 = -(int)ROUND(ptr0[len0 -1]);
+    int       len1 = (len0 > 0) ? -(int)ROUND(ptr0[len0 -1]) : 0;
     int       pos;           // array position
 
+    // no rows ('{}' INITCOND)
+    if (len0 == 0) PG_RETURN_NULL();
+
     // if there is the proper size
     if ((len0 -1)/3 == len1 && len1 > 0) {
         result = array_new_real(len1);
@@ -442,168 +661,643 @@ c_array_std_final(PG_FUNCTION_ARGS) {
 
 
 /****************************************************************************************************
- * Document Retrieval Functions
+ * Moving (window) aggregates - array_sum, array_accumulate, array_avg and array_std OVER (... ROWS n PRECEDING)
+ * The state is the accumulator of c_array_acc_real (ΣAi, ΣAi^2, Σi, -i) in float8[] - the rows leaving
+ * the frame are subtracted by the inverse transition (no float4 cancellation drift), O(dim) per row.
  ****************************************************************************************************/
 
-PG_FUNCTION_INFO_V1(c_rating_normalize_vect);
-/*
- * Perform the normalization of vector. 
- * @param vector float[]
- */
-Datum 
-c_rating_normalize_vect(PG_FUNCTION_ARGS) {
-    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+// the vector dimension of a moving accumulator (0 if empty - the frame has no rows)
+static int array_macc_dim(ArrayType* state) {
+    float8*     ptr0 = (float8*) ARR_DATA_PTR(state);
+    int         len0 = ArrayGetNItems(ARR_NDIM(state), ARR_DIMS(state));
+    int         dim = (len0 -1) / 3;
 
-    int         length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));   // array lengths
+    if (len0 < 4 || (len0 -1) % 3 != 0 || -(int)ROUND(ptr0[len0 -1]) != dim || ptr0[2*dim] <= 0) return 0;
+    return dim;
+}
 
-    float4*     ptr = (float4*)ARR_DATA_PTR(vector);         // array data pointers  
-    int         pos = 0;           // array position
-    float4      norm = 0;          // norm for the normalization
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_rating_normalize_vect length: %d \r\n", length)));
-    #endif
-    
-    // L2 norm(x) = sqrt( Sum[(xi)^2] )
-    //                  i
-    // go through the vector
-    while (pos < length) {    
-        #ifdef _DEBUG
-            ereport(NOTICE, (111112, errmsg("c_rating_normalize_vect pos: %d (%f) \r\n", pos, ptr[pos])));
-        #endif        
-            
-        norm += (ptr[pos] * ptr[pos]);
-        pos++; 
-    } // go through the vector
+PG_FUNCTION_INFO_V1(c_array_macc_real);
+/****************************************************************************************************
+ * Moving accumulator transition - adds the vector to ΣAi, ΣAi^2, Σi (the initial state is empty '{}')
+ * @param elements0 float8[]  // INOUT
+ * @param elements1 real[]    // IN
+ */
+Datum c_array_macc_real(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = array_inout_real(fcinfo); // accumulated value (updated in place)
+    ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
+    int         len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));   // array lengths
+    int         len1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));
 
-    // sqrt
-    norm = sqrt(norm);
+    // the first row - a new accumulator (the aggregate state must not be repalloc'ed under the executor)
+    if (len0 == 0) {
+        vector0 = array_new_double(3*len1 +1);
+        ((float8*) ARR_DATA_PTR(vector0))[3*len1] = -len1;    // the checksum
+        len0 = 3*len1 +1;
+    }
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111115, errmsg("c_rating_normalize_vect return norm: %f \r\n", norm)));
-    #endif
-            
-    PG_RETURN_FLOAT4(norm);
+    if (len0 == 3*len1 +1) {
+        vector_macc_real((float8*) ARR_DATA_PTR(vector0), (float4*) ARR_DATA_PTR(vector1), len1, 1);
+    }
+    else {
+        #ifdef _DEBUG
+            ereport(WARNING, (111111, errmsg("c_array_macc_real() length0: %d != (3*length1 +1): %d", len0, len1)));
+        #endif
+    }
+
+    PG_RETURN_ARRAYTYPE_P(vector0);
 }
 
 
-PG_FUNCTION_INFO_V1(c_rating_cosine_norm);
-/*
- * Counts cosine rating of two vectors using the pre-counted norm (recomended). 
- * @param elements1 int4[]
- * @param weights1 float[]
- * @param norm1 float  
- * @param elements2 int4[]
- * @param weights2 float[]
- * @param norm2 float 
+PG_FUNCTION_INFO_V1(c_array_macc_inv_real);
+/****************************************************************************************************
+ * Moving accumulator inverse transition - subtracts the vector leaving the window frame
+ * (the vectors of a different length were not accumulated, so they are not subtracted either)
+ * @param elements0 float8[]  // INOUT
+ * @param elements1 real[]    // IN
  */
-Datum 
-c_rating_cosine_norm(PG_FUNCTION_ARGS) {
-    ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(0);
-    ArrayType*  weight1 = PG_GETARG_ARRAYTYPE_P(0);
-    float4      norm1 = PG_GETARG_FLOAT4(2);
+Datum c_array_macc_inv_real(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = array_inout_real(fcinfo); // accumulated value (updated in place)
+    ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(1); // operand
+    float8*     ptr0 = (float8*) ARR_DATA_PTR(vector0);
+    int         len0 = ArrayGetNItems(ARR_NDIM(vector0), ARR_DIMS(vector0));   // array lengths
+    int         len1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));
 
-    ArrayType*  vector2 = PG_GETARG_ARRAYTYPE_P(3);
-    ArrayType*  weight2 = PG_GETARG_ARRAYTYPE_P(4);
-    float4      norm2 = PG_GETARG_FLOAT4(5);
+    if (len0 == 3*len1 +1 && len1 > 0) {
+        vector_macc_real(ptr0, (float4*) ARR_DATA_PTR(vector1), len1, -1);
 
-    int         length1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
-    int         length2 = ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2));
-    
-    // check length of weights - for SIGSEGV :)
-    if ( ( length1 > ArrayGetNItems(ARR_NDIM(weight1), ARR_DIMS(weight1) )) || ( length2 > ArrayGetNItems(ARR_NDIM(weight2), ARR_DIMS(weight2) )) ) {
-        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
-                       errmsg("weight arrays must be of the same size as key arrays")));
+        // the frame is empty - exact zeros, not the rounding residue of the sums
+        if (ptr0[2*len1] <= 0) memset(ptr0, 0, sizeof(float8) * 3*len1);
     }
 
-    int32*      ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
-    float4*     ptrw1 = (float4*) ARR_DATA_PTR(weight1);
-    int32*      ptr2 = (int32*) ARR_DATA_PTR(vector2);
-    float4*     ptrw2 = (float4*) ARR_DATA_PTR(weight2);    
-    int         pos1 = 0;           // array position
-    int         pos2 = 0;
-    float4      rating = 0;         // result
+    PG_RETURN_ARRAYTYPE_P(vector0);
+}
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_rating_cosine length1: %d length2: %d \r\n", length1, length2)));
-    #endif
-        
-    //                  |dq.dd|
-    //    r(dq, dd) = -----------
-    //                 |dq|x|dd|
-    //
-    // go through the two vectors
-    while (pos1 < length1 && pos2 < length2) {    
 
-        #ifdef _DEBUG
-            ereport(NOTICE, (111112, errmsg("c_rating_cosine pos1: %d (%d, %f) pos2: %d (%d, %f) \r\n", pos1, ptr1[pos1], ptrw1[pos1], pos2, ptr2[pos2], ptrw2[pos2])));
-        #endif        
-            
-        // this is done for the first time and when values equals	
-        if (ptr1[pos1] == ptr2[pos2]) {
-            rating += (ptrw1[pos1] * ptrw2[pos2]);
-            pos1++;
-            pos2++;
+PG_FUNCTION_INFO_V1(c_array_macc_sum_final);
+/****************************************************************************************************
+ * Moving sum of vectors final - ΣAi (NULL if the frame is empty)
+ * @param elements0 float8[]
+ */
+Datum
+c_array_macc_sum_final(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P(0);
+    float8*     ptr0 = (float8*) ARR_DATA_PTR(vector0);
+    int         dim = array_macc_dim(vector0);
+    ArrayType*  result;
+    float4*     ptr1;
+    int         pos;
+
+    if (dim == 0) PG_RETURN_NULL();
+
+    result = array_new_real(dim);
+    ptr1 = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < dim; pos++) ptr1[pos] = ptr0[pos];
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
 
-	    #ifdef _DEBUG
-                ereport(NOTICE, (111113, errmsg("ptr1[pos1] == ptr2[pos2] (pos1++ pos2++) \r\n")));
-            #endif        
-            continue;
-        }
-        // value of vector1 is smaller - set the next one
-        else if(ptr1[pos1] < ptr2[pos2])
-        {
-            pos1++;
 
-	    #ifdef _DEBUG
-                ereport(NOTICE, (111113, errmsg("ptr1[pos1] < ptr2[pos2] (pos1++) \r\n")));
-            #endif        
-            continue;            
-        }
-        // cmpresult > 0 - try next position in vector2
-        else
-        {
-            pos2++;
+PG_FUNCTION_INFO_V1(c_array_macc_acc_final);
+/****************************************************************************************************
+ * Moving accumulator final - the real[] accumulator of array_accumulate (ΣAi, ΣAi^2, Σi, -i)
+ * @param elements0 float8[]
+ */
+Datum
+c_array_macc_acc_final(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P(0);
+    float8*     ptr0 = (float8*) ARR_DATA_PTR(vector0);
+    int         dim = array_macc_dim(vector0);
+    ArrayType*  result;
+    float4*     ptr1;
+    int         pos;
+
+    if (dim == 0) PG_RETURN_NULL();
+
+    result = array_new_real(3*dim +1);
+    ptr1 = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < 3*dim +1; pos++) ptr1[pos] = ptr0[pos];
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
 
-	    #ifdef _DEBUG
-                ereport(NOTICE, (111113, errmsg("ptr1[pos1] > ptr2[pos2] (pos2++) \r\n")));
-            #endif        
-            continue;            
-        }
-    } // go through the two vectors
 
-    // if the rating is 0 or it may cause division by 0, return 0
-    if (rating == 0 || norm1 == 0 || norm2 == 0) PG_RETURN_FLOAT4(rating);
+PG_FUNCTION_INFO_V1(c_array_macc_avg_final);
+/****************************************************************************************************
+ * Moving average of vectors final - ΣAi / Σi
+ * @param elements0 float8[]
+ */
+Datum
+c_array_macc_avg_final(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P(0);
+    float8*     ptr0 = (float8*) ARR_DATA_PTR(vector0);
+    int         dim = array_macc_dim(vector0);
+    ArrayType*  result;
+    float4*     ptr1;
+    int         pos;
+
+    if (dim == 0) PG_RETURN_NULL();
+
+    result = array_new_real(dim);
+    ptr1 = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < dim; pos++) ptr1[pos] = ptr0[pos] / ptr0[pos + 2*dim];
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
 
-    // normalize
-    rating /= (norm1 * norm2);
+
+PG_FUNCTION_INFO_V1(c_array_macc_std_final);
+/****************************************************************************************************
+ * Moving standard deviation of vectors final - sqrt(ΣAi^2 / Σi - avg^2)
+ * @param elements0 float8[]
+ */
+Datum
+c_array_macc_std_final(PG_FUNCTION_ARGS) {
+    ArrayType*  vector0 = PG_GETARG_ARRAYTYPE_P(0);
+    float8*     ptr0 = (float8*) ARR_DATA_PTR(vector0);
+    int         dim = array_macc_dim(vector0);
+    ArrayType*  result;
+    float4*     ptr1;
+    int         pos;
+
+    if (dim == 0) PG_RETURN_NULL();
+
+    result = array_new_real(dim);
+    ptr1 = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < dim; pos++) {
+        float8  avg = ptr0[pos] / ptr0[pos + 2*dim];
+        float8  var = ptr0[pos + dim] / ptr0[pos + 2*dim] - avg * avg;     // variance
+
+        ptr1[pos] = (var > 0) ? sqrt(var) : 0;
+    }
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+
+
+/****************************************************************************************************
+ * Kernel selection
+ * The dense, byte and sparse kernels are in pgsiftorder_kernels.c (no server dependencies, see make bench),
+ * the best ones are picked by CPUID once, in _PG_init(), and may be lowered by pgsiftorder.simd.
+ ****************************************************************************************************/
+
+static const struct config_enum_entry simd_options[] = {
+    {"scalar", SIMD_SCALAR, false},
+    {"sse4.2", SIMD_SSE42, false},
+    {"avx2", SIMD_AVX2, false},
+    {"avx512", SIMD_AVX512, false},
+    {"auto", SIMD_AUTO, false},
+    {NULL, 0, false}
+};
+
+static int       simd_setting = SIMD_AUTO;     // pgsiftorder.simd
+
+
+static void simd_assign_hook(int newval, void *extra) {
+    simd_select(newval);
+}
+
+
+/*
+ * Library load - detect the CPU once and register pgsiftorder.simd (and the index and statistics settings)
+ */
+void _PG_init(void) {
+    simd_cpu = simd_detect();
+
+    DefineCustomEnumVariable("pgsiftorder.simd",
+                             "Instruction set used by the dense distance and sparse intersection kernels.",
+                             "auto picks the best one supported by the CPU, scalar is the reference implementation.",
+                             &simd_setting,
+                             SIMD_AUTO,
+                             simd_options,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             simd_assign_hook,
+                             NULL);
+
+    simd_select(simd_setting);
+
+    // the IVF-flat index (reloptions, pgsiftorder.ivf_probes)
+    ivf_init();
+
+    // the runtime statistics (pgsiftorder.stats, the shared memory area if preloaded)
+    stats_init();
+
+    // the planner support of the ratings (pgsiftorder.rating_overlap)
+    support_init();
+}
+
+
+PG_FUNCTION_INFO_V1(c_pgsiftorder_simd);
+/****************************************************************************************************
+ * Name of the instruction set the dense and sparse kernels currently run with.
+ */
+Datum 
+c_pgsiftorder_simd(PG_FUNCTION_ARGS) {
+    PG_RETURN_TEXT_P(cstring_to_text(simd_options[simd_active].name));
+}
+
+
+/****************************************************************************************************
+ * Constant query cache
+ * A rating in a scan usually compares every row with the same query (a constant or a parameter). If the
+ * query arguments are stable for the call site (get_fn_expr_arg_stable), the data derived from them - the
+ * norm and an id lookup table - are built once into fn_extra, so the rows only walk their own elements.
+ * Non-stable arguments (e.g. joins) keep the original per-row intersection.
+ ****************************************************************************************************/
+
+// the dense lookup table (an int32 per id) is used up to this id range, a hash table above it
+#define QUERY_DENSE_MAX_RANGE (1 << 18)
+
+typedef struct QueryCache {
+    int         arg;            // the query elements argument (its weights follow), -1 ~ not stable
+    int         length;         // the query elements
+    int32*      ids;
+    float4*     weights;        // NULL for the boolean rating
+    float4      norm;           // sum of squares of the weights (without sqrt)
+    int32       min;            // dense lookup: position + 1 of the element id - min, 0 ~ none
+    int32       range;
+    int32*      dense;
+    uint32      mask;           // hash lookup (linear probing) of the size mask + 1
+    int32*      keys;
+    int32*      slots;          // position + 1, 0 ~ empty
+} QueryCache;
+
+static inline uint32 query_hash(int32 id) {
+    uint32 h = (uint32) id * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+/*
+ * Position of the element in the query or -1
+ */
+static inline int query_cache_find(const QueryCache* qc, int32 id) {
+    uint32 h;
+
+    if (qc->dense != NULL) {
+        uint32 offset = (uint32) id - (uint32) qc->min;
+        return (offset < (uint32) qc->range) ? qc->dense[offset] - 1 : -1;
+    }
+
+    for (h = query_hash(id) & qc->mask; qc->slots[h] != 0; h = (h + 1) & qc->mask) {
+        if (qc->keys[h] == id) return qc->slots[h] - 1;
+    }
+    return -1;
+}
+
+/*
+ * Builds the lookup table of the query elements (in the current memory context)
+ */
+static void query_cache_build(QueryCache* qc, const int32* ptr, int length) {
+    int32   min = 0;
+    int32   max = 0;
+    int     pos;
+
+    qc->length = length;
+    qc->ids = (int32*) palloc(sizeof(int32) * (length + 1));
+    memcpy(qc->ids, ptr, sizeof(int32) * length);
+
+    for (pos = 0; pos < length; pos++) {
+        if (pos == 0 || ptr[pos] < min) min = ptr[pos];
+        if (pos == 0 || ptr[pos] > max) max = ptr[pos];
+    }
+
+    if ((int64) max - min < QUERY_DENSE_MAX_RANGE) {
+        qc->min = min;
+        qc->range = (length > 0) ? max - min + 1 : 0;
+        qc->dense = (int32*) palloc0(sizeof(int32) * (qc->range + 1));
+        for (pos = length - 1; pos >= 0; pos--) qc->dense[ptr[pos] - min] = pos + 1;   // the first repetition wins
+        return;
+    }
+
+    qc->mask = 15;
+    while (qc->mask < (uint32) length * 2) qc->mask = (qc->mask << 1) | 1;
+    qc->keys = (int32*) palloc(sizeof(int32) * (qc->mask + 1));
+    qc->slots = (int32*) palloc0(sizeof(int32) * (qc->mask + 1));
+
+    for (pos = 0; pos < length; pos++) {
+        uint32 h = query_hash(ptr[pos]) & qc->mask;
+
+        while (qc->slots[h] != 0 && qc->keys[h] != ptr[pos]) h = (h + 1) & qc->mask;
+        if (qc->slots[h] != 0) continue;        // the first repetition wins
+        qc->keys[h] = ptr[pos];
+        qc->slots[h] = pos + 1;
+    }
+}
+
+/*
+ * Returns the query cache of the call site, or NULL if no query side is stable. The query elements are
+ * the argument arg2 or arg1 (arg2 is preferred, the usual rating(column, constant)), followed by the
+ * weights if weighted.
+ */
+static QueryCache* query_cache(FunctionCallInfo fcinfo, int arg1, int arg2, bool weighted) {
+    QueryCache*     qc = (QueryCache*) fcinfo->flinfo->fn_extra;
+    MemoryContext   oldcontext;
+    ArrayType*      vector;
+    int             arg = -1;
+
+    if (qc != NULL) return (qc->arg < 0) ? NULL : qc;
+
+    if (get_fn_expr_arg_stable(fcinfo->flinfo, arg2) && (!weighted || get_fn_expr_arg_stable(fcinfo->flinfo, arg2 + 1)))
+        arg = arg2;
+    else if (get_fn_expr_arg_stable(fcinfo->flinfo, arg1) && (!weighted || get_fn_expr_arg_stable(fcinfo->flinfo, arg1 + 1)))
+        arg = arg1;
+
+    oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+    qc = (QueryCache*) palloc0(sizeof(QueryCache));
+    qc->arg = arg;
+
+    if (arg >= 0) {
+        vector = PG_GETARG_ARRAYTYPE_P(arg);
+        query_cache_build(qc, (int32*) ARR_DATA_PTR(vector), ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector)));
+
+        if (weighted) {
+            ArrayType* weight = PG_GETARG_ARRAYTYPE_P(arg + 1);
+
+            // check length of weights - for SIGSEGV :)
+            if (qc->length > ArrayGetNItems(ARR_NDIM(weight), ARR_DIMS(weight))) {
+                ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                               errmsg("weight arrays must be of the same size as key arrays")));
+            }
+            qc->weights = (float4*) palloc(sizeof(float4) * (qc->length + 1));
+            memcpy(qc->weights, ARR_DATA_PTR(weight), sizeof(float4) * qc->length);
+            qc->norm = sparse_sum_squares(qc->weights, qc->length);
+        }
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    fcinfo->flinfo->fn_extra = (void*) qc;
+
+    return (arg < 0) ? NULL : qc;
+}
+
+/*
+ * The query position of the document element ptr[pos] or -1 - as the merge of sparse_intersect() pairs
+ * them, the r-th repetition of an id in the document matches the r-th one in the query (run counts them)
+ */
+static inline int query_cache_match(const QueryCache* qc, const int32* ptr, int pos, int* run) {
+    int match = query_cache_find(qc, ptr[pos]);
+
+    *run = (pos > 0 && ptr[pos] == ptr[pos - 1]) ? *run + 1 : 0;
+    if (match < 0 || *run == 0) return match;
+    return (match + *run < qc->length && qc->ids[match + *run] == ptr[pos]) ? match + *run : -1;
+}
+
+/*
+ * Number of common elements of the query and a document
+ */
+static int query_cache_count(const QueryCache* qc, const int32* ptr, int length) {
+    int     count = 0;
+    int     run = 0;
+    int     pos;
+
+    // a long document against a short query - galloping does not touch all its elements
+    if (length / SPARSE_GALLOP_RATIO >= qc->length)
+        return sparse_intersect(qc->ids, qc->length, ptr, length, NULL, NULL);
+
+    for (pos = 0; pos < length; pos++) count += (query_cache_match(qc, ptr, pos, &run) >= 0);
+    return count;
+}
+
+/*
+ * Dot product of the weights of common elements of the query and a document (in the ascending order),
+ * and their number
+ */
+static float4 query_cache_dot(const QueryCache* qc, const int32* ptr, const float4* ptrw, int length, int* matches) {
+    float4  rating = 0;
+    int     run = 0;
+    int     pos;
+
+    *matches = 0;
+    if (length / SPARSE_GALLOP_RATIO >= qc->length) {
+        int*    matchq = (int*) palloc(sizeof(int) * (qc->length + 1));
+        int*    matchd = (int*) palloc(sizeof(int) * (qc->length + 1));
+
+        rating = sparse_rating(qc->ids, qc->weights, qc->length, ptr, ptrw, length, matchq, matchd, matches);
+        pfree(matchq);
+        pfree(matchd);
+        return rating;
+    }
+
+    for (pos = 0; pos < length; pos++) {
+        int match = query_cache_match(qc, ptr, pos, &run);
+        if (match >= 0) {
+            rating += (qc->weights[match] * ptrw[pos]);
+            (*matches)++;
+        }
+    }
+    return rating;
+}
+
+/*
+ * Variances sigma^2 of the Mahalanobis distance, cached if the deviations are stable (NULL otherwise) - the
+ * kernels divide by them as by the uncached stdev * stdev
+ */
+typedef struct VarianceCache {
+    int         length;
+    float4      x[FLEXIBLE_ARRAY_MEMBER];
+} VarianceCache;
+
+static const float4* variance_cache(FunctionCallInfo fcinfo, int arg, const float4* stdev, int length) {
+    VarianceCache*  vc = (VarianceCache*) fcinfo->flinfo->fn_extra;
+    int             pos;
+
+    if (vc == NULL) {
+        bool stable = get_fn_expr_arg_stable(fcinfo->flinfo, arg);
+
+        vc = (VarianceCache*) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+                                                 offsetof(VarianceCache, x) + sizeof(float4) * (stable ? length : 0));
+        vc->length = stable ? length : -1;
+        for (pos = 0; pos < length && stable; pos++) vc->x[pos] = stdev[pos] * stdev[pos];
+        fcinfo->flinfo->fn_extra = (void*) vc;
+    }
+
+    return (vc->length == length) ? vc->x : NULL;
+}
+
+/*
+ * The dimension order of the bounded distances - a 1 based int4[] permutation (see dimension_order())
+ * converted to 0 based positions, validated once and cached if the order is stable
+ */
+typedef struct OrderCache {
+    int         length;
+    int32       x[FLEXIBLE_ARRAY_MEMBER];
+} OrderCache;
+
+static const int32* order_cache(FunctionCallInfo fcinfo, int arg, int length) {
+    OrderCache*  oc = (OrderCache*) fcinfo->flinfo->fn_extra;
+    ArrayType*   order;
+    int32*       ptr;
+    int32*       result;
+    bool*        seen;
+    int          pos;
+
+    if (oc != NULL && oc->length == length) return oc->x;
+
+    order = PG_GETARG_ARRAYTYPE_P(arg);
+    if (ARR_HASNULL(order) || ArrayGetNItems(ARR_NDIM(order), ARR_DIMS(order)) != length) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("the dimension order must be a permutation of 1..%d", length)));
+    }
+
+    ptr = (int32*) ARR_DATA_PTR(order);
+    result = (int32*) palloc(sizeof(int32) * MAX(length, 1));
+    seen = (bool*) palloc0(sizeof(bool) * MAX(length, 1));
+    for (pos = 0; pos < length; pos++) {
+        int32 dimension = ptr[pos] - 1;
+
+        if (dimension < 0 || dimension >= length || seen[dimension]) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("the dimension order must be a permutation of 1..%d", length)));
+        }
+        seen[dimension] = true;
+        result[pos] = dimension;
+    }
+    pfree(seen);
+
+    if (oc == NULL && get_fn_expr_arg_stable(fcinfo->flinfo, arg)) {
+        oc = (OrderCache*) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, offsetof(OrderCache, x) + sizeof(int32) * length);
+        oc->length = length;
+        memcpy(oc->x, result, sizeof(int32) * length);
+        fcinfo->flinfo->fn_extra = (void*) oc;
+    }
+    return result;
+}
+
+
+/****************************************************************************************************
+ * Document Retrieval Functions
+ ****************************************************************************************************/
+
+PG_FUNCTION_INFO_V1(c_rating_normalize_vect);
+/*
+ * Perform the normalization of vector. 
+ * @param vector float[]
+ */
+Datum 
+c_rating_normalize_vect(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+    uint64      detoasted = STATS_CLOCK();
+
+    int         length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));   // array lengths
+
+    float4*     ptr = (float4*)ARR_DATA_PTR(vector);         // array data pointers  
+    int         pos = 0;           // array position
+    float4      norm = 0;          // norm for the normalization
 
     #ifdef _DEBUG
-        ereport(NOTICE, (111115, errmsg("c_rating_cosine return rating: %f \r\n", rating)));
+        ereport(NOTICE, (111111, errmsg("c_rating_normalize_vect length: %d \r\n", length)));
     #endif
+    
+    // L2 norm(x) = sqrt( Sum[(xi)^2] )
+    //                  i
+    // go through the vector
+    while (pos < length) {    
+        #ifdef _DEBUG
+            ereport(NOTICE, (111112, errmsg("c_rating_normalize_vect pos: %d (%f) \r\n", pos, ptr[pos])));
+        #endif        
             
-    PG_RETURN_FLOAT4(rating);
+        norm += (ptr[pos] * ptr[pos]);
+        pos++; 
+    } // go through the vector
+
+    // sqrt
+    norm = sqrt(norm);
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111115, errmsg("c_rating_normalize_vect return norm: %f \r\n", norm)));
+    #endif
+
+    STATS_COUNT(STAT_RATING_NORMALIZE_VECT, started, detoasted, length, 0, 0);
+            
+    PG_RETURN_FLOAT4(norm);
 }
 
 
-PG_FUNCTION_INFO_V1(c_rating_cosine);
 /*
- * Counts cosine rating of two vectors.
+ * The rating of two sorted sparse vectors - Σ weights1 * weights2 of the common ids (each element matches
+ * once, in order - see sparse_intersect()), weights2 NULL rates a common id by weights1 alone (the weighted
+ * boolean rating). match1 and match2 hold MIN(length1, length2) + 1 positions.
+ */
+float4 sparse_rating(const int32* ids1, const float4* weights1, int length1,
+                     const int32* ids2, const float4* weights2, int length2, int* match1, int* match2, int* matches) {
+    float4  rating = 0;
+    int     i;
+
+    *matches = sparse_intersect(ids1, length1, ids2, length2, match1, match2);
+    if (weights2 == NULL) {
+        for (i = 0; i < *matches; i++) rating += weights1[match1[i]];
+    }
+    else {
+        for (i = 0; i < *matches; i++) rating += (weights1[match1[i]] * weights2[match2[i]]);
+    }
+    return rating;
+}
+
+/*
+ *                  |dq.dd|
+ *    r(dq, dd) = -----------   the rating as it is if 0 or any of the norms is 0 (no division by 0)
+ *                 |dq|x|dd|
+ */
+float4 sparse_cosine(float4 rating, float8 norm1, float8 norm2) {
+    if (rating == 0 || norm1 == 0 || norm2 == 0) return rating;
+    return rating / (norm1 * norm2);
+}
+
+
+PG_FUNCTION_INFO_V1(c_rating_cosine_norm);
+/*
+ * Counts cosine rating of two vectors using the pre-counted norm (recomended). 
  * @param elements1 int4[]
  * @param weights1 float[]
+ * @param norm1 float  
  * @param elements2 int4[]
  * @param weights2 float[]
+ * @param norm2 float 
  */
 Datum 
-c_rating_cosine(PG_FUNCTION_ARGS) {
+c_rating_cosine_norm(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    QueryCache* qc = query_cache(fcinfo, 0, 3, true);   // a constant query side (or NULL)
+
+    if (qc != NULL) {
+        // the document is the other side, only its elements are walked
+        int         doc = (qc->arg == 0) ? 3 : 0;
+        ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(doc);
+        ArrayType*  weight = PG_GETARG_ARRAYTYPE_P(doc + 1);
+        float4      norm1 = PG_GETARG_FLOAT4(2);
+        float4      norm2 = PG_GETARG_FLOAT4(5);
+        int         length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+        uint64      detoasted = STATS_CLOCK();
+        float4      rating;
+        int         matches;
+
+        if (length > ArrayGetNItems(ARR_NDIM(weight), ARR_DIMS(weight))) {
+            ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                           errmsg("weight arrays must be of the same size as key arrays")));
+        }
+
+        rating = query_cache_dot(qc, (int32*) ARR_DATA_PTR(vector), (float4*) ARR_DATA_PTR(weight), length, &matches);
+        STATS_COUNT(STAT_RATING_COSINE_NORM, started, detoasted, qc->length + length, MIN(qc->length, length), matches);
+
+        PG_RETURN_FLOAT4(sparse_cosine(rating, norm1, norm2));
+    }
+
     ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(0);
     ArrayType*  weight1 = PG_GETARG_ARRAYTYPE_P(1);
+    float4      norm1 = PG_GETARG_FLOAT4(2);
 
-    ArrayType*  vector2 = PG_GETARG_ARRAYTYPE_P(2);
-    ArrayType*  weight2 = PG_GETARG_ARRAYTYPE_P(3);
+    ArrayType*  vector2 = PG_GETARG_ARRAYTYPE_P(3);
+    ArrayType*  weight2 = PG_GETARG_ARRAYTYPE_P(4);
+    float4      norm2 = PG_GETARG_FLOAT4(5);
 
     int         length1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
     int         length2 = ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2));
+    uint64      detoasted = STATS_CLOCK();
     
     // check length of weights - for SIGSEGV :)
     if ( ( length1 > ArrayGetNItems(ARR_NDIM(weight1), ARR_DIMS(weight1) )) || ( length2 > ArrayGetNItems(ARR_NDIM(weight2), ARR_DIMS(weight2) )) ) {
@@ -615,82 +1309,115 @@ c_rating_cosine(PG_FUNCTION_ARGS) {
     float4*     ptrw1 = (float4*) ARR_DATA_PTR(weight1);
     int32*      ptr2 = (int32*) ARR_DATA_PTR(vector2);
     float4*     ptrw2 = (float4*) ARR_DATA_PTR(weight2);    
-    int         pos1 = 0;           // array position
-    int         pos2 = 0;
-    float4      norm1 = 0;          // norms for the normalization
-    float4      norm2 = 0;
+    int*        match1 = (int*) palloc(sizeof(int) * (MIN(length1, length2) + 1));    // positions of common elements
+    int*        match2 = (int*) palloc(sizeof(int) * (MIN(length1, length2) + 1));
+    int         matches;
     float4      rating = 0;         // result
 
     #ifdef _DEBUG
         ereport(NOTICE, (111111, errmsg("c_rating_cosine length1: %d length2: %d \r\n", length1, length2)));
     #endif
         
-    //                  |dq.dd|
-    //    r(dq, dd) = -----------
-    //                 |dq|x|dd|
-    //
-    // go through the two vectors
-    while (pos1 < length1 && pos2 < length2) {    
+    // intersect the two vectors (see the sorted sparse vector kernels) and normalize
+    rating = sparse_rating(ptr1, ptrw1, length1, ptr2, ptrw2, length2, match1, match2, &matches);
 
-        #ifdef _DEBUG
-            ereport(NOTICE, (111112, errmsg("c_rating_cosine pos1: %d (%d, %f) pos2: %d (%d, %f) \r\n", pos1, ptr1[pos1], ptrw1[pos1], pos2, ptr2[pos2], ptrw2[pos2])));
-        #endif        
-            
-        // this is done for the first time and when values equals	
-        if (ptr1[pos1] == ptr2[pos2]) {
-            rating += (ptrw1[pos1] * ptrw2[pos2]);
+    pfree(match1);
+    pfree(match2);
+    STATS_COUNT(STAT_RATING_COSINE_NORM, started, detoasted, length1 + length2, MIN(length1, length2), matches);
 
-            norm1 += (ptrw1[pos1] * ptrw1[pos1]);
-            norm2 += (ptrw2[pos2] * ptrw2[pos2]);
+    rating = sparse_cosine(rating, norm1, norm2);
 
-            pos1++;
-            pos2++;
+    #ifdef _DEBUG
+        ereport(NOTICE, (111115, errmsg("c_rating_cosine return rating: %f \r\n", rating)));
+    #endif
+            
+    PG_RETURN_FLOAT4(rating);
+}
 
-	    #ifdef _DEBUG
-                ereport(NOTICE, (111113, errmsg("ptr1[pos1] == ptr2[pos2] (pos1++ pos2++) \r\n")));
-            #endif        
-            continue;
+
+PG_FUNCTION_INFO_V1(c_rating_cosine);
+/*
+ * Counts cosine rating of two vectors.
+ * @param elements1 int4[]
+ * @param weights1 float[]
+ * @param elements2 int4[]
+ * @param weights2 float[]
+ */
+Datum 
+c_rating_cosine(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    uint64      detoasted;
+    QueryCache* qc = query_cache(fcinfo, 0, 2, true);   // a constant query side (or NULL)
+    float4      norm1 = 0;          // norms for the normalization
+    float4      norm2 = 0;
+    float4      rating = 0;         // result
+    int         matches;
+
+    if (qc != NULL) {
+        // the document is the other side, only its elements are walked
+        int         doc = (qc->arg == 0) ? 2 : 0;
+        ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(doc);
+        ArrayType*  weight = PG_GETARG_ARRAYTYPE_P(doc + 1);
+        int         length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+
+        if (length > ArrayGetNItems(ARR_NDIM(weight), ARR_DIMS(weight))) {
+            ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                           errmsg("weight arrays must be of the same size as key arrays")));
         }
-        // value of vector1 is smaller - set the next one
-        else if(ptr1[pos1] < ptr2[pos2])
-        {
-            norm1 += (ptrw1[pos1] * ptrw1[pos1]);
 
-            pos1++;
+        detoasted = STATS_CLOCK();
+        rating = query_cache_dot(qc, (int32*) ARR_DATA_PTR(vector), (float4*) ARR_DATA_PTR(weight), length, &matches);
+        norm1 = qc->norm;
+        norm2 = sparse_sum_squares((float4*) ARR_DATA_PTR(weight), length);
+        STATS_COUNT(STAT_RATING_COSINE, started, detoasted, qc->length + length, MIN(qc->length, length), matches);
+    }
+    else {
+        ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(0);
+        ArrayType*  weight1 = PG_GETARG_ARRAYTYPE_P(1);
 
-	    #ifdef _DEBUG
-                ereport(NOTICE, (111113, errmsg("ptr1[pos1] < ptr2[pos2] (pos1++) \r\n")));
-            #endif        
-            continue;            
-        }
-        // cmpresult > 0 - try next position in vector2
-        else
-        {
-            norm2 += (ptrw2[pos2] * ptrw2[pos2]);
+        ArrayType*  vector2 = PG_GETARG_ARRAYTYPE_P(2);
+        ArrayType*  weight2 = PG_GETARG_ARRAYTYPE_P(3);
 
-            pos2++;
+        int         length1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+        int         length2 = ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2));
 
-	    #ifdef _DEBUG
-                ereport(NOTICE, (111113, errmsg("ptr1[pos1] > ptr2[pos2] (pos2++) \r\n")));
-            #endif        
-            continue;            
+        // check length of weights - for SIGSEGV :)
+        if ( ( length1 > ArrayGetNItems(ARR_NDIM(weight1), ARR_DIMS(weight1) )) || ( length2 > ArrayGetNItems(ARR_NDIM(weight2), ARR_DIMS(weight2) )) ) {
+            ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                           errmsg("weight arrays must be of the same size as key arrays")));
         }
-    } // go through the two vectors
 
-    // finish the vectors normalization (none if equal or one of them)
-    int   i;
-    for (i = pos1; i < length1; i++) norm1 += (ptrw1[i] * ptrw1[i]);
-    for (i = pos2; i < length2; i++) norm2 += (ptrw2[i] * ptrw2[i]);
-    
+        int32*      ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
+        float4*     ptrw1 = (float4*) ARR_DATA_PTR(weight1);
+        int32*      ptr2 = (int32*) ARR_DATA_PTR(vector2);
+        float4*     ptrw2 = (float4*) ARR_DATA_PTR(weight2);
+        int*        match1 = (int*) palloc(sizeof(int) * (MIN(length1, length2) + 1));    // positions of common elements
+        int*        match2 = (int*) palloc(sizeof(int) * (MIN(length1, length2) + 1));
+
+        detoasted = STATS_CLOCK();
+
+        #ifdef _DEBUG
+            ereport(NOTICE, (111111, errmsg("c_rating_cosine length1: %d length2: %d \r\n", length1, length2)));
+        #endif
+
+        // intersect the two vectors (see the sorted sparse vector kernels)
+        rating = sparse_rating(ptr1, ptrw1, length1, ptr2, ptrw2, length2, match1, match2, &matches);
+
+        pfree(match1);
+        pfree(match2);
+
+        // the vectors normalization
+        norm1 = sparse_sum_squares(ptrw1, length1);
+        norm2 = sparse_sum_squares(ptrw2, length2);
+        STATS_COUNT(STAT_RATING_COSINE, started, detoasted, length1 + length2, MIN(length1, length2), matches);
+    }
+
     #ifdef _DEBUG
-        ereport(NOTICE, (111114, errmsg("c_rating_cosine rating: %f norm1: %f norm2: %f (pos1: %d pos2: %d) \r\n", rating, sqrt(norm1), sqrt(norm2), pos1, pos2)));
+        ereport(NOTICE, (111114, errmsg("c_rating_cosine rating: %f norm1: %f norm2: %f \r\n", rating, sqrt(norm1), sqrt(norm2))));
     #endif
 
-    // if the rating is 0 or it may cause division by 0, return 0
-    if (rating == 0 || norm1 == 0 || norm2 == 0) PG_RETURN_FLOAT4(rating);
-
     // normalize
-    rating /= (sqrt(norm1) * sqrt(norm2));
+    rating = sparse_cosine(rating, sqrt(norm1), sqrt(norm2));
 
     #ifdef _DEBUG
         ereport(NOTICE, (111115, errmsg("c_rating_cosine return rating: %f \r\n", rating)));
@@ -709,6 +1436,20 @@ PG_FUNCTION_INFO_V1(c_rating_boolean_int);
  */
 Datum 
 c_rating_boolean_int(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    QueryCache*  qc = query_cache(fcinfo, 0, 1, false);  // a constant query side (or NULL)
+
+    if (qc != NULL) {
+        // the document is the other side, only its elements are looked up
+        ArrayType*   vector = PG_GETARG_ARRAYTYPE_P((qc->arg == 0) ? 1 : 0);
+        int          length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+        uint64       detoasted = STATS_CLOCK();
+        int32        rating = query_cache_count(qc, (int32*) ARR_DATA_PTR(vector), length);
+
+        STATS_COUNT(STAT_RATING_BOOLEAN_INT, started, detoasted, qc->length + length, MIN(qc->length, length), rating);
+        PG_RETURN_INT32(rating);
+    }
+
     ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
     ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
     
@@ -716,8 +1457,7 @@ c_rating_boolean_int(PG_FUNCTION_ARGS) {
     int          length2 = ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2));
     int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
     int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
-    int          pos1 = 0;           // array position
-    int          pos2 = 0;
+    uint64       detoasted = STATS_CLOCK();
     int32        rating = 0;         // result
 
     #ifdef _DEBUG
@@ -727,38 +1467,96 @@ c_rating_boolean_int(PG_FUNCTION_ARGS) {
     //
     // r(dq, dd) = |dq.dd|
     //
-    // go through the two vectors
-    while (pos1 < length1 && pos2 < length2) {    
+    // intersect the two vectors (see the sorted sparse vector kernels)
+    rating = sparse_intersect(ptr1, length1, ptr2, length2, NULL, NULL);
+    STATS_COUNT(STAT_RATING_BOOLEAN_INT, started, detoasted, length1 + length2, MIN(length1, length2), rating);
+    
+    PG_RETURN_INT32(rating);
+}
 
-        #ifdef _DEBUG
-            ereport(NOTICE, (111111, errmsg("c_rating_boolean_impl pos1: %d (%d) pos2: %d (%d)", pos1, ptr1[pos1], pos2, ptr2[pos2])));
-        #endif
-            
-        // this is done for the first time and when values equals	
-        if (ptr1[pos1] == ptr2[pos2]) {
-            rating++;
-            
-            pos1++;
-            pos2++;
-            continue;
-        }
-        // value of vector1 is smaller - set the next one
-        else if(ptr1[pos1] < ptr2[pos2])
-        {
-            pos1++;
-            continue;            
-        }
-        // cmpresult > 0 - try next position in vector2
-        else
-        {
-            pos2++;
-            continue;            
-        }
-    } // go through the two vectors
-    
-    PG_RETURN_INT32(rating);
+
+
+/*
+ * Type specialized merges of rating_boolean(anyarray, anyarray) - the by-value fixed-length element types
+ * compared inline instead of a btree comparison call and a pointer walk per element pair (the float
+ * comparison follows the btree one, NaN equals NaN and is greater than the rest)
+ */
+#define BOOLEAN_CMP(x, y)       (((x) > (y)) - ((x) < (y)))
+#define BOOLEAN_CMP_FLOAT(x, y) (isnan(x) ? !isnan(y) : (isnan(y) ? -1 : BOOLEAN_CMP(x, y)))
+
+#define BOOLEAN_MERGE(name, type, cmp) \
+    static int name(const char* ptr1, int length1, const char* ptr2, int length2) { \
+        const type* a = (const type*) ptr1; \
+        const type* b = (const type*) ptr2; \
+        int         pos1 = 0; \
+        int         pos2 = 0; \
+        int         count = 0; \
+        while (pos1 < length1 && pos2 < length2) { \
+            int c = cmp(a[pos1], b[pos2]); \
+            if (c == 0) { count++; pos1++; pos2++; } \
+            else if (c < 0) pos1++; \
+            else pos2++; \
+        } \
+        return count; \
+    }
+
+BOOLEAN_MERGE(boolean_merge_int2, int16, BOOLEAN_CMP)
+BOOLEAN_MERGE(boolean_merge_oid, Oid, BOOLEAN_CMP)
+BOOLEAN_MERGE(boolean_merge_float4, float4, BOOLEAN_CMP_FLOAT)
+BOOLEAN_MERGE(boolean_merge_float8, float8, BOOLEAN_CMP_FLOAT)
+
+// int4 and int8 are the rating_boolean_int() and rating_boolean_int8() intersections (SIMD blocks, galloping)
+static int boolean_merge_int4(const char* ptr1, int length1, const char* ptr2, int length2) {
+    return sparse_intersect((const int32*) ptr1, length1, (const int32*) ptr2, length2, NULL, NULL);
+}
+
+static int boolean_merge_int8(const char* ptr1, int length1, const char* ptr2, int length2) {
+    return sparse_intersect_int8((const int64*) ptr1, length1, (const int64*) ptr2, length2, NULL, NULL);
 }
 
+/*
+ * The merge of the element type chosen once per scan (fn_extra) - a specialized one, or NULL and the
+ * comparison function of the type cache for the rest (varlena types, ...)
+ */
+typedef struct BooleanCache {
+    Oid             element_type;
+    int             (*merge)(const char*, int, const char*, int);
+    TypeCacheEntry* typentry;
+} BooleanCache;
+
+static BooleanCache* boolean_cache(FunctionCallInfo fcinfo, Oid element_type) {
+    BooleanCache*   bc = (BooleanCache*) fcinfo->flinfo->fn_extra;
+
+    if (bc != NULL && bc->element_type == element_type) return bc;
+
+    if (bc == NULL) bc = (BooleanCache*) MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(BooleanCache));
+    bc->element_type = element_type;
+    bc->typentry = NULL;
+    switch (element_type) {
+        case INT2OID:   bc->merge = boolean_merge_int2; break;
+        case INT4OID:   bc->merge = boolean_merge_int4; break;
+        case INT8OID:   bc->merge = boolean_merge_int8; break;
+        case OIDOID:    bc->merge = boolean_merge_oid; break;
+        case FLOAT4OID: bc->merge = boolean_merge_float4; break;
+        case FLOAT8OID: bc->merge = boolean_merge_float8; break;
+        default:        bc->merge = NULL; break;
+    }
+
+    /*
+     * The generic path looks up the comparison function only once per series of calls, assuming the
+     * element type doesn't change underneath us. The typcache is used so that we have no memory
+     * leakage when being used as an index support function.
+     */
+    if (bc->merge == NULL) {
+        bc->typentry = lookup_type_cache(element_type, TYPECACHE_CMP_PROC_FINFO);
+        if (!OidIsValid(bc->typentry->cmp_proc_finfo.fn_oid))
+                ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
+                errmsg("could not identify a comparison function for type %s", format_type_be(element_type))));
+    }
+
+    fcinfo->flinfo->fn_extra = (void*) bc;
+    return bc;
+}
 
 
 PG_FUNCTION_INFO_V1(c_rating_boolean);
@@ -776,8 +1574,10 @@ Datum c_rating_boolean(PG_FUNCTION_ARGS)
 // just an implementation
 // TODO: CHECK!
 int32 c_rating_boolean_anyarray(FunctionCallInfo fcinfo) {
+    uint64      started = STATS_CLOCK();                    // pgsiftorder.stats
     ArrayType*  array1 = PG_GETARG_ARRAYTYPE_P(0);          // arrays to be compared
     ArrayType*  array2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64      detoasted = STATS_CLOCK();
     int32       ndims1 = ARR_NDIM(array1);                  // temporary dimension info
     int32       ndims2 = ARR_NDIM(array2);
     int32*      dims1 = ARR_DIMS(array1);
@@ -785,8 +1585,9 @@ int32 c_rating_boolean_anyarray(FunctionCallInfo fcinfo) {
     int32       length1 = ArrayGetNItems(ndims1, dims1);    // array lengths
     int32       length2 = ArrayGetNItems(ndims2, dims2);
     Oid         element_type = ARR_ELEMTYPE(array1);        // type of the array - int4 ~ 23, float4 ~ 800
+    BooleanCache*   bc;
     TypeCacheEntry* typentry;
-    FunctionCallInfoData locfcinfo;
+    LOCAL_FCINFO(locfcinfo, 2);     // the comparison call (PostgreSQL 12+)
     bool        typbyval;
     int32       typlen;
     char        typalign;
@@ -811,27 +1612,26 @@ int32 c_rating_boolean_anyarray(FunctionCallInfo fcinfo) {
             ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
             errmsg("cannot compare arrays of different element types")));    
     
-    /*
-     * We arrange to look up the comparison function only once per series of
-     * calls, assuming the element type doesn't change underneath us. The
-     * typcache is used so that we have no memory leakage when being used as
-     * an index support function.
-     */
-    typentry = (TypeCacheEntry *) fcinfo->flinfo->fn_extra;
-    if (typentry == NULL || typentry->type_id != element_type)
-    {
+    // the specialized merge of the element type (the arrays without NULLs)
+    bc = boolean_cache(fcinfo, element_type);
+    if (bc->merge != NULL && !ARR_HASNULL(array1) && !ARR_HASNULL(array2)) {
+        rating = bc->merge(ptr1, length1, ptr2, length2);
+        STATS_COUNT(STAT_RATING_BOOLEAN, started, detoasted, length1 + length2, MIN(length1, length2), rating);
+        PG_RETURN_INT32(rating);
+    }
+
+    // the generic comparison (see the type cache of boolean_cache())
+    typentry = bc->typentry;
+    if (typentry == NULL) {
         typentry = lookup_type_cache(element_type, TYPECACHE_CMP_PROC_FINFO);
-        if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
-                ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FUNCTION),
-                errmsg("could not identify a comparison function for type %i", format_type_be(element_type))));
-        fcinfo->flinfo->fn_extra = (void *) typentry;
+        bc->typentry = typentry;
     }
     typlen = typentry->typlen;
     typbyval = typentry->typbyval;
     typalign = typentry->typalign;
 
     // apply the operator to each pair of array elements.
-    InitFunctionCallInfoData(locfcinfo, &typentry->cmp_proc_finfo, 2, NULL, NULL, NULL); // FIXME: LAST NULL!!!!!
+    InitFunctionCallInfoData(*locfcinfo, &typentry->cmp_proc_finfo, 2, PG_GET_COLLATION(), NULL, NULL);
 
     //
     // r(dq, dd) = |dq.dd|
@@ -843,12 +1643,12 @@ int32 c_rating_boolean_anyarray(FunctionCallInfo fcinfo) {
         elt2 = fetch_att(ptr2, typbyval, typlen);
         
         // Compare the pairs of elements
-        locfcinfo.arg[0] = elt1;
-        locfcinfo.arg[1] = elt2;
-        locfcinfo.argnull[0] = false;
-        locfcinfo.argnull[1] = false;
-        locfcinfo.isnull = false;
-        cmpresult = DatumGetInt32(FunctionCallInvoke(&locfcinfo));  // store the cmpresult to the next round
+        locfcinfo->args[0].value = elt1;
+        locfcinfo->args[1].value = elt2;
+        locfcinfo->args[0].isnull = false;
+        locfcinfo->args[1].isnull = false;
+        locfcinfo->isnull = false;
+        cmpresult = DatumGetInt32(FunctionCallInvoke(locfcinfo));  // store the cmpresult to the next round
         
         #ifdef _DEBUG
             ereport(NOTICE, (111111, errmsg("c_rating_boolean_impl pos1: %d pos2: %d cmpresult: %d", pos1, pos2, cmpresult)));
@@ -886,7 +1686,263 @@ int32 c_rating_boolean_anyarray(FunctionCallInfo fcinfo) {
             continue;            
         }
     } // go through the two vectors
-    
+
+    STATS_COUNT(STAT_RATING_BOOLEAN, started, detoasted, length1 + length2, MIN(length1, length2), rating);
+    PG_RETURN_INT32(rating);
+}
+
+
+/*
+ * Text tokens as int8 term ids - a 64 bit hash of the bytes (term_hash64()), sorted and deduplicated, so
+ * the text retrieval runs on the integer intersection of the visual words instead of the collation aware
+ * comparison of every element pair (rating_boolean(text[], text[])). Two different tokens of the same id
+ * in one array are an error; the term_dictionary table (see install.sql) finds them across the rows.
+ */
+typedef struct TermToken {
+    int64       id;
+    const char* ptr;
+    int         length;
+} TermToken;
+
+static int term_token_cmp(const void* a, const void* b) {
+    const TermToken* t1 = (const TermToken*) a;
+    const TermToken* t2 = (const TermToken*) b;
+
+    if (t1->id != t2->id) return (t1->id < t2->id) ? -1 : 1;
+    if (t1->length != t2->length) return (t1->length < t2->length) ? -1 : 1;
+    return memcmp(t1->ptr, t2->ptr, t1->length);
+}
+
+// the tokens (NULLs skipped) sorted by their ids, the same tokens next to each other
+static TermToken* term_tokens(ArrayType* tokens, int* count) {
+    Datum*      values;
+    bool*       nulls;
+    int         nitems;
+    TermToken*  terms;
+    int         pos;
+
+    deconstruct_array(tokens, TEXTOID, -1, false, 'i', &values, &nulls, &nitems);
+    terms = (TermToken*) palloc(sizeof(TermToken) * (nitems + 1));
+    *count = 0;
+    for (pos = 0; pos < nitems; pos++) {
+        text*   token;
+
+        if (nulls[pos]) continue;
+        token = (text*) DatumGetPointer(values[pos]);
+        terms[*count].ptr = VARDATA_ANY(token);
+        terms[*count].length = VARSIZE_ANY_EXHDR(token);
+        terms[*count].id = term_hash64((const uint8*) terms[*count].ptr, terms[*count].length);
+        (*count)++;
+    }
+    pfree(values);
+    pfree(nulls);
+
+    qsort(terms, *count, sizeof(TermToken), term_token_cmp);
+    for (pos = 1; pos < *count; pos++) {
+        if (terms[pos].id == terms[pos - 1].id && term_token_cmp(&terms[pos], &terms[pos - 1]) != 0) {
+            ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                            errmsg("term id collision of \"%.*s\" and \"%.*s\"", terms[pos - 1].length, terms[pos - 1].ptr,
+                                   terms[pos].length, terms[pos].ptr)));
+        }
+    }
+    return terms;
+}
+
+
+PG_FUNCTION_INFO_V1(c_term_id);
+/*****************************************************************************************************
+ * The int8 id (64 bit hash) of a text token.
+ * @param token text
+ */
+Datum
+c_term_id(PG_FUNCTION_ARGS) {
+    text*   token = PG_GETARG_TEXT_PP(0);
+
+    PG_RETURN_INT64(term_hash64((const uint8*) VARDATA_ANY(token), VARSIZE_ANY_EXHDR(token)));
+}
+
+
+PG_FUNCTION_INFO_V1(c_term_ids);
+/*****************************************************************************************************
+ * The sorted distinct int8 ids of text tokens (NULLs skipped) - the elements of rating_boolean_int8 and
+ * rating_cosine(int8[], ...).
+ * @param tokens text[]
+ * @return int8[]
+ */
+Datum
+c_term_ids(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    ArrayType*  tokens = PG_GETARG_ARRAYTYPE_P(0);
+    uint64      detoasted = STATS_CLOCK();
+    TermToken*  terms;
+    int64*      ids;
+    int         count;
+    int         distinct = 0;
+    int         pos;
+
+    terms = term_tokens(tokens, &count);
+    if (count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT8OID));
+
+    ids = (int64*) palloc(sizeof(int64) * count);
+    for (pos = 0; pos < count; pos++) {
+        if (distinct == 0 || ids[distinct - 1] != terms[pos].id) ids[distinct++] = terms[pos].id;
+    }
+    pfree(terms);
+
+    STATS_COUNT(STAT_TERM_IDS, started, detoasted, count, 0, distinct);
+    PG_RETURN_ARRAYTYPE_P(construct_array((Datum*) ids, distinct, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+}
+
+
+PG_FUNCTION_INFO_V1(c_term_counts);
+/*****************************************************************************************************
+ * The occurrences of text tokens in the order of term_ids() - the term frequency weights.
+ * @param tokens text[]
+ * @return real[]
+ */
+Datum
+c_term_counts(PG_FUNCTION_ARGS) {
+    ArrayType*  tokens = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*  result;
+    TermToken*  terms;
+    float4*     ptr;
+    int         count;
+    int         distinct = 0;
+    int         pos;
+
+    terms = term_tokens(tokens, &count);
+    if (count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    for (pos = 0; pos < count; pos++) {
+        if (pos == 0 || terms[pos].id != terms[pos - 1].id) distinct++;
+    }
+
+    result = array_new_real(distinct);
+    ptr = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0, distinct = -1; pos < count; pos++) {
+        if (pos == 0 || terms[pos].id != terms[pos - 1].id) distinct++;
+        ptr[distinct] += 1;
+    }
+    pfree(terms);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+/*
+ * The dot product of the weights of the common int8 ids (args arg1, arg1 + 1 and arg2, arg2 + 1), and the
+ * sums of squares of the weights if norm1 and norm2 are given
+ */
+static float4 rating_dot_int8(FunctionCallInfo fcinfo, int arg1, int arg2, StatFunction function, uint64 started,
+                              float4* norm1, float4* norm2) {
+    ArrayType*  vector1 = PG_GETARG_ARRAYTYPE_P(arg1);
+    ArrayType*  weight1 = PG_GETARG_ARRAYTYPE_P(arg1 + 1);
+    ArrayType*  vector2 = PG_GETARG_ARRAYTYPE_P(arg2);
+    ArrayType*  weight2 = PG_GETARG_ARRAYTYPE_P(arg2 + 1);
+    int         length1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    int         length2 = ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2));
+    uint64      detoasted = STATS_CLOCK();
+    int64*      ptr1 = (int64*) ARR_DATA_PTR(vector1);         // array data pointers
+    float4*     ptrw1 = (float4*) ARR_DATA_PTR(weight1);
+    int64*      ptr2 = (int64*) ARR_DATA_PTR(vector2);
+    float4*     ptrw2 = (float4*) ARR_DATA_PTR(weight2);
+    int*        match1;
+    int*        match2;
+    int         matches;
+    int         i;
+    float4      rating = 0;
+
+    // check length of weights - for SIGSEGV :)
+    if ( ( length1 > ArrayGetNItems(ARR_NDIM(weight1), ARR_DIMS(weight1) )) || ( length2 > ArrayGetNItems(ARR_NDIM(weight2), ARR_DIMS(weight2) )) ) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                       errmsg("weight arrays must be of the same size as key arrays")));
+    }
+
+    match1 = (int*) palloc(sizeof(int) * (MIN(length1, length2) + 1));    // positions of common elements
+    match2 = (int*) palloc(sizeof(int) * (MIN(length1, length2) + 1));
+    matches = sparse_intersect_int8(ptr1, length1, ptr2, length2, match1, match2);
+    for (i = 0; i < matches; i++) {
+        rating += (ptrw1[match1[i]] * ptrw2[match2[i]]);
+    }
+    pfree(match1);
+    pfree(match2);
+
+    if (norm1 != NULL) {
+        *norm1 = sparse_sum_squares(ptrw1, length1);
+        *norm2 = sparse_sum_squares(ptrw2, length2);
+    }
+
+    STATS_COUNT(function, started, detoasted, length1 + length2, MIN(length1, length2), matches);
+    return rating;
+}
+
+
+PG_FUNCTION_INFO_V1(c_rating_cosine_norm_int8);
+/*
+ * Counts cosine rating of two int8 term vectors using the pre-counted norm.
+ * @param elements1 int8[]
+ * @param weights1 float[]
+ * @param norm1 float
+ * @param elements2 int8[]
+ * @param weights2 float[]
+ * @param norm2 float
+ */
+Datum
+c_rating_cosine_norm_int8(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    float4      norm1 = PG_GETARG_FLOAT4(2);
+    float4      norm2 = PG_GETARG_FLOAT4(5);
+    float4      rating = rating_dot_int8(fcinfo, 0, 3, STAT_RATING_COSINE_NORM_INT8, started, NULL, NULL);
+
+    // if the rating is 0 or it may cause division by 0, return 0
+    if (rating == 0 || norm1 == 0 || norm2 == 0) PG_RETURN_FLOAT4(rating);
+    PG_RETURN_FLOAT4(rating / (norm1 * norm2));
+}
+
+
+PG_FUNCTION_INFO_V1(c_rating_cosine_int8);
+/*
+ * Counts cosine rating of two int8 term vectors.
+ * @param elements1 int8[]
+ * @param weights1 float[]
+ * @param elements2 int8[]
+ * @param weights2 float[]
+ */
+Datum
+c_rating_cosine_int8(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    float4      norm1 = 0;          // sums of squares of the weights
+    float4      norm2 = 0;
+    float4      rating = rating_dot_int8(fcinfo, 0, 2, STAT_RATING_COSINE_INT8, started, &norm1, &norm2);
+
+    // if the rating is 0 or it may cause division by 0, return 0
+    if (rating == 0 || norm1 == 0 || norm2 == 0) PG_RETURN_FLOAT4(rating);
+    PG_RETURN_FLOAT4(rating / (sqrt(norm1) * sqrt(norm2)));
+}
+
+
+PG_FUNCTION_INFO_V1(c_rating_boolean_int8);
+/****************************************************************************************************
+ * Counts boolean rating of two int8 term vectors.
+ * @param elements1 int8[]
+ * @param elements2 int8[]
+ */
+Datum
+c_rating_boolean_int8(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    int          length1 = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    int          length2 = ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2));
+    uint64       detoasted = STATS_CLOCK();
+    int32        rating;
+
+    //
+    // r(dq, dd) = |dq.dd|
+    //
+    rating = sparse_intersect_int8((int64*) ARR_DATA_PTR(vector1), length1, (int64*) ARR_DATA_PTR(vector2), length2, NULL, NULL);
+    STATS_COUNT(STAT_RATING_BOOLEAN_INT8, started, detoasted, length1 + length2, MIN(length1, length2), rating);
+
     PG_RETURN_INT32(rating);
 }
 
@@ -899,8 +1955,10 @@ PG_FUNCTION_INFO_V1(c_distance_square_int);
  */
 Datum 
 c_distance_square_int(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
     ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
     ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64       detoasted = STATS_CLOCK();
     
     int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
     if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
@@ -910,26 +1968,20 @@ c_distance_square_int(PG_FUNCTION_ARGS) {
     
     int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
     int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
-    int          pos = 0;            // array position
     int64        distance = 0;       // result
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_distance_square_int length: %d (%ld)", length, distance)));
-    #endif
-    
     // Euclidean distance without sqrt() normalization (square distance):
     // d(x, y) = Sum[ (xi - yi)^2 ]
     //            i
     //
-    // go through the two vectors
-    for (pos = 0; pos < length; pos++) {
-        int64 diff = ptr1[pos] - ptr2[pos];
-        distance += (diff * diff);
-        #ifdef _DEBUG
-            ereport(NOTICE, (111111, errmsg("c_distance_square_int pos: %d (%d, %d), diff: %ld^2=%ld, distance: %ld", length, ptr1[pos], ptr2[pos], diff, (diff*diff), distance)));
-        #endif
-    } // go through the two vectors
+    // go through the two vectors (see the dense vector kernels)
+    distance = dense_square_int(ptr1, ptr2, length);
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_distance_square_int length: %d (%ld)", length, distance)));
+    #endif
 
+    STATS_COUNT(STAT_DISTANCE_SQUARE_INT, started, detoasted, 2 * length, 0, 0);
     PG_RETURN_INT64(distance);
 }
 
@@ -942,8 +1994,10 @@ PG_FUNCTION_INFO_V1(c_distance_square_real);
  */
 Datum 
 c_distance_square_real(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
     ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
     ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64       detoasted = STATS_CLOCK();
     
     int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
     if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
@@ -953,175 +2007,2910 @@ c_distance_square_real(PG_FUNCTION_ARGS) {
     
     float4*     ptr1 = (float4*) ARR_DATA_PTR(vector1);         // array data pointers
     float4*     ptr2 = (float4*) ARR_DATA_PTR(vector2);
-    int         pos = 0;            // array position
     float4      distance = 0;       // result
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_distance_square_real length: %d", length)));
-    #endif
-    
     // Euclidean distance without sqrt() normalization (square distance):
     // d(x, y) = Sum[ (xi - yi)^2 ]
     //            i
     //
-    // go through the two vectors
-    for (pos = 0; pos < length; pos++) {
-        float4 diff = ptr1[pos] - ptr2[pos];
-        distance += (diff * diff);
-        #ifdef _DEBUG
-            ereport(NOTICE, (111111, errmsg("c_distance_square_real pos: %d (%f, %f), diff: %f^2=%f, distance: %f", pos, ptr1[pos], ptr2[pos], diff, (diff*diff), distance)));
-        #endif
-    } // go through the two vectors
+    // go through the two vectors (see the dense vector kernels)
+    distance = dense_square_real(ptr1, ptr2, length);
 
-    PG_RETURN_FLOAT8(distance);
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_distance_square_real length: %d (%f)", length, distance)));
+    #endif
+
+    STATS_COUNT(STAT_DISTANCE_SQUARE_REAL, started, detoasted, 2 * length, 0, 0);
+    // the function is declared as real
+    PG_RETURN_FLOAT4(distance);
 }
 
 
-PG_FUNCTION_INFO_V1(c_distance_manhattan_int);
+PG_FUNCTION_INFO_V1(c_distance_square_bounded_int);
 /****************************************************************************************************
- * Counts Manhattan distance(Minkowski distance - L1) of two vectors.
+ * Square distance of two vectors abandoned early - NULL once the partial sum exceeds the bound (the
+ * k-th best distance so far of a kNN re-ranking), checked every DENSE_BOUND_BLOCK dimensions.
  * @param elements1 int4[]
  * @param elements2 int4[]
+ * @param bound int8
+ * @param order int4[] (optional) the dimensions to visit first (high variance), see dimension_order()
  */
 Datum 
-c_distance_manhattan_int(PG_FUNCTION_ARGS) {
+c_distance_square_bounded_int(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
     ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
     ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
-    
+    int64        bound = PG_GETARG_INT64(2);
+    uint64       detoasted = STATS_CLOCK();
     int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    const int32* order = NULL;
+    int64        distance;
+
     if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
         ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
                         errmsg("both arrays must be of the same size")));
     }
-    
-    int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
-    int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
-    int          pos = 0;            // array position
-    int64        distance = 0;       // result
+    if (PG_NARGS() > 3 && !PG_ARGISNULL(3)) order = order_cache(fcinfo, 3, length);
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_distance_manhattan_int length: %d (%ld)", length, distance)));
-    #endif
-    
-    // Manhattan distance:
-    // d(x, y) = Sum ( |xi - yi| )
-    //            i
-    //
-    // go through the two vectors
-    for (pos = 0; pos < length; pos++) {
-        int64 diff = ABS(ptr1[pos] - ptr2[pos]);
-        distance += diff;
-        #ifdef _DEBUG
-            ereport(NOTICE, (111111, errmsg("c_distance_manhattan_int pos: %d (%d, %d), diff: %ld^2=%ld, distance: %ld", pos, ptr1[pos], ptr2[pos], diff, (diff*diff), distance)));
-        #endif
-    } // go through the two vectors
+    distance = dense_square_int_bounded((int32*) ARR_DATA_PTR(vector1), (int32*) ARR_DATA_PTR(vector2), length, bound, order);
 
+    // the hit rate of the statistics is the abandoned rate
+    STATS_COUNT(STAT_DISTANCE_SQUARE_BOUNDED_INT, started, detoasted, 2 * length, 1, distance > bound);
+    if (distance > bound) PG_RETURN_NULL();
     PG_RETURN_INT64(distance);
 }
 
 
-PG_FUNCTION_INFO_V1(c_distance_chessboard_int);
+PG_FUNCTION_INFO_V1(c_distance_square_bounded_real);
 /****************************************************************************************************
- * Counts Chebyshev distance(Minkowski distance - Lmax or called Chessboard distance) of two vectors.
- * @param elements1 int4[]
- * @param elements2 int4[]
+ * Square distance of two vectors abandoned early - NULL once the partial sum exceeds the bound (the
+ * k-th best distance so far of a kNN re-ranking), checked every DENSE_BOUND_BLOCK dimensions.
+ * @param elements1 real[]
+ * @param elements2 real[]
+ * @param bound real
+ * @param order int4[] (optional) the dimensions to visit first (high variance), see dimension_order()
  */
 Datum 
-c_distance_chessboard_int(PG_FUNCTION_ARGS) {
+c_distance_square_bounded_real(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
     ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
     ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
-    
+    float4       bound = PG_GETARG_FLOAT4(2);
+    uint64       detoasted = STATS_CLOCK();
     int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    const int32* order = NULL;
+    float4       distance;
+
     if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
         ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
                         errmsg("both arrays must be of the same size")));
     }
-    
-    int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
-    int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
-    int          pos = 0;            // array position
-    int64        distance = 0;       // result
+    if (PG_NARGS() > 3 && !PG_ARGISNULL(3)) order = order_cache(fcinfo, 3, length);
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_distance_chessboard_int length: %d (%ld)", length, distance)));
-    #endif
-    
-    // Chebyshev distance:
-    // d(x, y) = max (|xi - yi|)
-    //            i
-    //
-    // go through the two vectors
-    for (pos = 0; pos < length; pos++) {
-        int64 diff = ABS(ptr1[pos] - ptr2[pos]);
-        if (diff > distance) {
-          distance = diff;
-        }
-        #ifdef _DEBUG
-            ereport(NOTICE, (111111, errmsg("c_distance_chessboard_int pos: %d (%d, %d), diff: %ld, distance: %ld", pos, ptr1[pos], ptr2[pos], diff, distance)));
-        #endif
-    } // go through the two vectors
+    distance = dense_square_real_bounded((float4*) ARR_DATA_PTR(vector1), (float4*) ARR_DATA_PTR(vector2), length, bound, order);
 
-    PG_RETURN_INT64(distance);
+    STATS_COUNT(STAT_DISTANCE_SQUARE_BOUNDED_REAL, started, detoasted, 2 * length, 1, distance > bound);
+    if (distance > bound) PG_RETURN_NULL();
+    PG_RETURN_FLOAT4(distance);
 }
 
 
-PG_FUNCTION_INFO_V1(c_distance_mahalanobis_int);
+// a dimension and its deviation (variance), the greatest first
+typedef struct DimensionRank {
+    float4      value;
+    int32       dimension;
+} DimensionRank;
+
+static int dimension_rank_cmp(const void* a, const void* b) {
+    const DimensionRank* r1 = (const DimensionRank*) a;
+    const DimensionRank* r2 = (const DimensionRank*) b;
+
+    if (r1->value > r2->value || (!isnan(r1->value) && isnan(r2->value))) return -1;
+    if (r1->value < r2->value || (isnan(r1->value) && !isnan(r2->value))) return 1;
+    return (r1->dimension > r2->dimension) - (r1->dimension < r2->dimension);
+}
+
+PG_FUNCTION_INFO_V1(c_dimension_order);
 /****************************************************************************************************
- * Counts Mahalanobis distance of two vectors.
- * @param elements1 int4[]
- * @param elements2 int4[]
- * @param StandardDeviation float4[] 
+ * The dimensions (1 based) by the given deviations or variances descending - the order argument of
+ * distance_square_bounded(), e.g. dimension_order(array_std(features)) over a sample
+ * @param stdev real[]
  */
 Datum 
-c_distance_mahalanobis_int(PG_FUNCTION_ARGS) {
-    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
-    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
-    ArrayType*   stdev   = PG_GETARG_ARRAYTYPE_P(2);
-    
-    int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
-    if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
-        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
-                        errmsg("both arrays must be of the same size")));
+c_dimension_order(PG_FUNCTION_ARGS) {
+    ArrayType*      stdev = PG_GETARG_ARRAYTYPE_P(0);
+    int             length = ArrayGetNItems(ARR_NDIM(stdev), ARR_DIMS(stdev));
+    float4*         ptr = (float4*) ARR_DATA_PTR(stdev);
+    DimensionRank*  ranks;
+    ArrayType*      result;
+    int32*          ptr0;
+    int             pos;
+
+    if (ARR_HASNULL(stdev)) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("the deviations must not contain NULLs")));
     }
-    
-    int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
-    int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
-    float4*      ptr_stdev = (float4*) ARR_DATA_PTR(stdev);
-    int          pos = 0;            // array position
-    float4       sq_diff = 0;
-    float4       variance = 0;
-    float4       distance = 0;  
+    if (length == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT4OID));
 
-    #ifdef _DEBUG
-        ereport(NOTICE, (111111, errmsg("c_distance_mahalanobis_int length: %d (%f)", length, distance)));
-    #endif
-    
-    //  Standard deviation(as argument):
-    //  sigma = sqrt( 1/N * Sum (pi - mean)^2 ) = sqrt ( (1/N * Sum (pi^2)) - mean^2 ) 
-    //                       i                                  i
-    //
-    // Mahalanobis distance without sqrt():
-    // d(x, y) = Sum [ (xi - yi)^2 ] / sigmai^2
-    //            i
-    //
-    // go through the two vectors
+    ranks = (DimensionRank*) palloc(sizeof(DimensionRank) * length);
     for (pos = 0; pos < length; pos++) {
-          // Sum [ (pi - qi)^2 ]  - for count of Mahalanobis distance
-        int64 diff = ptr1[pos] - ptr2[pos];
-        sq_diff += ((diff * diff));
-        variance = ptr_stdev[pos] * ptr_stdev[pos];
-        
-        //if (variance == 0) PG_RETURN_FLOAT8(variance);
-        
-          // Mahalanobis distance:
-        distance += sq_diff / variance;
-        
-        #ifdef _DEBUG
-              // TODO: upravit !!
-            ereport(NOTICE, (111111, errmsg("c_distance_mahalanobis_int pos: %d (%d, %d), diff: %ld^2=%ld, distance: %f", pos, ptr1[pos], ptr2[pos], diff, (diff*diff), distance)));
-        #endif
-    } // go through the two vectors
+        ranks[pos].value = ptr[pos];
+        ranks[pos].dimension = pos + 1;
+    }
+    qsort(ranks, length, sizeof(DimensionRank), dimension_rank_cmp);
 
-    PG_RETURN_FLOAT8(distance);
+    result = array_new(length, INT4OID);
+    ptr0 = (int32*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < length; pos++) ptr0[pos] = ranks[pos].dimension;
+
+    pfree(ranks);
+    PG_RETURN_ARRAYTYPE_P(result);
 }
 
+
+/*
+ * The row-major candidate matrix real[count][length] of a batch distance (one row ~ one candidate)
+ */
+static const float4* distance_batch_candidates(ArrayType* candidates, int length, int* count) {
+    int     nitems = ArrayGetNItems(ARR_NDIM(candidates), ARR_DIMS(candidates));
+
+    if (ARR_HASNULL(candidates)) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("candidates must not contain NULLs")));
+    }
+    if (nitems == 0) {
+        *count = 0;
+        return NULL;
+    }
+    if (ARR_NDIM(candidates) != 2 || ARR_DIMS(candidates)[1] != length) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("candidates must be a two-dimensional array of %d element rows (the query length)", length)));
+    }
+
+    *count = ARR_DIMS(candidates)[0];
+    return (float4*) ARR_DATA_PTR(candidates);
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_square_batch);
+/****************************************************************************************************
+ * Counts square distances of the query to each row of the candidate matrix at once
+ * (the query is detoasted once and the kernel keeps it in registers for several rows).
+ * @param query float4[]
+ * @param candidates float4[][] - a row per candidate
+ * @return float4[] - a distance per candidate (row)
+ */
+Datum 
+c_distance_square_batch(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    uint64       detoasted;
+    ArrayType*   query = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   candidates = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType*   result;
+
+    int          length = ArrayGetNItems(ARR_NDIM(query), ARR_DIMS(query));   // query length
+    int          count;
+    const float4* rows = distance_batch_candidates(candidates, length, &count);
+
+    if (count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    // d(q, ci) = Sum[ (qj - cij)^2 ] for each row i
+    detoasted = STATS_CLOCK();
+    result = array_new_real(count);
+    dense_square_real_batch((float4*) ARR_DATA_PTR(query), rows, count, length, (float4*) ARR_DATA_PTR(result));
+    STATS_COUNT(STAT_DISTANCE_SQUARE_BATCH, started, detoasted, (uint64) length * (count + 1), 0, 0);
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_distance_square_batch length: %d, candidates: %d", length, count)));
+    #endif
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+/*
+ * The k nearest candidates - a max-heap of the k best so far (the worst of them on the top)
+ */
+typedef struct {
+    float4  distance;
+    int32   index;          // 1 based row number
+} DistanceTopK;
+
+static inline bool topk_worse(const DistanceTopK* a, const DistanceTopK* b) {
+    return (a->distance > b->distance) || (a->distance == b->distance && a->index > b->index);
+}
+
+static void topk_sift_down(DistanceTopK* heap, int size, int pos) {
+    for (;;) {
+        int     child = 2 * pos + 1;
+        DistanceTopK tmp;
+
+        if (child >= size) break;
+        if (child + 1 < size && topk_worse(&heap[child + 1], &heap[child])) child++;
+        if (!topk_worse(&heap[child], &heap[pos])) break;
+
+        tmp = heap[pos]; heap[pos] = heap[child]; heap[child] = tmp;
+        pos = child;
+    }
+}
+
+static int topk_cmp(const void* a, const void* b) {
+    return topk_worse((const DistanceTopK*) a, (const DistanceTopK*) b) ? 1
+         : (topk_worse((const DistanceTopK*) b, (const DistanceTopK*) a) ? -1 : 0);
+}
+
+// the k smallest of the distances, ordered (returns their count)
+static int topk_select(const float4* distances, int count, int k, DistanceTopK* heap) {
+    int     size = 0;
+    int     i;
+
+    for (i = 0; i < count; i++) {
+        DistanceTopK item = {distances[i], i + 1};
+
+        if (size < k) {
+            // heapify once full
+            heap[size++] = item;
+            if (size == k) {
+                int pos;
+                for (pos = k / 2 - 1; pos >= 0; pos--) topk_sift_down(heap, size, pos);
+            }
+        }
+        else if (topk_worse(&heap[0], &item)) {
+            heap[0] = item;
+            topk_sift_down(heap, size, 0);
+        }
+    }
+
+    qsort(heap, size, sizeof(DistanceTopK), topk_cmp);
+    return size;
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_square_topk);
+/****************************************************************************************************
+ * The k candidates nearest to the query (square distance) - the rows (1 based) and their distances.
+ * Used to re-rank candidates pulled from an (inverted) index in a single call.
+ * @param query float4[]
+ * @param candidates float4[][] - a row per candidate
+ * @param k int4
+ * @return SETOF (index int4, distance float4) ordered by the distance
+ */
+Datum 
+c_distance_square_topk(PG_FUNCTION_ARGS) {
+    FuncCallContext*  funcctx;
+    DistanceTopK*     heap;
+
+    if (SRF_IS_FIRSTCALL()) {
+        MemoryContext   oldcontext;
+        ArrayType*      query;
+        ArrayType*      candidates;
+        TupleDesc       tupdesc;
+        const float4*   rows;
+        float4*         distances;
+        int             length, count;
+        int             k = PG_GETARG_INT32(2);
+        uint64          started = STATS_CLOCK();        // pgsiftorder.stats
+        uint64          detoasted;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("function returning record called in context that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        query = PG_GETARG_ARRAYTYPE_P(0);
+        candidates = PG_GETARG_ARRAYTYPE_P(1);
+        length = ArrayGetNItems(ARR_NDIM(query), ARR_DIMS(query));
+        rows = distance_batch_candidates(candidates, length, &count);
+        detoasted = STATS_CLOCK();
+
+        k = MIN(MAX(k, 0), count);
+        heap = (DistanceTopK*) palloc(sizeof(DistanceTopK) * MAX(k, 1));
+        if (k > 0) {
+            distances = (float4*) palloc(sizeof(float4) * count);
+            dense_square_real_batch((float4*) ARR_DATA_PTR(query), rows, count, length, distances);
+            k = topk_select(distances, count, k, heap);
+            pfree(distances);
+        }
+        STATS_COUNT(STAT_DISTANCE_SQUARE_TOPK, started, detoasted, (uint64) length * (count + 1), 0, 0);
+
+        funcctx->user_fctx = heap;
+        funcctx->max_calls = k;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    heap = (DistanceTopK*) funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        Datum       values[2];
+        bool        nulls[2] = {false, false};
+        HeapTuple   tuple;
+
+        values[0] = Int32GetDatum(heap[funcctx->call_cntr].index);
+        values[1] = Float4GetDatum(heap[funcctx->call_cntr].distance);
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+
+/****************************************************************************************************
+ * Top-k aggregates
+ * topk(id, score, k) and topk_distance(id, distance, k) replace ORDER BY score DESC LIMIT k - a heap of
+ * the k best rows (the worst of them on the top, grown on demand), so the memory is O(min(k, rows)) however
+ * large k is and however many rows match. The result are the ids, the best first. Ties are broken by the
+ * smaller id, NaN orders as in Postgres (above all numbers). The states combine for the parallel aggregation.
+ ****************************************************************************************************/
+
+typedef struct TopKItem {
+    float4      score;
+    int64       id;
+} TopKItem;
+
+typedef struct TopKState {
+    int32       k;
+    int32       count;          // items in the heap (at most k)
+    int32       capacity;       // of the items (at most k, doubled on demand)
+    bool        ascending;      // distance - the smallest first (score - the largest first)
+    TopKItem*   items;
+} TopKState;
+
+#define TOPK_INITIAL_CAPACITY   64
+
+// float4 comparison with NaN above all numbers (float4_cmp_internal)
+static inline int topk_cmp_score(float4 a, float4 b) {
+    if (isnan(a)) return isnan(b) ? 0 : 1;
+    if (isnan(b)) return -1;
+    return (a > b) - (a < b);
+}
+
+static inline bool topk_item_worse(const TopKState* state, const TopKItem* a, const TopKItem* b) {
+    int cmp = topk_cmp_score(a->score, b->score);
+
+    if (cmp == 0) return a->id > b->id;
+    return state->ascending ? (cmp > 0) : (cmp < 0);
+}
+
+// room for count items (count <= k) - the items stay in the context of the state
+static void topk_reserve(TopKState* state, int32 count) {
+    if (count <= state->capacity) return;
+
+    state->capacity = (int32) MIN((int64) state->k, MAX((int64) state->capacity * 2, (int64) count));
+    state->items = (TopKItem*) repalloc(state->items, sizeof(TopKItem) * state->capacity);
+}
+
+static void topk_push(TopKState* state, const TopKItem* item) {
+    TopKItem*   heap;
+    int         pos;
+
+    if (state->count < state->k) {
+        topk_reserve(state, state->count + 1);
+        heap = state->items;
+
+        // sift up
+        for (pos = state->count++; pos > 0 && topk_item_worse(state, item, &heap[(pos - 1) / 2]); pos = (pos - 1) / 2)
+            heap[pos] = heap[(pos - 1) / 2];
+        heap[pos] = *item;
+        return;
+    }
+    heap = state->items;
+    if (state->k == 0 || !topk_item_worse(state, &heap[0], item)) return;
+
+    // replace the worst and sift down
+    for (pos = 0;;) {
+        int child = 2 * pos + 1;
+
+        if (child >= state->count) break;
+        if (child + 1 < state->count && topk_item_worse(state, &heap[child + 1], &heap[child])) child++;
+        if (!topk_item_worse(state, &heap[child], item)) break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = *item;
+}
+
+static TopKState* topk_state_new(MemoryContext context, int32 k, bool ascending) {
+    TopKState*  state;
+
+    // topk_final copies up to k + 1 items
+    if (k < 0 || (Size) k + 1 > MaxAllocSize / sizeof(TopKItem))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("k must be between 0 and %d", (int) (MaxAllocSize / sizeof(TopKItem) - 1))));
+
+    state = (TopKState*) MemoryContextAllocZero(context, sizeof(TopKState));
+    state->k = k;
+    state->ascending = ascending;
+    state->capacity = MIN(k, TOPK_INITIAL_CAPACITY);
+    state->items = (TopKItem*) MemoryContextAlloc(context, sizeof(TopKItem) * MAX(state->capacity, 1));
+    return state;
+}
+
+// the transition of both aggregates
+static Datum topk_accum(FunctionCallInfo fcinfo, bool ascending) {
+    uint64          started = STATS_CLOCK();    // pgsiftorder.stats
+    MemoryContext   aggcontext;
+    TopKState*      state = PG_ARGISNULL(0) ? NULL : (TopKState*) PG_GETARG_POINTER(0);
+    TopKItem        item;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("topk called in non-aggregate context")));
+
+    if (state == NULL) {
+        if (PG_ARGISNULL(3))
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                            errmsg("k must not be NULL")));
+        state = topk_state_new(aggcontext, PG_GETARG_INT32(3), ascending);
+    }
+
+    // rows without the id or the score are skipped (as by the WHERE score IS NOT NULL)
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) PG_RETURN_POINTER(state);
+
+    item.id = PG_GETARG_INT64(1);
+    item.score = PG_GETARG_FLOAT4(2);
+    topk_push(state, &item);
+    STATS_COUNT(STAT_TOPK_ACCUM, started, 0, 1, 0, 0);
+
+    PG_RETURN_POINTER(state);
+}
+
+
+PG_FUNCTION_INFO_V1(c_topk_accum);
+/****************************************************************************************************
+ * topk transition - keeps the k rows of the largest score
+ * @param state internal
+ * @param id int8
+ * @param score float4
+ * @param k int4
+ */
+Datum
+c_topk_accum(PG_FUNCTION_ARGS) {
+    return topk_accum(fcinfo, false);
+}
+
+
+PG_FUNCTION_INFO_V1(c_topk_distance_accum);
+/****************************************************************************************************
+ * topk_distance transition - keeps the k rows of the smallest distance
+ * @param state internal
+ * @param id int8
+ * @param distance float4
+ * @param k int4
+ */
+Datum
+c_topk_distance_accum(PG_FUNCTION_ARGS) {
+    return topk_accum(fcinfo, true);
+}
+
+
+PG_FUNCTION_INFO_V1(c_topk_combine);
+/****************************************************************************************************
+ * topk combine (parallel aggregation) - pushes the items of the second state to the first one
+ * @param state1 internal
+ * @param state2 internal
+ */
+Datum
+c_topk_combine(PG_FUNCTION_ARGS) {
+    MemoryContext   aggcontext;
+    TopKState*      state1 = PG_ARGISNULL(0) ? NULL : (TopKState*) PG_GETARG_POINTER(0);
+    TopKState*      state2 = PG_ARGISNULL(1) ? NULL : (TopKState*) PG_GETARG_POINTER(1);
+    int             pos;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("c_topk_combine called in non-aggregate context")));
+
+    if (state2 == NULL) PG_RETURN_POINTER(state1);
+    if (state1 == NULL) {
+        state1 = topk_state_new(aggcontext, state2->k, state2->ascending);
+        topk_reserve(state1, state2->count);
+        state1->count = state2->count;
+        memcpy(state1->items, state2->items, sizeof(TopKItem) * state2->count);
+        PG_RETURN_POINTER(state1);
+    }
+
+    for (pos = 0; pos < state2->count; pos++) topk_push(state1, &state2->items[pos]);
+
+    PG_RETURN_POINTER(state1);
+}
+
+
+PG_FUNCTION_INFO_V1(c_topk_serialize);
+/****************************************************************************************************
+ * topk state serialization (parallel aggregation) - k, count, ascending and the items
+ * @param state internal
+ */
+Datum
+c_topk_serialize(PG_FUNCTION_ARGS) {
+    TopKState*      state = (TopKState*) PG_GETARG_POINTER(0);
+    int             pos;
+    StringInfoData  buf;
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, state->k);
+    pq_sendint32(&buf, state->count);
+    pq_sendbyte(&buf, state->ascending);
+    for (pos = 0; pos < state->count; pos++) {
+        pq_sendint64(&buf, state->items[pos].id);
+        pq_sendfloat4(&buf, state->items[pos].score);
+    }
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+
+PG_FUNCTION_INFO_V1(c_topk_deserialize);
+/****************************************************************************************************
+ * topk state deserialization (parallel aggregation)
+ * @param serialized bytea
+ * @param dummy internal
+ */
+Datum
+c_topk_deserialize(PG_FUNCTION_ARGS) {
+    bytea*          serialized = PG_GETARG_BYTEA_PP(0);
+    MemoryContext   aggcontext;
+    StringInfoData  buf;
+    TopKState*      state;
+    int32           k;
+    int             pos;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("c_topk_deserialize called in non-aggregate context")));
+
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(serialized), VARSIZE_ANY_EXHDR(serialized));
+
+    k = pq_getmsgint(&buf, sizeof(int32));
+    state = topk_state_new(CurrentMemoryContext, k, false);
+    state->count = pq_getmsgint(&buf, sizeof(int32));
+    state->ascending = pq_getmsgbyte(&buf);
+    if (state->count < 0 || state->count > k)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid topk state")));
+    topk_reserve(state, state->count);
+    for (pos = 0; pos < state->count; pos++) {
+        state->items[pos].id = pq_getmsgint64(&buf);
+        state->items[pos].score = pq_getmsgfloat4(&buf);
+    }
+    pq_getmsgend(&buf);
+    pfree(buf.data);
+
+    PG_RETURN_POINTER(state);
+}
+
+
+// qsort of the heap copy - the best first
+static const TopKState* topk_sort_state;
+
+static int topk_item_cmp(const void* a, const void* b) {
+    if (topk_item_worse(topk_sort_state, (const TopKItem*) a, (const TopKItem*) b)) return 1;
+    if (topk_item_worse(topk_sort_state, (const TopKItem*) b, (const TopKItem*) a)) return -1;
+    return 0;
+}
+
+
+PG_FUNCTION_INFO_V1(c_topk_final);
+/****************************************************************************************************
+ * topk final - the ids ordered from the best (the state is not modified)
+ * @param state internal
+ * @return int8[]
+ */
+Datum
+c_topk_final(PG_FUNCTION_ARGS) {
+    TopKState*      state = PG_ARGISNULL(0) ? NULL : (TopKState*) PG_GETARG_POINTER(0);
+    TopKItem*       items;
+    Datum*          ids;
+    int             pos;
+
+    if (state == NULL) PG_RETURN_NULL();
+
+    items = (TopKItem*) palloc(sizeof(TopKItem) * (state->count + 1));
+    memcpy(items, state->items, sizeof(TopKItem) * state->count);
+    topk_sort_state = state;
+    qsort(items, state->count, sizeof(TopKItem), topk_item_cmp);
+
+    ids = (Datum*) palloc(sizeof(Datum) * (state->count + 1));
+    for (pos = 0; pos < state->count; pos++) ids[pos] = Int64GetDatum(items[pos].id);
+
+    PG_RETURN_ARRAYTYPE_P(construct_array(ids, state->count, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_manhattan_real);
+/****************************************************************************************************
+ * Counts Manhattan distance(Minkowski distance - L1) of two vectors.
+ * @param elements1 float4[]
+ * @param elements2 float4[]
+ */
+Datum 
+c_distance_manhattan_real(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64       detoasted = STATS_CLOCK();
+    
+    int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    float4       distance;
+
+    if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both arrays must be of the same size")));
+    }
+
+    // d(x, y) = Sum ( |xi - yi| )
+    distance = dense_manhattan_real((float4*) ARR_DATA_PTR(vector1), (float4*) ARR_DATA_PTR(vector2), length);
+
+    STATS_COUNT(STAT_DISTANCE_MANHATTAN_REAL, started, detoasted, 2 * length, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_cosine_real);
+/****************************************************************************************************
+ * Counts cosine distance (1 - cosine similarity) of two dense vectors, a zero vector is at the distance 1.
+ * For sparse vectors (ids and weights), see rating_cosine().
+ * @param elements1 float4[]
+ * @param elements2 float4[]
+ */
+Datum 
+c_distance_cosine_real(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64       detoasted = STATS_CLOCK();
+    
+    int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    float4       distance;
+
+    if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both arrays must be of the same size")));
+    }
+
+    // d(x, y) = 1 - Sum (xi * yi) / (|x| |y|)
+    distance = dense_cosine_real((float4*) ARR_DATA_PTR(vector1), (float4*) ARR_DATA_PTR(vector2), length);
+
+    STATS_COUNT(STAT_DISTANCE_COSINE_REAL, started, detoasted, 2 * length, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_manhattan_int);
+/****************************************************************************************************
+ * Counts Manhattan distance(Minkowski distance - L1) of two vectors.
+ * @param elements1 int4[]
+ * @param elements2 int4[]
+ */
+Datum 
+c_distance_manhattan_int(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64       detoasted = STATS_CLOCK();
+    
+    int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both arrays must be of the same size")));
+    }
+    
+    int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
+    int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
+    int64        distance = 0;       // result
+
+    // Manhattan distance:
+    // d(x, y) = Sum ( |xi - yi| )
+    //            i
+    //
+    // go through the two vectors (see the dense vector kernels)
+    distance = dense_manhattan_int(ptr1, ptr2, length);
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_distance_manhattan_int length: %d (%ld)", length, distance)));
+    #endif
+
+    STATS_COUNT(STAT_DISTANCE_MANHATTAN_INT, started, detoasted, 2 * length, 0, 0);
+    PG_RETURN_INT64(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_chessboard_int);
+/****************************************************************************************************
+ * Counts Chebyshev distance(Minkowski distance - Lmax or called Chessboard distance) of two vectors.
+ * @param elements1 int4[]
+ * @param elements2 int4[]
+ */
+Datum 
+c_distance_chessboard_int(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    uint64       detoasted = STATS_CLOCK();
+    
+    int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both arrays must be of the same size")));
+    }
+    
+    int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
+    int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
+    int64        distance = 0;       // result
+
+    // Chebyshev distance:
+    // d(x, y) = max (|xi - yi|)
+    //            i
+    //
+    // go through the two vectors (see the dense vector kernels)
+    distance = dense_chessboard_int(ptr1, ptr2, length);
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_distance_chessboard_int length: %d (%ld)", length, distance)));
+    #endif
+
+    STATS_COUNT(STAT_DISTANCE_CHESSBOARD_INT, started, detoasted, 2 * length, 0, 0);
+    PG_RETURN_INT64(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_distance_mahalanobis_int);
+/****************************************************************************************************
+ * Counts Mahalanobis distance of two vectors.
+ * @param elements1 int4[]
+ * @param elements2 int4[]
+ * @param StandardDeviation float4[] 
+ */
+Datum 
+c_distance_mahalanobis_int(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    ArrayType*   vector1 = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*   vector2 = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType*   stdev   = PG_GETARG_ARRAYTYPE_P(2);
+    uint64       detoasted = STATS_CLOCK();
+    
+    int          length = ArrayGetNItems(ARR_NDIM(vector1), ARR_DIMS(vector1));   // array lengths
+    if (length != ArrayGetNItems(ARR_NDIM(vector2), ARR_DIMS(vector2))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both arrays must be of the same size")));
+    }
+    
+    int32*       ptr1 = (int32*) ARR_DATA_PTR(vector1);         // array data pointers
+    int32*       ptr2 = (int32*) ARR_DATA_PTR(vector2);
+    // check length of deviations - for SIGSEGV :)
+    if (length > ArrayGetNItems(ARR_NDIM(stdev), ARR_DIMS(stdev))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("standard deviation array must be of the same size as the vectors")));
+    }
+
+    float4*      ptr_stdev = (float4*) ARR_DATA_PTR(stdev);
+    const float4* variance = variance_cache(fcinfo, 2, ptr_stdev, length);  // sigma^2 if constant
+    float4       distance = 0;  
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_distance_mahalanobis_int length: %d", length)));
+    #endif
+    
+    //  Standard deviation(as argument):
+    //  sigma = sqrt( 1/N * Sum (pi - mean)^2 ) = sqrt ( (1/N * Sum (pi^2)) - mean^2 ) 
+    //                       i                                  i
+    //
+    // Mahalanobis distance without sqrt():
+    // d(x, y) = Sum [ (xi - yi)^2 ] / sigmai^2
+    //            i
+    //
+    distance = dense_mahalanobis_int(ptr1, ptr2, ptr_stdev, variance, length);
+
+    STATS_COUNT(STAT_DISTANCE_MAHALANOBIS_INT, started, detoasted, 2 * length, 0, 0);
+    PG_RETURN_FLOAT8(distance);
+}
+
+
+
+
+/****************************************************************************************************
+ * Dense vector type fvec(n)
+ * A varlena header and the float4 payload - no ArrayType header (ndim, dims, lbound, dataoffset), the
+ * dimension is VARSIZE based and fixed by the typmod: fvec(128) for SIFT, fvec(31) for Gabor features.
+ * (FVector itself is in pgsiftorder.h)
+ ****************************************************************************************************/
+
+static FVector* fvec_new(int dim) {
+    FVector*    v = (FVector*) palloc0(FVEC_SIZE(dim));
+
+    SET_VARSIZE(v, FVEC_SIZE(dim));
+    return v;
+}
+
+static void fvec_check_dim(int dim, int32 typmod) {
+    if (dim < 1)
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("fvec must have at least 1 dimension")));
+    if (dim > FVEC_MAX_DIM)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("fvec cannot have more than %d dimensions", FVEC_MAX_DIM)));
+    if (typmod != -1 && typmod != dim)
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("expected %d dimensions, not %d", typmod, dim)));
+}
+
+// both vectors must be of the same dimension (the typmod does not apply to expressions)
+static int fvec_same_dim(FVector* v1, FVector* v2) {
+    int dim = FVEC_DIM(v1);
+
+    if (dim != FVEC_DIM(v2)) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both vectors must be of the same dimension (%d and %d)", dim, FVEC_DIM(v2))));
+    }
+    return dim;
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_in);
+/****************************************************************************************************
+ * fvec input - '{1,2,3}' (like real[]) or '[1,2,3]'
+ * @param input cstring
+ * @param typelem oid
+ * @param typmod int4
+ */
+Datum 
+c_fvec_in(PG_FUNCTION_ARGS) {
+    char*       str = PG_GETARG_CSTRING(0);
+    int32       typmod = PG_GETARG_INT32(2);
+    char*       ptr = str;
+    char*       end;
+    char        close;
+    int         dim = 1;        // number of elements (commas +1)
+    int         pos;
+    FVector*    result;
+
+    while (isspace((unsigned char) *ptr)) ptr++;
+    if (*ptr != '{' && *ptr != '[')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("invalid input syntax for type fvec: \"%s\"", str),
+                        errdetail("Vector contents must start with \"{\" or \"[\".")));
+    close = (*ptr == '{') ? '}' : ']';
+    ptr++;
+
+    for (end = ptr; *end != '\0'; end++) {
+        if (*end == ',') dim++;
+    }
+    fvec_check_dim(dim, typmod);
+    result = fvec_new(dim);
+
+    for (pos = 0; pos < dim; pos++) {
+        while (isspace((unsigned char) *ptr)) ptr++;
+
+        errno = 0;
+        result->x[pos] = strtof(ptr, &end);
+        if (end == ptr)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type fvec: \"%s\"", str)));
+        if (errno == ERANGE && isinf(result->x[pos]))
+            ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                            errmsg("\"%.*s\" is out of range for type real", (int) (end - ptr), ptr)));
+        ptr = end;
+
+        while (isspace((unsigned char) *ptr)) ptr++;
+        if (*ptr != ((pos < dim -1) ? ',' : close))
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type fvec: \"%s\"", str)));
+        ptr++;
+    }
+
+    while (isspace((unsigned char) *ptr)) ptr++;
+    if (*ptr != '\0')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("invalid input syntax for type fvec: \"%s\"", str),
+                        errdetail("Junk after closing bracket.")));
+
+    PG_RETURN_FVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_out);
+/****************************************************************************************************
+ * fvec output - '{1,2,3}' (like real[], so the text casts work both ways)
+ * @param vector fvec
+ */
+Datum 
+c_fvec_out(PG_FUNCTION_ARGS) {
+    FVector*    vector = PG_GETARG_FVECTOR_P(0);
+    int         dim = FVEC_DIM(vector);
+    int         pos;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '{');
+    for (pos = 0; pos < dim; pos++) {
+        if (pos > 0) appendStringInfoChar(&buf, ',');
+        appendStringInfoString(&buf, DatumGetCString(DirectFunctionCall1(float4out, Float4GetDatum(vector->x[pos]))));
+    }
+    appendStringInfoChar(&buf, '}');
+
+    PG_RETURN_CSTRING(buf.data);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_typmod_in);
+/****************************************************************************************************
+ * fvec(n) typmod input - the dimension
+ * @param typmods cstring[]
+ */
+Datum 
+c_fvec_typmod_in(PG_FUNCTION_ARGS) {
+    ArrayType*  typmods = PG_GETARG_ARRAYTYPE_P(0);
+    int32*      tl;
+    int         n;
+
+    tl = ArrayGetIntegerTypmods(typmods, &n);
+    if (n != 1)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid type modifier"),
+                        errdetail("fvec takes just the dimension, e.g. fvec(128).")));
+    if (tl[0] < 1 || tl[0] > FVEC_MAX_DIM)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("dimension of fvec must be between 1 and %d", FVEC_MAX_DIM)));
+
+    PG_RETURN_INT32(tl[0]);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_typmod_out);
+/****************************************************************************************************
+ * fvec(n) typmod output
+ * @param typmod int4
+ */
+Datum 
+c_fvec_typmod_out(PG_FUNCTION_ARGS) {
+    int32       typmod = PG_GETARG_INT32(0);
+
+    if (typmod < 0) PG_RETURN_CSTRING(pstrdup(""));
+    PG_RETURN_CSTRING(psprintf("(%d)", typmod));
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_recv);
+/****************************************************************************************************
+ * fvec binary input - int4 dimension and float4 elements
+ * @param buf internal
+ * @param typelem oid
+ * @param typmod int4
+ */
+Datum 
+c_fvec_recv(PG_FUNCTION_ARGS) {
+    StringInfo  buf = (StringInfo) PG_GETARG_POINTER(0);
+    int32       typmod = PG_GETARG_INT32(2);
+    int         dim = pq_getmsgint(buf, sizeof(int32));
+    int         pos;
+    FVector*    result;
+
+    fvec_check_dim(dim, typmod);
+    result = fvec_new(dim);
+    for (pos = 0; pos < dim; pos++) {
+        result->x[pos] = pq_getmsgfloat4(buf);
+    }
+
+    PG_RETURN_FVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_send);
+/****************************************************************************************************
+ * fvec binary output - int4 dimension and float4 elements
+ * @param vector fvec
+ */
+Datum 
+c_fvec_send(PG_FUNCTION_ARGS) {
+    FVector*    vector = PG_GETARG_FVECTOR_P(0);
+    int         dim = FVEC_DIM(vector);
+    int         pos;
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, dim);
+    for (pos = 0; pos < dim; pos++) {
+        pq_sendfloat4(&buf, vector->x[pos]);
+    }
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_typmod);
+/****************************************************************************************************
+ * fvec(n) length coercion - CAST (v AS fvec(n)) and the assignment to a fvec(n) column
+ * @param vector fvec
+ * @param typmod int4
+ * @param explicit bool
+ */
+Datum 
+c_fvec_typmod(PG_FUNCTION_ARGS) {
+    FVector*    vector = PG_GETARG_FVECTOR_P(0);
+    int32       typmod = PG_GETARG_INT32(1);
+
+    fvec_check_dim(FVEC_DIM(vector), typmod);
+    PG_RETURN_FVECTOR_P(vector);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_from_real);
+/****************************************************************************************************
+ * Cast real[] to fvec(n)
+ * @param elements real[]
+ * @param typmod int4
+ * @param explicit bool
+ */
+Datum 
+c_fvec_from_real(PG_FUNCTION_ARGS) {
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+    int32       typmod = PG_GETARG_INT32(1);
+    int         dim = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    FVector*    result;
+
+    if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector))
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("array must be one-dimensional and must not contain NULLs")));
+    fvec_check_dim(dim, typmod);
+
+    result = fvec_new(dim);
+    memcpy(result->x, ARR_DATA_PTR(vector), dim * sizeof(float4));
+
+    PG_RETURN_FVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_from_int);
+/****************************************************************************************************
+ * Cast int[] to fvec(n) (e.g. the Gabor features)
+ * @param elements int4[]
+ * @param typmod int4
+ * @param explicit bool
+ */
+Datum 
+c_fvec_from_int(PG_FUNCTION_ARGS) {
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+    int32       typmod = PG_GETARG_INT32(1);
+    int         dim = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    int32*      ptr = (int32*) ARR_DATA_PTR(vector);
+    int         pos;
+    FVector*    result;
+
+    if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector))
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("array must be one-dimensional and must not contain NULLs")));
+    fvec_check_dim(dim, typmod);
+
+    result = fvec_new(dim);
+    for (pos = 0; pos < dim; pos++) {
+        result->x[pos] = (float4) ptr[pos];
+    }
+
+    PG_RETURN_FVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_to_real);
+/****************************************************************************************************
+ * Cast fvec to real[]
+ * @param vector fvec
+ */
+Datum 
+c_fvec_to_real(PG_FUNCTION_ARGS) {
+    FVector*    vector = PG_GETARG_FVECTOR_P(0);
+    int         dim = FVEC_DIM(vector);
+    ArrayType*  result = array_new_real(dim);
+
+    memcpy(ARR_DATA_PTR(result), vector->x, dim * sizeof(float4));
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_distance_square);
+/****************************************************************************************************
+ * Counts square distance of two vectors.
+ * @param vector1 fvec
+ * @param vector2 fvec
+ */
+Datum 
+c_fvec_distance_square(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    FVector*    vector1 = PG_GETARG_FVECTOR_P(0);
+    FVector*    vector2 = PG_GETARG_FVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = fvec_same_dim(vector1, vector2);
+    float4      distance;
+
+    // d(x, y) = Sum[ (xi - yi)^2 ]
+    distance = dense_square_real(vector1->x, vector2->x, dim);
+
+    STATS_COUNT(STAT_FVEC_DISTANCE_SQUARE, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_distance_square_bounded);
+/****************************************************************************************************
+ * Square distance of two fvec abandoned early - NULL once the partial sum exceeds the bound
+ * @param vector1 fvec
+ * @param vector2 fvec
+ * @param bound real
+ * @param order int4[] (optional) the dimensions to visit first (high variance), see dimension_order()
+ */
+Datum 
+c_fvec_distance_square_bounded(PG_FUNCTION_ARGS) {
+    uint64       started = STATS_CLOCK();       // pgsiftorder.stats
+    FVector*     vector1 = PG_GETARG_FVECTOR_P(0);
+    FVector*     vector2 = PG_GETARG_FVECTOR_P(1);
+    float4       bound = PG_GETARG_FLOAT4(2);
+    uint64       detoasted = STATS_CLOCK();
+    int          dim = fvec_same_dim(vector1, vector2);
+    const int32* order = NULL;
+    float4       distance;
+
+    if (PG_NARGS() > 3 && !PG_ARGISNULL(3)) order = order_cache(fcinfo, 3, dim);
+
+    distance = dense_square_real_bounded(vector1->x, vector2->x, dim, bound, order);
+
+    STATS_COUNT(STAT_FVEC_DISTANCE_SQUARE_BOUNDED, started, detoasted, 2 * dim, 1, distance > bound);
+    if (distance > bound) PG_RETURN_NULL();
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_distance_manhattan);
+/****************************************************************************************************
+ * Counts Manhattan distance(Minkowski distance - L1) of two vectors.
+ * @param vector1 fvec
+ * @param vector2 fvec
+ */
+Datum 
+c_fvec_distance_manhattan(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    FVector*    vector1 = PG_GETARG_FVECTOR_P(0);
+    FVector*    vector2 = PG_GETARG_FVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = fvec_same_dim(vector1, vector2);
+    float4      distance;
+
+    // d(x, y) = Sum ( |xi - yi| )
+    distance = dense_manhattan_real(vector1->x, vector2->x, dim);
+
+    STATS_COUNT(STAT_FVEC_DISTANCE_MANHATTAN, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_distance_chessboard);
+/****************************************************************************************************
+ * Counts Chebyshev distance(Minkowski distance - Lmax or called Chessboard distance) of two vectors.
+ * @param vector1 fvec
+ * @param vector2 fvec
+ */
+Datum 
+c_fvec_distance_chessboard(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    FVector*    vector1 = PG_GETARG_FVECTOR_P(0);
+    FVector*    vector2 = PG_GETARG_FVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = fvec_same_dim(vector1, vector2);
+    float4      distance;
+
+    // d(x, y) = max (|xi - yi|)
+    distance = dense_chessboard_real(vector1->x, vector2->x, dim);
+
+    STATS_COUNT(STAT_FVEC_DISTANCE_CHESSBOARD, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_distance_cosine);
+/****************************************************************************************************
+ * Counts cosine distance (1 - cosine similarity) of two vectors.
+ * @param vector1 fvec
+ * @param vector2 fvec
+ */
+Datum 
+c_fvec_distance_cosine(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    FVector*    vector1 = PG_GETARG_FVECTOR_P(0);
+    FVector*    vector2 = PG_GETARG_FVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = fvec_same_dim(vector1, vector2);
+    float4      distance;
+
+    // d(x, y) = 1 - Sum (xi * yi) / (|x| |y|)
+    distance = dense_cosine_real(vector1->x, vector2->x, dim);
+
+    STATS_COUNT(STAT_FVEC_DISTANCE_COSINE, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvec_distance_mahalanobis);
+/****************************************************************************************************
+ * Counts Mahalanobis distance (without sqrt) of two vectors.
+ * @param vector1 fvec
+ * @param vector2 fvec
+ * @param StandardDeviation fvec
+ */
+Datum 
+c_fvec_distance_mahalanobis(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    FVector*    vector1 = PG_GETARG_FVECTOR_P(0);
+    FVector*    vector2 = PG_GETARG_FVECTOR_P(1);
+    FVector*    stdev   = PG_GETARG_FVECTOR_P(2);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = fvec_same_dim(vector1, vector2);
+    float4      distance = 0;
+    const float4* variance;
+
+    fvec_same_dim(vector1, stdev);
+    variance = variance_cache(fcinfo, 2, stdev->x, dim);  // sigma^2 if constant
+
+    // d(x, y) = Sum [ (xi - yi)^2 / sigmai^2 ]
+    //            i
+    distance = dense_mahalanobis_real(vector1->x, vector2->x, stdev->x, variance, dim);
+
+    STATS_COUNT(STAT_FVEC_DISTANCE_MAHALANOBIS, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
+
+
+
+/****************************************************************************************************
+ * Byte vector type bvec(n)
+ * Quantized vectors - a uint8 per dimension: 128-d SIFT descriptors take 129 bytes on disk (a short
+ * varlena header) instead of ~530 as int[]. Computed by the byte vector kernels.
+ * (BVector itself is in pgsiftorder.h)
+ ****************************************************************************************************/
+
+static BVector* bvec_new(int dim) {
+    BVector*    v = (BVector*) palloc0(BVEC_SIZE(dim));
+
+    SET_VARSIZE(v, BVEC_SIZE(dim));
+    return v;
+}
+
+static void bvec_check_dim(int dim, int32 typmod) {
+    if (dim < 1)
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("bvec must have at least 1 dimension")));
+    if (dim > BVEC_MAX_DIM)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("bvec cannot have more than %d dimensions", BVEC_MAX_DIM)));
+    if (typmod != -1 && typmod != dim)
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("expected %d dimensions, not %d", typmod, dim)));
+}
+
+static uint8 bvec_check_value(int64 value) {
+    if (value < 0 || value > 255)
+        ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                        errmsg("bvec elements must be between 0 and 255, not " INT64_FORMAT, value),
+                        errhint("Use quantize() for other ranges.")));
+    return (uint8) value;
+}
+
+// both vectors must be of the same dimension (the typmod does not apply to expressions)
+static int bvec_same_dim(BVector* v1, BVector* v2) {
+    int dim = BVEC_DIM(v1);
+
+    if (dim != BVEC_DIM(v2)) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("both vectors must be of the same dimension (%d and %d)", dim, BVEC_DIM(v2))));
+    }
+    return dim;
+}
+
+// the quantization range lo..hi maps to 0..255
+static float8 bvec_check_range(float4 lo, float4 hi) {
+    if (!(hi > lo) || isinf(hi - lo))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("quantization range must be finite and non-empty (lo < hi)")));
+    return ((float8) hi - lo) / 255.0;
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_in);
+/****************************************************************************************************
+ * bvec input - '{1,2,3}' (like int[]) or '[1,2,3]'
+ * @param input cstring
+ * @param typelem oid
+ * @param typmod int4
+ */
+Datum 
+c_bvec_in(PG_FUNCTION_ARGS) {
+    char*       str = PG_GETARG_CSTRING(0);
+    int32       typmod = PG_GETARG_INT32(2);
+    char*       ptr = str;
+    char*       end;
+    char        close;
+    int         dim = 1;        // number of elements (commas +1)
+    int         pos;
+    long        value;
+    BVector*    result;
+
+    while (isspace((unsigned char) *ptr)) ptr++;
+    if (*ptr != '{' && *ptr != '[')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("invalid input syntax for type bvec: \"%s\"", str),
+                        errdetail("Vector contents must start with \"{\" or \"[\".")));
+    close = (*ptr == '{') ? '}' : ']';
+    ptr++;
+
+    for (end = ptr; *end != '\0'; end++) {
+        if (*end == ',') dim++;
+    }
+    bvec_check_dim(dim, typmod);
+    result = bvec_new(dim);
+
+    for (pos = 0; pos < dim; pos++) {
+        while (isspace((unsigned char) *ptr)) ptr++;
+
+        errno = 0;
+        value = strtol(ptr, &end, 10);
+        if (end == ptr || errno == ERANGE)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type bvec: \"%s\"", str)));
+        result->x[pos] = bvec_check_value(value);
+        ptr = end;
+
+        while (isspace((unsigned char) *ptr)) ptr++;
+        if (*ptr != ((pos < dim -1) ? ',' : close))
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type bvec: \"%s\"", str)));
+        ptr++;
+    }
+
+    while (isspace((unsigned char) *ptr)) ptr++;
+    if (*ptr != '\0')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("invalid input syntax for type bvec: \"%s\"", str),
+                        errdetail("Junk after closing bracket.")));
+
+    PG_RETURN_BVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_out);
+/****************************************************************************************************
+ * bvec output - '{1,2,3}' (like int[], so the text casts work both ways)
+ * @param vector bvec
+ */
+Datum 
+c_bvec_out(PG_FUNCTION_ARGS) {
+    BVector*    vector = PG_GETARG_BVECTOR_P(0);
+    uint8*      x = BVEC_DATA(vector);
+    int         dim = BVEC_DIM(vector);
+    int         pos;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '{');
+    for (pos = 0; pos < dim; pos++) {
+        if (pos > 0) appendStringInfoChar(&buf, ',');
+        appendStringInfo(&buf, "%d", (int) x[pos]);
+    }
+    appendStringInfoChar(&buf, '}');
+
+    PG_RETURN_CSTRING(buf.data);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_typmod_in);
+/****************************************************************************************************
+ * bvec(n) typmod input - the dimension
+ * @param typmods cstring[]
+ */
+Datum 
+c_bvec_typmod_in(PG_FUNCTION_ARGS) {
+    ArrayType*  typmods = PG_GETARG_ARRAYTYPE_P(0);
+    int32*      tl;
+    int         n;
+
+    tl = ArrayGetIntegerTypmods(typmods, &n);
+    if (n != 1)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid type modifier"),
+                        errdetail("bvec takes just the dimension, e.g. bvec(128).")));
+    if (tl[0] < 1 || tl[0] > BVEC_MAX_DIM)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("dimension of bvec must be between 1 and %d", BVEC_MAX_DIM)));
+
+    PG_RETURN_INT32(tl[0]);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_recv);
+/****************************************************************************************************
+ * bvec binary input - int4 dimension and the bytes
+ * @param buf internal
+ * @param typelem oid
+ * @param typmod int4
+ */
+Datum 
+c_bvec_recv(PG_FUNCTION_ARGS) {
+    StringInfo  buf = (StringInfo) PG_GETARG_POINTER(0);
+    int32       typmod = PG_GETARG_INT32(2);
+    int         dim = pq_getmsgint(buf, sizeof(int32));
+    BVector*    result;
+
+    bvec_check_dim(dim, typmod);
+    result = bvec_new(dim);
+    pq_copymsgbytes(buf, (char*) result->x, dim);
+
+    PG_RETURN_BVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_send);
+/****************************************************************************************************
+ * bvec binary output - int4 dimension and the bytes
+ * @param vector bvec
+ */
+Datum 
+c_bvec_send(PG_FUNCTION_ARGS) {
+    BVector*    vector = PG_GETARG_BVECTOR_P(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, BVEC_DIM(vector));
+    pq_sendbytes(&buf, (char*) BVEC_DATA(vector), BVEC_DIM(vector));
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_typmod);
+/****************************************************************************************************
+ * bvec(n) length coercion - CAST (v AS bvec(n)) and the assignment to a bvec(n) column
+ * @param vector bvec
+ * @param typmod int4
+ * @param explicit bool
+ */
+Datum 
+c_bvec_typmod(PG_FUNCTION_ARGS) {
+    BVector*    vector = PG_GETARG_BVECTOR_P(0);
+    int32       typmod = PG_GETARG_INT32(1);
+
+    bvec_check_dim(BVEC_DIM(vector), typmod);
+    PG_RETURN_BVECTOR_P(vector);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_from_int);
+/****************************************************************************************************
+ * Cast int[] to bvec(n) - the elements must be 0..255 (SIFT descriptors)
+ * @param elements int4[]
+ * @param typmod int4
+ * @param explicit bool
+ */
+Datum 
+c_bvec_from_int(PG_FUNCTION_ARGS) {
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+    int32       typmod = PG_GETARG_INT32(1);
+    int         dim = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    int32*      ptr = (int32*) ARR_DATA_PTR(vector);
+    int         pos;
+    BVector*    result;
+
+    if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector))
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("array must be one-dimensional and must not contain NULLs")));
+    bvec_check_dim(dim, typmod);
+
+    result = bvec_new(dim);
+    for (pos = 0; pos < dim; pos++) {
+        result->x[pos] = bvec_check_value(ptr[pos]);
+    }
+
+    PG_RETURN_BVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_to_int);
+/****************************************************************************************************
+ * Cast bvec to int[]
+ * @param vector bvec
+ */
+Datum 
+c_bvec_to_int(PG_FUNCTION_ARGS) {
+    BVector*    vector = PG_GETARG_BVECTOR_P(0);
+    uint8*      x = BVEC_DATA(vector);
+    int         dim = BVEC_DIM(vector);
+    ArrayType*  result = array_new(dim, INT4OID);
+    int32*      ptr = (int32*) ARR_DATA_PTR(result);
+    int         pos;
+
+    for (pos = 0; pos < dim; pos++) {
+        ptr[pos] = x[pos];
+    }
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_quantize);
+/****************************************************************************************************
+ * Quantize real[] to bvec - the range lo..hi maps linearly to 0..255 (rounded, clamped)
+ * @param elements real[]
+ * @param lo real
+ * @param hi real
+ */
+Datum 
+c_bvec_quantize(PG_FUNCTION_ARGS) {
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+    float4      lo = PG_GETARG_FLOAT4(1);
+    float8      step = bvec_check_range(lo, PG_GETARG_FLOAT4(2));
+    int         dim = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    float4*     ptr = (float4*) ARR_DATA_PTR(vector);
+    int         pos;
+    BVector*    result;
+
+    if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector))
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("array must be one-dimensional and must not contain NULLs")));
+    bvec_check_dim(dim, -1);
+
+    result = bvec_new(dim);
+    for (pos = 0; pos < dim; pos++) {
+        float8 q = rint((ptr[pos] - lo) / step);
+        result->x[pos] = (uint8) ((q > 255) ? 255 : ((q > 0) ? q : 0));     // NaN ~ 0
+    }
+
+    PG_RETURN_BVECTOR_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_dequantize);
+/****************************************************************************************************
+ * Dequantize bvec to real[] - 0..255 maps linearly to the range lo..hi
+ * @param vector bvec
+ * @param lo real
+ * @param hi real
+ */
+Datum 
+c_bvec_dequantize(PG_FUNCTION_ARGS) {
+    BVector*    vector = PG_GETARG_BVECTOR_P(0);
+    float4      lo = PG_GETARG_FLOAT4(1);
+    float8      step = bvec_check_range(lo, PG_GETARG_FLOAT4(2));
+    uint8*      x = BVEC_DATA(vector);
+    int         dim = BVEC_DIM(vector);
+    ArrayType*  result = array_new_real(dim);
+    float4*     ptr = (float4*) ARR_DATA_PTR(result);
+    int         pos;
+
+    for (pos = 0; pos < dim; pos++) {
+        ptr[pos] = (float4) (lo + x[pos] * step);
+    }
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_distance_square);
+/****************************************************************************************************
+ * Counts square distance of two byte vectors.
+ * @param vector1 bvec
+ * @param vector2 bvec
+ */
+Datum 
+c_bvec_distance_square(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    BVector*    vector1 = PG_GETARG_BVECTOR_P(0);
+    BVector*    vector2 = PG_GETARG_BVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = bvec_same_dim(vector1, vector2);
+    int64       distance;
+
+    // d(x, y) = Sum[ (xi - yi)^2 ]
+    distance = byte_square(BVEC_DATA(vector1), BVEC_DATA(vector2), dim);
+
+    STATS_COUNT(STAT_BVEC_DISTANCE_SQUARE, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_INT64(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_distance_manhattan);
+/****************************************************************************************************
+ * Counts Manhattan distance(Minkowski distance - L1) of two byte vectors.
+ * @param vector1 bvec
+ * @param vector2 bvec
+ */
+Datum 
+c_bvec_distance_manhattan(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    BVector*    vector1 = PG_GETARG_BVECTOR_P(0);
+    BVector*    vector2 = PG_GETARG_BVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = bvec_same_dim(vector1, vector2);
+    int64       distance;
+
+    // d(x, y) = Sum ( |xi - yi| )
+    distance = byte_manhattan(BVEC_DATA(vector1), BVEC_DATA(vector2), dim);
+
+    STATS_COUNT(STAT_BVEC_DISTANCE_MANHATTAN, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_INT64(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_bvec_dot);
+/****************************************************************************************************
+ * Counts dot (inner) product of two byte vectors.
+ * @param vector1 bvec
+ * @param vector2 bvec
+ */
+Datum 
+c_bvec_dot(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    BVector*    vector1 = PG_GETARG_BVECTOR_P(0);
+    BVector*    vector2 = PG_GETARG_BVECTOR_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         dim = bvec_same_dim(vector1, vector2);
+    int64       rating;
+
+    // s(x, y) = Sum ( xi * yi )
+    rating = byte_dot(BVEC_DATA(vector1), BVEC_DATA(vector2), dim);
+
+    STATS_COUNT(STAT_BVEC_DOT, started, detoasted, 2 * dim, 0, 0);
+    PG_RETURN_INT64(rating);
+}
+
+
+
+/****************************************************************************************************
+ * Sparse vector type sparsevec
+ * A document (or a query) of rating_cosine in one value - ids, weights and the norm, so a row is one
+ * detoast and about half the width of the int[] and real[] columns (the ids are 1-2 byte deltas). The
+ * ratings decode the ids in a streaming way, a constant query is decoded once (the query cache).
+ * (SparseVector itself is in pgsiftorder.h)
+ ****************************************************************************************************/
+
+typedef struct SparseElement {
+    int32       id;
+    float4      weight;
+} SparseElement;
+
+static int svec_element_cmp(const void* a, const void* b) {
+    int32 ida = ((const SparseElement*) a)->id;
+    int32 idb = ((const SparseElement*) b)->id;
+
+    return (ida > idb) - (ida < idb);
+}
+
+static inline int svec_varbyte_size(uint32 value) {
+    int size = 1;
+
+    while (value >= 0x80) { value >>= 7; size++; }
+    return size;
+}
+
+static inline uint8* svec_varbyte_put(uint8* ptr, uint32 value) {
+    while (value >= 0x80) { *ptr++ = (uint8) (value | 0x80); value >>= 7; }
+    *ptr++ = (uint8) value;
+    return ptr;
+}
+
+static inline uint32 svec_varbyte_get(const uint8** ptr) {
+    const uint8*    p = *ptr;
+    uint32          value = *p & 0x7F;
+    int             shift = 7;
+
+    while (*p++ & 0x80) { value |= (uint32) (*p & 0x7F) << shift; shift += 7; }
+    *ptr = p;
+    return value;
+}
+
+// the next id of a stream - the deltas wrap in uint32, the first one is the id itself
+#define SVEC_NEXT_ID(id, ptr)   ((int32) ((uint32) (id) + svec_varbyte_get(&(ptr))))
+
+/*
+ * Builds the sparse vector of the elements (sorted by id here, the ids must not repeat)
+ */
+static SparseVector* svec_build(SparseElement* elements, int nnz) {
+    SparseVector*   result;
+    uint8*          ptr;
+    Size            bytes = 0;
+    float4          norm = 0;
+    int             pos;
+
+    if (nnz > SVEC_MAX_NNZ)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("sparsevec cannot have more than %d elements", SVEC_MAX_NNZ)));
+
+    for (pos = 1; pos < nnz; pos++) {
+        if (elements[pos - 1].id >= elements[pos].id) {
+            qsort(elements, nnz, sizeof(SparseElement), svec_element_cmp);
+            break;
+        }
+    }
+
+    for (pos = 0; pos < nnz; pos++) {
+        if (pos > 0 && elements[pos - 1].id == elements[pos].id)
+            ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                            errmsg("sparsevec element %d is repeated", elements[pos].id)));
+        if (isnan(elements[pos].weight) || isinf(elements[pos].weight))
+            ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                            errmsg("sparsevec weights must be finite")));
+
+        bytes += svec_varbyte_size((uint32) elements[pos].id - (uint32) ((pos > 0) ? elements[pos - 1].id : 0));
+        norm += (elements[pos].weight * elements[pos].weight);
+    }
+
+    result = (SparseVector*) palloc0(SVEC_SIZE(nnz, bytes));
+    SET_VARSIZE(result, SVEC_SIZE(nnz, bytes));
+    result->nnz = nnz;
+    result->norm = sqrt(norm);
+
+    ptr = SVEC_IDS(result);
+    for (pos = 0; pos < nnz; pos++) {
+        SVEC_WEIGHTS(result)[pos] = elements[pos].weight;
+        ptr = svec_varbyte_put(ptr, (uint32) elements[pos].id - (uint32) ((pos > 0) ? elements[pos - 1].id : 0));
+    }
+
+    return result;
+}
+
+/*
+ * Decodes the ids (of nnz + 1 items)
+ */
+static int32* svec_ids(const SparseVector* vector) {
+    int32*          ids = (int32*) palloc(sizeof(int32) * (vector->nnz + 1));
+    const uint8*    ptr = SVEC_IDS(vector);
+    int32           id = 0;
+    int             pos;
+
+    for (pos = 0; pos < vector->nnz; pos++) {
+        id = SVEC_NEXT_ID(id, ptr);
+        ids[pos] = id;
+    }
+    return ids;
+}
+
+/*
+ * Number of common elements of two sparse vectors and the dot product of their weights (if dot is given),
+ * a merge of the two id streams
+ */
+static int svec_intersect(const SparseVector* vector1, const SparseVector* vector2, float4* dot) {
+    const uint8*    ptr1 = SVEC_IDS(vector1);
+    const uint8*    ptr2 = SVEC_IDS(vector2);
+    const float4*   ptrw1 = SVEC_WEIGHTS(vector1);
+    const float4*   ptrw2 = SVEC_WEIGHTS(vector2);
+    int             pos1 = 0;
+    int             pos2 = 0;
+    int32           id1;
+    int32           id2;
+    int             count = 0;
+    float4          rating = 0;
+
+    if (vector1->nnz > 0 && vector2->nnz > 0) {
+        id1 = SVEC_NEXT_ID(0, ptr1);
+        id2 = SVEC_NEXT_ID(0, ptr2);
+
+        for (;;) {
+            if (id1 < id2) {
+                if (++pos1 == vector1->nnz) break;
+                id1 = SVEC_NEXT_ID(id1, ptr1);
+            }
+            else if (id1 > id2) {
+                if (++pos2 == vector2->nnz) break;
+                id2 = SVEC_NEXT_ID(id2, ptr2);
+            }
+            else {
+                count++;
+                if (dot != NULL) rating += (ptrw1[pos1] * ptrw2[pos2]);
+                if (++pos1 == vector1->nnz || ++pos2 == vector2->nnz) break;
+                id1 = SVEC_NEXT_ID(id1, ptr1);
+                id2 = SVEC_NEXT_ID(id2, ptr2);
+            }
+        }
+    }
+
+    if (dot != NULL) *dot = rating;
+    return count;
+}
+
+/*
+ * Returns the query cache of the call site, or NULL if no argument is stable (see the constant query
+ * cache, the norm is the L2 norm of the sparsevec here)
+ */
+static QueryCache* svec_query_cache(FunctionCallInfo fcinfo) {
+    QueryCache*     qc = (QueryCache*) fcinfo->flinfo->fn_extra;
+    MemoryContext   oldcontext;
+    int             arg = -1;
+
+    if (qc != NULL) return (qc->arg < 0) ? NULL : qc;
+
+    if (get_fn_expr_arg_stable(fcinfo->flinfo, 1)) arg = 1;
+    else if (get_fn_expr_arg_stable(fcinfo->flinfo, 0)) arg = 0;
+
+    oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+    qc = (QueryCache*) palloc0(sizeof(QueryCache));
+    qc->arg = arg;
+
+    if (arg >= 0) {
+        SparseVector*   vector = PG_GETARG_SVECTOR_P(arg);
+        int32*          ids = svec_ids(vector);
+
+        query_cache_build(qc, ids, vector->nnz);
+        pfree(ids);
+        qc->weights = (float4*) palloc(sizeof(float4) * (vector->nnz + 1));
+        memcpy(qc->weights, SVEC_WEIGHTS(vector), sizeof(float4) * vector->nnz);
+        qc->norm = vector->norm;
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    fcinfo->flinfo->fn_extra = (void*) qc;
+
+    return (arg < 0) ? NULL : qc;
+}
+
+/*
+ * Number of common elements of the cached query and a document and the dot product of their weights,
+ * only the document ids are decoded
+ */
+static int svec_query_intersect(const QueryCache* qc, const SparseVector* vector, float4* dot) {
+    const uint8*    ptr = SVEC_IDS(vector);
+    const float4*   ptrw = SVEC_WEIGHTS(vector);
+    int32           id = 0;
+    int             pos;
+    int             count = 0;
+    float4          rating = 0;
+
+    for (pos = 0; pos < vector->nnz; pos++) {
+        int match;
+
+        id = SVEC_NEXT_ID(id, ptr);
+        match = query_cache_find(qc, id);
+        if (match >= 0) {
+            count++;
+            rating += (qc->weights[match] * ptrw[pos]);
+        }
+    }
+
+    if (dot != NULL) *dot = rating;
+    return count;
+}
+
+/*
+ * The rating of the arguments 0 and 1 - the cached query against the document, or the merge
+ */
+static int svec_rating(FunctionCallInfo fcinfo, StatFunction stat, float4* dot, float4* norm1, float4* norm2) {
+    uint64          started = STATS_CLOCK();    // pgsiftorder.stats
+    uint64          detoasted;
+    QueryCache*     qc = svec_query_cache(fcinfo);
+    SparseVector*   vector;
+    int             count;
+
+    if (qc != NULL) {
+        vector = PG_GETARG_SVECTOR_P((qc->arg == 0) ? 1 : 0);
+        detoasted = STATS_CLOCK();
+        count = svec_query_intersect(qc, vector, dot);
+        if (norm1 != NULL) *norm1 = qc->norm;
+        if (norm2 != NULL) *norm2 = vector->norm;
+        STATS_COUNT(stat, started, detoasted, qc->length + vector->nnz, MIN(qc->length, vector->nnz), count);
+    }
+    else {
+        SparseVector* vector1 = PG_GETARG_SVECTOR_P(0);
+
+        vector = PG_GETARG_SVECTOR_P(1);
+        detoasted = STATS_CLOCK();
+        count = svec_intersect(vector1, vector, dot);
+        if (norm1 != NULL) *norm1 = vector1->norm;
+        if (norm2 != NULL) *norm2 = vector->norm;
+        STATS_COUNT(stat, started, detoasted, vector1->nnz + vector->nnz, MIN(vector1->nnz, vector->nnz), count);
+    }
+
+    return count;
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_in);
+/****************************************************************************************************
+ * sparsevec input - '{id:weight,...}', e.g. '{2:0.7,5:0.7}' (the elements are sorted by id)
+ * @param input cstring
+ * @param typelem oid
+ * @param typmod int4
+ */
+Datum 
+c_sparsevec_in(PG_FUNCTION_ARGS) {
+    char*           str = PG_GETARG_CSTRING(0);
+    char*           ptr = str;
+    char*           end;
+    int             nnz = 1;        // number of elements (commas +1)
+    int             pos;
+    long            id;
+    SparseElement*  elements;
+
+    while (isspace((unsigned char) *ptr)) ptr++;
+    if (*ptr != '{')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("invalid input syntax for type sparsevec: \"%s\"", str),
+                        errdetail("Vector contents must start with \"{\".")));
+    ptr++;
+
+    for (end = ptr; *end != '\0'; end++) {
+        if (*end == ',') nnz++;
+    }
+    for (end = ptr; isspace((unsigned char) *end); end++);
+    if (*end == '}') nnz = 0;       // '{}'
+    if (nnz > SVEC_MAX_NNZ)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("sparsevec cannot have more than %d elements", SVEC_MAX_NNZ)));
+    elements = (SparseElement*) palloc(sizeof(SparseElement) * (nnz + 1));
+
+    for (pos = 0; pos < nnz; pos++) {
+        while (isspace((unsigned char) *ptr)) ptr++;
+
+        errno = 0;
+        id = strtol(ptr, &end, 10);
+        if (end == ptr || errno == ERANGE || id < PG_INT32_MIN || id > PG_INT32_MAX)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type sparsevec: \"%s\"", str)));
+        elements[pos].id = (int32) id;
+        ptr = end;
+
+        while (isspace((unsigned char) *ptr)) ptr++;
+        if (*ptr != ':')
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type sparsevec: \"%s\"", str),
+                            errdetail("Elements must be given as id:weight.")));
+        ptr++;
+
+        errno = 0;
+        elements[pos].weight = strtof(ptr, &end);
+        if (end == ptr)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type sparsevec: \"%s\"", str)));
+        if (errno == ERANGE && isinf(elements[pos].weight))
+            ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                            errmsg("\"%.*s\" is out of range for type real", (int) (end - ptr), ptr)));
+        ptr = end;
+
+        while (isspace((unsigned char) *ptr)) ptr++;
+        if (*ptr != ((pos < nnz -1) ? ',' : '}'))
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for type sparsevec: \"%s\"", str)));
+        ptr++;
+    }
+    if (nnz == 0) {
+        while (isspace((unsigned char) *ptr)) ptr++;
+        ptr++;      // '}'
+    }
+
+    while (isspace((unsigned char) *ptr)) ptr++;
+    if (*ptr != '\0')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("invalid input syntax for type sparsevec: \"%s\"", str),
+                        errdetail("Junk after closing bracket.")));
+
+    PG_RETURN_SVECTOR_P(svec_build(elements, nnz));
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_out);
+/****************************************************************************************************
+ * sparsevec output - '{id:weight,...}'
+ * @param vector sparsevec
+ */
+Datum 
+c_sparsevec_out(PG_FUNCTION_ARGS) {
+    SparseVector*   vector = PG_GETARG_SVECTOR_P(0);
+    const uint8*    ptr = SVEC_IDS(vector);
+    int32           id = 0;
+    int             pos;
+    StringInfoData  buf;
+
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '{');
+    for (pos = 0; pos < vector->nnz; pos++) {
+        id = SVEC_NEXT_ID(id, ptr);
+        if (pos > 0) appendStringInfoChar(&buf, ',');
+        appendStringInfo(&buf, "%d:", id);
+        appendStringInfoString(&buf, DatumGetCString(DirectFunctionCall1(float4out, Float4GetDatum(SVEC_WEIGHTS(vector)[pos]))));
+    }
+    appendStringInfoChar(&buf, '}');
+
+    PG_RETURN_CSTRING(buf.data);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_recv);
+/****************************************************************************************************
+ * sparsevec binary input - int4 number of elements and the int4 id, float4 weight pairs
+ * @param buf internal
+ * @param typelem oid
+ * @param typmod int4
+ */
+Datum 
+c_sparsevec_recv(PG_FUNCTION_ARGS) {
+    StringInfo      buf = (StringInfo) PG_GETARG_POINTER(0);
+    int             nnz = pq_getmsgint(buf, sizeof(int32));
+    int             pos;
+    SparseElement*  elements;
+
+    if (nnz < 0 || nnz > SVEC_MAX_NNZ)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid number of sparsevec elements: %d", nnz)));
+
+    elements = (SparseElement*) palloc(sizeof(SparseElement) * (nnz + 1));
+    for (pos = 0; pos < nnz; pos++) {
+        elements[pos].id = pq_getmsgint(buf, sizeof(int32));
+        elements[pos].weight = pq_getmsgfloat4(buf);
+    }
+
+    PG_RETURN_SVECTOR_P(svec_build(elements, nnz));
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_send);
+/****************************************************************************************************
+ * sparsevec binary output - int4 number of elements and the int4 id, float4 weight pairs
+ * @param vector sparsevec
+ */
+Datum 
+c_sparsevec_send(PG_FUNCTION_ARGS) {
+    SparseVector*   vector = PG_GETARG_SVECTOR_P(0);
+    const uint8*    ptr = SVEC_IDS(vector);
+    int32           id = 0;
+    int             pos;
+    StringInfoData  buf;
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, vector->nnz);
+    for (pos = 0; pos < vector->nnz; pos++) {
+        id = SVEC_NEXT_ID(id, ptr);
+        pq_sendint32(&buf, id);
+        pq_sendfloat4(&buf, SVEC_WEIGHTS(vector)[pos]);
+    }
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_from_arrays);
+/****************************************************************************************************
+ * sparsevec of the ids and weights arrays (the rating_cosine arguments)
+ * @param elements int4[]
+ * @param weights float[]
+ */
+Datum 
+c_sparsevec_from_arrays(PG_FUNCTION_ARGS) {
+    ArrayType*      vector = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*      weight = PG_GETARG_ARRAYTYPE_P(1);
+    int             nnz = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    int32*          ptr;
+    float4*         ptrw;
+    int             pos;
+    SparseElement*  elements;
+
+    if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector) || ARR_NDIM(weight) > 1 || ARR_HASNULL(weight))
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("array must be one-dimensional and must not contain NULLs")));
+    if (nnz != ArrayGetNItems(ARR_NDIM(weight), ARR_DIMS(weight)))
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("weight arrays must be of the same size as key arrays")));
+
+    ptr = (int32*) ARR_DATA_PTR(vector);
+    ptrw = (float4*) ARR_DATA_PTR(weight);
+    elements = (SparseElement*) palloc(sizeof(SparseElement) * (nnz + 1));
+    for (pos = 0; pos < nnz; pos++) {
+        elements[pos].id = ptr[pos];
+        elements[pos].weight = ptrw[pos];
+    }
+
+    PG_RETURN_SVECTOR_P(svec_build(elements, nnz));
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_ids);
+/****************************************************************************************************
+ * Ids (elements) of the sparse vector - int4[]
+ * @param vector sparsevec
+ */
+Datum 
+c_sparsevec_ids(PG_FUNCTION_ARGS) {
+    SparseVector*   vector = PG_GETARG_SVECTOR_P(0);
+    ArrayType*      result;
+    int32*          ids;
+
+    if (vector->nnz == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT4OID));
+
+    result = array_new(vector->nnz, INT4OID);
+    ids = svec_ids(vector);
+    memcpy(ARR_DATA_PTR(result), ids, sizeof(int32) * vector->nnz);
+    pfree(ids);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_weights);
+/****************************************************************************************************
+ * Weights of the sparse vector - float[] (in the order of ids)
+ * @param vector sparsevec
+ */
+Datum 
+c_sparsevec_weights(PG_FUNCTION_ARGS) {
+    SparseVector*   vector = PG_GETARG_SVECTOR_P(0);
+    ArrayType*      result;
+
+    if (vector->nnz == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(vector->nnz);
+    memcpy(ARR_DATA_PTR(result), SVEC_WEIGHTS(vector), sizeof(float4) * vector->nnz);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_norm);
+/****************************************************************************************************
+ * L2 norm of the sparse vector weights (as rating_normalize_vect, stored in the value)
+ * @param vector sparsevec
+ */
+Datum 
+c_sparsevec_norm(PG_FUNCTION_ARGS) {
+    SparseVector*   vector = PG_GETARG_SVECTOR_P(0);
+
+    PG_RETURN_FLOAT4(vector->norm);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_cosine);
+/****************************************************************************************************
+ * Counts cosine rating of two sparse vectors (using their norms).
+ * @param vector1 sparsevec
+ * @param vector2 sparsevec
+ */
+Datum 
+c_sparsevec_cosine(PG_FUNCTION_ARGS) {
+    float4      rating = 0;
+    float4      norm1 = 0;
+    float4      norm2 = 0;
+
+    //                  |dq.dd|
+    //    r(dq, dd) = -----------
+    //                 |dq|x|dd|
+    //
+    svec_rating(fcinfo, STAT_SPARSEVEC_COSINE, &rating, &norm1, &norm2);
+
+    // if the rating is 0 or it may cause division by 0, return 0
+    if (rating == 0 || norm1 == 0 || norm2 == 0) PG_RETURN_FLOAT4(rating);
+
+    PG_RETURN_FLOAT4(rating / (norm1 * norm2));
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_dot);
+/****************************************************************************************************
+ * Counts dot product of two sparse vectors (the cosine rating of normalized weights).
+ * @param vector1 sparsevec
+ * @param vector2 sparsevec
+ */
+Datum 
+c_sparsevec_dot(PG_FUNCTION_ARGS) {
+    float4      rating = 0;
+
+    svec_rating(fcinfo, STAT_SPARSEVEC_DOT, &rating, NULL, NULL);
+
+    PG_RETURN_FLOAT4(rating);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_boolean);
+/****************************************************************************************************
+ * Counts boolean rating of two sparse vectors (the number of common ids).
+ * @param vector1 sparsevec
+ * @param vector2 sparsevec
+ */
+Datum 
+c_sparsevec_boolean(PG_FUNCTION_ARGS) {
+    PG_RETURN_INT32(svec_rating(fcinfo, STAT_SPARSEVEC_BOOLEAN, NULL, NULL, NULL));
+}
+
+
+/****************************************************************************************************
+ * Multi-query ratings
+ * A batch evaluation scores the same collection against many queries. Their elements are merged into
+ * one term table - the union of the ids (a query cache lookup), each with the postings of the queries it
+ * occurs in - so a document is walked once for all of them (cached in fn_extra if the queries are stable).
+ ****************************************************************************************************/
+
+typedef struct MultiPosting {
+    int32       id;
+    int32       query;
+    float4      weight;
+} MultiPosting;
+
+typedef struct MultiQueryCache {
+    int         count;          // queries
+    QueryCache  terms;          // the union of the query ids
+    int32*      offsets;        // the postings of a term: offsets[term] .. offsets[term + 1] - 1
+    int32*      queries;        // the query of a posting
+    float4*     weights;        // and its weight
+    float4*     norms;          // L2 norms of the queries (sparsevec), 0 otherwise
+} MultiQueryCache;
+
+static int multi_posting_cmp(const void* a, const void* b) {
+    const MultiPosting* p1 = (const MultiPosting*) a;
+    const MultiPosting* p2 = (const MultiPosting*) b;
+
+    if (p1->id != p2->id) return (p1->id > p2->id) - (p1->id < p2->id);
+    return (p1->query > p2->query) - (p1->query < p2->query);
+}
+
+/*
+ * Builds the term table of the postings (sorted here, in the current memory context)
+ */
+static void multi_query_build(MultiQueryCache* mq, MultiPosting* postings, int size) {
+    int32*  ids = (int32*) palloc(sizeof(int32) * (size + 1));
+    int     terms = 0;
+    int     count = 0;
+    int     pos;
+
+    mq->offsets = (int32*) palloc(sizeof(int32) * (size + 2));
+    mq->queries = (int32*) palloc(sizeof(int32) * (size + 1));
+    mq->weights = (float4*) palloc(sizeof(float4) * (size + 1));
+
+    qsort(postings, size, sizeof(MultiPosting), multi_posting_cmp);
+    for (pos = 0; pos < size; pos++) {
+        if (pos > 0 && postings[pos].id == postings[pos - 1].id && postings[pos].query == postings[pos - 1].query)
+            continue;       // the first repetition wins
+
+        if (terms == 0 || postings[pos].id != ids[terms - 1]) {
+            ids[terms] = postings[pos].id;
+            mq->offsets[terms++] = count;
+        }
+        mq->queries[count] = postings[pos].query;
+        mq->weights[count++] = postings[pos].weight;
+    }
+    mq->offsets[terms] = count;
+
+    query_cache_build(&mq->terms, ids, terms);
+    pfree(ids);
+}
+
+/*
+ * The postings of int[][] queries - a row per query, NULLs pad the shorter ones (a 1-D array is a single query)
+ */
+static MultiPosting* multi_query_int(MultiQueryCache* mq, ArrayType* queries, int* size) {
+    Datum*          values;
+    bool*           nulls;
+    MultiPosting*   postings;
+    int             nitems;
+    int             width;
+    int             pos;
+
+    if (ARR_NDIM(queries) > 2) {
+        ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                        errmsg("queries must be a one or two dimensional array")));
+    }
+
+    deconstruct_array(queries, INT4OID, sizeof(int32), true, 'i', &values, &nulls, &nitems);
+    mq->count = (ARR_NDIM(queries) == 2) ? ARR_DIMS(queries)[0] : (nitems > 0);
+    width = (mq->count > 0) ? nitems / mq->count : 0;
+    mq->norms = (float4*) palloc0(sizeof(float4) * (mq->count + 1));
+
+    postings = (MultiPosting*) palloc(sizeof(MultiPosting) * (nitems + 1));
+    *size = 0;
+    for (pos = 0; pos < nitems; pos++) {
+        if (nulls[pos]) continue;
+        postings[*size].id = DatumGetInt32(values[pos]);
+        postings[*size].query = pos / width;
+        postings[(*size)++].weight = 1;
+    }
+
+    pfree(values);
+    pfree(nulls);
+    return postings;
+}
+
+/*
+ * The postings of sparsevec[] queries (a NULL query matches nothing)
+ */
+static MultiPosting* multi_query_svec(MultiQueryCache* mq, ArrayType* queries, int* size) {
+    TypeCacheEntry* typentry = lookup_type_cache(ARR_ELEMTYPE(queries), 0);
+    Datum*          values;
+    bool*           nulls;
+    MultiPosting*   postings;
+    int             nnz = 0;
+    int             query;
+    int             pos;
+
+    deconstruct_array(queries, ARR_ELEMTYPE(queries), typentry->typlen, typentry->typbyval, typentry->typalign,
+                      &values, &nulls, &mq->count);
+    mq->norms = (float4*) palloc0(sizeof(float4) * (mq->count + 1));
+
+    for (query = 0; query < mq->count; query++) {
+        if (nulls[query]) continue;
+        values[query] = PointerGetDatum(DatumGetSparseVector(values[query]));
+        nnz += ((SparseVector*) DatumGetPointer(values[query]))->nnz;
+    }
+
+    postings = (MultiPosting*) palloc(sizeof(MultiPosting) * (nnz + 1));
+    *size = 0;
+    for (query = 0; query < mq->count; query++) {
+        SparseVector*   vector;
+        const uint8*    ptr;
+        int32           id = 0;
+
+        if (nulls[query]) continue;
+        vector = (SparseVector*) DatumGetPointer(values[query]);
+        ptr = SVEC_IDS(vector);
+        for (pos = 0; pos < vector->nnz; pos++) {
+            id = SVEC_NEXT_ID(id, ptr);
+            postings[*size].id = id;
+            postings[*size].query = query;
+            postings[(*size)++].weight = SVEC_WEIGHTS(vector)[pos];
+        }
+        mq->norms[query] = vector->norm;
+    }
+
+    pfree(values);
+    pfree(nulls);
+    return postings;
+}
+
+/*
+ * Returns the term table of the queries (the argument arg, int[][] or sparsevec[]) - cached if stable
+ */
+static MultiQueryCache* multi_query_cache(FunctionCallInfo fcinfo, int arg) {
+    MultiQueryCache*    mq = (MultiQueryCache*) fcinfo->flinfo->fn_extra;
+    ArrayType*          queries;
+    MemoryContext       oldcontext;
+    MultiPosting*       postings;
+    bool                stable;
+    int                 size;
+
+    if (mq != NULL) return mq;
+
+    stable = get_fn_expr_arg_stable(fcinfo->flinfo, arg);
+    queries = PG_GETARG_ARRAYTYPE_P(arg);
+
+    oldcontext = MemoryContextSwitchTo(stable ? fcinfo->flinfo->fn_mcxt : CurrentMemoryContext);
+    mq = (MultiQueryCache*) palloc0(sizeof(MultiQueryCache));
+    postings = (ARR_ELEMTYPE(queries) == INT4OID) ? multi_query_int(mq, queries, &size) : multi_query_svec(mq, queries, &size);
+    multi_query_build(mq, postings, size);
+    pfree(postings);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (stable) fcinfo->flinfo->fn_extra = (void*) mq;
+    return mq;
+}
+
+/*
+ * Adds a document element to the ratings (or the numbers of common elements) of all the queries, returns
+ * whether it is in any
+ */
+static inline int multi_query_add(const MultiQueryCache* mq, int32 id, float4 weight, float4* ratings, int32* counts) {
+    int     term = query_cache_find(&mq->terms, id);
+    int     pos;
+
+    if (term < 0) return 0;
+
+    for (pos = mq->offsets[term]; pos < mq->offsets[term + 1]; pos++) {
+        if (ratings != NULL) ratings[mq->queries[pos]] += (mq->weights[pos] * weight);
+        else counts[mq->queries[pos]]++;
+    }
+    return 1;
+}
+
+// the cosine normalization of the ratings by the query norms and the document norm
+static void multi_query_normalize(const MultiQueryCache* mq, float4* ratings, float4 norm) {
+    int     query;
+
+    for (query = 0; query < mq->count; query++) {
+        // if the rating is 0 or it may cause division by 0, keep it
+        if (ratings[query] == 0 || mq->norms[query] == 0 || norm == 0) continue;
+        ratings[query] /= (mq->norms[query] * norm);
+    }
+}
+
+
+PG_FUNCTION_INFO_V1(c_rating_cosine_multi);
+/****************************************************************************************************
+ * Cosine ratings of a document against many queries in one pass - the real[] of the query ratings.
+ * @param elements int4[]
+ * @param weights float[]
+ * @param queries sparsevec[]
+ */
+Datum 
+c_rating_cosine_multi(PG_FUNCTION_ARGS) {
+    uint64              started = STATS_CLOCK();    // pgsiftorder.stats
+    MultiQueryCache*    mq = multi_query_cache(fcinfo, 2);
+    ArrayType*          vector = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*          weight = PG_GETARG_ARRAYTYPE_P(1);
+    uint64              detoasted = STATS_CLOCK();
+    int                 length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    int32*              ptr = (int32*) ARR_DATA_PTR(vector);
+    float4*             ptrw = (float4*) ARR_DATA_PTR(weight);
+    ArrayType*          result;
+    float4*             ratings;
+    int                 matches = 0;
+    int                 pos;
+
+    // check length of weights - for SIGSEGV :)
+    if (length > ArrayGetNItems(ARR_NDIM(weight), ARR_DIMS(weight))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                       errmsg("weight arrays must be of the same size as key arrays")));
+    }
+
+    if (mq->count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(mq->count);
+    ratings = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < length; pos++) matches += multi_query_add(mq, ptr[pos], ptrw[pos], ratings, NULL);
+    multi_query_normalize(mq, ratings, sqrt(sparse_sum_squares(ptrw, length)));
+
+    STATS_COUNT(STAT_RATING_COSINE_MULTI, started, detoasted, mq->terms.length + length, MIN(mq->terms.length, length), matches);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_rating_boolean_multi);
+/****************************************************************************************************
+ * Boolean ratings of a document against many queries in one pass - the int[] of the common elements.
+ * @param elements int4[]
+ * @param queries int4[][] (a row per query, NULL padded) or sparsevec[]
+ */
+Datum 
+c_rating_boolean_multi(PG_FUNCTION_ARGS) {
+    uint64              started = STATS_CLOCK();    // pgsiftorder.stats
+    MultiQueryCache*    mq = multi_query_cache(fcinfo, 1);
+    ArrayType*          vector = PG_GETARG_ARRAYTYPE_P(0);
+    uint64              detoasted = STATS_CLOCK();
+    int                 length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    int32*              ptr = (int32*) ARR_DATA_PTR(vector);
+    ArrayType*          result;
+    int                 matches = 0;
+    int                 pos;
+
+    if (mq->count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT4OID));
+
+    result = array_new(mq->count, INT4OID);
+    for (pos = 0; pos < length; pos++) matches += multi_query_add(mq, ptr[pos], 1, NULL, (int32*) ARR_DATA_PTR(result));
+
+    STATS_COUNT(STAT_RATING_BOOLEAN_MULTI, started, detoasted, mq->terms.length + length, MIN(mq->terms.length, length), matches);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_cosine_multi);
+/****************************************************************************************************
+ * Cosine ratings of a sparse vector against many queries in one pass (the stored norms)
+ * @param vector sparsevec
+ * @param queries sparsevec[]
+ */
+Datum 
+c_sparsevec_cosine_multi(PG_FUNCTION_ARGS) {
+    uint64              started = STATS_CLOCK();    // pgsiftorder.stats
+    MultiQueryCache*    mq = multi_query_cache(fcinfo, 1);
+    SparseVector*       vector = PG_GETARG_SVECTOR_P(0);
+    uint64              detoasted = STATS_CLOCK();
+    const uint8*        ptr = SVEC_IDS(vector);
+    ArrayType*          result;
+    float4*             ratings;
+    int32               id = 0;
+    int                 matches = 0;
+    int                 pos;
+
+    if (mq->count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT4OID));
+
+    result = array_new_real(mq->count);
+    ratings = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < vector->nnz; pos++) {
+        id = SVEC_NEXT_ID(id, ptr);
+        matches += multi_query_add(mq, id, SVEC_WEIGHTS(vector)[pos], ratings, NULL);
+    }
+    multi_query_normalize(mq, ratings, vector->norm);
+
+    STATS_COUNT(STAT_SPARSEVEC_COSINE_MULTI, started, detoasted, mq->terms.length + vector->nnz, MIN(mq->terms.length, vector->nnz), matches);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_sparsevec_boolean_multi);
+/****************************************************************************************************
+ * Boolean ratings of a sparse vector against many queries in one pass
+ * @param vector sparsevec
+ * @param queries int4[][] (a row per query, NULL padded) or sparsevec[]
+ */
+Datum 
+c_sparsevec_boolean_multi(PG_FUNCTION_ARGS) {
+    uint64              started = STATS_CLOCK();    // pgsiftorder.stats
+    MultiQueryCache*    mq = multi_query_cache(fcinfo, 1);
+    SparseVector*       vector = PG_GETARG_SVECTOR_P(0);
+    uint64              detoasted = STATS_CLOCK();
+    const uint8*        ptr = SVEC_IDS(vector);
+    ArrayType*          result;
+    int32               id = 0;
+    int                 matches = 0;
+    int                 pos;
+
+    if (mq->count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT4OID));
+
+    result = array_new(mq->count, INT4OID);
+    for (pos = 0; pos < vector->nnz; pos++) {
+        id = SVEC_NEXT_ID(id, ptr);
+        matches += multi_query_add(mq, id, 1, NULL, (int32*) ARR_DATA_PTR(result));
+    }
+
+    STATS_COUNT(STAT_SPARSEVEC_BOOLEAN_MULTI, started, detoasted, mq->terms.length + vector->nnz, MIN(mq->terms.length, vector->nnz), matches);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+/****************************************************************************************************
+ * Binary signatures
+ * A cheap filter stage before the exact distances - the sign-of-projection (Hamming embedding) signature
+ * of a vector as bytea or bit(n), compared by the popcount Hamming distance (see bit_hamming).
+ ****************************************************************************************************/
+
+#define SIGNATURE_MAX_BITS (64 * 1024)
+
+typedef struct SignatureCache {
+    int         bits;
+    int         length;
+    float4*     projection;     // bits x length
+    float4*     thresholds;     // NULL ~ 0
+} SignatureCache;
+
+/*
+ * The projection real[bits][length] (the argument 1) and its thresholds real[bits] (the argument 2 if
+ * given), checked and cached if stable
+ */
+static SignatureCache* signature_cache(FunctionCallInfo fcinfo, int length) {
+    SignatureCache* sc = (SignatureCache*) fcinfo->flinfo->fn_extra;
+    ArrayType*      projection;
+    ArrayType*      thresholds = NULL;
+    bool            stable;
+    int             bits;
+
+    if (sc != NULL && sc->length == length) return sc;
+
+    projection = PG_GETARG_ARRAYTYPE_P(1);
+    if (ARR_NDIM(projection) != 2 || ARR_HASNULL(projection) || ARR_DIMS(projection)[1] != length) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("the projection must be real[bits][%d] without NULLs", length)));
+    }
+    bits = ARR_DIMS(projection)[0];
+    if (bits < 1 || bits > SIGNATURE_MAX_BITS) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("signatures must have 1 to %d bits", SIGNATURE_MAX_BITS)));
+    }
+    if (PG_NARGS() > 2) {
+        thresholds = PG_GETARG_ARRAYTYPE_P(2);
+        if (ARR_HASNULL(thresholds) || ArrayGetNItems(ARR_NDIM(thresholds), ARR_DIMS(thresholds)) != bits) {
+            ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                            errmsg("the thresholds must be real[%d] without NULLs", bits)));
+        }
+    }
+
+    stable = (sc == NULL) && get_fn_expr_arg_stable(fcinfo->flinfo, 1) && (thresholds == NULL || get_fn_expr_arg_stable(fcinfo->flinfo, 2));
+    if (stable) {
+        sc = (SignatureCache*) MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(SignatureCache));
+        sc->projection = (float4*) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(float4) * bits * length);
+        memcpy(sc->projection, ARR_DATA_PTR(projection), sizeof(float4) * bits * length);
+        if (thresholds != NULL) {
+            sc->thresholds = (float4*) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(float4) * bits);
+            memcpy(sc->thresholds, ARR_DATA_PTR(thresholds), sizeof(float4) * bits);
+        }
+        fcinfo->flinfo->fn_extra = (void*) sc;
+    }
+    else {
+        sc = (SignatureCache*) palloc0(sizeof(SignatureCache));
+        sc->projection = (float4*) ARR_DATA_PTR(projection);
+        sc->thresholds = (thresholds != NULL) ? (float4*) ARR_DATA_PTR(thresholds) : NULL;
+    }
+    sc->bits = bits;
+    sc->length = length;
+
+    return sc;
+}
+
+// the signatures to compare must be of the same length
+static void signature_same_length(int length1, int length2) {
+    if (length1 != length2) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("signatures must be of the same length (%d and %d)", length1, length2)));
+    }
+}
+
+/*
+ * The candidate signatures bytea[] - their data pointers (all of the query length)
+ */
+static const uint8** hamming_candidates(ArrayType* candidates, int length, int* count) {
+    Datum*          values;
+    bool*           nulls;
+    const uint8**   rows;
+    int             pos;
+
+    if (ARR_HASNULL(candidates)) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("candidates must not contain NULLs")));
+    }
+
+    deconstruct_array(candidates, BYTEAOID, -1, false, 'i', &values, &nulls, count);
+    rows = (const uint8**) palloc(sizeof(uint8*) * (*count + 1));
+    for (pos = 0; pos < *count; pos++) {
+        bytea* signature = DatumGetByteaPP(values[pos]);
+
+        signature_same_length(length, VARSIZE_ANY_EXHDR(signature));
+        rows[pos] = (const uint8*) VARDATA_ANY(signature);
+    }
+
+    pfree(values);
+    pfree(nulls);
+    return rows;
+}
+
+
+PG_FUNCTION_INFO_V1(c_signature);
+/****************************************************************************************************
+ * Binary signature of a vector - the bit r is set if the projection on the row r exceeds the threshold r
+ * (the sign of the random projections without thresholds, the Hamming embedding with the medians).
+ * @param elements real[] or int4[]
+ * @param projection real[bits][length], e.g. signature_projection(bits, length)
+ * @param thresholds real[bits] (optional)
+ * @return bytea of (bits + 7) / 8 bytes, the most significant bit first
+ */
+Datum 
+c_signature(PG_FUNCTION_ARGS) {
+    uint64          started = STATS_CLOCK();    // pgsiftorder.stats
+    ArrayType*      vector = PG_GETARG_ARRAYTYPE_P(0);
+    uint64          detoasted = STATS_CLOCK();
+    int             length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    SignatureCache* sc = signature_cache(fcinfo, length);
+    float4*         x = (float4*) ARR_DATA_PTR(vector);
+    bytea*          result = (bytea*) palloc(VARHDRSZ + (sc->bits + 7) / 8);
+    int             pos;
+
+    if (ARR_HASNULL(vector)) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("vector must not contain NULLs")));
+    }
+    if (ARR_ELEMTYPE(vector) == INT4OID) {
+        int32*  ptr = (int32*) ARR_DATA_PTR(vector);
+
+        x = (float4*) palloc(sizeof(float4) * (length + 1));
+        for (pos = 0; pos < length; pos++) x[pos] = (float4) ptr[pos];
+    }
+
+    SET_VARSIZE(result, VARHDRSZ + (sc->bits + 7) / 8);
+    signature_bits(sc->projection, sc->thresholds, x, sc->bits, length, (uint8*) VARDATA(result));
+
+    STATS_COUNT(STAT_SIGNATURE, started, detoasted, (uint64) length * (sc->bits + 1), 0, 0);
+    PG_RETURN_BYTEA_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_signature_projection);
+/****************************************************************************************************
+ * A random projection real[bits][length] of the signatures - N(0, 1) elements, the same for the same seed
+ * @param bits int4
+ * @param length int4
+ * @param seed int4
+ */
+Datum 
+c_signature_projection(PG_FUNCTION_ARGS) {
+    int32       bits = PG_GETARG_INT32(0);
+    int32       length = PG_GETARG_INT32(1);
+    uint64      state = (uint64) (uint32) PG_GETARG_INT32(2) * 0x9E3779B97F4A7C15ULL;
+    ArrayType*  result;
+    float4*     ptr;
+    int         nbytes;
+    int         pos;
+
+    if (bits < 1 || bits > SIGNATURE_MAX_BITS || length < 1 || (int64) bits * length > MaxAllocSize / sizeof(float4) / 2) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("invalid projection size %d x %d", bits, length)));
+    }
+
+    nbytes = ARR_OVERHEAD_NONULLS(2) + sizeof(float4) * bits * length;
+    result = (ArrayType*) palloc0(nbytes);
+    SET_VARSIZE(result, nbytes);
+    ARR_NDIM(result) = 2;
+    result->dataoffset = 0;         /* marker for no null bitmap */
+    ARR_ELEMTYPE(result) = FLOAT4OID;
+    ARR_DIMS(result)[0] = bits;
+    ARR_DIMS(result)[1] = length;
+    ARR_LBOUND(result)[0] = ARR_LBOUND(result)[1] = 1;
+
+    // Box-Muller of the splitmix64 sequence (independent of the server random())
+    ptr = (float4*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < bits * length; pos += 2) {
+        double  u[2];
+        int     i;
+
+        for (i = 0; i < 2; i++) {
+            uint64 z = (state += 0x9E3779B97F4A7C15ULL);
+
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            u[i] = ((z ^ (z >> 31)) >> 11) * (1.0 / 9007199254740992.0);     // [0, 1)
+        }
+        ptr[pos] = (float4) (sqrt(-2.0 * log(1.0 - u[0])) * cos(2.0 * M_PI * u[1]));
+        if (pos + 1 < bits * length) ptr[pos + 1] = (float4) (sqrt(-2.0 * log(1.0 - u[0])) * sin(2.0 * M_PI * u[1]));
+    }
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_signature_to_bit);
+/****************************************************************************************************
+ * Signature bytea to bit varying (8 bits a byte, e.g. signature_to_bit(signature(...))::bit(64))
+ * @param signature bytea
+ */
+Datum 
+c_signature_to_bit(PG_FUNCTION_ARGS) {
+    bytea*      signature = PG_GETARG_BYTEA_PP(0);
+    int         length = VARSIZE_ANY_EXHDR(signature);
+    VarBit*     result = (VarBit*) palloc0(VARBITTOTALLEN(length * 8));
+
+    SET_VARSIZE(result, VARBITTOTALLEN(length * 8));
+    VARBITLEN(result) = length * 8;
+    memcpy(VARBITS(result), VARDATA_ANY(signature), length);
+
+    PG_RETURN_VARBIT_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_hamming_distance);
+/****************************************************************************************************
+ * Hamming distance of two signatures - the number of different bits (POPCNT)
+ * @param signature1 bytea
+ * @param signature2 bytea
+ */
+Datum 
+c_hamming_distance(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    bytea*      signature1 = PG_GETARG_BYTEA_PP(0);
+    bytea*      signature2 = PG_GETARG_BYTEA_PP(1);
+    uint64      detoasted = STATS_CLOCK();
+    int         length = VARSIZE_ANY_EXHDR(signature1);
+    int32       distance;
+
+    signature_same_length(length, VARSIZE_ANY_EXHDR(signature2));
+    distance = (int32) bit_hamming((uint8*) VARDATA_ANY(signature1), (uint8*) VARDATA_ANY(signature2), length);
+
+    STATS_COUNT(STAT_HAMMING_DISTANCE, started, detoasted, 2 * length, 0, 0);
+    PG_RETURN_INT32(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_hamming_distance_bit);
+/****************************************************************************************************
+ * Hamming distance of two bit strings (the padding bits of the last byte are zeros)
+ * @param signature1 bit varying
+ * @param signature2 bit varying
+ */
+Datum 
+c_hamming_distance_bit(PG_FUNCTION_ARGS) {
+    uint64      started = STATS_CLOCK();        // pgsiftorder.stats
+    VarBit*     signature1 = PG_GETARG_VARBIT_P(0);
+    VarBit*     signature2 = PG_GETARG_VARBIT_P(1);
+    uint64      detoasted = STATS_CLOCK();
+    int32       distance;
+
+    signature_same_length(VARBITLEN(signature1), VARBITLEN(signature2));
+    distance = (int32) bit_hamming(VARBITS(signature1), VARBITS(signature2), VARBITBYTES(signature1));
+
+    STATS_COUNT(STAT_HAMMING_DISTANCE, started, detoasted, 2 * VARBITBYTES(signature1), 0, 0);
+    PG_RETURN_INT32(distance);
+}
+
+
+PG_FUNCTION_INFO_V1(c_hamming_distance_batch);
+/****************************************************************************************************
+ * Hamming distances of the query signature to each of the candidates at once
+ * @param query bytea
+ * @param candidates bytea[]
+ * @return int4[] - a distance per candidate
+ */
+Datum 
+c_hamming_distance_batch(PG_FUNCTION_ARGS) {
+    uint64          started = STATS_CLOCK();    // pgsiftorder.stats
+    bytea*          query = PG_GETARG_BYTEA_PP(0);
+    ArrayType*      candidates = PG_GETARG_ARRAYTYPE_P(1);
+    int             length = VARSIZE_ANY_EXHDR(query);
+    int             count;
+    const uint8**   rows = hamming_candidates(candidates, length, &count);
+    uint64          detoasted = STATS_CLOCK();
+    ArrayType*      result;
+    int32*          ptr;
+    int             pos;
+
+    if (count == 0) PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT4OID));
+
+    result = array_new(count, INT4OID);
+    ptr = (int32*) ARR_DATA_PTR(result);
+    for (pos = 0; pos < count; pos++) ptr[pos] = (int32) bit_hamming((uint8*) VARDATA_ANY(query), rows[pos], length);
+
+    STATS_COUNT(STAT_HAMMING_DISTANCE_BATCH, started, detoasted, (uint64) length * (count + 1), 0, 0);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_hamming_topk);
+/****************************************************************************************************
+ * The k candidate signatures nearest to the query (Hamming distance) - the 1 based indexes and distances,
+ * the survivors of the filter stage to re-rank by the exact distance
+ * @param query bytea
+ * @param candidates bytea[]
+ * @param k int4
+ * @return SETOF (index int4, distance int4) ordered by the distance
+ */
+Datum 
+c_hamming_topk(PG_FUNCTION_ARGS) {
+    FuncCallContext*  funcctx;
+    DistanceTopK*     heap;
+
+    if (SRF_IS_FIRSTCALL()) {
+        MemoryContext   oldcontext;
+        bytea*          query;
+        TupleDesc       tupdesc;
+        const uint8**   rows;
+        float4*         distances;
+        int             length, count, pos;
+        int             k = PG_GETARG_INT32(2);
+        uint64          started = STATS_CLOCK();        // pgsiftorder.stats
+        uint64          detoasted;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("function returning record called in context that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        query = PG_GETARG_BYTEA_PP(0);
+        length = VARSIZE_ANY_EXHDR(query);
+        rows = hamming_candidates(PG_GETARG_ARRAYTYPE_P(1), length, &count);
+        detoasted = STATS_CLOCK();
+
+        // the bit counts are exact in float4, the heap of distance_square_topk() is reused
+        k = MIN(MAX(k, 0), count);
+        heap = (DistanceTopK*) palloc(sizeof(DistanceTopK) * MAX(k, 1));
+        if (k > 0) {
+            distances = (float4*) palloc(sizeof(float4) * count);
+            for (pos = 0; pos < count; pos++) distances[pos] = (float4) bit_hamming((uint8*) VARDATA_ANY(query), rows[pos], length);
+            k = topk_select(distances, count, k, heap);
+            pfree(distances);
+        }
+        STATS_COUNT(STAT_HAMMING_TOPK, started, detoasted, (uint64) length * (count + 1), 0, 0);
+
+        funcctx->user_fctx = heap;
+        funcctx->max_calls = k;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    heap = (DistanceTopK*) funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        Datum       values[2];
+        bool        nulls[2] = {false, false};
+        HeapTuple   tuple;
+
+        values[0] = Int32GetDatum(heap[funcctx->call_cntr].index);
+        values[1] = Int32GetDatum((int32) heap[funcctx->call_cntr].distance);
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,197 @@
+/* 
+ * File:   pgsiftorder.h
+ * Author: chmelarp
+ *
+ * Declarations shared by the pgsiftorder translation units (the library itself and the index).
+ * 
+ * See the README.txt for reference!
+ */
+
+#ifndef _PGSIFTORDER_H
+#define	_PGSIFTORDER_H
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <utils/array.h>
+
+#include "pgsiftorder_kernels.h"    // the dense, byte and sparse kernels, selected by CPUID in _PG_init()
+
+
+/*
+ * Dense vector type fvec(n) - a varlena header and the float4 payload
+ */
+#define FVEC_MAX_DIM 16000
+
+typedef struct FVector {
+    int32       vl_len_;        // varlena header (do not touch directly!)
+    float4      x[FLEXIBLE_ARRAY_MEMBER];
+} FVector;
+
+#define FVEC_DIM(v)             ((int) ((VARSIZE(v) - VARHDRSZ) / sizeof(float4)))
+#define FVEC_SIZE(dim)          (VARHDRSZ + sizeof(float4) * (dim))
+#define DatumGetFVector(x)      ((FVector*) PG_DETOAST_DATUM(x))
+#define PG_GETARG_FVECTOR_P(n)  DatumGetFVector(PG_GETARG_DATUM(n))
+#define PG_RETURN_FVECTOR_P(x)  PG_RETURN_POINTER(x)
+
+Datum c_fvec_in(PG_FUNCTION_ARGS);     // identifies the type (its oid is not fixed)
+
+
+/*
+ * Byte vector type bvec(n) - a varlena header and uint8 elements (quantized SIFT descriptors).
+ * It may be stored with a short (1 byte) header, so it is read by VARDATA_ANY without a copy.
+ */
+#define BVEC_MAX_DIM 16000      // the int32 kernel accumulators do not overflow up to this
+
+typedef struct BVector {
+    int32       vl_len_;        // varlena header (do not touch directly!)
+    uint8       x[FLEXIBLE_ARRAY_MEMBER];
+} BVector;
+
+#define BVEC_DIM(v)             ((int) VARSIZE_ANY_EXHDR(v))
+#define BVEC_DATA(v)            ((uint8*) VARDATA_ANY(v))
+#define BVEC_SIZE(dim)          (VARHDRSZ + (dim))
+#define DatumGetBVector(x)      ((BVector*) PG_DETOAST_DATUM_PACKED(x))
+#define PG_GETARG_BVECTOR_P(n)  DatumGetBVector(PG_GETARG_DATUM(n))
+#define PG_RETURN_BVECTOR_P(x)  PG_RETURN_POINTER(x)
+
+Datum c_bvec_in(PG_FUNCTION_ARGS);
+
+
+/*
+ * Sparse vector type sparsevec - sorted element ids (visual words, terms), their float4 weights and the
+ * L2 norm in one varlena. The weights go first (aligned), the ids follow as varbyte coded deltas.
+ */
+#define SVEC_MAX_NNZ (64 * 1024 * 1024)     // up to 9 bytes an element below MaxAllocSize
+
+typedef struct SparseVector {
+    int32       vl_len_;        // varlena header (do not touch directly!)
+    int32       nnz;            // number of elements
+    float4      norm;           // L2 norm of the weights
+    float4      x[FLEXIBLE_ARRAY_MEMBER];   // nnz weights, then the ids
+} SparseVector;
+
+#define SVEC_WEIGHTS(v)         ((v)->x)
+#define SVEC_IDS(v)             ((uint8*) ((v)->x + (v)->nnz))
+#define SVEC_SIZE(nnz, bytes)   (offsetof(SparseVector, x) + sizeof(float4) * (nnz) + (bytes))
+#define DatumGetSparseVector(x) ((SparseVector*) PG_DETOAST_DATUM(x))
+#define PG_GETARG_SVECTOR_P(n)  DatumGetSparseVector(PG_GETARG_DATUM(n))
+#define PG_RETURN_SVECTOR_P(x)  PG_RETURN_POINTER(x)
+
+
+/*
+ * Array helpers (pgsiftorder.c)
+ */
+ArrayType* array_new(int num, unsigned int oid);
+ArrayType* array_new_real(int num);
+
+
+/*
+ * Ratings of sorted sparse vectors (pgsiftorder.c) - rating_cosine, rating_cosine_norm and sift_search
+ */
+float4 sparse_rating(const int32* ids1, const float4* weights1, int length1,
+                     const int32* ids2, const float4* weights2, int length2, int* match1, int* match2, int* matches);
+float4 sparse_cosine(float4 rating, float8 norm1, float8 norm2);
+
+
+/*
+ * Runtime statistics (pgsiftorder_stats.c) - calls, elements, intersection hits and cycles of the entry
+ * points, counted per backend and added to the shared memory area (shared_preload_libraries only)
+ *
+ *     uint64 started = STATS_CLOCK();          // before the arguments are detoasted
+ *     ...
+ *     detoasted = STATS_CLOCK();               // the arguments are ready
+ *     ...
+ *     STATS_COUNT(STAT_RATING_COSINE, started, detoasted, length1 + length2, MIN(length1, length2), matches);
+ */
+typedef enum {
+    STAT_RATING_NORMALIZE_VECT,
+    STAT_RATING_COSINE_NORM,
+    STAT_RATING_COSINE,
+    STAT_RATING_BOOLEAN_INT,
+    STAT_RATING_BOOLEAN,
+    STAT_RATING_COSINE_NORM_INT8,
+    STAT_RATING_COSINE_INT8,
+    STAT_RATING_BOOLEAN_INT8,
+    STAT_TERM_IDS,
+    STAT_RATING_COSINE_MULTI,
+    STAT_RATING_BOOLEAN_MULTI,
+    STAT_DISTANCE_SQUARE_INT,
+    STAT_DISTANCE_SQUARE_REAL,
+    STAT_DISTANCE_SQUARE_BATCH,
+    STAT_DISTANCE_SQUARE_TOPK,
+    STAT_DISTANCE_SQUARE_BOUNDED_INT,
+    STAT_DISTANCE_SQUARE_BOUNDED_REAL,
+    STAT_DISTANCE_MANHATTAN_INT,
+    STAT_DISTANCE_MANHATTAN_REAL,
+    STAT_DISTANCE_CHESSBOARD_INT,
+    STAT_DISTANCE_COSINE_REAL,
+    STAT_DISTANCE_MAHALANOBIS_INT,
+    STAT_ARRAY_ACC_REAL,
+    STAT_TOPK_ACCUM,
+    STAT_FVEC_DISTANCE_SQUARE,
+    STAT_FVEC_DISTANCE_SQUARE_BOUNDED,
+    STAT_FVEC_DISTANCE_MANHATTAN,
+    STAT_FVEC_DISTANCE_CHESSBOARD,
+    STAT_FVEC_DISTANCE_COSINE,
+    STAT_FVEC_DISTANCE_MAHALANOBIS,
+    STAT_BVEC_DISTANCE_SQUARE,
+    STAT_BVEC_DISTANCE_MANHATTAN,
+    STAT_BVEC_DOT,
+    STAT_SPARSEVEC_COSINE,
+    STAT_SPARSEVEC_DOT,
+    STAT_SPARSEVEC_BOOLEAN,
+    STAT_SPARSEVEC_COSINE_MULTI,
+    STAT_SPARSEVEC_BOOLEAN_MULTI,
+    STAT_PQ_DISTANCE,
+    STAT_SIGNATURE,
+    STAT_HAMMING_DISTANCE,
+    STAT_HAMMING_DISTANCE_BATCH,
+    STAT_HAMMING_TOPK,
+    STAT_IVF_SCAN,
+    STAT_SIFT_SEARCH,
+    STAT_FUNCTIONS
+} StatFunction;
+
+typedef enum {
+    STATS_OFF = 0,
+    STATS_COUNTS,               // calls, elements and intersection hits
+    STATS_CYCLES                // and the CPU cycles (two clock reads a call)
+} StatsLevel;
+
+extern int stats_tracking;      // pgsiftorder.stats, STATS_OFF unless preloaded
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#define stats_clock()           ((uint64) __rdtsc())
+#else
+uint64 stats_clock(void);       // nanoseconds where there is no cycle counter
+#endif
+
+#define STATS_CLOCK()           ((stats_tracking == STATS_CYCLES) ? stats_clock() : 0)
+#define STATS_COUNT(function, started, detoasted, elements, probes, matches) \
+    do { \
+        if (stats_tracking != STATS_OFF) stats_count((function), (started), (detoasted), (elements), (probes), (matches)); \
+    } while (0)
+
+void stats_init(void);
+void stats_count(StatFunction function, uint64 started, uint64 detoasted, uint64 elements, uint64 probes, uint64 matches);
+
+
+/*
+ * Planner support of the ratings (pgsiftorder_support.c) - the cost, rating_*(...) > 0 as a && condition
+ */
+void support_init(void);
+
+
+/*
+ * IVF-flat kNN index access method (pgsiftorder_ivf.c)
+ */
+void ivf_init(void);
+
+// k-means (Lloyd's, the square distance) - the IVF lists and the PQ codebooks
+#define KMEANS_ITERATIONS 10
+
+int kmeans_nearest(const float4* centroids, int k, int dim, const float4* x);
+void kmeans_real(const float4* samples, int n, int dim, int k, float4* centroids);
+
+#endif	/* _PGSIFTORDER_H */
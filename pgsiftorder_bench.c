@@ -0,0 +1,355 @@
+/*
+ * File:   pgsiftorder_bench.c
+ * Author: chmelarp
+ *
+ * Micro-benchmark of the numeric cores (pgsiftorder_kernels.c) out of the server:
+ *     make bench && ./pgsiftorder_bench [seconds per measurement]
+ *
+ * Synthetic data - SIFT-128 descriptors (0..255, as real, int and byte vectors), Gabor-31 features,
+ * longer dense vectors and sparse bag-of-words documents (Zipf-like word ids) at several query to
+ * document length skews. Every kernel variant the CPU supports (scalar .. avx512) is reported in
+ * ns/pair, GB/s (the bytes of both operands) and elements/cycle (TSC cycles, x86 only).
+ *
+ * See the README.txt for reference!
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder_kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() ((double) __rdtsc())
+#else
+#define BENCH_CYCLES() 0.0
+#endif
+
+#define BENCH_POOL_BYTES    (8 * 1024 * 1024)   // the vectors of a measurement (beyond L2)
+#define BENCH_VOCABULARY    1000000             // sparse word ids
+
+static const char* simd_names[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+static double   bench_seconds = 0.1;            // minimum time of a measurement
+static volatile double bench_sink;              // keeps the results alive
+
+
+/*
+ * Random numbers (xorshift64*)
+ */
+static uint64 bench_state = 0x9E3779B97F4A7C15ULL;
+
+static double bench_random(void) {
+    bench_state ^= bench_state >> 12;
+    bench_state ^= bench_state << 25;
+    bench_state ^= bench_state >> 27;
+    return (double) ((bench_state * 0x2545F4914F6CDD1DULL) >> 11) / (double) (1ULL << 53);
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Generators
+ */
+
+// SIFT descriptor - mostly small gradients with a heavy tail, clamped to 0..255
+static void gen_sift(float4* x, int length) {
+    int pos;
+
+    for (pos = 0; pos < length; pos++) x[pos] = (float4) MIN(255, floor(-log(1 - bench_random()) * 24));
+}
+
+// Gabor features - responses around the mean 150
+static void gen_gabor(float4* x, int length) {
+    int pos;
+
+    for (pos = 0; pos < length; pos++) x[pos] = (float4) floor(150 + 40 * (bench_random() + bench_random() - 1));
+}
+
+static int int32_cmp(const void* a, const void* b) {
+    int32 x = *(const int32*) a;
+    int32 y = *(const int32*) b;
+
+    return (x > y) - (x < y);
+}
+
+// bag of words - sorted unique word ids, the frequent (small) ids are more likely
+static void gen_bow(int32* ids, int length) {
+    int count = 0;
+    int pos;
+
+    while (count < length) {
+        for (pos = count; pos < length; pos++) ids[pos] = (int32) (BENCH_VOCABULARY * pow(bench_random(), 3));
+        qsort(ids, length, sizeof(int32), int32_cmp);
+        for (count = 0, pos = 0; pos < length; pos++) {
+            if (count == 0 || ids[pos] != ids[count - 1]) ids[count++] = ids[pos];
+        }
+    }
+}
+
+
+/*
+ * Measurement - runs passes over a pool of vectors (each against the query) for bench_seconds
+ */
+typedef enum {
+    K_SQUARE_REAL, K_MANHATTAN_REAL, K_CHESSBOARD_REAL, K_COSINE_REAL, K_SQUARE_REAL_BATCH,
+    K_SQUARE_INT, K_MANHATTAN_INT, K_CHESSBOARD_INT,
+    K_BYTE_SQUARE, K_BYTE_MANHATTAN, K_BYTE_DOT, K_BIT_HAMMING,
+    K_MAHALANOBIS_REAL, K_ADD_REAL, K_ACC_REAL
+} BenchKernel;
+
+typedef struct {
+    const char*     name;
+    BenchKernel     kernel;
+    int             element;        // bytes of an element
+    bool            dispatched;     // selected by simd_select() (others are measured once)
+} BenchEntry;
+
+static const BenchEntry bench_dense[] = {
+    {"square_real", K_SQUARE_REAL, sizeof(float4), true},
+    {"manhattan_real", K_MANHATTAN_REAL, sizeof(float4), true},
+    {"chessboard_real", K_CHESSBOARD_REAL, sizeof(float4), true},
+    {"cosine_real", K_COSINE_REAL, sizeof(float4), true},
+    {"square_real_batch", K_SQUARE_REAL_BATCH, sizeof(float4), true},
+    {"square_int", K_SQUARE_INT, sizeof(int32), true},
+    {"manhattan_int", K_MANHATTAN_INT, sizeof(int32), true},
+    {"chessboard_int", K_CHESSBOARD_INT, sizeof(int32), true},
+    {"byte_square", K_BYTE_SQUARE, sizeof(uint8), true},
+    {"byte_manhattan", K_BYTE_MANHATTAN, sizeof(uint8), true},
+    {"byte_dot", K_BYTE_DOT, sizeof(uint8), true},
+    {"bit_hamming", K_BIT_HAMMING, sizeof(uint8), true},
+    {"mahalanobis_real", K_MAHALANOBIS_REAL, sizeof(float4), false},
+    {"add_real", K_ADD_REAL, sizeof(float4), false},
+    {"acc_real", K_ACC_REAL, sizeof(float4), false},
+};
+
+typedef struct {
+    int             length;
+    int             count;          // vectors in the pool
+    float4*         query;
+    float4*         reals;          // count x length
+    int32*          ints;
+    uint8*          bytes;
+    float4*         stdev;
+    float4*         acc;            // 3 x length
+    float4*         distances;      // count
+} BenchPool;
+
+static void bench_pool(BenchPool* pool, int length, void (*gen)(float4*, int)) {
+    int i, pos;
+
+    pool->length = length;
+    pool->count = MAX(16, BENCH_POOL_BYTES / (int) (length * sizeof(float4)));
+    pool->query = (float4*) malloc(sizeof(float4) * length);
+    pool->reals = (float4*) malloc(sizeof(float4) * (size_t) length * pool->count);
+    pool->ints = (int32*) malloc(sizeof(int32) * (size_t) length * pool->count);
+    pool->bytes = (uint8*) malloc((size_t) length * pool->count);
+    pool->stdev = (float4*) malloc(sizeof(float4) * length);
+    pool->acc = (float4*) calloc(3 * length, sizeof(float4));
+    pool->distances = (float4*) malloc(sizeof(float4) * pool->count);
+
+    gen(pool->query, length);
+    for (i = 0; i < pool->count; i++) gen(pool->reals + (size_t) i * length, length);
+    for (pos = 0; pos < length * pool->count; pos++) {
+        pool->ints[pos] = (int32) pool->reals[pos];
+        pool->bytes[pos] = (uint8) MIN(255, MAX(0, pool->reals[pos]));
+    }
+    for (pos = 0; pos < length; pos++) pool->stdev[pos] = (float4) (1 + 40 * bench_random());
+}
+
+static void bench_pool_free(BenchPool* pool) {
+    free(pool->query); free(pool->reals); free(pool->ints); free(pool->bytes);
+    free(pool->stdev); free(pool->acc); free(pool->distances);
+}
+
+// a pass over the pool - returns the number of pairs
+static int bench_pass(const BenchPool* pool, BenchKernel kernel) {
+    const int       length = pool->length;
+    const float4*   q = pool->query;
+    const int32*    qi = pool->ints;            // the first vector is the query of the int kernels
+    const uint8*    qb = pool->bytes;
+    double          sum = 0;
+    int             i;
+
+    if (kernel == K_SQUARE_REAL_BATCH) {
+        dense_square_real_batch(q, pool->reals, pool->count, length, pool->distances);
+        bench_sink = pool->distances[pool->count - 1];
+        return pool->count;
+    }
+
+    for (i = 0; i < pool->count; i++) {
+        const size_t    offset = (size_t) i * length;
+
+        switch (kernel) {
+            case K_SQUARE_REAL:     sum += dense_square_real(q, pool->reals + offset, length); break;
+            case K_MANHATTAN_REAL:  sum += dense_manhattan_real(q, pool->reals + offset, length); break;
+            case K_CHESSBOARD_REAL: sum += dense_chessboard_real(q, pool->reals + offset, length); break;
+            case K_COSINE_REAL:     sum += dense_cosine_real(q, pool->reals + offset, length); break;
+            case K_SQUARE_INT:      sum += dense_square_int(qi, pool->ints + offset, length); break;
+            case K_MANHATTAN_INT:   sum += dense_manhattan_int(qi, pool->ints + offset, length); break;
+            case K_CHESSBOARD_INT:  sum += dense_chessboard_int(qi, pool->ints + offset, length); break;
+            case K_BYTE_SQUARE:     sum += byte_square(qb, pool->bytes + offset, length); break;
+            case K_BYTE_MANHATTAN:  sum += byte_manhattan(qb, pool->bytes + offset, length); break;
+            case K_BYTE_DOT:        sum += byte_dot(qb, pool->bytes + offset, length); break;
+            case K_BIT_HAMMING:     sum += bit_hamming(qb, pool->bytes + offset, length); break;
+            case K_MAHALANOBIS_REAL: sum += dense_mahalanobis_real(q, pool->reals + offset, pool->stdev, NULL, length); break;
+            case K_ADD_REAL:        vector_add_real(pool->acc, pool->reals + offset, length); break;
+            case K_ACC_REAL:        vector_acc_real(pool->acc, pool->reals + offset, length); break;
+            default: break;
+        }
+    }
+    bench_sink = sum + pool->acc[0];
+    return pool->count;
+}
+
+static void bench_report(const char* name, const char* variant, const char* shape, double pairs,
+                         double seconds, double cycles, double elements, double bytes) {
+    double ns = seconds * 1e9 / pairs;
+
+    if (cycles > 0)
+        printf("%-21s %-7s %-14s %10.1f ns/pair %8.2f GB/s %7.2f el/cycle\n", name, variant, shape,
+               ns, bytes * pairs / seconds * 1e-9, elements * pairs / cycles);
+    else
+        printf("%-21s %-7s %-14s %10.1f ns/pair %8.2f GB/s %7s el/cycle\n", name, variant, shape,
+               ns, bytes * pairs / seconds * 1e-9, "-");
+}
+
+static void bench_dense_kernel(const BenchPool* pool, const BenchEntry* entry, const char* variant, const char* shape) {
+    double  pairs = 0;
+    double  start, seconds, cycles;
+
+    bench_pass(pool, entry->kernel);        // warm up
+    start = bench_now();
+    cycles = BENCH_CYCLES();
+    do {
+        pairs += bench_pass(pool, entry->kernel);
+        seconds = bench_now() - start;
+    } while (seconds < bench_seconds);
+    cycles = BENCH_CYCLES() - cycles;
+
+    bench_report(entry->name, variant, shape, pairs, seconds, cycles, pool->length, 2.0 * pool->length * entry->element);
+}
+
+
+/*
+ * Sparse intersection - the query of qlength words against documents skew times longer
+ */
+static void bench_sparse(int qlength, int skew) {
+    const int   dlength = qlength * skew;
+    const int   count = MAX(16, BENCH_POOL_BYTES / (int) (dlength * sizeof(int32)));
+    int32*      query = (int32*) malloc(sizeof(int32) * qlength);
+    int32*      docs = (int32*) malloc(sizeof(int32) * (size_t) dlength * count);
+    int64*      query8 = (int64*) malloc(sizeof(int64) * qlength);
+    int64*      docs8 = (int64*) malloc(sizeof(int64) * (size_t) dlength * count);
+    int*        match1 = (int*) malloc(sizeof(int) * qlength);
+    int*        match2 = (int*) malloc(sizeof(int) * qlength);
+    char        shape[32];
+    int         level, i;
+
+    gen_bow(query, qlength);
+    for (i = 0; i < count; i++) gen_bow(docs + (size_t) i * dlength, dlength);
+    for (i = 0; i < qlength; i++) query8[i] = query[i];
+    for (i = 0; i < dlength * count; i++) docs8[i] = docs[i];
+    snprintf(shape, sizeof(shape), "q%d x%d", qlength, skew);
+
+    for (level = SIMD_SCALAR; level <= simd_cpu; level++) {
+        double  pairs = 0;
+        double  matches = 0;
+        double  start, seconds, cycles;
+
+        simd_select(level);
+        start = bench_now();
+        cycles = BENCH_CYCLES();
+        do {
+            for (i = 0; i < count; i++) {
+                matches += sparse_intersect(query, qlength, docs + (size_t) i * dlength, dlength, match1, match2);
+            }
+            pairs += count;
+            seconds = bench_now() - start;
+        } while (seconds < bench_seconds);
+        cycles = BENCH_CYCLES() - cycles;
+        bench_sink = matches;
+
+        bench_report("sparse_intersect", simd_names[level], shape, pairs, seconds, cycles,
+                     qlength + dlength, (qlength + dlength) * sizeof(int32));
+
+        // the same ids as int8 (hashed text terms)
+        pairs = 0;
+        matches = 0;
+        start = bench_now();
+        cycles = BENCH_CYCLES();
+        do {
+            for (i = 0; i < count; i++) {
+                matches += sparse_intersect_int8(query8, qlength, docs8 + (size_t) i * dlength, dlength, match1, match2);
+            }
+            pairs += count;
+            seconds = bench_now() - start;
+        } while (seconds < bench_seconds);
+        cycles = BENCH_CYCLES() - cycles;
+        bench_sink = matches;
+
+        bench_report("sparse_intersect_int8", simd_names[level], shape, pairs, seconds, cycles,
+                     qlength + dlength, (qlength + dlength) * sizeof(int64));
+    }
+
+    free(query); free(docs); free(query8); free(docs8); free(match1); free(match2);
+}
+
+
+int main(int argc, char** argv) {
+    static const struct {
+        const char* name;
+        int         length;
+        void        (*gen)(float4*, int);
+    } shapes[] = {
+        {"gabor-31", 31, gen_gabor},
+        {"sift-128", 128, gen_sift},
+        {"dense-960", 960, gen_sift},
+        {"dense-4096", 4096, gen_sift},
+    };
+    static const int qlengths[] = {16, 100};
+    static const int skews[] = {1, 4, 32, 128};
+    int     s, k, level;
+
+    if (argc > 1) bench_seconds = atof(argv[1]);
+    if (bench_seconds <= 0) bench_seconds = 0.1;
+
+    simd_cpu = simd_detect();
+    printf("pgsiftorder kernels - the CPU supports %s (avx512bw %d, avx512vnni %d, avx512vpopcntdq %d)\n\n",
+           simd_names[simd_cpu], simd_avx512bw, simd_avx512vnni, simd_avx512vpopcntdq);
+
+    for (s = 0; s < (int) (sizeof(shapes) / sizeof(shapes[0])); s++) {
+        BenchPool pool;
+
+        bench_pool(&pool, shapes[s].length, shapes[s].gen);
+        for (k = 0; k < (int) (sizeof(bench_dense) / sizeof(bench_dense[0])); k++) {
+            if (!bench_dense[k].dispatched) {
+                simd_select(SIMD_AUTO);
+                bench_dense_kernel(&pool, &bench_dense[k], "c", shapes[s].name);
+                continue;
+            }
+            for (level = SIMD_SCALAR; level <= simd_cpu; level++) {
+                simd_select(level);
+                bench_dense_kernel(&pool, &bench_dense[k], simd_names[level], shapes[s].name);
+            }
+        }
+        bench_pool_free(&pool);
+        printf("\n");
+    }
+
+    for (s = 0; s < (int) (sizeof(qlengths) / sizeof(qlengths[0])); s++) {
+        for (k = 0; k < (int) (sizeof(skews) / sizeof(skews[0])); k++) bench_sparse(qlengths[s], skews[k]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * File:   pgsiftorder_check.c
+ * Author: chmelarp
+ *
+ * Self-check of the numeric cores (pgsiftorder_kernels.c) out of the server:
+ *     make check-kernels
+ *
+ * Every kernel variant the CPU supports (sse4.2 .. avx512) must return the results of the scalar one
+ * (the reference) - also for the inputs the SQL functions do not promise anything about, e.g. sparse
+ * arrays repeating an element, which must never write more than MIN(length1, length2) matches. The
+ * cached query preparations (the Mahalanobis variances) must return the results of the uncached ones.
+ *
+ * See the README.txt for reference!
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder_kernels.h"
+
+#define CHECK_CASES     20000       // random cases a check
+
+static const char* simd_names[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+static int check_failures = 0;
+
+
+/*
+ * Random numbers (xorshift64*)
+ */
+static uint64 check_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64 check_random(void) {
+    check_state ^= check_state >> 12;
+    check_state ^= check_state << 25;
+    check_state ^= check_state >> 27;
+    return check_state * 0x2545F4914F6CDD1DULL;
+}
+
+// a sorted array of length values from 0..range-1 (a small range repeats them)
+static void check_sorted(int64* x, int length, int range) {
+    int pos, i;
+
+    for (pos = 0; pos < length; pos++) x[pos] = (int64) (check_random() % range);
+    for (pos = 1; pos < length; pos++) {
+        int64 v = x[pos];
+
+        for (i = pos; i > 0 && x[i - 1] > v; i--) x[i] = x[i - 1];
+        x[i] = v;
+    }
+}
+
+static void check_fail(const char* name, const char* variant, int length1, int length2, const char* what) {
+    if (check_failures++ < 10)
+        printf("FAILED %s %s (lengths %d and %d): %s\n", name, variant, length1, length2, what);
+}
+
+
+/*
+ * sparse_intersect() - the results (count and positions) of the block merges equal the scalar merge
+ */
+static void check_sparse_case(const int32* ptr1, int length1, const int32* ptr2, int length2, int level) {
+    int     bound = MIN(length1, length2) + 1;      // the callers' buffers
+    int*    ref1 = (int*) malloc(sizeof(int) * bound);
+    int*    ref2 = (int*) malloc(sizeof(int) * bound);
+    int*    match1 = (int*) malloc(sizeof(int) * (bound + 1));
+    int*    match2 = (int*) malloc(sizeof(int) * (bound + 1));
+    int     ref, count;
+
+    simd_select(SIMD_SCALAR);
+    ref = sparse_intersect(ptr1, length1, ptr2, length2, ref1, ref2);
+
+    simd_select(level);
+    match1[bound] = match2[bound] = -1;             // canaries
+    count = sparse_intersect(ptr1, length1, ptr2, length2, match1, match2);
+
+    if (match1[bound] != -1 || match2[bound] != -1 || count > MIN(length1, length2))
+        check_fail("sparse_intersect", simd_names[level], length1, length2, "more matches than the buffers hold");
+    else if (count != ref || memcmp(match1, ref1, sizeof(int) * ref) != 0 || memcmp(match2, ref2, sizeof(int) * ref) != 0)
+        check_fail("sparse_intersect", simd_names[level], length1, length2, "matches differ from the scalar merge");
+    else if (sparse_intersect(ptr1, length1, ptr2, length2, NULL, NULL) != ref)
+        check_fail("sparse_intersect", simd_names[level], length1, length2, "count differs from the scalar merge");
+
+    free(ref1); free(ref2); free(match1); free(match2);
+}
+
+static void check_sparse(int level) {
+    int32   ptr1[300], ptr2[300];
+    int64   x[300];
+    int     c, pos, length1, length2;
+
+    // 255 copies of an id against distinct ids
+    for (pos = 0; pos < 255; pos++) ptr1[pos] = 5;
+    for (pos = 0; pos < 8; pos++) ptr2[pos] = 5 + pos;
+    check_sparse_case(ptr1, 255, ptr2, 8, level);
+    check_sparse_case(ptr2, 8, ptr1, 255, level);
+    check_sparse_case(ptr1, 255, ptr1, 255, level);
+
+    for (c = 0; c < CHECK_CASES; c++) {
+        int range = (c % 3 == 0) ? 1000 : 1 + (int) (check_random() % 64);     // distinct .. repeated
+
+        length1 = (int) (check_random() % 300);
+        length2 = (int) (check_random() % 300);
+        check_sorted(x, length1, range);
+        for (pos = 0; pos < length1; pos++) ptr1[pos] = (int32) x[pos];
+        check_sorted(x, length2, range);
+        for (pos = 0; pos < length2; pos++) ptr2[pos] = (int32) x[pos];
+        check_sparse_case(ptr1, length1, ptr2, length2, level);
+    }
+}
+
+/*
+ * sparse_intersect_int8() - as sparse_intersect()
+ */
+static void check_sparse_int8_case(const int64* ptr1, int length1, const int64* ptr2, int length2, int level) {
+    int     bound = MIN(length1, length2) + 1;
+    int*    ref1 = (int*) malloc(sizeof(int) * bound);
+    int*    ref2 = (int*) malloc(sizeof(int) * bound);
+    int*    match1 = (int*) malloc(sizeof(int) * (bound + 1));
+    int*    match2 = (int*) malloc(sizeof(int) * (bound + 1));
+    int     ref, count;
+
+    simd_select(SIMD_SCALAR);
+    ref = sparse_intersect_int8(ptr1, length1, ptr2, length2, ref1, ref2);
+
+    simd_select(level);
+    match1[bound] = match2[bound] = -1;
+    count = sparse_intersect_int8(ptr1, length1, ptr2, length2, match1, match2);
+
+    if (match1[bound] != -1 || match2[bound] != -1 || count > MIN(length1, length2))
+        check_fail("sparse_intersect_int8", simd_names[level], length1, length2, "more matches than the buffers hold");
+    else if (count != ref || memcmp(match1, ref1, sizeof(int) * ref) != 0 || memcmp(match2, ref2, sizeof(int) * ref) != 0)
+        check_fail("sparse_intersect_int8", simd_names[level], length1, length2, "matches differ from the scalar merge");
+    else if (sparse_intersect_int8(ptr1, length1, ptr2, length2, NULL, NULL) != ref)
+        check_fail("sparse_intersect_int8", simd_names[level], length1, length2, "count differs from the scalar merge");
+
+    free(ref1); free(ref2); free(match1); free(match2);
+}
+
+static void check_sparse_int8(int level) {
+    int64   ptr1[300], ptr2[300];
+    int     c, pos, length1, length2;
+
+    for (pos = 0; pos < 255; pos++) ptr1[pos] = 5;
+    for (pos = 0; pos < 8; pos++) ptr2[pos] = 5 + pos;
+    check_sparse_int8_case(ptr1, 255, ptr2, 8, level);
+    check_sparse_int8_case(ptr2, 8, ptr1, 255, level);
+    check_sparse_int8_case(ptr1, 255, ptr1, 255, level);
+
+    for (c = 0; c < CHECK_CASES; c++) {
+        int range = (c % 3 == 0) ? 1000 : 1 + (int) (check_random() % 64);
+
+        length1 = (int) (check_random() % 300);
+        length2 = (int) (check_random() % 300);
+        check_sorted(ptr1, length1, range);
+        check_sorted(ptr2, length2, range);
+        for (pos = 0; pos < length2; pos++) ptr2[pos] -= 500;      // negative ids (term hashes) too
+        for (pos = 0; pos < length1; pos++) ptr1[pos] -= 500;
+        check_sparse_int8_case(ptr1, length1, ptr2, length2, level);
+    }
+}
+
+
+/*
+ * The Mahalanobis distance by the cached variances must be the one by the standard deviations
+ */
+static void check_mahalanobis(void) {
+    float4  real1[64], real2[64], stdev[64], variance[64];
+    int32   int1[64], int2[64];
+    int     c, pos, length;
+
+    for (c = 0; c < CHECK_CASES / 100; c++) {
+        length = 1 + (int) (check_random() % 64);
+        for (pos = 0; pos < length; pos++) {
+            int1[pos] = (int32) (check_random() % 2000001) - 1000000;
+            int2[pos] = (int32) (check_random() % 2000001) - 1000000;
+            real1[pos] = (float4) int1[pos] / 7919.0f;
+            real2[pos] = (float4) int2[pos] / 7919.0f;
+            stdev[pos] = 0.01f + (float4) (check_random() % 100000) / 997.0f;
+            variance[pos] = stdev[pos] * stdev[pos];
+        }
+        if (dense_mahalanobis_int(int1, int2, stdev, variance, length) != dense_mahalanobis_int(int1, int2, stdev, NULL, length))
+            check_fail("dense_mahalanobis_int", "cached", length, length, "differs from the uncached");
+        if (dense_mahalanobis_real(real1, real2, stdev, variance, length) != dense_mahalanobis_real(real1, real2, stdev, NULL, length))
+            check_fail("dense_mahalanobis_real", "cached", length, length, "differs from the uncached");
+    }
+}
+
+
+int main(void) {
+    int     level;
+
+    simd_cpu = simd_detect();
+    printf("pgsiftorder kernels - the CPU supports %s\n", simd_names[simd_cpu]);
+
+    check_mahalanobis();
+    printf("%-8s %s\n", "cached", (check_failures == 0) ? "ok" : "FAILED");
+
+    for (level = SIMD_SSE42; level <= simd_cpu; level++) {
+        int failures = check_failures;
+
+        check_sparse(level);
+        check_sparse_int8(level);
+        printf("%-8s %s\n", simd_names[level], (check_failures == failures) ? "ok" : "FAILED");
+    }
+
+    return (check_failures == 0) ? 0 : 1;
+}
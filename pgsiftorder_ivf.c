@@ -0,0 +1,1292 @@
+/*
+ * File:   pgsiftorder_ivf.c
+ * Author: chmelarp
+ *
+ * IVF-flat kNN index access method (sift_ivf) for ORDER BY features <-> query LIMIT k.
+ *
+ * The indexed vectors (real[], int[] or fvec) are clustered by k-means into "lists" (inverted files),
+ * a scan computes the query distance to the list centroids, visits the "probes" nearest lists and
+ * returns their vectors ordered by the exact distance of the operator (<-> square, <+> Manhattan, <=> cosine -
+ * the dense kernels of pgsiftorder.c, int[] by the int64 ones). The lists are always clustered by the square
+ * distance (of float4 centroids).
+ * It is an approximate index - more probes, better recall and slower search.
+ *
+ * Page layout (all the pages are WAL logged - generic WAL records, the build by log_newpage_range):
+ *   block 0         meta page (dimension, number of lists, first centroid page)
+ *   centroid pages  IvfCentroidItem {list start page, list insert (last) page, centroid}
+ *   list pages      IvfListItem {heap tid, vector} chained by nextblkno (int[] vectors are kept as int32)
+ *
+ * See the README.txt for reference!
+ */
+
+#include <math.h>
+#include <float.h>
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>                  // maintenance_work_mem
+#include <access/amapi.h>               // index access method API
+#include <access/genam.h>               // RelationGetIndexScan, index_open
+#include <access/generic_xlog.h>        // generic WAL records
+#include <access/reloptions.h>          // WITH (lists = ...)
+#include <access/relscan.h>             // IndexScanDesc
+#include <access/tableam.h>             // table_index_build_scan
+#include <access/xloginsert.h>          // log_newpage_range
+#include <catalog/index.h>              // IndexInfo
+#include <catalog/pg_amop.h>            // ivf_validate
+#include <catalog/pg_amproc.h>
+#include <catalog/pg_opclass.h>
+#include <catalog/pg_type.h>
+#include <commands/vacuum.h>            // IndexBulkDeleteResult
+#include <optimizer/optimizer.h>
+#include <storage/bufmgr.h>
+#include <storage/lmgr.h>               // LockRelationForExtension
+#include <utils/array.h>
+#include <utils/builtins.h>             // format_type_be
+#include <utils/guc.h>
+#include <utils/inval.h>                // CacheInvalidateRelcache
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/regproc.h>              // format_operator
+#include <utils/selfuncs.h>             // genericcostestimate
+#include <utils/syscache.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder.h"
+
+
+#define IVF_MAGIC               0x53494654      // "SIFT"
+#define IVF_VERSION             1
+#define IVF_PAGE_ID             0xFF91          // for pg_filedump and the like
+#define IVF_METAPAGE_BLKNO      0
+
+#define IVF_DEFAULT_LISTS       100
+#define IVF_MAX_LISTS           32768
+#define IVF_SAMPLES_PER_LIST    50              // k-means training sample
+#define IVF_MAX_DIM             1900            // a centroid must fit in a page
+
+// ordering operator strategies (see install.sql)
+#define IVF_STRATEGY_L2         1               // <->  square distance
+#define IVF_STRATEGY_L1         2               // <+>  Manhattan distance
+#define IVF_STRATEGY_COSINE     3               // <=>  cosine distance
+
+
+/*
+ * Pages, items
+ */
+typedef struct IvfPageOpaqueData {
+    BlockNumber nextblkno;          // next page of the list (or of the centroids)
+    uint16      unused;
+    uint16      page_id;            // IVF_PAGE_ID
+} IvfPageOpaqueData;
+
+typedef IvfPageOpaqueData* IvfPageOpaque;
+
+#define IvfPageGetOpaque(page)  ((IvfPageOpaque) PageGetSpecialPointer(page))
+
+typedef struct IvfMetaPageData {
+    uint32      magic;
+    uint32      version;
+    int32       dim;                // 0 ~ not known yet (built on an empty table)
+    int32       lists;
+    BlockNumber centroidStart;      // the first centroid page
+} IvfMetaPageData;
+
+typedef IvfMetaPageData* IvfMetaPage;
+
+#define IvfPageGetMeta(page)    ((IvfMetaPage) PageGetContents(page))
+
+typedef struct IvfCentroidItem {
+    BlockNumber startPage;          // the first page of the list
+    BlockNumber insertPage;         // the last page of the list (a hint, follow nextblkno)
+    float4      x[FLEXIBLE_ARRAY_MEMBER];
+} IvfCentroidItem;
+
+typedef struct IvfListItem {
+    ItemPointerData heaptid;
+    float4      x[FLEXIBLE_ARRAY_MEMBER];   // int32 of an int[] index
+} IvfListItem;
+
+#define IVF_CENTROID_SIZE(dim)  (offsetof(IvfCentroidItem, x) + sizeof(float4) * (dim))
+#define IVF_LIST_ITEM_SIZE(dim) (offsetof(IvfListItem, x) + sizeof(float4) * (dim))
+
+
+/*
+ * Options, settings
+ */
+typedef struct IvfOptions {
+    int32       vl_len_;            // varlena header (do not touch directly!)
+    int         lists;              // number of inverted lists
+} IvfOptions;
+
+static relopt_kind ivf_relopt_kind;
+static int         ivf_probes = 1;  // pgsiftorder.ivf_probes
+
+
+/*
+ * Centroids cached in rd_amcache (rebuilt with the relcache entry)
+ */
+typedef struct IvfCache {
+    int         dim;
+    int         lists;
+    float4*     centroids;          // lists x dim
+    BlockNumber* startPage;
+    ItemPointerData* centroidTid;   // where the centroid item is (to update its insert page)
+} IvfCache;
+
+
+/*
+ * Scan state
+ */
+typedef struct IvfCandidate {
+    union {
+        float4  real;               // real[] and fvec (and the centroids)
+        int64   integer;            // int[] - exact, as the int8 of the operator
+    } distance;
+    ItemPointerData heaptid;
+} IvfCandidate;
+
+typedef struct IvfScanOpaqueData {
+    MemoryContext cxt;              // candidates live here (reset on rescan)
+    float4*     query;
+    const int32* iquery;            // the query of an int[] index
+    int         strategy;
+    bool        started;
+    IvfCandidate* candidates;
+    int         count;
+    int         next;
+} IvfScanOpaqueData;
+
+typedef IvfScanOpaqueData* IvfScanOpaque;
+
+
+
+/****************************************************************************************************
+ * Helpers
+ ****************************************************************************************************/
+
+/*
+ * The vector of an indexed value or of a query - real[] and fvec as they are, int[] converted to float4
+ * (the centroids and the list assignment are float4, see ivf_store_vector for the ranked int32).
+ */
+static float4* ivf_vector(Datum value, Oid typid, int* dim) {
+    if (typid == FLOAT4ARRAYOID || typid == INT4ARRAYOID) {
+        ArrayType*  vector = DatumGetArrayTypeP(value);
+
+        if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector))
+            ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                            errmsg("array must be one-dimensional and must not contain NULLs")));
+        *dim = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+
+        if (typid == INT4ARRAYOID) {
+            int32*  ptr = (int32*) ARR_DATA_PTR(vector);
+            float4* result = (float4*) palloc(sizeof(float4) * Max(*dim, 1));
+            int     pos;
+
+            for (pos = 0; pos < *dim; pos++) result[pos] = (float4) ptr[pos];
+            return result;
+        }
+        return (float4*) ARR_DATA_PTR(vector);
+    }
+    else {
+        // fvec (the only other type with an operator class)
+        FVector*    vector = DatumGetFVector(value);
+
+        *dim = FVEC_DIM(vector);
+        return vector->x;
+    }
+}
+
+/*
+ * The stored vector of an indexed value - int[] as its int32 (ranked exactly by the int kernels, the float4
+ * x only places it into a list), the others as the float4 x
+ */
+static void ivf_store_vector(Datum value, Oid typid, const float4* x, int dim, float4* dest) {
+    if (typid == INT4ARRAYOID) memcpy(dest, ARR_DATA_PTR(DatumGetArrayTypeP(value)), sizeof(int32) * dim);
+    else memcpy(dest, x, sizeof(float4) * dim);
+}
+
+static float4 (*ivf_kernel(int strategy))(const float4*, const float4*, int) {
+    switch (strategy) {
+        case IVF_STRATEGY_L2:
+            return dense_square_real;
+        case IVF_STRATEGY_L1:
+            return dense_manhattan_real;
+        case IVF_STRATEGY_COSINE:
+            return dense_cosine_real;
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", strategy);
+    }
+    return NULL;
+}
+
+static int64 (*ivf_kernel_int(int strategy))(const int32*, const int32*, int) {
+    switch (strategy) {
+        case IVF_STRATEGY_L2:
+            return dense_square_int;
+        case IVF_STRATEGY_L1:
+            return dense_manhattan_int;
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", strategy);
+    }
+    return NULL;
+}
+
+static void ivf_init_page(Page page) {
+    PageInit(page, BLCKSZ, sizeof(IvfPageOpaqueData));
+    IvfPageGetOpaque(page)->nextblkno = InvalidBlockNumber;
+    IvfPageGetOpaque(page)->page_id = IVF_PAGE_ID;
+}
+
+// a new (exclusively locked) page at the end of the relation
+static Buffer ivf_new_buffer(Relation index, ForkNumber forkNum) {
+    Buffer  buf;
+
+    LockRelationForExtension(index, ExclusiveLock);
+    buf = ReadBufferExtended(index, forkNum, P_NEW, RBM_NORMAL, NULL);
+    UnlockRelationForExtension(index, ExclusiveLock);
+
+    LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+    return buf;
+}
+
+static IvfMetaPageData ivf_read_meta(Relation index) {
+    Buffer          buf = ReadBuffer(index, IVF_METAPAGE_BLKNO);
+    IvfMetaPageData meta;
+
+    LockBuffer(buf, BUFFER_LOCK_SHARE);
+    meta = *IvfPageGetMeta(BufferGetPage(buf));
+    UnlockReleaseBuffer(buf);
+
+    if (meta.magic != IVF_MAGIC)
+        ereport(ERROR, (errcode(ERRCODE_INDEX_CORRUPTED),
+                        errmsg("index \"%s\" is not a sift_ivf index", RelationGetRelationName(index))));
+    return meta;
+}
+
+/*
+ * Centroids of the index (read once per relcache entry)
+ */
+static IvfCache* ivf_get_cache(Relation index) {
+    IvfCache*       cache = (IvfCache*) index->rd_amcache;
+    IvfMetaPageData meta;
+    MemoryContext   oldcxt;
+    BlockNumber     blkno;
+    int             i = 0;
+
+    if (cache != NULL) return cache;
+
+    meta = ivf_read_meta(index);
+
+    oldcxt = MemoryContextSwitchTo(index->rd_indexcxt);
+    cache = (IvfCache*) palloc0(sizeof(IvfCache));
+    cache->dim = meta.dim;
+    cache->lists = meta.lists;
+    cache->centroids = (float4*) palloc(sizeof(float4) * Max((Size) meta.lists * meta.dim, 1));
+    cache->startPage = (BlockNumber*) palloc(sizeof(BlockNumber) * Max(meta.lists, 1));
+    cache->centroidTid = (ItemPointerData*) palloc(sizeof(ItemPointerData) * Max(meta.lists, 1));
+    MemoryContextSwitchTo(oldcxt);
+
+    for (blkno = meta.centroidStart; BlockNumberIsValid(blkno) && i < meta.lists; ) {
+        Buffer          buf = ReadBuffer(index, blkno);
+        Page            page;
+        OffsetNumber    offno, maxoff;
+
+        LockBuffer(buf, BUFFER_LOCK_SHARE);
+        page = BufferGetPage(buf);
+        maxoff = PageGetMaxOffsetNumber(page);
+        for (offno = FirstOffsetNumber; offno <= maxoff && i < meta.lists; offno = OffsetNumberNext(offno)) {
+            IvfCentroidItem* item = (IvfCentroidItem*) PageGetItem(page, PageGetItemId(page, offno));
+
+            memcpy(cache->centroids + (Size) i * meta.dim, item->x, sizeof(float4) * meta.dim);
+            cache->startPage[i] = item->startPage;
+            ItemPointerSet(&cache->centroidTid[i], blkno, offno);
+            i++;
+        }
+        blkno = IvfPageGetOpaque(page)->nextblkno;
+        UnlockReleaseBuffer(buf);
+    }
+
+    if (i != meta.lists)
+        ereport(ERROR, (errcode(ERRCODE_INDEX_CORRUPTED),
+                        errmsg("index \"%s\" has %d centroids instead of %d", RelationGetRelationName(index), i, meta.lists)));
+
+    index->rd_amcache = cache;
+    return cache;
+}
+
+
+/****************************************************************************************************
+ * k-means clustering (shared with the PQ codebook training)
+ ****************************************************************************************************/
+
+// the nearest centroid (square distance, the k-means one)
+int kmeans_nearest(const float4* centroids, int k, int dim, const float4* x) {
+    float4  best = FLT_MAX;
+    int     nearest = 0;
+    int     i;
+
+    for (i = 0; i < k; i++) {
+        float4 distance = dense_square_real(centroids + (Size) i * dim, x, dim);
+        if (distance < best) {
+            best = distance;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+/*
+ * Lloyd's k-means of n samples into k <= n centroids (evenly picked initial centroids, an empty
+ * cluster gets a random sample)
+ */
+void kmeans_real(const float4* samples, int n, int dim, int k, float4* centroids) {
+    float4* sums = (float4*) palloc(sizeof(float4) * (Size) k * dim);
+    int*    counts = (int*) palloc(sizeof(int) * k);
+    int     iteration, i, j;
+
+    for (i = 0; i < k; i++) {
+        memcpy(centroids + (Size) i * dim, samples + (Size) (i * (Size) n / k) * dim, sizeof(float4) * dim);
+    }
+
+    for (iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+        CHECK_FOR_INTERRUPTS();
+
+        memset(sums, 0, sizeof(float4) * (Size) k * dim);
+        memset(counts, 0, sizeof(int) * k);
+        for (j = 0; j < n; j++) {
+            const float4* x = samples + (Size) j * dim;
+            int           nearest = kmeans_nearest(centroids, k, dim, x);
+            float4*       sum = sums + (Size) nearest * dim;
+            int           pos;
+
+            for (pos = 0; pos < dim; pos++) sum[pos] += x[pos];
+            counts[nearest]++;
+        }
+        for (i = 0; i < k; i++) {
+            float4* c = centroids + (Size) i * dim;
+            int     pos;
+
+            if (counts[i] == 0) {
+                memcpy(c, samples + (Size) (random() % n) * dim, sizeof(float4) * dim);
+                continue;
+            }
+            for (pos = 0; pos < dim; pos++) c[pos] = sums[(Size) i * dim + pos] / counts[i];
+        }
+    }
+
+    pfree(sums);
+    pfree(counts);
+}
+
+
+/****************************************************************************************************
+ * Build - sample, k-means, write the centroids and then the lists
+ ****************************************************************************************************/
+
+typedef struct IvfBuildState {
+    Relation    index;
+    Oid         typid;
+    int         lists;
+    int         dim;
+    // the first pass - reservoir sample
+    float4*     samples;
+    int         maxSamples;
+    int         numSamples;
+    double      seen;
+    // the second pass - assignment
+    float4*     centroids;
+    BlockNumber* tails;             // the last page of each list
+    double      indtuples;
+    MemoryContext tmpcxt;           // per tuple
+} IvfBuildState;
+
+static int ivf_check_dim(IvfBuildState* state, int dim) {
+    if (state->dim == 0) {
+        if (dim < 1 || dim > IVF_MAX_DIM)
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("sift_ivf supports vectors of 1 to %d dimensions, not %d", IVF_MAX_DIM, dim)));
+        state->dim = dim;
+    }
+    else if (dim != state->dim) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("all the indexed vectors must be of the same dimension (%d and %d)", state->dim, dim)));
+    }
+    return dim;
+}
+
+#if PG_VERSION_NUM >= 130000
+static void ivf_sample_callback(Relation index, ItemPointer tid, Datum* values, bool* isnull,
+                                bool tupleIsAlive, void* arg) {
+#else
+static void ivf_sample_callback(Relation index, HeapTuple htup, Datum* values, bool* isnull,
+                                bool tupleIsAlive, void* arg) {
+    ItemPointer     tid = &htup->t_self;
+#endif
+    IvfBuildState*  state = (IvfBuildState*) arg;
+    MemoryContext   oldcxt;
+    float4*         x;
+    int             dim;
+    int             slot;
+
+    if (isnull[0]) return;
+
+    oldcxt = MemoryContextSwitchTo(state->tmpcxt);
+    x = ivf_vector(values[0], state->typid, &dim);
+    ivf_check_dim(state, dim);
+
+    if (state->samples == NULL) {
+        Size budget = (Size) maintenance_work_mem * 1024L / (sizeof(float4) * dim);
+
+        state->maxSamples = (int) Min((Size) state->lists * IVF_SAMPLES_PER_LIST, Max(budget, (Size) state->lists));
+        state->samples = (float4*) MemoryContextAllocHuge(oldcxt, sizeof(float4) * (Size) state->maxSamples * dim);
+    }
+
+    // reservoir sampling (Algorithm R)
+    state->seen++;
+    if (state->numSamples < state->maxSamples) slot = state->numSamples++;
+    else {
+        slot = (int) floor((double) random() / ((double) MAX_RANDOM_VALUE + 1) * state->seen);
+        if (slot >= state->maxSamples) slot = -1;
+    }
+    if (slot >= 0) memcpy(state->samples + (Size) slot * dim, x, sizeof(float4) * dim);
+
+    MemoryContextSwitchTo(oldcxt);
+    MemoryContextReset(state->tmpcxt);
+}
+
+// append an item to the list page (build - no WAL yet, see log_newpage_range)
+static void ivf_build_append(IvfBuildState* state, int list, Item item, Size size) {
+    Buffer  buf = ReadBuffer(state->index, state->tails[list]);
+    Page    page;
+
+    LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+    page = BufferGetPage(buf);
+
+    if (PageGetFreeSpace(page) < MAXALIGN(size)) {
+        Buffer newbuf = ivf_new_buffer(state->index, MAIN_FORKNUM);
+
+        ivf_init_page(BufferGetPage(newbuf));
+        IvfPageGetOpaque(page)->nextblkno = BufferGetBlockNumber(newbuf);
+        MarkBufferDirty(buf);
+        UnlockReleaseBuffer(buf);
+
+        buf = newbuf;
+        page = BufferGetPage(buf);
+        state->tails[list] = BufferGetBlockNumber(buf);
+    }
+
+    if (PageAddItem(page, item, size, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+        elog(ERROR, "failed to add item to \"%s\"", RelationGetRelationName(state->index));
+    MarkBufferDirty(buf);
+    UnlockReleaseBuffer(buf);
+}
+
+#if PG_VERSION_NUM >= 130000
+static void ivf_assign_callback(Relation index, ItemPointer tid, Datum* values, bool* isnull,
+                                bool tupleIsAlive, void* arg) {
+#else
+static void ivf_assign_callback(Relation index, HeapTuple htup, Datum* values, bool* isnull,
+                                bool tupleIsAlive, void* arg) {
+    ItemPointer     tid = &htup->t_self;
+#endif
+    IvfBuildState*  state = (IvfBuildState*) arg;
+    MemoryContext   oldcxt;
+    IvfListItem*    item;
+    float4*         x;
+    int             dim;
+
+    if (isnull[0]) return;
+
+    oldcxt = MemoryContextSwitchTo(state->tmpcxt);
+    x = ivf_vector(values[0], state->typid, &dim);
+    ivf_check_dim(state, dim);
+
+    item = (IvfListItem*) palloc0(IVF_LIST_ITEM_SIZE(dim));
+    item->heaptid = *tid;
+    ivf_store_vector(values[0], state->typid, x, dim, item->x);
+    ivf_build_append(state, kmeans_nearest(state->centroids, state->lists, dim, x), (Item) item, IVF_LIST_ITEM_SIZE(dim));
+    state->indtuples++;
+
+    MemoryContextSwitchTo(oldcxt);
+    MemoryContextReset(state->tmpcxt);
+}
+
+/*
+ * Meta page and the centroid pages (startPage and insertPage are set later)
+ */
+static void ivf_write_meta(Relation index, ForkNumber forkNum, int dim, int lists, const float4* centroids,
+                           ItemPointerData* centroidTid) {
+    Buffer          metabuf = ivf_new_buffer(index, forkNum);
+    Buffer          buf;
+    Page            page;
+    IvfMetaPage     meta;
+    IvfCentroidItem* item = (IvfCentroidItem*) palloc0(IVF_CENTROID_SIZE(Max(dim, 1)));
+    int             i;
+
+    Assert(BufferGetBlockNumber(metabuf) == IVF_METAPAGE_BLKNO);
+
+    // the first centroid page (even if there are no centroids yet)
+    buf = ivf_new_buffer(index, forkNum);
+    page = BufferGetPage(buf);
+    ivf_init_page(page);
+
+    ivf_init_page(BufferGetPage(metabuf));
+    meta = IvfPageGetMeta(BufferGetPage(metabuf));
+    meta->magic = IVF_MAGIC;
+    meta->version = IVF_VERSION;
+    meta->dim = dim;
+    meta->lists = lists;
+    meta->centroidStart = BufferGetBlockNumber(buf);
+    ((PageHeader) BufferGetPage(metabuf))->pd_lower = ((char*) meta + sizeof(IvfMetaPageData)) - (char*) BufferGetPage(metabuf);
+    MarkBufferDirty(metabuf);
+    UnlockReleaseBuffer(metabuf);
+
+    for (i = 0; i < lists; i++) {
+        OffsetNumber offno;
+
+        item->startPage = InvalidBlockNumber;
+        item->insertPage = InvalidBlockNumber;
+        memcpy(item->x, centroids + (Size) i * dim, sizeof(float4) * dim);
+
+        if (PageGetFreeSpace(page) < MAXALIGN(IVF_CENTROID_SIZE(dim))) {
+            Buffer newbuf = ivf_new_buffer(index, forkNum);
+
+            ivf_init_page(BufferGetPage(newbuf));
+            IvfPageGetOpaque(page)->nextblkno = BufferGetBlockNumber(newbuf);
+            MarkBufferDirty(buf);
+            UnlockReleaseBuffer(buf);
+            buf = newbuf;
+            page = BufferGetPage(buf);
+        }
+        offno = PageAddItem(page, (Item) item, IVF_CENTROID_SIZE(dim), InvalidOffsetNumber, false, false);
+        if (offno == InvalidOffsetNumber)
+            elog(ERROR, "failed to add centroid to \"%s\"", RelationGetRelationName(index));
+        ItemPointerSet(&centroidTid[i], BufferGetBlockNumber(buf), offno);
+    }
+    MarkBufferDirty(buf);
+    UnlockReleaseBuffer(buf);
+    pfree(item);
+}
+
+static void ivf_set_list_pages(Relation index, ItemPointerData* centroidTid, BlockNumber startPage, BlockNumber insertPage) {
+    Buffer          buf = ReadBuffer(index, ItemPointerGetBlockNumber(centroidTid));
+    Page            page;
+    IvfCentroidItem* item;
+
+    LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+    page = BufferGetPage(buf);
+    item = (IvfCentroidItem*) PageGetItem(page, PageGetItemId(page, ItemPointerGetOffsetNumber(centroidTid)));
+    item->startPage = startPage;
+    item->insertPage = insertPage;
+    MarkBufferDirty(buf);
+    UnlockReleaseBuffer(buf);
+}
+
+
+/*
+ * ambuild
+ */
+static IndexBuildResult* ivf_build(Relation heap, Relation index, IndexInfo* indexInfo) {
+    IndexBuildResult* result = (IndexBuildResult*) palloc0(sizeof(IndexBuildResult));
+    IvfOptions*     options = (IvfOptions*) index->rd_options;
+    IvfBuildState   state;
+    ItemPointerData* centroidTid;
+    BlockNumber*    startPage;
+    double          reltuples;
+    int             i;
+
+    if (RelationGetNumberOfBlocks(index) != 0)
+        elog(ERROR, "index \"%s\" already contains data", RelationGetRelationName(index));
+
+    memset(&state, 0, sizeof(state));
+    state.index = index;
+    state.typid = TupleDescAttr(RelationGetDescr(index), 0)->atttypid;
+    state.lists = (options != NULL) ? options->lists : IVF_DEFAULT_LISTS;
+    state.tmpcxt = AllocSetContextCreate(CurrentMemoryContext, "sift_ivf build temporary context", ALLOCSET_DEFAULT_SIZES);
+
+    // the first pass - sample the vectors
+    reltuples = table_index_build_scan(heap, index, indexInfo, true, true, ivf_sample_callback, (void*) &state, NULL);
+
+    // fewer vectors than lists (an empty table ~ no lists, the first insert makes one) - REINDEX it when loaded
+    if (state.numSamples == 0)
+        ereport(WARNING, (errmsg("sift_ivf index \"%s\" is built on an empty table", RelationGetRelationName(index)),
+                          errdetail("All the inserted vectors will go to a single list."),
+                          errhint("REINDEX the index once the table is loaded.")));
+    else if (state.numSamples < state.lists)
+        ereport(WARNING, (errmsg("sift_ivf index \"%s\" has %d lists instead of %d", RelationGetRelationName(index),
+                                 state.numSamples, state.lists),
+                          errdetail("The table has fewer vectors than lists, the inserted vectors go to these lists."),
+                          errhint("REINDEX the index once the table is loaded.")));
+    state.lists = Min(state.lists, state.numSamples);
+    state.centroids = (float4*) palloc0(sizeof(float4) * Max((Size) state.lists * state.dim, 1));
+    if (state.lists > 0) kmeans_real(state.samples, state.numSamples, state.dim, state.lists, state.centroids);
+    if (state.samples != NULL) pfree(state.samples);
+
+    centroidTid = (ItemPointerData*) palloc(sizeof(ItemPointerData) * Max(state.lists, 1));
+    ivf_write_meta(index, MAIN_FORKNUM, state.dim, state.lists, state.centroids, centroidTid);
+
+    // the first page of each list
+    startPage = (BlockNumber*) palloc(sizeof(BlockNumber) * Max(state.lists, 1));
+    state.tails = (BlockNumber*) palloc(sizeof(BlockNumber) * Max(state.lists, 1));
+    for (i = 0; i < state.lists; i++) {
+        Buffer buf = ivf_new_buffer(index, MAIN_FORKNUM);
+
+        ivf_init_page(BufferGetPage(buf));
+        MarkBufferDirty(buf);
+        startPage[i] = state.tails[i] = BufferGetBlockNumber(buf);
+        UnlockReleaseBuffer(buf);
+    }
+
+    // the second pass - assign the vectors to the lists
+    if (state.lists > 0)
+        table_index_build_scan(heap, index, indexInfo, true, true, ivf_assign_callback, (void*) &state, NULL);
+
+    for (i = 0; i < state.lists; i++) {
+        ivf_set_list_pages(index, &centroidTid[i], startPage[i], state.tails[i]);
+    }
+
+    // WAL log the whole index at once
+    if (RelationNeedsWAL(index))
+        log_newpage_range(index, MAIN_FORKNUM, 0, RelationGetNumberOfBlocks(index), true);
+
+    MemoryContextDelete(state.tmpcxt);
+
+    result->heap_tuples = reltuples;
+    result->index_tuples = state.indtuples;
+    return result;
+}
+
+/*
+ * ambuildempty - the init fork of an unlogged index
+ */
+static void ivf_buildempty(Relation index) {
+    ItemPointerData centroidTid;
+
+    ivf_write_meta(index, INIT_FORKNUM, 0, 0, NULL, &centroidTid);
+    log_newpage_range(index, INIT_FORKNUM, 0, RelationGetNumberOfBlocks(index), true);
+}
+
+
+/****************************************************************************************************
+ * Insert
+ ****************************************************************************************************/
+
+/*
+ * The first vector of an index built on an empty table - it becomes the centroid of the only list
+ */
+static void ivf_insert_first(Relation index, const float4* x, int dim) {
+    Buffer              metabuf, cbuf, lbuf;
+    GenericXLogState*   xlog;
+    Page                metapage, cpage, lpage;
+    IvfMetaPage         meta;
+    IvfCentroidItem*    item;
+
+    if (dim < 1 || dim > IVF_MAX_DIM)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("sift_ivf supports vectors of 1 to %d dimensions, not %d", IVF_MAX_DIM, dim)));
+
+    metabuf = ReadBuffer(index, IVF_METAPAGE_BLKNO);
+    LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+    if (IvfPageGetMeta(BufferGetPage(metabuf))->lists > 0) {
+        // somebody was faster
+        UnlockReleaseBuffer(metabuf);
+        return;
+    }
+
+    cbuf = ReadBuffer(index, IvfPageGetMeta(BufferGetPage(metabuf))->centroidStart);
+    LockBuffer(cbuf, BUFFER_LOCK_EXCLUSIVE);
+    lbuf = ivf_new_buffer(index, MAIN_FORKNUM);
+
+    xlog = GenericXLogStart(index);
+    metapage = GenericXLogRegisterBuffer(xlog, metabuf, 0);
+    cpage = GenericXLogRegisterBuffer(xlog, cbuf, 0);
+    lpage = GenericXLogRegisterBuffer(xlog, lbuf, GENERIC_XLOG_FULL_IMAGE);
+
+    ivf_init_page(lpage);
+
+    item = (IvfCentroidItem*) palloc0(IVF_CENTROID_SIZE(dim));
+    item->startPage = BufferGetBlockNumber(lbuf);
+    item->insertPage = BufferGetBlockNumber(lbuf);
+    memcpy(item->x, x, sizeof(float4) * dim);
+    if (PageAddItem(cpage, (Item) item, IVF_CENTROID_SIZE(dim), InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+        elog(ERROR, "failed to add centroid to \"%s\"", RelationGetRelationName(index));
+
+    meta = IvfPageGetMeta(metapage);
+    meta->dim = dim;
+    meta->lists = 1;
+
+    GenericXLogFinish(xlog);
+    UnlockReleaseBuffer(lbuf);
+    UnlockReleaseBuffer(cbuf);
+    UnlockReleaseBuffer(metabuf);
+
+    // the cached (empty) centroids of the other backends are not valid any more
+    CacheInvalidateRelcache(index);
+}
+
+/*
+ * aminsert - append the vector to the last page of the nearest list
+ */
+static bool ivf_insert(Relation index, Datum* values, bool* isnull, ItemPointer heap_tid,
+                       Relation heap, IndexUniqueCheck checkUnique,
+#if PG_VERSION_NUM >= 140000
+                       bool indexUnchanged,
+#endif
+                       IndexInfo* indexInfo) {
+    MemoryContext       tmpcxt, oldcxt;
+    IvfCache*           cache;
+    IvfListItem*        item;
+    IvfCentroidItem*    centroid;
+    GenericXLogState*   xlog;
+    Buffer              buf, cbuf, newbuf;
+    Page                page, cpage, newpage;
+    BlockNumber         blkno;
+    float4*             x;
+    int                 dim;
+    int                 list;
+    Size                size;
+
+    if (isnull[0]) return false;
+
+    tmpcxt = AllocSetContextCreate(CurrentMemoryContext, "sift_ivf insert temporary context", ALLOCSET_SMALL_SIZES);
+    oldcxt = MemoryContextSwitchTo(tmpcxt);
+
+    x = ivf_vector(values[0], TupleDescAttr(RelationGetDescr(index), 0)->atttypid, &dim);
+
+    cache = ivf_get_cache(index);
+    if (cache->lists == 0) {
+        ivf_insert_first(index, x, dim);
+        index->rd_amcache = NULL;
+        cache = ivf_get_cache(index);
+    }
+    if (dim != cache->dim)
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("all the indexed vectors must be of the same dimension (%d and %d)", cache->dim, dim)));
+
+    list = kmeans_nearest(cache->centroids, cache->lists, dim, x);
+
+    size = IVF_LIST_ITEM_SIZE(dim);
+    item = (IvfListItem*) palloc0(size);
+    item->heaptid = *heap_tid;
+    ivf_store_vector(values[0], TupleDescAttr(RelationGetDescr(index), 0)->atttypid, x, dim, item->x);
+
+    // the insert page of the list
+    cbuf = ReadBuffer(index, ItemPointerGetBlockNumber(&cache->centroidTid[list]));
+    LockBuffer(cbuf, BUFFER_LOCK_SHARE);
+    cpage = BufferGetPage(cbuf);
+    centroid = (IvfCentroidItem*) PageGetItem(cpage, PageGetItemId(cpage, ItemPointerGetOffsetNumber(&cache->centroidTid[list])));
+    blkno = centroid->insertPage;
+    UnlockReleaseBuffer(cbuf);
+
+    // the real last page (the insert page is just a hint)
+    for (;;) {
+        buf = ReadBuffer(index, blkno);
+        LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+        page = BufferGetPage(buf);
+        blkno = IvfPageGetOpaque(page)->nextblkno;
+        if (!BlockNumberIsValid(blkno)) break;
+        UnlockReleaseBuffer(buf);
+    }
+
+    if (PageGetFreeSpace(page) >= MAXALIGN(size)) {
+        xlog = GenericXLogStart(index);
+        page = GenericXLogRegisterBuffer(xlog, buf, 0);
+        if (PageAddItem(page, (Item) item, size, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+            elog(ERROR, "failed to add item to \"%s\"", RelationGetRelationName(index));
+        GenericXLogFinish(xlog);
+        UnlockReleaseBuffer(buf);
+    }
+    else {
+        // a new last page - link it and move the insert page of the list
+        newbuf = ivf_new_buffer(index, MAIN_FORKNUM);
+        cbuf = ReadBuffer(index, ItemPointerGetBlockNumber(&cache->centroidTid[list]));
+        LockBuffer(cbuf, BUFFER_LOCK_EXCLUSIVE);
+
+        xlog = GenericXLogStart(index);
+        page = GenericXLogRegisterBuffer(xlog, buf, 0);
+        newpage = GenericXLogRegisterBuffer(xlog, newbuf, GENERIC_XLOG_FULL_IMAGE);
+        cpage = GenericXLogRegisterBuffer(xlog, cbuf, 0);
+
+        ivf_init_page(newpage);
+        if (PageAddItem(newpage, (Item) item, size, InvalidOffsetNumber, false, false) == InvalidOffsetNumber)
+            elog(ERROR, "failed to add item to \"%s\"", RelationGetRelationName(index));
+        IvfPageGetOpaque(page)->nextblkno = BufferGetBlockNumber(newbuf);
+        centroid = (IvfCentroidItem*) PageGetItem(cpage, PageGetItemId(cpage, ItemPointerGetOffsetNumber(&cache->centroidTid[list])));
+        centroid->insertPage = BufferGetBlockNumber(newbuf);
+
+        GenericXLogFinish(xlog);
+        UnlockReleaseBuffer(cbuf);
+        UnlockReleaseBuffer(newbuf);
+        UnlockReleaseBuffer(buf);
+    }
+
+    MemoryContextSwitchTo(oldcxt);
+    MemoryContextDelete(tmpcxt);
+
+    return false;
+}
+
+
+/****************************************************************************************************
+ * Vacuum
+ ****************************************************************************************************/
+
+/*
+ * ambulkdelete - remove the items of dead heap tuples (the pages stay in the lists)
+ */
+static IndexBulkDeleteResult* ivf_bulkdelete(IndexVacuumInfo* info, IndexBulkDeleteResult* stats,
+                                             IndexBulkDeleteCallback callback, void* callback_state) {
+    Relation        index = info->index;
+    IvfCache*       cache = ivf_get_cache(index);
+    OffsetNumber    deletable[MaxOffsetNumber];
+    int             list;
+
+    if (stats == NULL) stats = (IndexBulkDeleteResult*) palloc0(sizeof(IndexBulkDeleteResult));
+
+    for (list = 0; list < cache->lists; list++) {
+        BlockNumber blkno = cache->startPage[list];
+
+        while (BlockNumberIsValid(blkno)) {
+            Buffer          buf;
+            Page            page;
+            OffsetNumber    offno, maxoff;
+            int             ndeletable = 0;
+
+            vacuum_delay_point();
+
+            buf = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL, info->strategy);
+            LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+            page = BufferGetPage(buf);
+            maxoff = PageGetMaxOffsetNumber(page);
+
+            for (offno = FirstOffsetNumber; offno <= maxoff; offno = OffsetNumberNext(offno)) {
+                IvfListItem* item = (IvfListItem*) PageGetItem(page, PageGetItemId(page, offno));
+
+                if (callback(&item->heaptid, callback_state)) {
+                    deletable[ndeletable++] = offno;
+                    stats->tuples_removed++;
+                }
+                else stats->num_index_tuples++;
+            }
+
+            if (ndeletable > 0) {
+                GenericXLogState* xlog = GenericXLogStart(index);
+
+                page = GenericXLogRegisterBuffer(xlog, buf, 0);
+                PageIndexMultiDelete(page, deletable, ndeletable);
+                GenericXLogFinish(xlog);
+            }
+
+            blkno = IvfPageGetOpaque(page)->nextblkno;
+            UnlockReleaseBuffer(buf);
+        }
+    }
+
+    return stats;
+}
+
+/*
+ * amvacuumcleanup
+ */
+static IndexBulkDeleteResult* ivf_vacuumcleanup(IndexVacuumInfo* info, IndexBulkDeleteResult* stats) {
+    if (info->analyze_only) return stats;
+
+    if (stats == NULL) stats = (IndexBulkDeleteResult*) palloc0(sizeof(IndexBulkDeleteResult));
+    stats->num_pages = RelationGetNumberOfBlocks(info->index);
+
+    return stats;
+}
+
+
+/****************************************************************************************************
+ * Scan - the nearest lists, all their vectors ordered by the exact distance
+ ****************************************************************************************************/
+
+static int ivf_candidate_cmp(const void* a, const void* b) {
+    float4 da = ((const IvfCandidate*) a)->distance.real;
+    float4 db = ((const IvfCandidate*) b)->distance.real;
+
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static int ivf_candidate_cmp_int(const void* a, const void* b) {
+    int64 da = ((const IvfCandidate*) a)->distance.integer;
+    int64 db = ((const IvfCandidate*) b)->distance.integer;
+
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static IndexScanDesc ivf_beginscan(Relation index, int nkeys, int norderbys) {
+    IndexScanDesc   scan = RelationGetIndexScan(index, nkeys, norderbys);
+    IvfScanOpaque   so = (IvfScanOpaque) palloc0(sizeof(IvfScanOpaqueData));
+
+    so->cxt = AllocSetContextCreate(CurrentMemoryContext, "sift_ivf scan context", ALLOCSET_DEFAULT_SIZES);
+    scan->opaque = so;
+    return scan;
+}
+
+static void ivf_rescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderbys, int norderbys) {
+    IvfScanOpaque   so = (IvfScanOpaque) scan->opaque;
+
+    if (keys && scan->numberOfKeys > 0)
+        memmove(scan->keyData, keys, scan->numberOfKeys * sizeof(ScanKeyData));
+    if (orderbys && scan->numberOfOrderBys > 0)
+        memmove(scan->orderByData, orderbys, scan->numberOfOrderBys * sizeof(ScanKeyData));
+
+    MemoryContextReset(so->cxt);
+    so->query = NULL;
+    so->iquery = NULL;
+    so->candidates = NULL;
+    so->count = 0;
+    so->next = 0;
+    so->started = false;
+}
+
+// the probes nearest lists to the query
+static int ivf_probe_lists(IvfCache* cache, const float4* query, int probes, int* lists) {
+    IvfCandidate*   order = (IvfCandidate*) palloc(sizeof(IvfCandidate) * cache->lists);
+    int             i;
+
+    for (i = 0; i < cache->lists; i++) {
+        order[i].distance.real = dense_square_real(cache->centroids + (Size) i * cache->dim, query, cache->dim);
+        ItemPointerSetBlockNumber(&order[i].heaptid, i);    // just the list number here
+    }
+    qsort(order, cache->lists, sizeof(IvfCandidate), ivf_candidate_cmp);
+
+    probes = Min(probes, cache->lists);
+    for (i = 0; i < probes; i++) lists[i] = ItemPointerGetBlockNumber(&order[i].heaptid);
+
+    pfree(order);
+    return probes;
+}
+
+static void ivf_collect(IndexScanDesc scan) {
+    uint64          started = STATS_CLOCK();    // pgsiftorder.stats
+    IvfScanOpaque   so = (IvfScanOpaque) scan->opaque;
+    Relation        index = scan->indexRelation;
+    IvfCache*       cache = ivf_get_cache(index);
+    MemoryContext   oldcxt = MemoryContextSwitchTo(so->cxt);
+    Oid             typid = TupleDescAttr(RelationGetDescr(index), 0)->atttypid;
+    float4          (*kernel)(const float4*, const float4*, int) = NULL;
+    int64           (*kernel_int)(const int32*, const int32*, int) = NULL;
+    int*            lists;
+    int             probes, p;
+    int             capacity = 1024;
+    int             dim;
+
+    if (cache->lists == 0) {
+        MemoryContextSwitchTo(oldcxt);
+        return;
+    }
+
+    // int[] ~ int[] (see ivf_validate), ranked by the exact int64 distance
+    so->query = ivf_vector(scan->orderByData[0].sk_argument, typid, &dim);
+    if (typid == INT4ARRAYOID) {
+        so->iquery = (const int32*) ARR_DATA_PTR(DatumGetArrayTypeP(scan->orderByData[0].sk_argument));
+        kernel_int = ivf_kernel_int(so->strategy);
+    }
+    else kernel = ivf_kernel(so->strategy);
+
+    if (dim != cache->dim)
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("query vector has %d dimensions, the index has %d", dim, cache->dim)));
+
+    lists = (int*) palloc(sizeof(int) * Min(ivf_probes, cache->lists));
+    probes = ivf_probe_lists(cache, so->query, ivf_probes, lists);
+
+    so->candidates = (IvfCandidate*) MemoryContextAllocHuge(so->cxt, sizeof(IvfCandidate) * capacity);
+    for (p = 0; p < probes; p++) {
+        BlockNumber blkno = cache->startPage[lists[p]];
+
+        while (BlockNumberIsValid(blkno)) {
+            Buffer          buf = ReadBuffer(index, blkno);
+            Page            page;
+            OffsetNumber    offno, maxoff;
+
+            LockBuffer(buf, BUFFER_LOCK_SHARE);
+            page = BufferGetPage(buf);
+            maxoff = PageGetMaxOffsetNumber(page);
+
+            if (so->count + maxoff > capacity) {
+                capacity = Max(capacity * 2, so->count + maxoff);
+                so->candidates = (IvfCandidate*) repalloc_huge(so->candidates, sizeof(IvfCandidate) * capacity);
+            }
+            for (offno = FirstOffsetNumber; offno <= maxoff; offno = OffsetNumberNext(offno)) {
+                IvfListItem*    item = (IvfListItem*) PageGetItem(page, PageGetItemId(page, offno));
+                IvfCandidate*   c = &so->candidates[so->count++];
+
+                if (kernel_int != NULL) c->distance.integer = kernel_int(so->iquery, (const int32*) item->x, dim);
+                else c->distance.real = kernel(so->query, item->x, dim);
+                c->heaptid = item->heaptid;
+            }
+
+            blkno = IvfPageGetOpaque(page)->nextblkno;
+            UnlockReleaseBuffer(buf);
+        }
+    }
+
+    qsort(so->candidates, so->count, sizeof(IvfCandidate), (kernel_int != NULL) ? ivf_candidate_cmp_int : ivf_candidate_cmp);
+    MemoryContextSwitchTo(oldcxt);
+
+    // the elements of the candidates ranked
+    STATS_COUNT(STAT_IVF_SCAN, started, 0, (uint64) so->count * dim, 0, 0);
+}
+
+/*
+ * amgettuple
+ */
+static bool ivf_gettuple(IndexScanDesc scan, ScanDirection dir) {
+    IvfScanOpaque   so = (IvfScanOpaque) scan->opaque;
+
+    if (!so->started) {
+        if (scan->numberOfOrderBys == 0 || scan->orderByData[0].sk_flags & SK_ISNULL)
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("sift_ivf index can only be scanned by ORDER BY vector <->, <+> or <=> query")));
+
+        so->strategy = scan->orderByData[0].sk_strategy;
+        ivf_collect(scan);
+        so->started = true;
+    }
+
+    if (so->next >= so->count) return false;
+
+    scan->xs_heaptid = so->candidates[so->next++].heaptid;
+    scan->xs_recheck = false;
+    scan->xs_recheckorderby = false;
+    return true;
+}
+
+static void ivf_endscan(IndexScanDesc scan) {
+    IvfScanOpaque   so = (IvfScanOpaque) scan->opaque;
+
+    MemoryContextDelete(so->cxt);
+    pfree(so);
+    scan->opaque = NULL;
+}
+
+
+/****************************************************************************************************
+ * Planner, options, the handler
+ ****************************************************************************************************/
+
+/*
+ * amcostestimate - the probed fraction of the index is read (all of it before the first tuple), the lists
+ * are those of the meta page (fewer than WITH (lists) of a small table, one after an empty table build)
+ */
+static void ivf_costestimate(PlannerInfo* root, IndexPath* path, double loop_count,
+                             Cost* indexStartupCost, Cost* indexTotalCost, Selectivity* indexSelectivity,
+                             double* indexCorrelation, double* indexPages) {
+    GenericCosts    costs;
+    Relation        index;
+    int             lists;
+    double          ratio;
+
+    // only ORDER BY makes sense
+    if (path->indexorderbys == NIL) {
+        *indexStartupCost = DBL_MAX;
+        *indexTotalCost = DBL_MAX;
+        *indexSelectivity = 0;
+        *indexCorrelation = 0;
+        *indexPages = 0;
+        return;
+    }
+
+    index = index_open(path->indexinfo->indexoid, NoLock);
+    lists = Max(ivf_get_cache(index)->lists, 1);
+    index_close(index, NoLock);
+
+    ratio = Min(1.0, (double) ivf_probes / lists);
+
+    MemSet(&costs, 0, sizeof(costs));
+    costs.numIndexTuples = Max(1.0, path->indexinfo->tuples * ratio);
+    genericcostestimate(root, path, loop_count, &costs);
+
+    *indexStartupCost = costs.indexTotalCost;
+    *indexTotalCost = costs.indexTotalCost;
+    *indexSelectivity = costs.indexSelectivity;
+    *indexCorrelation = 0;
+    *indexPages = costs.numIndexPages;
+}
+
+static bytea* ivf_options(Datum reloptions, bool validate) {
+    static const relopt_parse_elt tab[] = {
+        {"lists", RELOPT_TYPE_INT, offsetof(IvfOptions, lists)},
+    };
+#if PG_VERSION_NUM >= 130000
+    return (bytea*) build_reloptions(reloptions, validate, ivf_relopt_kind, sizeof(IvfOptions), tab, lengthof(tab));
+#else
+    relopt_value*   options;
+    IvfOptions*     result;
+    int             numoptions;
+
+    options = parseRelOptions(reloptions, validate, ivf_relopt_kind, &numoptions);
+    if (numoptions == 0) return NULL;
+
+    result = (IvfOptions*) allocateReloptStruct(sizeof(IvfOptions), options, numoptions);
+    fillRelOptions((void*) result, sizeof(IvfOptions), options, numoptions, validate, tab, lengthof(tab));
+    pfree(options);
+    return (bytea*) result;
+#endif
+}
+
+/*
+ * amvalidate - ORDER BY operators of the strategies 1 to 3 (no cosine of int[]) of the opclass type,
+ * no support functions
+ */
+static bool ivf_validate(Oid opclassoid) {
+    bool            result = true;
+    HeapTuple       classtup, typetup;
+    Form_pg_opclass classform;
+    Oid             opfamilyoid, opcintype;
+    char*           opclassname;
+    CatCList*       oprlist;
+    CatCList*       proclist;
+    int             i;
+
+    classtup = SearchSysCache1(CLAOID, ObjectIdGetDatum(opclassoid));
+    if (!HeapTupleIsValid(classtup))
+        elog(ERROR, "cache lookup failed for operator class %u", opclassoid);
+    classform = (Form_pg_opclass) GETSTRUCT(classtup);
+    opfamilyoid = classform->opcfamily;
+    opcintype = classform->opcintype;
+    opclassname = NameStr(classform->opcname);
+
+    // the types of ivf_vector
+    if (opcintype != INT4ARRAYOID && opcintype != FLOAT4ARRAYOID) {
+        typetup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(opcintype));
+        if (!HeapTupleIsValid(typetup))
+            elog(ERROR, "cache lookup failed for type %u", opcintype);
+        if (strcmp(NameStr(((Form_pg_type) GETSTRUCT(typetup))->typname), "fvec") != 0) {
+            ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                           errmsg("sift_ivf operator class \"%s\" is for type %s, not int[], real[] or fvec",
+                                  opclassname, format_type_be(opcintype))));
+            result = false;
+        }
+        ReleaseSysCache(typetup);
+    }
+
+    oprlist = SearchSysCacheList1(AMOPSTRATEGY, ObjectIdGetDatum(opfamilyoid));
+    for (i = 0; i < oprlist->n_members; i++) {
+        Form_pg_amop oprform = (Form_pg_amop) GETSTRUCT(&oprlist->members[i]->tuple);
+
+        if (oprform->amopstrategy < IVF_STRATEGY_L2 || oprform->amopstrategy > IVF_STRATEGY_COSINE ||
+            (oprform->amopstrategy == IVF_STRATEGY_COSINE && opcintype == INT4ARRAYOID)) {
+            ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                           errmsg("sift_ivf operator family of \"%s\" contains operator %s with invalid strategy number %d",
+                                  opclassname, format_operator(oprform->amopopr), oprform->amopstrategy)));
+            result = false;
+        }
+        if (oprform->amoppurpose != AMOP_ORDER) {
+            ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                           errmsg("sift_ivf operator family of \"%s\" contains operator %s that is not FOR ORDER BY",
+                                  opclassname, format_operator(oprform->amopopr))));
+            result = false;
+        }
+        if (oprform->amoplefttype != opcintype || oprform->amoprighttype != opcintype) {
+            ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                           errmsg("sift_ivf operator family of \"%s\" contains operator %s with wrong input types",
+                                  opclassname, format_operator(oprform->amopopr))));
+            result = false;
+        }
+    }
+    ReleaseCatCacheList(oprlist);
+
+    proclist = SearchSysCacheList1(AMPROCNUM, ObjectIdGetDatum(opfamilyoid));
+    if (proclist->n_members > 0) {
+        ereport(INFO, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                       errmsg("sift_ivf operator family of \"%s\" contains support functions, sift_ivf has none",
+                              opclassname)));
+        result = false;
+    }
+    ReleaseCatCacheList(proclist);
+
+    ReleaseSysCache(classtup);
+    return result;
+}
+
+
+PG_FUNCTION_INFO_V1(c_ivf_handler);
+/****************************************************************************************************
+ * IVF-flat index access method handler
+ * CREATE INDEX ... USING sift_ivf (features) WITH (lists = 100); SET pgsiftorder.ivf_probes = 10;
+ */
+Datum
+c_ivf_handler(PG_FUNCTION_ARGS) {
+    IndexAmRoutine* amroutine = makeNode(IndexAmRoutine);
+
+    amroutine->amstrategies = 0;
+    amroutine->amsupport = 0;
+#if PG_VERSION_NUM >= 130000
+    amroutine->amoptsprocnum = 0;
+#endif
+    amroutine->amcanorder = false;
+    amroutine->amcanorderbyop = true;
+    amroutine->amcanbackward = false;
+    amroutine->amcanunique = false;
+    amroutine->amcanmulticol = false;
+    amroutine->amoptionalkey = true;
+    amroutine->amsearcharray = false;
+    amroutine->amsearchnulls = false;
+    amroutine->amstorage = false;
+    amroutine->amclusterable = false;
+    amroutine->ampredlocks = false;
+    amroutine->amcanparallel = false;
+    amroutine->amcaninclude = false;
+#if PG_VERSION_NUM >= 130000
+    amroutine->amusemaintenanceworkmem = false;
+    amroutine->amparallelvacuumoptions = VACUUM_OPTION_PARALLEL_BULKDEL;
+#endif
+    amroutine->amkeytype = InvalidOid;
+
+    amroutine->ambuild = ivf_build;
+    amroutine->ambuildempty = ivf_buildempty;
+    amroutine->aminsert = ivf_insert;
+    amroutine->ambulkdelete = ivf_bulkdelete;
+    amroutine->amvacuumcleanup = ivf_vacuumcleanup;
+    amroutine->amcanreturn = NULL;
+    amroutine->amcostestimate = ivf_costestimate;
+    amroutine->amoptions = ivf_options;
+    amroutine->amproperty = NULL;
+    amroutine->ambuildphasename = NULL;
+    amroutine->amvalidate = ivf_validate;
+#if PG_VERSION_NUM >= 140000
+    amroutine->amadjustmembers = NULL;
+#endif
+    amroutine->ambeginscan = ivf_beginscan;
+    amroutine->amrescan = ivf_rescan;
+    amroutine->amgettuple = ivf_gettuple;
+    amroutine->amgetbitmap = NULL;
+    amroutine->amendscan = ivf_endscan;
+    amroutine->ammarkpos = NULL;
+    amroutine->amrestrpos = NULL;
+    amroutine->amestimateparallelscan = NULL;
+    amroutine->aminitparallelscan = NULL;
+    amroutine->amparallelrescan = NULL;
+
+    PG_RETURN_POINTER(amroutine);
+}
+
+
+/*
+ * Library load (called from _PG_init) - the lists reloption and pgsiftorder.ivf_probes
+ */
+void ivf_init(void) {
+    ivf_relopt_kind = add_reloption_kind();
+    add_int_reloption(ivf_relopt_kind, "lists", "Number of inverted lists (k-means clusters)",
+                      IVF_DEFAULT_LISTS, 1, IVF_MAX_LISTS
+#if PG_VERSION_NUM >= 130000
+                      , AccessExclusiveLock
+#endif
+                      );
+
+    DefineCustomIntVariable("pgsiftorder.ivf_probes",
+                            "Number of the nearest sift_ivf lists a scan visits.",
+                            "More probes - better recall, slower search (lists probes ~ exact search).",
+                            &ivf_probes,
+                            1, 1, IVF_MAX_LISTS,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+}
@@ -0,0 +1,1890 @@
+/*
+ * File:   pgsiftorder_kernels.c
+ * Author: chmelarp
+ *
+ * The numeric cores of pgsiftorder - dense distances, byte vectors, sorted sparse intersection and the
+ * elementwise loops, with the runtime SIMD selection. No server headers are used here, so the kernels
+ * are measured out of the server by the bench driver (make bench, pgsiftorder_bench.c).
+ *
+ * See the README.txt for reference!
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder_kernels.h"
+
+// x86-64 SIMD kernels (the 32 bit x86 lacks the 64 bit intrinsics), compiled per function with target attributes and picked at load time
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PGSO_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+/****************************************************************************************************
+ * Dense vector kernels
+ * The scalar versions are the reference (and the fallback), the SSE4.2/AVX2/AVX-512 versions use
+ * several independent accumulators. The best one is picked by CPUID once, in _PG_init(), and may be
+ * lowered by "SET pgsiftorder.simd = scalar" (e.g. to compare results against the reference).
+ ****************************************************************************************************/
+
+SimdLevel simd_cpu = SIMD_SCALAR;       // the best the CPU (and OS) supports
+SimdLevel simd_active = SIMD_SCALAR;    // the one the kernels below were selected for
+
+
+/*
+ * Scalar reference kernels (these are the original loops)
+ */
+static float4 dense_square_real_scalar(const float4* ptr1, const float4* ptr2, int length) {
+    float4 distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        float4 diff = ptr1[pos] - ptr2[pos];
+        distance += (diff * diff);
+    }
+    return distance;
+}
+
+static int64 dense_square_int_scalar(const int32* ptr1, const int32* ptr2, int length) {
+    int64  distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        int64 diff = ptr1[pos] - ptr2[pos];
+        distance += (diff * diff);
+    }
+    return distance;
+}
+
+static int64 dense_manhattan_int_scalar(const int32* ptr1, const int32* ptr2, int length) {
+    int64  distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        int64 diff = ABS(ptr1[pos] - ptr2[pos]);
+        distance += diff;
+    }
+    return distance;
+}
+
+static int64 dense_chessboard_int_scalar(const int32* ptr1, const int32* ptr2, int length) {
+    int64  distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        int64 diff = ABS(ptr1[pos] - ptr2[pos]);
+        if (diff > distance) distance = diff;
+    }
+    return distance;
+}
+
+static float4 dense_manhattan_real_scalar(const float4* ptr1, const float4* ptr2, int length) {
+    float4 distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        distance += fabsf(ptr1[pos] - ptr2[pos]);
+    }
+    return distance;
+}
+
+static float4 dense_chessboard_real_scalar(const float4* ptr1, const float4* ptr2, int length) {
+    float4 distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        float4 diff = fabsf(ptr1[pos] - ptr2[pos]);
+        if (diff > distance) distance = diff;
+    }
+    return distance;
+}
+
+// cosine distance 1 - x.y / (|x| |y|) from the dot product and the square norms (a zero vector is "orthogonal")
+static inline float4 dense_cosine_finish(float4 dot, float4 norm1, float4 norm2) {
+    double similarity;
+
+    if (norm1 <= 0 || norm2 <= 0) return 1;
+    similarity = dot / sqrt((double) norm1 * norm2);
+    return (float4) (1.0 - MAX(-1.0, MIN(1.0, similarity)));    // the rounding may get out of [-1, 1]
+}
+
+static float4 dense_cosine_real_scalar(const float4* ptr1, const float4* ptr2, int length) {
+    float4 dot = 0, norm1 = 0, norm2 = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        dot += ptr1[pos] * ptr2[pos];
+        norm1 += ptr1[pos] * ptr1[pos];
+        norm2 += ptr2[pos] * ptr2[pos];
+    }
+    return dense_cosine_finish(dot, norm1, norm2);
+}
+
+// square distances of the query to count row-major vectors (the selected kernel per row)
+static void dense_square_real_batch_rows(const float4* query, const float4* rows, int count, int length, float4* result) {
+    int    i;
+
+    for (i = 0; i < count; i++) {
+        result[i] = dense_square_real(query, rows + (Size) i * length, length);
+    }
+}
+
+
+#ifdef PGSO_X86_SIMD
+/*
+ * SSE4.2 kernels - 4 lanes, 4 accumulators (16 elements per iteration)
+ */
+__attribute__((target("sse4.2")))
+static float4 dense_square_real_sse42(const float4* ptr1, const float4* ptr2, int length) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    __m128 d0, d1, d2, d3;
+    float4 distance;
+    int    pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        d0 = _mm_sub_ps(_mm_loadu_ps(ptr1 + pos     ), _mm_loadu_ps(ptr2 + pos     ));
+        d1 = _mm_sub_ps(_mm_loadu_ps(ptr1 + pos +  4), _mm_loadu_ps(ptr2 + pos +  4));
+        d2 = _mm_sub_ps(_mm_loadu_ps(ptr1 + pos +  8), _mm_loadu_ps(ptr2 + pos +  8));
+        d3 = _mm_sub_ps(_mm_loadu_ps(ptr1 + pos + 12), _mm_loadu_ps(ptr2 + pos + 12));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(d2, d2));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(d3, d3));
+    }
+    for (; pos + 4 <= length; pos += 4) {
+        d0 = _mm_sub_ps(_mm_loadu_ps(ptr1 + pos), _mm_loadu_ps(ptr2 + pos));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+    }
+
+    acc0 = _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+    acc0 = _mm_hadd_ps(acc0, acc0);
+    acc0 = _mm_hadd_ps(acc0, acc0);
+    distance = _mm_cvtss_f32(acc0);
+
+    for (; pos < length; pos++) {
+        float4 diff = ptr1[pos] - ptr2[pos];
+        distance += (diff * diff);
+    }
+    return distance;
+}
+
+// (xi - yi)^2 of 4 int32 lanes added to 2 int64 lanes (the difference wraps as in the scalar code)
+__attribute__((target("sse4.2")))
+static inline __m128i sse42_add_square_epi32(__m128i acc, __m128i diff) {
+    acc = _mm_add_epi64(acc, _mm_mul_epi32(diff, diff));
+    diff = _mm_srli_epi64(diff, 32);
+    return _mm_add_epi64(acc, _mm_mul_epi32(diff, diff));
+}
+
+// |xi - yi| of 4 int32 lanes (sign extended) added to 2 int64 lanes
+__attribute__((target("sse4.2")))
+static inline __m128i sse42_add_abs_epi32(__m128i acc, __m128i diff) {
+    diff = _mm_abs_epi32(diff);
+    acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(diff));
+    return _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(diff, 8)));
+}
+
+__attribute__((target("sse4.2")))
+static int64 sse42_hsum_epi64(__m128i acc) {
+    return _mm_cvtsi128_si64(acc) + _mm_extract_epi64(acc, 1);
+}
+
+#define LOAD_DIFF_128(off) _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(ptr1 + pos + (off))), \
+                                         _mm_loadu_si128((const __m128i*)(ptr2 + pos + (off))))
+
+__attribute__((target("sse4.2")))
+static int64 dense_square_int_sse42(const int32* ptr1, const int32* ptr2, int length) {
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    __m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        acc0 = sse42_add_square_epi32(acc0, LOAD_DIFF_128(0));
+        acc1 = sse42_add_square_epi32(acc1, LOAD_DIFF_128(4));
+        acc2 = sse42_add_square_epi32(acc2, LOAD_DIFF_128(8));
+        acc3 = sse42_add_square_epi32(acc3, LOAD_DIFF_128(12));
+    }
+    for (; pos + 4 <= length; pos += 4) {
+        acc0 = sse42_add_square_epi32(acc0, LOAD_DIFF_128(0));
+    }
+
+    acc0 = _mm_add_epi64(_mm_add_epi64(acc0, acc1), _mm_add_epi64(acc2, acc3));
+    distance = sse42_hsum_epi64(acc0);
+    return distance + dense_square_int_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("sse4.2")))
+static int64 dense_manhattan_int_sse42(const int32* ptr1, const int32* ptr2, int length) {
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    __m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        acc0 = sse42_add_abs_epi32(acc0, LOAD_DIFF_128(0));
+        acc1 = sse42_add_abs_epi32(acc1, LOAD_DIFF_128(4));
+        acc2 = sse42_add_abs_epi32(acc2, LOAD_DIFF_128(8));
+        acc3 = sse42_add_abs_epi32(acc3, LOAD_DIFF_128(12));
+    }
+    for (; pos + 4 <= length; pos += 4) {
+        acc0 = sse42_add_abs_epi32(acc0, LOAD_DIFF_128(0));
+    }
+
+    acc0 = _mm_add_epi64(_mm_add_epi64(acc0, acc1), _mm_add_epi64(acc2, acc3));
+    distance = sse42_hsum_epi64(acc0);
+    return distance + dense_manhattan_int_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("sse4.2")))
+static int64 dense_chessboard_int_sse42(const int32* ptr1, const int32* ptr2, int length) {
+    __m128i max0 = _mm_setzero_si128(), max1 = _mm_setzero_si128();
+    int64   distance, tail;
+    int     pos = 0;
+
+    for (; pos + 8 <= length; pos += 8) {
+        max0 = _mm_max_epi32(max0, _mm_abs_epi32(LOAD_DIFF_128(0)));
+        max1 = _mm_max_epi32(max1, _mm_abs_epi32(LOAD_DIFF_128(4)));
+    }
+    for (; pos + 4 <= length; pos += 4) {
+        max0 = _mm_max_epi32(max0, _mm_abs_epi32(LOAD_DIFF_128(0)));
+    }
+
+    max0 = _mm_max_epi32(max0, max1);
+    max0 = _mm_max_epi32(max0, _mm_shuffle_epi32(max0, _MM_SHUFFLE(1, 0, 3, 2)));
+    max0 = _mm_max_epi32(max0, _mm_shuffle_epi32(max0, _MM_SHUFFLE(2, 3, 0, 1)));
+    distance = _mm_cvtsi128_si32(max0);
+    tail = dense_chessboard_int_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+    return MAX(distance, tail);
+}
+
+// |x| of 4 float lanes (clear the sign bit)
+#define ABS_PS_128(x) _mm_andnot_ps(_mm_set1_ps(-0.0f), (x))
+
+__attribute__((target("sse4.2")))
+static float4 dense_manhattan_real_sse42(const float4* ptr1, const float4* ptr2, int length) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    float4 distance;
+    int    pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        acc0 = _mm_add_ps(acc0, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos     ), _mm_loadu_ps(ptr2 + pos     ))));
+        acc1 = _mm_add_ps(acc1, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos +  4), _mm_loadu_ps(ptr2 + pos +  4))));
+        acc2 = _mm_add_ps(acc2, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos +  8), _mm_loadu_ps(ptr2 + pos +  8))));
+        acc3 = _mm_add_ps(acc3, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos + 12), _mm_loadu_ps(ptr2 + pos + 12))));
+    }
+    for (; pos + 4 <= length; pos += 4) {
+        acc0 = _mm_add_ps(acc0, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos), _mm_loadu_ps(ptr2 + pos))));
+    }
+
+    acc0 = _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+    acc0 = _mm_hadd_ps(acc0, acc0);
+    acc0 = _mm_hadd_ps(acc0, acc0);
+    distance = _mm_cvtss_f32(acc0);
+    return distance + dense_manhattan_real_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("sse4.2")))
+static float4 dense_chessboard_real_sse42(const float4* ptr1, const float4* ptr2, int length) {
+    __m128 max0 = _mm_setzero_ps(), max1 = _mm_setzero_ps();
+    float4 distance, tail;
+    int    pos = 0;
+
+    for (; pos + 8 <= length; pos += 8) {
+        max0 = _mm_max_ps(max0, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos    ), _mm_loadu_ps(ptr2 + pos    ))));
+        max1 = _mm_max_ps(max1, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos + 4), _mm_loadu_ps(ptr2 + pos + 4))));
+    }
+    for (; pos + 4 <= length; pos += 4) {
+        max0 = _mm_max_ps(max0, ABS_PS_128(_mm_sub_ps(_mm_loadu_ps(ptr1 + pos), _mm_loadu_ps(ptr2 + pos))));
+    }
+
+    max0 = _mm_max_ps(max0, max1);
+    max0 = _mm_max_ps(max0, _mm_movehl_ps(max0, max0));
+    max0 = _mm_max_ss(max0, _mm_shuffle_ps(max0, max0, _MM_SHUFFLE(1, 1, 1, 1)));
+    distance = _mm_cvtss_f32(max0);
+    tail = dense_chessboard_real_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+    return MAX(distance, tail);
+}
+
+__attribute__((target("sse4.2")))
+static inline float4 sse42_hsum_ps(__m128 acc) {
+    acc = _mm_hadd_ps(acc, acc);
+    acc = _mm_hadd_ps(acc, acc);
+    return _mm_cvtss_f32(acc);
+}
+
+__attribute__((target("sse4.2")))
+static float4 dense_cosine_real_sse42(const float4* ptr1, const float4* ptr2, int length) {
+    __m128 dot0 = _mm_setzero_ps(), dot1 = _mm_setzero_ps();
+    __m128 nx0 = _mm_setzero_ps(), nx1 = _mm_setzero_ps();
+    __m128 ny0 = _mm_setzero_ps(), ny1 = _mm_setzero_ps();
+    __m128 x0, x1, y0, y1;
+    float4 dot, norm1, norm2;
+    int    pos = 0;
+
+    for (; pos + 8 <= length; pos += 8) {
+        x0 = _mm_loadu_ps(ptr1 + pos); x1 = _mm_loadu_ps(ptr1 + pos + 4);
+        y0 = _mm_loadu_ps(ptr2 + pos); y1 = _mm_loadu_ps(ptr2 + pos + 4);
+        dot0 = _mm_add_ps(dot0, _mm_mul_ps(x0, y0)); dot1 = _mm_add_ps(dot1, _mm_mul_ps(x1, y1));
+        nx0 = _mm_add_ps(nx0, _mm_mul_ps(x0, x0));   nx1 = _mm_add_ps(nx1, _mm_mul_ps(x1, x1));
+        ny0 = _mm_add_ps(ny0, _mm_mul_ps(y0, y0));   ny1 = _mm_add_ps(ny1, _mm_mul_ps(y1, y1));
+    }
+
+    dot = sse42_hsum_ps(_mm_add_ps(dot0, dot1));
+    norm1 = sse42_hsum_ps(_mm_add_ps(nx0, nx1));
+    norm2 = sse42_hsum_ps(_mm_add_ps(ny0, ny1));
+    for (; pos < length; pos++) {
+        dot += ptr1[pos] * ptr2[pos];
+        norm1 += ptr1[pos] * ptr1[pos];
+        norm2 += ptr2[pos] * ptr2[pos];
+    }
+    return dense_cosine_finish(dot, norm1, norm2);
+}
+
+
+/*
+ * AVX2 kernels - 8 lanes, 4 accumulators (32 elements per iteration)
+ */
+__attribute__((target("avx2,fma")))
+static float4 dense_square_real_avx2(const float4* ptr1, const float4* ptr2, int length) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    __m256 d0, d1, d2, d3;
+    __m128 sum;
+    float4 distance;
+    int    pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        d0 = _mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos     ), _mm256_loadu_ps(ptr2 + pos     ));
+        d1 = _mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos +  8), _mm256_loadu_ps(ptr2 + pos +  8));
+        d2 = _mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos + 16), _mm256_loadu_ps(ptr2 + pos + 16));
+        d3 = _mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos + 24), _mm256_loadu_ps(ptr2 + pos + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        d0 = _mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos), _mm256_loadu_ps(ptr2 + pos));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    }
+
+    acc0 = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    distance = _mm_cvtss_f32(sum);
+
+    for (; pos < length; pos++) {
+        float4 diff = ptr1[pos] - ptr2[pos];
+        distance += (diff * diff);
+    }
+    return distance;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_add_square_epi32(__m256i acc, __m256i diff) {
+    acc = _mm256_add_epi64(acc, _mm256_mul_epi32(diff, diff));
+    diff = _mm256_srli_epi64(diff, 32);
+    return _mm256_add_epi64(acc, _mm256_mul_epi32(diff, diff));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_add_abs_epi32(__m256i acc, __m256i diff) {
+    diff = _mm256_abs_epi32(diff);
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(diff)));
+    return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(diff, 1)));
+}
+
+__attribute__((target("avx2")))
+static int64 avx2_hsum_epi64(__m256i acc) {
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+}
+
+#define LOAD_DIFF_256(off) _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(ptr1 + pos + (off))), \
+                                            _mm256_loadu_si256((const __m256i*)(ptr2 + pos + (off))))
+
+__attribute__((target("avx2")))
+static int64 dense_square_int_avx2(const int32* ptr1, const int32* ptr2, int length) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        acc0 = avx2_add_square_epi32(acc0, LOAD_DIFF_256(0));
+        acc1 = avx2_add_square_epi32(acc1, LOAD_DIFF_256(8));
+        acc2 = avx2_add_square_epi32(acc2, LOAD_DIFF_256(16));
+        acc3 = avx2_add_square_epi32(acc3, LOAD_DIFF_256(24));
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        acc0 = avx2_add_square_epi32(acc0, LOAD_DIFF_256(0));
+    }
+
+    acc0 = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3));
+    distance = avx2_hsum_epi64(acc0);
+    return distance + dense_square_int_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("avx2")))
+static int64 dense_manhattan_int_avx2(const int32* ptr1, const int32* ptr2, int length) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        acc0 = avx2_add_abs_epi32(acc0, LOAD_DIFF_256(0));
+        acc1 = avx2_add_abs_epi32(acc1, LOAD_DIFF_256(8));
+        acc2 = avx2_add_abs_epi32(acc2, LOAD_DIFF_256(16));
+        acc3 = avx2_add_abs_epi32(acc3, LOAD_DIFF_256(24));
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        acc0 = avx2_add_abs_epi32(acc0, LOAD_DIFF_256(0));
+    }
+
+    acc0 = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3));
+    distance = avx2_hsum_epi64(acc0);
+    return distance + dense_manhattan_int_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("avx2")))
+static int64 dense_chessboard_int_avx2(const int32* ptr1, const int32* ptr2, int length) {
+    __m256i max0 = _mm256_setzero_si256(), max1 = _mm256_setzero_si256();
+    __m128i max;
+    int64   distance, tail;
+    int     pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        max0 = _mm256_max_epi32(max0, _mm256_abs_epi32(LOAD_DIFF_256(0)));
+        max1 = _mm256_max_epi32(max1, _mm256_abs_epi32(LOAD_DIFF_256(8)));
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        max0 = _mm256_max_epi32(max0, _mm256_abs_epi32(LOAD_DIFF_256(0)));
+    }
+
+    max0 = _mm256_max_epi32(max0, max1);
+    max = _mm_max_epi32(_mm256_castsi256_si128(max0), _mm256_extracti128_si256(max0, 1));
+    max = _mm_max_epi32(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+    max = _mm_max_epi32(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+    distance = _mm_cvtsi128_si32(max);
+    tail = dense_chessboard_int_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+    return MAX(distance, tail);
+}
+
+#define ABS_PS_256(x) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), (x))
+
+__attribute__((target("avx2")))
+static float4 dense_manhattan_real_avx2(const float4* ptr1, const float4* ptr2, int length) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    __m128 sum;
+    float4 distance;
+    int    pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        acc0 = _mm256_add_ps(acc0, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos     ), _mm256_loadu_ps(ptr2 + pos     ))));
+        acc1 = _mm256_add_ps(acc1, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos +  8), _mm256_loadu_ps(ptr2 + pos +  8))));
+        acc2 = _mm256_add_ps(acc2, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos + 16), _mm256_loadu_ps(ptr2 + pos + 16))));
+        acc3 = _mm256_add_ps(acc3, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos + 24), _mm256_loadu_ps(ptr2 + pos + 24))));
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        acc0 = _mm256_add_ps(acc0, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos), _mm256_loadu_ps(ptr2 + pos))));
+    }
+
+    acc0 = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    distance = _mm_cvtss_f32(sum);
+    return distance + dense_manhattan_real_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("avx2")))
+static float4 dense_chessboard_real_avx2(const float4* ptr1, const float4* ptr2, int length) {
+    __m256 max0 = _mm256_setzero_ps(), max1 = _mm256_setzero_ps();
+    __m128 max;
+    float4 distance, tail;
+    int    pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        max0 = _mm256_max_ps(max0, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos    ), _mm256_loadu_ps(ptr2 + pos    ))));
+        max1 = _mm256_max_ps(max1, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos + 8), _mm256_loadu_ps(ptr2 + pos + 8))));
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        max0 = _mm256_max_ps(max0, ABS_PS_256(_mm256_sub_ps(_mm256_loadu_ps(ptr1 + pos), _mm256_loadu_ps(ptr2 + pos))));
+    }
+
+    max0 = _mm256_max_ps(max0, max1);
+    max = _mm_max_ps(_mm256_castps256_ps128(max0), _mm256_extractf128_ps(max0, 1));
+    max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+    max = _mm_max_ss(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1, 1, 1, 1)));
+    distance = _mm_cvtss_f32(max);
+    tail = dense_chessboard_real_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+    return MAX(distance, tail);
+}
+
+__attribute__((target("avx2")))
+static inline float4 avx2_hsum_ps(__m256 acc) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float4 dense_cosine_real_avx2(const float4* ptr1, const float4* ptr2, int length) {
+    __m256 dot0 = _mm256_setzero_ps(), dot1 = _mm256_setzero_ps();
+    __m256 nx0 = _mm256_setzero_ps(), nx1 = _mm256_setzero_ps();
+    __m256 ny0 = _mm256_setzero_ps(), ny1 = _mm256_setzero_ps();
+    __m256 x0, x1, y0, y1;
+    float4 dot, norm1, norm2;
+    int    pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        x0 = _mm256_loadu_ps(ptr1 + pos); x1 = _mm256_loadu_ps(ptr1 + pos + 8);
+        y0 = _mm256_loadu_ps(ptr2 + pos); y1 = _mm256_loadu_ps(ptr2 + pos + 8);
+        dot0 = _mm256_fmadd_ps(x0, y0, dot0); dot1 = _mm256_fmadd_ps(x1, y1, dot1);
+        nx0 = _mm256_fmadd_ps(x0, x0, nx0);   nx1 = _mm256_fmadd_ps(x1, x1, nx1);
+        ny0 = _mm256_fmadd_ps(y0, y0, ny0);   ny1 = _mm256_fmadd_ps(y1, y1, ny1);
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        x0 = _mm256_loadu_ps(ptr1 + pos);
+        y0 = _mm256_loadu_ps(ptr2 + pos);
+        dot0 = _mm256_fmadd_ps(x0, y0, dot0);
+        nx0 = _mm256_fmadd_ps(x0, x0, nx0);
+        ny0 = _mm256_fmadd_ps(y0, y0, ny0);
+    }
+
+    dot = avx2_hsum_ps(_mm256_add_ps(dot0, dot1));
+    norm1 = avx2_hsum_ps(_mm256_add_ps(nx0, nx1));
+    norm2 = avx2_hsum_ps(_mm256_add_ps(ny0, ny1));
+    for (; pos < length; pos++) {
+        dot += ptr1[pos] * ptr2[pos];
+        norm1 += ptr1[pos] * ptr1[pos];
+        norm2 += ptr2[pos] * ptr2[pos];
+    }
+    return dense_cosine_finish(dot, norm1, norm2);
+}
+
+// 4 rows at once - each query chunk is loaded once and kept in a register for all the 4 rows
+__attribute__((target("avx2,fma")))
+static void dense_square_real_batch_avx2(const float4* query, const float4* rows, int count, int length, float4* result) {
+    int    i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        const float4* r0 = rows + (Size) i * length;
+        const float4* r1 = r0 + length;
+        const float4* r2 = r1 + length;
+        const float4* r3 = r2 + length;
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        __m256 q, d;
+        int    pos = 0;
+
+        for (; pos + 8 <= length; pos += 8) {
+            q = _mm256_loadu_ps(query + pos);
+            d = _mm256_sub_ps(q, _mm256_loadu_ps(r0 + pos)); acc0 = _mm256_fmadd_ps(d, d, acc0);
+            d = _mm256_sub_ps(q, _mm256_loadu_ps(r1 + pos)); acc1 = _mm256_fmadd_ps(d, d, acc1);
+            d = _mm256_sub_ps(q, _mm256_loadu_ps(r2 + pos)); acc2 = _mm256_fmadd_ps(d, d, acc2);
+            d = _mm256_sub_ps(q, _mm256_loadu_ps(r3 + pos)); acc3 = _mm256_fmadd_ps(d, d, acc3);
+        }
+        result[i    ] = avx2_hsum_ps(acc0) + dense_square_real_scalar(query + pos, r0 + pos, length - pos);
+        result[i + 1] = avx2_hsum_ps(acc1) + dense_square_real_scalar(query + pos, r1 + pos, length - pos);
+        result[i + 2] = avx2_hsum_ps(acc2) + dense_square_real_scalar(query + pos, r2 + pos, length - pos);
+        result[i + 3] = avx2_hsum_ps(acc3) + dense_square_real_scalar(query + pos, r3 + pos, length - pos);
+    }
+    for (; i < count; i++) {
+        result[i] = dense_square_real_avx2(query, rows + (Size) i * length, length);
+    }
+}
+
+
+/*
+ * AVX-512 kernels - 16 lanes, 4 accumulators (64 elements per iteration), masked tail
+ */
+__attribute__((target("avx512f")))
+static float4 dense_square_real_avx512(const float4* ptr1, const float4* ptr2, int length) {
+    __m512    acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512    acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    __m512    d0, d1, d2, d3;
+    __mmask16 mask;
+    int       pos = 0;
+
+    for (; pos + 64 <= length; pos += 64) {
+        d0 = _mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos     ), _mm512_loadu_ps(ptr2 + pos     ));
+        d1 = _mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 16), _mm512_loadu_ps(ptr2 + pos + 16));
+        d2 = _mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 32), _mm512_loadu_ps(ptr2 + pos + 32));
+        d3 = _mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 48), _mm512_loadu_ps(ptr2 + pos + 48));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm512_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm512_fmadd_ps(d3, d3, acc3);
+    }
+    for (; pos + 16 <= length; pos += 16) {
+        d0 = _mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos), _mm512_loadu_ps(ptr2 + pos));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    }
+    if (pos < length) {
+        mask = (__mmask16) ((1u << (length - pos)) - 1);
+        d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ptr1 + pos), _mm512_maskz_loadu_ps(mask, ptr2 + pos));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    }
+
+    acc0 = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+    return _mm512_reduce_add_ps(acc0);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i avx512_add_square_epi32(__m512i acc, __m512i diff) {
+    acc = _mm512_add_epi64(acc, _mm512_mul_epi32(diff, diff));
+    diff = _mm512_srli_epi64(diff, 32);
+    return _mm512_add_epi64(acc, _mm512_mul_epi32(diff, diff));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i avx512_add_abs_epi32(__m512i acc, __m512i diff) {
+    diff = _mm512_abs_epi32(diff);
+    acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(diff)));
+    return _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(diff, 1)));
+}
+
+#define LOAD_DIFF_512(off) _mm512_sub_epi32(_mm512_loadu_si512((const void*)(ptr1 + pos + (off))), \
+                                            _mm512_loadu_si512((const void*)(ptr2 + pos + (off))))
+#define LOAD_DIFF_512_TAIL(mask) _mm512_sub_epi32(_mm512_maskz_loadu_epi32((mask), ptr1 + pos), \
+                                                  _mm512_maskz_loadu_epi32((mask), ptr2 + pos))
+
+__attribute__((target("avx512f")))
+static int64 dense_square_int_avx512(const int32* ptr1, const int32* ptr2, int length) {
+    __m512i   acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i   acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+    int       pos = 0;
+
+    for (; pos + 64 <= length; pos += 64) {
+        acc0 = avx512_add_square_epi32(acc0, LOAD_DIFF_512(0));
+        acc1 = avx512_add_square_epi32(acc1, LOAD_DIFF_512(16));
+        acc2 = avx512_add_square_epi32(acc2, LOAD_DIFF_512(32));
+        acc3 = avx512_add_square_epi32(acc3, LOAD_DIFF_512(48));
+    }
+    for (; pos + 16 <= length; pos += 16) {
+        acc0 = avx512_add_square_epi32(acc0, LOAD_DIFF_512(0));
+    }
+    if (pos < length) {
+        acc0 = avx512_add_square_epi32(acc0, LOAD_DIFF_512_TAIL((__mmask16) ((1u << (length - pos)) - 1)));
+    }
+
+    acc0 = _mm512_add_epi64(_mm512_add_epi64(acc0, acc1), _mm512_add_epi64(acc2, acc3));
+    return _mm512_reduce_add_epi64(acc0);
+}
+
+__attribute__((target("avx512f")))
+static int64 dense_manhattan_int_avx512(const int32* ptr1, const int32* ptr2, int length) {
+    __m512i   acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i   acc2 = _mm512_setzero_si512(), acc3 = _mm512_setzero_si512();
+    int       pos = 0;
+
+    for (; pos + 64 <= length; pos += 64) {
+        acc0 = avx512_add_abs_epi32(acc0, LOAD_DIFF_512(0));
+        acc1 = avx512_add_abs_epi32(acc1, LOAD_DIFF_512(16));
+        acc2 = avx512_add_abs_epi32(acc2, LOAD_DIFF_512(32));
+        acc3 = avx512_add_abs_epi32(acc3, LOAD_DIFF_512(48));
+    }
+    for (; pos + 16 <= length; pos += 16) {
+        acc0 = avx512_add_abs_epi32(acc0, LOAD_DIFF_512(0));
+    }
+    if (pos < length) {
+        acc0 = avx512_add_abs_epi32(acc0, LOAD_DIFF_512_TAIL((__mmask16) ((1u << (length - pos)) - 1)));
+    }
+
+    acc0 = _mm512_add_epi64(_mm512_add_epi64(acc0, acc1), _mm512_add_epi64(acc2, acc3));
+    return _mm512_reduce_add_epi64(acc0);
+}
+
+__attribute__((target("avx512f")))
+static int64 dense_chessboard_int_avx512(const int32* ptr1, const int32* ptr2, int length) {
+    __m512i   max0 = _mm512_setzero_si512(), max1 = _mm512_setzero_si512();
+    int       pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        max0 = _mm512_max_epi32(max0, _mm512_abs_epi32(LOAD_DIFF_512(0)));
+        max1 = _mm512_max_epi32(max1, _mm512_abs_epi32(LOAD_DIFF_512(16)));
+    }
+    for (; pos + 16 <= length; pos += 16) {
+        max0 = _mm512_max_epi32(max0, _mm512_abs_epi32(LOAD_DIFF_512(0)));
+    }
+    if (pos < length) {
+        max0 = _mm512_max_epi32(max0, _mm512_abs_epi32(LOAD_DIFF_512_TAIL((__mmask16) ((1u << (length - pos)) - 1))));
+    }
+
+    return _mm512_reduce_max_epi32(_mm512_max_epi32(max0, max1));
+}
+
+__attribute__((target("avx512f")))
+static float4 dense_manhattan_real_avx512(const float4* ptr1, const float4* ptr2, int length) {
+    __m512    acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512    acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    __mmask16 mask;
+    int       pos = 0;
+
+    for (; pos + 64 <= length; pos += 64) {
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos     ), _mm512_loadu_ps(ptr2 + pos     ))));
+        acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 16), _mm512_loadu_ps(ptr2 + pos + 16))));
+        acc2 = _mm512_add_ps(acc2, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 32), _mm512_loadu_ps(ptr2 + pos + 32))));
+        acc3 = _mm512_add_ps(acc3, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 48), _mm512_loadu_ps(ptr2 + pos + 48))));
+    }
+    for (; pos + 16 <= length; pos += 16) {
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos), _mm512_loadu_ps(ptr2 + pos))));
+    }
+    if (pos < length) {
+        mask = (__mmask16) ((1u << (length - pos)) - 1);
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ptr1 + pos), _mm512_maskz_loadu_ps(mask, ptr2 + pos))));
+    }
+
+    acc0 = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+    return _mm512_reduce_add_ps(acc0);
+}
+
+__attribute__((target("avx512f")))
+static float4 dense_chessboard_real_avx512(const float4* ptr1, const float4* ptr2, int length) {
+    __m512    max0 = _mm512_setzero_ps(), max1 = _mm512_setzero_ps();
+    __mmask16 mask;
+    int       pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        max0 = _mm512_max_ps(max0, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos     ), _mm512_loadu_ps(ptr2 + pos     ))));
+        max1 = _mm512_max_ps(max1, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos + 16), _mm512_loadu_ps(ptr2 + pos + 16))));
+    }
+    for (; pos + 16 <= length; pos += 16) {
+        max0 = _mm512_max_ps(max0, _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(ptr1 + pos), _mm512_loadu_ps(ptr2 + pos))));
+    }
+    if (pos < length) {
+        mask = (__mmask16) ((1u << (length - pos)) - 1);
+        max0 = _mm512_max_ps(max0, _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ptr1 + pos), _mm512_maskz_loadu_ps(mask, ptr2 + pos))));
+    }
+
+    return _mm512_reduce_max_ps(_mm512_max_ps(max0, max1));
+}
+
+__attribute__((target("avx512f")))
+static float4 dense_cosine_real_avx512(const float4* ptr1, const float4* ptr2, int length) {
+    __m512    dot0 = _mm512_setzero_ps(), dot1 = _mm512_setzero_ps();
+    __m512    nx0 = _mm512_setzero_ps(), nx1 = _mm512_setzero_ps();
+    __m512    ny0 = _mm512_setzero_ps(), ny1 = _mm512_setzero_ps();
+    __m512    x0, x1, y0, y1;
+    __mmask16 mask;
+    int       pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        x0 = _mm512_loadu_ps(ptr1 + pos); x1 = _mm512_loadu_ps(ptr1 + pos + 16);
+        y0 = _mm512_loadu_ps(ptr2 + pos); y1 = _mm512_loadu_ps(ptr2 + pos + 16);
+        dot0 = _mm512_fmadd_ps(x0, y0, dot0); dot1 = _mm512_fmadd_ps(x1, y1, dot1);
+        nx0 = _mm512_fmadd_ps(x0, x0, nx0);   nx1 = _mm512_fmadd_ps(x1, x1, nx1);
+        ny0 = _mm512_fmadd_ps(y0, y0, ny0);   ny1 = _mm512_fmadd_ps(y1, y1, ny1);
+    }
+    for (; pos < length; pos += 16) {
+        mask = (length - pos >= 16) ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (length - pos)) - 1);
+        x0 = _mm512_maskz_loadu_ps(mask, ptr1 + pos);
+        y0 = _mm512_maskz_loadu_ps(mask, ptr2 + pos);
+        dot0 = _mm512_fmadd_ps(x0, y0, dot0);
+        nx0 = _mm512_fmadd_ps(x0, x0, nx0);
+        ny0 = _mm512_fmadd_ps(y0, y0, ny0);
+    }
+
+    return dense_cosine_finish(_mm512_reduce_add_ps(_mm512_add_ps(dot0, dot1)),
+                               _mm512_reduce_add_ps(_mm512_add_ps(nx0, nx1)),
+                               _mm512_reduce_add_ps(_mm512_add_ps(ny0, ny1)));
+}
+
+// 4 rows at once - each query chunk is loaded once and kept in a register for all the 4 rows
+__attribute__((target("avx512f")))
+static void dense_square_real_batch_avx512(const float4* query, const float4* rows, int count, int length, float4* result) {
+    int    i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        const float4* r0 = rows + (Size) i * length;
+        const float4* r1 = r0 + length;
+        const float4* r2 = r1 + length;
+        const float4* r3 = r2 + length;
+        __m512    acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        __m512    acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        __m512    q, d;
+        __mmask16 mask;
+        int       pos = 0;
+
+        for (; pos < length; pos += 16) {
+            mask = (length - pos >= 16) ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (length - pos)) - 1);
+            q = _mm512_maskz_loadu_ps(mask, query + pos);
+            d = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, r0 + pos)); acc0 = _mm512_fmadd_ps(d, d, acc0);
+            d = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, r1 + pos)); acc1 = _mm512_fmadd_ps(d, d, acc1);
+            d = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, r2 + pos)); acc2 = _mm512_fmadd_ps(d, d, acc2);
+            d = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, r3 + pos)); acc3 = _mm512_fmadd_ps(d, d, acc3);
+        }
+        result[i    ] = _mm512_reduce_add_ps(acc0);
+        result[i + 1] = _mm512_reduce_add_ps(acc1);
+        result[i + 2] = _mm512_reduce_add_ps(acc2);
+        result[i + 3] = _mm512_reduce_add_ps(acc3);
+    }
+    for (; i < count; i++) {
+        result[i] = dense_square_real_avx512(query, rows + (Size) i * length, length);
+    }
+}
+#endif /* PGSO_X86_SIMD */
+
+
+/****************************************************************************************************
+ * Byte vector kernels (bvec - quantized SIFT descriptors 0..255)
+ * The bytes are widened to int16 and multiplied pairwise into int32 (pmaddwd, or vpdpwssd with AVX-512
+ * VNNI), L1 uses the sum of absolute differences (psadbw). pmaddubsw is not used - it multiplies
+ * unsigned by signed bytes and saturates at int16, which does not work for two 0..255 vectors.
+ * The int32 lanes cannot overflow up to BVEC_MAX_DIM (255^2 * 16000 < 2^31).
+ ****************************************************************************************************/
+
+static int64 byte_square_scalar(const uint8* ptr1, const uint8* ptr2, int length) {
+    int64  distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        int32 diff = (int32) ptr1[pos] - (int32) ptr2[pos];
+        distance += diff * diff;
+    }
+    return distance;
+}
+
+static int64 byte_manhattan_scalar(const uint8* ptr1, const uint8* ptr2, int length) {
+    int64  distance = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        distance += ABS((int32) ptr1[pos] - (int32) ptr2[pos]);
+    }
+    return distance;
+}
+
+static int64 byte_dot_scalar(const uint8* ptr1, const uint8* ptr2, int length) {
+    int64  dot = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) {
+        dot += (int32) ptr1[pos] * (int32) ptr2[pos];
+    }
+    return dot;
+}
+
+
+#ifdef PGSO_X86_SIMD
+/*
+ * SSE4.2 - 16 bytes per iteration
+ */
+__attribute__((target("sse4.2")))
+static inline int64 sse42_hsum_epi32(__m128i acc) {
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("sse4.2")))
+static int64 byte_square_sse42(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    __m128i a, b, d;
+    int     pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        a = _mm_loadu_si128((const __m128i*) (ptr1 + pos));
+        b = _mm_loadu_si128((const __m128i*) (ptr2 + pos));
+        d = _mm_sub_epi16(_mm_cvtepu8_epi16(a), _mm_cvtepu8_epi16(b));
+        acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(d, d));
+        d = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(d, d));
+    }
+    return sse42_hsum_epi32(_mm_add_epi32(acc0, acc1)) + byte_square_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("sse4.2")))
+static int64 byte_manhattan_sse42(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m128i acc = _mm_setzero_si128();
+    int     pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (ptr1 + pos)),
+                                              _mm_loadu_si128((const __m128i*) (ptr2 + pos))));
+    }
+    return _mm_cvtsi128_si64(acc) + _mm_extract_epi64(acc, 1) + byte_manhattan_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("sse4.2")))
+static int64 byte_dot_sse42(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    __m128i a, b;
+    int     pos = 0;
+
+    for (; pos + 16 <= length; pos += 16) {
+        a = _mm_loadu_si128((const __m128i*) (ptr1 + pos));
+        b = _mm_loadu_si128((const __m128i*) (ptr2 + pos));
+        acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_cvtepu8_epi16(a), _mm_cvtepu8_epi16(b)));
+        acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+    }
+    return sse42_hsum_epi32(_mm_add_epi32(acc0, acc1)) + byte_dot_scalar(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+
+/*
+ * AVX2 - 32 bytes per iteration
+ */
+__attribute__((target("avx2")))
+static inline int64 avx2_hsum_epi32(__m256i acc) {
+    return sse42_hsum_epi32(_mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+}
+
+#define WIDEN_LO_256(v) _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v))
+#define WIDEN_HI_256(v) _mm256_cvtepu8_epi16(_mm256_extracti128_si256((v), 1))
+
+__attribute__((target("avx2")))
+static int64 byte_square_avx2(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i a, b, d;
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        a = _mm256_loadu_si256((const __m256i*) (ptr1 + pos));
+        b = _mm256_loadu_si256((const __m256i*) (ptr2 + pos));
+        d = _mm256_sub_epi16(WIDEN_LO_256(a), WIDEN_LO_256(b));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(d, d));
+        d = _mm256_sub_epi16(WIDEN_HI_256(a), WIDEN_HI_256(b));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(d, d));
+    }
+    distance = avx2_hsum_epi32(_mm256_add_epi32(acc0, acc1));
+
+    _mm256_zeroupper();     // the tail is legacy SSE code
+    return distance + byte_square_sse42(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("avx2")))
+static int64 byte_manhattan_avx2(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m256i acc = _mm256_setzero_si256();
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*) (ptr1 + pos)),
+                                                    _mm256_loadu_si256((const __m256i*) (ptr2 + pos))));
+    }
+    distance = avx2_hsum_epi64(acc);
+
+    _mm256_zeroupper();     // the tail is legacy SSE code
+    return distance + byte_manhattan_sse42(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+__attribute__((target("avx2")))
+static int64 byte_dot_avx2(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i a, b;
+    int64   distance;
+    int     pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        a = _mm256_loadu_si256((const __m256i*) (ptr1 + pos));
+        b = _mm256_loadu_si256((const __m256i*) (ptr2 + pos));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(WIDEN_LO_256(a), WIDEN_LO_256(b)));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(WIDEN_HI_256(a), WIDEN_HI_256(b)));
+    }
+    distance = avx2_hsum_epi32(_mm256_add_epi32(acc0, acc1));
+
+    _mm256_zeroupper();     // the tail is legacy SSE code
+    return distance + byte_dot_sse42(ptr1 + pos, ptr2 + pos, length - pos);
+}
+
+
+/*
+ * AVX-512BW - 64 bytes per iteration, masked tail (the VNNI versions fuse the multiply and add)
+ */
+#define WIDEN_LO_512(v) _mm512_cvtepu8_epi16(_mm512_castsi512_si256(v))
+#define WIDEN_HI_512(v) _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64((v), 1))
+#define BYTE_MASK_512   ((length - pos >= 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << (length - pos)) - 1))
+
+__attribute__((target("avx512f,avx512bw")))
+static int64 byte_square_avx512(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m512i   acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i   a, b, d;
+    __mmask64 mask;
+    int       pos = 0;
+
+    for (; pos < length; pos += 64) {
+        mask = BYTE_MASK_512;
+        a = _mm512_maskz_loadu_epi8(mask, ptr1 + pos);
+        b = _mm512_maskz_loadu_epi8(mask, ptr2 + pos);
+        d = _mm512_sub_epi16(WIDEN_LO_512(a), WIDEN_LO_512(b));
+        acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(d, d));
+        d = _mm512_sub_epi16(WIDEN_HI_512(a), WIDEN_HI_512(b));
+        acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(d, d));
+    }
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int64 byte_manhattan_avx512(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m512i   acc = _mm512_setzero_si512();
+    __mmask64 mask;
+    int       pos = 0;
+
+    for (; pos < length; pos += 64) {
+        mask = BYTE_MASK_512;
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_maskz_loadu_epi8(mask, ptr1 + pos),
+                                                    _mm512_maskz_loadu_epi8(mask, ptr2 + pos)));
+    }
+    return _mm512_reduce_add_epi64(acc);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int64 byte_dot_avx512(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m512i   acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i   a, b;
+    __mmask64 mask;
+    int       pos = 0;
+
+    for (; pos < length; pos += 64) {
+        mask = BYTE_MASK_512;
+        a = _mm512_maskz_loadu_epi8(mask, ptr1 + pos);
+        b = _mm512_maskz_loadu_epi8(mask, ptr2 + pos);
+        acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(WIDEN_LO_512(a), WIDEN_LO_512(b)));
+        acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(WIDEN_HI_512(a), WIDEN_HI_512(b)));
+    }
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int64 byte_square_vnni(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m512i   acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i   a, b, d;
+    __mmask64 mask;
+    int       pos = 0;
+
+    for (; pos < length; pos += 64) {
+        mask = BYTE_MASK_512;
+        a = _mm512_maskz_loadu_epi8(mask, ptr1 + pos);
+        b = _mm512_maskz_loadu_epi8(mask, ptr2 + pos);
+        d = _mm512_sub_epi16(WIDEN_LO_512(a), WIDEN_LO_512(b));
+        acc0 = _mm512_dpwssd_epi32(acc0, d, d);
+        d = _mm512_sub_epi16(WIDEN_HI_512(a), WIDEN_HI_512(b));
+        acc1 = _mm512_dpwssd_epi32(acc1, d, d);
+    }
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int64 byte_dot_vnni(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m512i   acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    __m512i   a, b;
+    __mmask64 mask;
+    int       pos = 0;
+
+    for (; pos < length; pos += 64) {
+        mask = BYTE_MASK_512;
+        a = _mm512_maskz_loadu_epi8(mask, ptr1 + pos);
+        b = _mm512_maskz_loadu_epi8(mask, ptr2 + pos);
+        acc0 = _mm512_dpwssd_epi32(acc0, WIDEN_LO_512(a), WIDEN_LO_512(b));
+        acc1 = _mm512_dpwssd_epi32(acc1, WIDEN_HI_512(a), WIDEN_HI_512(b));
+    }
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+#endif /* PGSO_X86_SIMD */
+
+
+/****************************************************************************************************
+ * Sorted sparse vector kernels
+ * Intersection of two sorted int4 arrays (visual words, term ids). Lopsided lengths (a short query
+ * against a long document) use galloping (exponential) search of the short array elements in the long
+ * one, similar lengths are merged block-wise (4x4 SSE or 8x8 AVX2 all-pairs compares). The matches are
+ * always reported in the ascending order, so the results equal the simple merge (the reference).
+ * Arrays should be ordered and without element repetition (see README) - a repeated element would match
+ * more than once in the all-pairs compares, so the block merges fall back to the simple merge when a
+ * matching block repeats an element (the results stay those of the reference, at most MIN(length1,
+ * length2) matches).
+ ****************************************************************************************************/
+
+/*
+ * Simple (branchy) merge - the reference and the tail of the block-wise merge
+ */
+static int sparse_intersect_scalar(const int32* ptr1, int length1, int pos1,
+                                   const int32* ptr2, int length2, int pos2,
+                                   int* match1, int* match2, int count) {
+    while (pos1 < length1 && pos2 < length2) {
+        if (ptr1[pos1] == ptr2[pos2]) {
+            if (match1 != NULL) {
+                match1[count] = pos1;
+                match2[count] = pos2;
+            }
+            count++;
+            pos1++;
+            pos2++;
+        }
+        else if (ptr1[pos1] < ptr2[pos2]) pos1++;
+        else                              pos2++;
+    }
+    return count;
+}
+
+/*
+ * The first position >= pos of the value >= x (or length), exponential then binary search
+ */
+static inline int sparse_gallop(const int32* ptr, int length, int pos, int32 x) {
+    int lo = pos, hi, mid;
+    int step = 1;
+
+    if (pos >= length || ptr[pos] >= x) return pos;
+
+    // ptr[lo] < x, find ptr[lo + step] >= x
+    while (lo + step < length && ptr[lo + step] < x) {
+        lo += step;
+        step <<= 1;
+    }
+    hi = MIN(lo + step, length);
+
+    // binary search in (lo, hi]
+    lo++;
+    while (lo < hi) {
+        mid = lo + ((hi - lo) >> 1);
+        if (ptr[mid] < x) lo = mid + 1;
+        else              hi = mid;
+    }
+    return lo;
+}
+
+static int sparse_intersect_gallop(const int32* shrt, int length_s, const int32* lng, int length_l,
+                                   int* match_s, int* match_l) {
+    int pos_s, pos_l = 0;
+    int count = 0;
+
+    for (pos_s = 0; pos_s < length_s && pos_l < length_l; pos_s++) {
+        pos_l = sparse_gallop(lng, length_l, pos_l, shrt[pos_s]);
+        if (pos_l < length_l && lng[pos_l] == shrt[pos_s]) {
+            if (match_s != NULL) {
+                match_s[count] = pos_s;
+                match_l[count] = pos_l;
+            }
+            count++;
+            pos_l++;
+        }
+    }
+    return count;
+}
+
+// does the block repeat an element, or its ends the neighbouring ones (the other array's block may
+// stay and be compared again)?
+static inline bool sparse_block_repeats(const int32* ptr, int length, int pos, int width) {
+    int i;
+    int end = MIN(pos + width, length - 1);
+
+    for (i = (pos > 0) ? pos - 1 : pos; i < end; i++) {
+        if (ptr[i] == ptr[i + 1]) return true;
+    }
+    return false;
+}
+
+// pair the k-th set bit of mask1 with the k-th set bit of mask2 (both blocks are sorted, no repetition)
+#define SPARSE_BLOCK_MATCHES(mask1, mask2) \
+    if (match1 == NULL) count += __builtin_popcount(mask1); \
+    else { \
+        while ((mask1) && (mask2)) { \
+            match1[count] = pos1 + __builtin_ctz(mask1); \
+            match2[count] = pos2 + __builtin_ctz(mask2); \
+            count++; \
+            (mask1) &= (mask1) - 1; \
+            (mask2) &= (mask2) - 1; \
+        } \
+    }
+
+#ifdef PGSO_X86_SIMD
+/*
+ * SSE4.2 block merge - 4x4 all-pairs compare by rotating the second block
+ */
+__attribute__((target("sse4.2,popcnt")))
+static int sparse_intersect_sse42(const int32* ptr1, int length1, const int32* ptr2, int length2,
+                                  int* match1, int* match2) {
+    int pos1 = 0, pos2 = 0;
+    int count = 0;
+
+    while (pos1 + 4 <= length1 && pos2 + 4 <= length2) {
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(ptr1 + pos1));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(ptr2 + pos2));
+        __m128i eq1 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(v1, v2),
+                                                _mm_cmpeq_epi32(v1, _mm_shuffle_epi32(v2, _MM_SHUFFLE(0, 3, 2, 1)))),
+                                   _mm_or_si128(_mm_cmpeq_epi32(v1, _mm_shuffle_epi32(v2, _MM_SHUFFLE(1, 0, 3, 2))),
+                                                _mm_cmpeq_epi32(v1, _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 1, 0, 3)))));
+        unsigned int mask1 = _mm_movemask_ps(_mm_castsi128_ps(eq1));
+        int32 max1 = ptr1[pos1 + 3];
+        int32 max2 = ptr2[pos2 + 3];
+
+        if (mask1) {
+            __m128i eq2 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(v2, v1),
+                                                    _mm_cmpeq_epi32(v2, _mm_shuffle_epi32(v1, _MM_SHUFFLE(0, 3, 2, 1)))),
+                                       _mm_or_si128(_mm_cmpeq_epi32(v2, _mm_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2))),
+                                                    _mm_cmpeq_epi32(v2, _mm_shuffle_epi32(v1, _MM_SHUFFLE(2, 1, 0, 3)))));
+            unsigned int mask2 = _mm_movemask_ps(_mm_castsi128_ps(eq2));
+
+            if (sparse_block_repeats(ptr1, length1, pos1, 4) || sparse_block_repeats(ptr2, length2, pos2, 4))
+                return sparse_intersect_scalar(ptr1, length1, 0, ptr2, length2, 0, match1, match2, 0);
+            SPARSE_BLOCK_MATCHES(mask1, mask2);
+        }
+        if (max1 <= max2) pos1 += 4;
+        if (max2 <= max1) pos2 += 4;
+    }
+
+    return sparse_intersect_scalar(ptr1, length1, pos1, ptr2, length2, pos2, match1, match2, count);
+}
+
+/*
+ * AVX2 block merge - 8x8 all-pairs compare by rotating the second block
+ */
+__attribute__((target("avx2,popcnt")))
+static inline unsigned int avx2_block_eq_mask(__m256i v1, __m256i v2) {
+    const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    __m256i eq = _mm256_cmpeq_epi32(v1, v2);
+    int     r;
+
+    for (r = 1; r < 8; r++) {
+        v2 = _mm256_permutevar8x32_epi32(v2, rot);
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(v1, v2));
+    }
+    return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+}
+
+__attribute__((target("avx2,popcnt")))
+static int sparse_intersect_avx2(const int32* ptr1, int length1, const int32* ptr2, int length2,
+                                 int* match1, int* match2) {
+    int pos1 = 0, pos2 = 0;
+    int count = 0;
+
+    while (pos1 + 8 <= length1 && pos2 + 8 <= length2) {
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(ptr1 + pos1));
+        __m256i v2 = _mm256_loadu_si256((const __m256i*)(ptr2 + pos2));
+        unsigned int mask1 = avx2_block_eq_mask(v1, v2);
+        int32 max1 = ptr1[pos1 + 7];
+        int32 max2 = ptr2[pos2 + 7];
+
+        if (mask1) {
+            unsigned int mask2 = avx2_block_eq_mask(v2, v1);
+
+            if (sparse_block_repeats(ptr1, length1, pos1, 8) || sparse_block_repeats(ptr2, length2, pos2, 8)) {
+                _mm256_zeroupper();
+                return sparse_intersect_scalar(ptr1, length1, 0, ptr2, length2, 0, match1, match2, 0);
+            }
+            SPARSE_BLOCK_MATCHES(mask1, mask2);
+        }
+        if (max1 <= max2) pos1 += 8;
+        if (max2 <= max1) pos2 += 8;
+    }
+
+    _mm256_zeroupper();     // the tail is legacy SSE code
+    return sparse_intersect_scalar(ptr1, length1, pos1, ptr2, length2, pos2, match1, match2, count);
+}
+#endif /* PGSO_X86_SIMD */
+
+
+static int sparse_intersect_merge_scalar(const int32* ptr1, int length1, const int32* ptr2, int length2,
+                                         int* match1, int* match2) {
+    return sparse_intersect_scalar(ptr1, length1, 0, ptr2, length2, 0, match1, match2, 0);
+}
+
+// the selected block merge (see simd_select())
+int (*sparse_intersect_merge)(const int32*, int, const int32*, int, int*, int*) = sparse_intersect_merge_scalar;
+
+/*
+ * Intersection of two sorted int4 arrays - returns the number of common elements and, if match1 and
+ * match2 are given (of at least MIN(length1, length2) items), their positions in the arrays.
+ */
+int sparse_intersect(const int32* ptr1, int length1, const int32* ptr2, int length2,
+                     int* match1, int* match2) {
+    if (length1 == 0 || length2 == 0) return 0;
+
+    if (length2 / SPARSE_GALLOP_RATIO >= length1)
+        return sparse_intersect_gallop(ptr1, length1, ptr2, length2, match1, match2);
+    if (length1 / SPARSE_GALLOP_RATIO >= length2)
+        return sparse_intersect_gallop(ptr2, length2, ptr1, length1, match2, match1);
+
+    return sparse_intersect_merge(ptr1, length1, ptr2, length2, match1, match2);
+}
+
+/*
+ * Sum of squares (the L2 norm without sqrt), in the same order as the original merge loops
+ */
+float4 sparse_sum_squares(const float4* ptrw, int length) {
+    float4 norm = 0;
+    int    pos;
+
+    for (pos = 0; pos < length; pos++) norm += (ptrw[pos] * ptrw[pos]);
+    return norm;
+}
+
+
+/****************************************************************************************************
+ * Sorted int8 term id kernels
+ * The intersection of two sorted int8 arrays (hashed text tokens, see term_ids()) - the same plan as the
+ * int4 one: galloping of the lopsided lengths, a 4x4 AVX2 block merge (64 bit compares) of the similar
+ * ones (the simple merge on repeated elements), the matches in the ascending order. And the hash of the
+ * tokens.
+ ****************************************************************************************************/
+
+static int sparse_intersect_int8_scalar(const int64* ptr1, int length1, int pos1,
+                                        const int64* ptr2, int length2, int pos2,
+                                        int* match1, int* match2, int count) {
+    while (pos1 < length1 && pos2 < length2) {
+        if (ptr1[pos1] == ptr2[pos2]) {
+            if (match1 != NULL) {
+                match1[count] = pos1;
+                match2[count] = pos2;
+            }
+            count++;
+            pos1++;
+            pos2++;
+        }
+        else if (ptr1[pos1] < ptr2[pos2]) pos1++;
+        else                              pos2++;
+    }
+    return count;
+}
+
+static inline int sparse_gallop_int8(const int64* ptr, int length, int pos, int64 x) {
+    int lo = pos, hi, mid;
+    int step = 1;
+
+    if (pos >= length || ptr[pos] >= x) return pos;
+
+    while (lo + step < length && ptr[lo + step] < x) {
+        lo += step;
+        step <<= 1;
+    }
+    hi = MIN(lo + step, length);
+
+    lo++;
+    while (lo < hi) {
+        mid = lo + ((hi - lo) >> 1);
+        if (ptr[mid] < x) lo = mid + 1;
+        else              hi = mid;
+    }
+    return lo;
+}
+
+static int sparse_intersect_int8_gallop(const int64* shrt, int length_s, const int64* lng, int length_l,
+                                        int* match_s, int* match_l) {
+    int pos_s, pos_l = 0;
+    int count = 0;
+
+    for (pos_s = 0; pos_s < length_s && pos_l < length_l; pos_s++) {
+        pos_l = sparse_gallop_int8(lng, length_l, pos_l, shrt[pos_s]);
+        if (pos_l < length_l && lng[pos_l] == shrt[pos_s]) {
+            if (match_s != NULL) {
+                match_s[count] = pos_s;
+                match_l[count] = pos_l;
+            }
+            count++;
+            pos_l++;
+        }
+    }
+    return count;
+}
+
+// see sparse_block_repeats()
+static inline bool sparse_block_repeats_int8(const int64* ptr, int length, int pos, int width) {
+    int i;
+    int end = MIN(pos + width, length - 1);
+
+    for (i = (pos > 0) ? pos - 1 : pos; i < end; i++) {
+        if (ptr[i] == ptr[i + 1]) return true;
+    }
+    return false;
+}
+
+#ifdef PGSO_X86_SIMD
+/*
+ * AVX2 block merge - 4x4 all-pairs compare of int8 by rotating the second block
+ */
+__attribute__((target("avx2,popcnt")))
+static inline unsigned int avx2_block_eq_mask_epi64(__m256i v1, __m256i v2) {
+    __m256i eq = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi64(v1, v2),
+                                                 _mm256_cmpeq_epi64(v1, _mm256_permute4x64_epi64(v2, _MM_SHUFFLE(0, 3, 2, 1)))),
+                                 _mm256_or_si256(_mm256_cmpeq_epi64(v1, _mm256_permute4x64_epi64(v2, _MM_SHUFFLE(1, 0, 3, 2))),
+                                                 _mm256_cmpeq_epi64(v1, _mm256_permute4x64_epi64(v2, _MM_SHUFFLE(2, 1, 0, 3)))));
+    return _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+}
+
+__attribute__((target("avx2,popcnt")))
+static int sparse_intersect_int8_avx2(const int64* ptr1, int length1, const int64* ptr2, int length2,
+                                      int* match1, int* match2) {
+    int pos1 = 0, pos2 = 0;
+    int count = 0;
+
+    while (pos1 + 4 <= length1 && pos2 + 4 <= length2) {
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(ptr1 + pos1));
+        __m256i v2 = _mm256_loadu_si256((const __m256i*)(ptr2 + pos2));
+        unsigned int mask1 = avx2_block_eq_mask_epi64(v1, v2);
+        int64 max1 = ptr1[pos1 + 3];
+        int64 max2 = ptr2[pos2 + 3];
+
+        if (mask1) {
+            unsigned int mask2 = avx2_block_eq_mask_epi64(v2, v1);
+
+            if (sparse_block_repeats_int8(ptr1, length1, pos1, 4) || sparse_block_repeats_int8(ptr2, length2, pos2, 4)) {
+                _mm256_zeroupper();
+                return sparse_intersect_int8_scalar(ptr1, length1, 0, ptr2, length2, 0, match1, match2, 0);
+            }
+            SPARSE_BLOCK_MATCHES(mask1, mask2);
+        }
+        if (max1 <= max2) pos1 += 4;
+        if (max2 <= max1) pos2 += 4;
+    }
+
+    _mm256_zeroupper();
+    return sparse_intersect_int8_scalar(ptr1, length1, pos1, ptr2, length2, pos2, match1, match2, count);
+}
+#endif /* PGSO_X86_SIMD */
+
+static int sparse_intersect_int8_merge_scalar(const int64* ptr1, int length1, const int64* ptr2, int length2,
+                                              int* match1, int* match2) {
+    return sparse_intersect_int8_scalar(ptr1, length1, 0, ptr2, length2, 0, match1, match2, 0);
+}
+
+// the selected block merge (see simd_select())
+int (*sparse_intersect_merge_int8)(const int64*, int, const int64*, int, int*, int*) = sparse_intersect_int8_merge_scalar;
+
+/*
+ * Intersection of two sorted int8 arrays - as sparse_intersect()
+ */
+int sparse_intersect_int8(const int64* ptr1, int length1, const int64* ptr2, int length2,
+                          int* match1, int* match2) {
+    if (length1 == 0 || length2 == 0) return 0;
+
+    if (length2 / SPARSE_GALLOP_RATIO >= length1)
+        return sparse_intersect_int8_gallop(ptr1, length1, ptr2, length2, match1, match2);
+    if (length1 / SPARSE_GALLOP_RATIO >= length2)
+        return sparse_intersect_int8_gallop(ptr2, length2, ptr1, length1, match2, match1);
+
+    return sparse_intersect_merge_int8(ptr1, length1, ptr2, length2, match1, match2);
+}
+
+/*
+ * 64 bit hash of a token (the bytes of a text) - 8 bytes a step (little endian on every platform, the
+ * ids are stored) and the murmur3 finalizer, so the ids are the same on every server
+ */
+static inline uint64 term_mix64(uint64 h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int64 term_hash64(const uint8* ptr, int length) {
+    uint64  h = 0x9E3779B97F4A7C15ULL ^ ((uint64) length * 0x100000001B3ULL);
+    uint64  chunk;
+    int     pos = 0, i;
+
+    for (; pos + 8 <= length; pos += 8) {
+        memcpy(&chunk, ptr + pos, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        chunk = __builtin_bswap64(chunk);
+#endif
+        h = (h ^ term_mix64(chunk)) * 0x100000001B3ULL;
+        h = (h << 27) | (h >> 37);
+    }
+    if (pos < length) {
+        chunk = 0;
+        for (i = length - 1; i >= pos; i--) chunk = (chunk << 8) | ptr[i];
+        h = (h ^ term_mix64(chunk)) * 0x100000001B3ULL;
+    }
+    return (int64) term_mix64(h);
+}
+
+
+/****************************************************************************************************
+ * Binary signature kernels
+ * Hamming distance of two bit strings (sign-of-projection signatures, bit(n)) - the popcount of the XOR,
+ * 64 bits at a time by POPCNT (the SSE4.2 and AVX2 levels) or 512 bits by AVX-512 VPOPCNTDQ.
+ ****************************************************************************************************/
+
+// the portable bit count (SWAR)
+static inline int popcount64(uint64 x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+static int64 bit_hamming_scalar(const uint8* ptr1, const uint8* ptr2, int length) {
+    int64   distance = 0;
+    uint64  a, b;
+    int     pos = 0;
+
+    for (; pos + 8 <= length; pos += 8) {
+        memcpy(&a, ptr1 + pos, 8);
+        memcpy(&b, ptr2 + pos, 8);
+        distance += popcount64(a ^ b);
+    }
+    for (; pos < length; pos++) distance += popcount64(ptr1[pos] ^ ptr2[pos]);
+    return distance;
+}
+
+#ifdef PGSO_X86_SIMD
+// 4 independent counts (POPCNT has a false output dependency on some cores)
+__attribute__((target("popcnt")))
+static int64 bit_hamming_popcnt(const uint8* ptr1, const uint8* ptr2, int length) {
+    int64   c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    uint64  a[4], b[4];
+    int     pos = 0;
+
+    for (; pos + 32 <= length; pos += 32) {
+        memcpy(a, ptr1 + pos, 32);
+        memcpy(b, ptr2 + pos, 32);
+        c0 += __builtin_popcountll(a[0] ^ b[0]);
+        c1 += __builtin_popcountll(a[1] ^ b[1]);
+        c2 += __builtin_popcountll(a[2] ^ b[2]);
+        c3 += __builtin_popcountll(a[3] ^ b[3]);
+    }
+    for (; pos + 8 <= length; pos += 8) {
+        memcpy(a, ptr1 + pos, 8);
+        memcpy(b, ptr2 + pos, 8);
+        c0 += __builtin_popcountll(a[0] ^ b[0]);
+    }
+    for (; pos < length; pos++) c1 += __builtin_popcount(ptr1[pos] ^ ptr2[pos]);
+    return c0 + c1 + c2 + c3;
+}
+
+// 64 bytes per iteration, masked tail - the short (128-512 bit) signatures stay on POPCNT
+__attribute__((target("popcnt,avx512f,avx512bw,avx512vpopcntdq")))
+static int64 bit_hamming_avx512(const uint8* ptr1, const uint8* ptr2, int length) {
+    __m512i   acc = _mm512_setzero_si512();
+    __mmask64 mask;
+    int       pos = 0;
+
+    if (length <= 64) return bit_hamming_popcnt(ptr1, ptr2, length);
+
+    for (; pos < length; pos += 64) {
+        mask = BYTE_MASK_512;
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, ptr1 + pos),
+                                                                          _mm512_maskz_loadu_epi8(mask, ptr2 + pos))));
+    }
+    return _mm512_reduce_add_epi64(acc);
+}
+#endif
+
+/*
+ * Sign-of-projection signature - the bit r (the most significant first) is set if the projection of x on
+ * the row r of the projection matrix (bits x length) exceeds the threshold r (0 without thresholds)
+ */
+void signature_bits(const float4* projection, const float4* thresholds, const float4* x, int bits, int length, uint8* signature) {
+    int     r, pos;
+
+    memset(signature, 0, (bits + 7) / 8);
+    for (r = 0; r < bits; r++) {
+        const float4*   row = projection + (size_t) r * length;
+        float4          dot = 0;
+
+        for (pos = 0; pos < length; pos++) dot += row[pos] * x[pos];
+        if (dot > ((thresholds != NULL) ? thresholds[r] : 0)) signature[r >> 3] |= (uint8) (0x80 >> (r & 7));
+    }
+}
+
+
+/****************************************************************************************************
+ * Elementwise vector kernels
+ * The loops of the array functions and aggregates (array_add, array_accumulate, ...) and of the
+ * Mahalanobis distance - plain C, the compiler vectorizes them for the baseline instruction set.
+ ****************************************************************************************************/
+
+void vector_greatest_real(float4* ptr0, const float4* ptr1, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] = MAX(ptr0[pos], ptr1[pos]);
+}
+
+void vector_least_real(float4* ptr0, const float4* ptr1, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] = MIN(ptr0[pos], ptr1[pos]);
+}
+
+void vector_add_real(float4* ptr0, const float4* ptr1, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] += ptr1[pos];
+}
+
+void vector_sub_real(float4* ptr0, const float4* ptr1, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] -= ptr1[pos];
+}
+
+void vector_mul_real(float4* ptr0, const float4* ptr1, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] *= ptr1[pos];
+}
+
+void vector_div_real(float4* ptr0, const float4* ptr1, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] /= ptr1[pos];
+}
+
+void vector_sqr_real(float4* ptr0, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] *= ptr0[pos];
+}
+
+void vector_sqrt_real(float4* ptr0, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) ptr0[pos] = (float4) sqrt(ptr0[pos]);
+}
+
+/*
+ * Fused elementwise kernels - one pass into a new result (no intermediate arrays)
+ */
+void vector_axpy_real(float4* result, float4 alpha, const float4* x, const float4* y, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) result[pos] = alpha * x[pos] + y[pos];
+}
+
+void vector_fma_real(float4* result, const float4* a, const float4* b, const float4* c, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) result[pos] = a[pos] * b[pos] + c[pos];
+}
+
+void vector_standardize_real(float4* result, const float4* a, const float4* mean, const float4* stdev, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) result[pos] = (a[pos] - mean[pos]) / stdev[pos];
+}
+
+// lo and hi of length items, or a single one if step is 0
+void vector_clamp_real(float4* result, const float4* a, const float4* lo, const float4* hi, int step, int length) {
+    int pos;
+    for (pos = 0; pos < length; pos++) result[pos] = MIN(MAX(a[pos], lo[pos * step]), hi[pos * step]);
+}
+
+/*
+ * Adds a vector to the average and standard deviation accumulator - ΣAi, ΣAi^2, Σi (of 3*length items)
+ */
+void vector_acc_real(float4* acc, const float4* ptr1, int length) {
+    int pos;
+
+    for (pos = 0; pos < length; pos++) {
+        acc[pos           ] += ptr1[pos];
+        acc[pos +   length] += ptr1[pos]*ptr1[pos];
+        acc[pos + 2*length] ++;
+    }
+}
+
+/*
+ * The moving (window) accumulator in float8 - the sign 1 adds the vector, -1 removes it
+ */
+void vector_macc_real(float8* acc, const float4* ptr1, int length, float8 sign) {
+    int pos;
+
+    for (pos = 0; pos < length; pos++) {
+        float8 x = ptr1[pos];
+
+        acc[pos           ] += sign * x;
+        acc[pos +   length] += sign * x*x;
+        acc[pos + 2*length] += sign;
+    }
+}
+
+/*
+ * Mahalanobis distance without sqrt - Sum [ (xi - yi)^2 / sigmai^2 ], by the variances sigmai^2 if given
+ * (a constant, see the query cache) or the standard deviations - the same float4 sigmai^2 and division
+ * either way, so the cached and uncached results are equal
+ */
+float4 dense_mahalanobis_int(const int32* ptr1, const int32* ptr2, const float4* stdev, const float4* variance, int length) {
+    float4  distance = 0;
+    int     pos;
+
+    for (pos = 0; pos < length; pos++) {
+        int64  diff = (int64) ptr1[pos] - ptr2[pos];
+        float4 sq_diff = (float4) (diff * diff);
+
+        if (variance != NULL) distance += sq_diff / variance[pos];
+        else distance += sq_diff / (stdev[pos] * stdev[pos]);
+    }
+    return distance;
+}
+
+float4 dense_mahalanobis_real(const float4* ptr1, const float4* ptr2, const float4* stdev, const float4* variance, int length) {
+    float4  distance = 0;
+    int     pos;
+
+    if (variance != NULL) {
+        for (pos = 0; pos < length; pos++) {
+            float4 diff = ptr1[pos] - ptr2[pos];
+            distance += (diff * diff) / variance[pos];
+        }
+    }
+    else {
+        for (pos = 0; pos < length; pos++) {
+            float4 diff = ptr1[pos] - ptr2[pos];
+            distance += (diff * diff) / (stdev[pos] * stdev[pos]);
+        }
+    }
+    return distance;
+}
+
+
+/*
+ * Bounded (early abandoning) square distances - the partial sum is checked every DENSE_BOUND_BLOCK
+ * dimensions and the loop stops once it exceeds the bound, so a result > bound is only a lower bound of
+ * the distance. The blocks go through the selected SIMD kernels, unless the dimensions are visited in
+ * the given order (0 based, high variance first) - then it is a scalar gather.
+ */
+float4 dense_square_real_bounded(const float4* ptr1, const float4* ptr2, int length, float4 bound, const int32* order) {
+    float4  distance = 0;
+    int     pos, end;
+
+    for (pos = 0; pos < length; pos = end) {
+        end = MIN(pos + DENSE_BOUND_BLOCK, length);
+
+        if (order != NULL) {
+            for (; pos < end; pos++) {
+                float4 diff = ptr1[order[pos]] - ptr2[order[pos]];
+                distance += diff * diff;
+            }
+        }
+        else distance += dense_square_real(ptr1 + pos, ptr2 + pos, end - pos);
+
+        if (distance > bound) break;
+    }
+    return distance;
+}
+
+int64 dense_square_int_bounded(const int32* ptr1, const int32* ptr2, int length, int64 bound, const int32* order) {
+    int64   distance = 0;
+    int     pos, end;
+
+    for (pos = 0; pos < length; pos = end) {
+        end = MIN(pos + DENSE_BOUND_BLOCK, length);
+
+        if (order != NULL) {
+            for (; pos < end; pos++) {
+                int64 diff = (int64) ptr1[order[pos]] - ptr2[order[pos]];
+                distance += diff * diff;
+            }
+        }
+        else distance += dense_square_int(ptr1 + pos, ptr2 + pos, end - pos);
+
+        if (distance > bound) break;
+    }
+    return distance;
+}
+
+
+// the selected kernels
+float4        (*dense_square_real)(const float4*, const float4*, int) = dense_square_real_scalar;
+int64         (*dense_square_int)(const int32*, const int32*, int) = dense_square_int_scalar;
+int64         (*dense_manhattan_int)(const int32*, const int32*, int) = dense_manhattan_int_scalar;
+int64         (*dense_chessboard_int)(const int32*, const int32*, int) = dense_chessboard_int_scalar;
+float4        (*dense_manhattan_real)(const float4*, const float4*, int) = dense_manhattan_real_scalar;
+float4        (*dense_chessboard_real)(const float4*, const float4*, int) = dense_chessboard_real_scalar;
+float4        (*dense_cosine_real)(const float4*, const float4*, int) = dense_cosine_real_scalar;
+void          (*dense_square_real_batch)(const float4*, const float4*, int, int, float4*) = dense_square_real_batch_rows;
+int64         (*byte_square)(const uint8*, const uint8*, int) = byte_square_scalar;
+int64         (*byte_manhattan)(const uint8*, const uint8*, int) = byte_manhattan_scalar;
+int64         (*byte_dot)(const uint8*, const uint8*, int) = byte_dot_scalar;
+int64         (*bit_hamming)(const uint8*, const uint8*, int) = bit_hamming_scalar;
+
+bool          simd_avx512bw = false;        // the byte kernels need AVX-512BW (and use VNNI if present)
+bool          simd_avx512vnni = false;
+bool          simd_avx512vpopcntdq = false;
+
+
+/*
+ * Detect the best instruction set supported by the CPU (CPUID, incl. the OS XSAVE support).
+ */
+SimdLevel simd_detect(void) {
+#ifdef PGSO_X86_SIMD
+    __builtin_cpu_init();
+    simd_avx512bw = __builtin_cpu_supports("avx512bw");
+    simd_avx512vnni = simd_avx512bw && __builtin_cpu_supports("avx512vnni");
+    simd_avx512vpopcntdq = simd_avx512bw && __builtin_cpu_supports("avx512vpopcntdq");
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) return SIMD_SSE42;
+#endif
+    return SIMD_SCALAR;
+}
+
+/*
+ * Select the kernels for the requested level (never above what the CPU supports).
+ */
+void simd_select(int requested) {
+    SimdLevel level = (requested == SIMD_AUTO || requested > simd_cpu) ? simd_cpu : (SimdLevel) requested;
+
+    dense_square_real    = dense_square_real_scalar;
+    dense_square_int     = dense_square_int_scalar;
+    dense_manhattan_int  = dense_manhattan_int_scalar;
+    dense_chessboard_int = dense_chessboard_int_scalar;
+    dense_manhattan_real = dense_manhattan_real_scalar;
+    dense_chessboard_real = dense_chessboard_real_scalar;
+    dense_cosine_real    = dense_cosine_real_scalar;
+    dense_square_real_batch = dense_square_real_batch_rows;
+    byte_square          = byte_square_scalar;
+    byte_manhattan       = byte_manhattan_scalar;
+    byte_dot             = byte_dot_scalar;
+    bit_hamming          = bit_hamming_scalar;
+    sparse_intersect_merge = sparse_intersect_merge_scalar;
+    sparse_intersect_merge_int8 = sparse_intersect_int8_merge_scalar;
+
+#ifdef PGSO_X86_SIMD
+    switch (level) {
+        case SIMD_AVX512:
+            dense_square_real    = dense_square_real_avx512;
+            dense_square_int     = dense_square_int_avx512;
+            dense_manhattan_int  = dense_manhattan_int_avx512;
+            dense_chessboard_int = dense_chessboard_int_avx512;
+            dense_manhattan_real = dense_manhattan_real_avx512;
+            dense_chessboard_real = dense_chessboard_real_avx512;
+            dense_cosine_real    = dense_cosine_real_avx512;
+            dense_square_real_batch = dense_square_real_batch_avx512;
+            byte_square          = simd_avx512vnni ? byte_square_vnni : (simd_avx512bw ? byte_square_avx512 : byte_square_avx2);
+            byte_manhattan       = simd_avx512bw ? byte_manhattan_avx512 : byte_manhattan_avx2;
+            byte_dot             = simd_avx512vnni ? byte_dot_vnni : (simd_avx512bw ? byte_dot_avx512 : byte_dot_avx2);
+            bit_hamming          = simd_avx512vpopcntdq ? bit_hamming_avx512 : bit_hamming_popcnt;
+            sparse_intersect_merge = sparse_intersect_avx2;
+            sparse_intersect_merge_int8 = sparse_intersect_int8_avx2;
+            break;
+        case SIMD_AVX2:
+            dense_square_real    = dense_square_real_avx2;
+            dense_square_int     = dense_square_int_avx2;
+            dense_manhattan_int  = dense_manhattan_int_avx2;
+            dense_chessboard_int = dense_chessboard_int_avx2;
+            dense_manhattan_real = dense_manhattan_real_avx2;
+            dense_chessboard_real = dense_chessboard_real_avx2;
+            dense_cosine_real    = dense_cosine_real_avx2;
+            dense_square_real_batch = dense_square_real_batch_avx2;
+            byte_square          = byte_square_avx2;
+            byte_manhattan       = byte_manhattan_avx2;
+            byte_dot             = byte_dot_avx2;
+            bit_hamming          = bit_hamming_popcnt;
+            sparse_intersect_merge = sparse_intersect_avx2;
+            sparse_intersect_merge_int8 = sparse_intersect_int8_avx2;
+            break;
+        case SIMD_SSE42:
+            dense_square_real    = dense_square_real_sse42;
+            dense_square_int     = dense_square_int_sse42;
+            dense_manhattan_int  = dense_manhattan_int_sse42;
+            dense_chessboard_int = dense_chessboard_int_sse42;
+            dense_manhattan_real = dense_manhattan_real_sse42;
+            dense_chessboard_real = dense_chessboard_real_sse42;
+            dense_cosine_real    = dense_cosine_real_sse42;
+            byte_square          = byte_square_sse42;
+            byte_manhattan       = byte_manhattan_sse42;
+            byte_dot             = byte_dot_sse42;
+            bit_hamming          = bit_hamming_popcnt;
+            sparse_intersect_merge = sparse_intersect_sse42;
+            break;
+        default:
+            break;
+    }
+#endif
+    simd_active = level;
+}
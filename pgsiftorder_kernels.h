@@ -0,0 +1,117 @@
+/*
+ * File:   pgsiftorder_kernels.h
+ * Author: chmelarp
+ *
+ * The numeric cores (pgsiftorder_kernels.c) - no server dependencies, shared by the library and the
+ * bench driver (make bench).
+ *
+ * See the README.txt for reference!
+ */
+
+#ifndef _PGSIFTORDER_KERNELS_H
+#define	_PGSIFTORDER_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// the Postgres type names (c.h) for the builds without the server headers
+#ifndef C_H
+typedef int32_t     int32;
+typedef int64_t     int64;
+typedef uint8_t     uint8;
+typedef uint32_t    uint32;
+typedef uint64_t    uint64;
+typedef float       float4;
+typedef double      float8;
+typedef size_t      Size;
+#endif
+
+
+/*
+ * Instruction sets of the kernels (pgsiftorder.simd)
+ */
+typedef enum {
+    SIMD_SCALAR = 0,
+    SIMD_SSE42,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_AUTO
+} SimdLevel;
+
+extern SimdLevel simd_cpu;              // the best the CPU (and OS) supports
+extern SimdLevel simd_active;           // the one the kernels were selected for
+extern bool      simd_avx512bw;         // the byte kernels need AVX-512BW (and use VNNI if present)
+extern bool      simd_avx512vnni;
+extern bool      simd_avx512vpopcntdq;  // the Hamming distance of the long signatures
+
+SimdLevel simd_detect(void);
+void simd_select(int requested);
+
+
+/*
+ * Dense vector kernels, selected by simd_select()
+ */
+extern float4 (*dense_square_real)(const float4*, const float4*, int);
+extern int64  (*dense_square_int)(const int32*, const int32*, int);
+extern int64  (*dense_manhattan_int)(const int32*, const int32*, int);
+extern int64  (*dense_chessboard_int)(const int32*, const int32*, int);
+extern float4 (*dense_manhattan_real)(const float4*, const float4*, int);
+extern float4 (*dense_chessboard_real)(const float4*, const float4*, int);
+extern float4 (*dense_cosine_real)(const float4*, const float4*, int);
+extern void   (*dense_square_real_batch)(const float4* query, const float4* rows, int count, int length, float4* result);
+
+// early abandoning - stop once the partial sum (checked every block) exceeds the bound
+#define DENSE_BOUND_BLOCK 32
+
+float4 dense_square_real_bounded(const float4* ptr1, const float4* ptr2, int length, float4 bound, const int32* order);
+int64  dense_square_int_bounded(const int32* ptr1, const int32* ptr2, int length, int64 bound, const int32* order);
+
+// byte vectors (bvec)
+extern int64  (*byte_square)(const uint8*, const uint8*, int);
+extern int64  (*byte_manhattan)(const uint8*, const uint8*, int);
+extern int64  (*byte_dot)(const uint8*, const uint8*, int);
+
+// binary signatures (bytea, bit(n)) - the number of differing bits of length bytes
+extern int64  (*bit_hamming)(const uint8*, const uint8*, int);
+void signature_bits(const float4* projection, const float4* thresholds, const float4* x, int bits, int length, uint8* signature);
+
+
+/*
+ * Sorted sparse vector kernels - the intersection of sorted int4 arrays (the positions of the matches
+ * if match1 and match2 are given)
+ */
+#define SPARSE_GALLOP_RATIO 32      // use galloping if the longer array is at least this many times longer
+
+extern int (*sparse_intersect_merge)(const int32*, int, const int32*, int, int*, int*);
+int sparse_intersect(const int32* ptr1, int length1, const int32* ptr2, int length2, int* match1, int* match2);
+float4 sparse_sum_squares(const float4* ptrw, int length);
+
+// the sorted int8 term ids (hashed text tokens) - the same intersection, the 64 bit hash of a token
+extern int (*sparse_intersect_merge_int8)(const int64*, int, const int64*, int, int*, int*);
+int sparse_intersect_int8(const int64* ptr1, int length1, const int64* ptr2, int length2, int* match1, int* match2);
+int64 term_hash64(const uint8* ptr, int length);
+
+
+/*
+ * Elementwise vector kernels - ptr0 is updated in place (the fused ones write a new result)
+ */
+void vector_greatest_real(float4* ptr0, const float4* ptr1, int length);
+void vector_least_real(float4* ptr0, const float4* ptr1, int length);
+void vector_add_real(float4* ptr0, const float4* ptr1, int length);
+void vector_sub_real(float4* ptr0, const float4* ptr1, int length);
+void vector_mul_real(float4* ptr0, const float4* ptr1, int length);
+void vector_div_real(float4* ptr0, const float4* ptr1, int length);
+void vector_sqr_real(float4* ptr0, int length);
+void vector_sqrt_real(float4* ptr0, int length);
+void vector_axpy_real(float4* result, float4 alpha, const float4* x, const float4* y, int length);
+void vector_fma_real(float4* result, const float4* a, const float4* b, const float4* c, int length);
+void vector_standardize_real(float4* result, const float4* a, const float4* mean, const float4* stdev, int length);
+void vector_clamp_real(float4* result, const float4* a, const float4* lo, const float4* hi, int step, int length);
+void vector_acc_real(float4* acc, const float4* ptr1, int length);
+void vector_macc_real(float8* acc, const float4* ptr1, int length, float8 sign);
+
+float4 dense_mahalanobis_int(const int32* ptr1, const int32* ptr2, const float4* stdev, const float4* variance, int length);
+float4 dense_mahalanobis_real(const float4* ptr1, const float4* ptr2, const float4* stdev, const float4* variance, int length);
+
+#endif	/* _PGSIFTORDER_KERNELS_H */
@@ -0,0 +1,383 @@
+/*
+ * File:   pgsiftorder_pq.c
+ * Author: chmelarp
+ *
+ * Product quantization (PQ) - compact codes of dense vectors and the asymmetric distance.
+ *
+ * A vector of dim = m * ds dimensions is split into m subvectors (subspaces), each of them is replaced
+ * by the number of the nearest of k <= 256 centroids trained by k-means for the subspace - a byte.
+ * The codebook is real[m][k][ds], the code is bytea of m bytes (a 128-d SIFT descriptor, m = 16 ~ 16 B).
+ *
+ * pq_distance(query, code, codebook) computes the square distances of the query subvectors to all
+ * the centroids once (a lookup table m x k, cached in fn_extra), the distance to a code then costs
+ * m table lookups instead of dim multiply-adds.
+ *
+ * See the README.txt for reference!
+ */
+
+#include <math.h>
+#include <string.h>
+#include <postgres.h>
+#include <fmgr.h>
+#include <catalog/pg_type.h>
+#include <utils/array.h>
+#include <utils/memutils.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder.h"
+
+
+#define PQ_MAX_CENTROIDS            256     // a code is a byte
+#define PQ_SAMPLES_PER_CENTROID     64      // k-means training sample (reservoir)
+
+
+/*
+ * Codebook real[m][k][ds] - checked, returns the dimensions
+ */
+static float4* pq_codebook(ArrayType* codebook, int* m, int* k, int* ds) {
+    if (ARR_NDIM(codebook) != 3 || ARR_HASNULL(codebook))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("codebook must be a three-dimensional array real[m][k][ds] without NULLs")));
+
+    *m = ARR_DIMS(codebook)[0];
+    *k = ARR_DIMS(codebook)[1];
+    *ds = ARR_DIMS(codebook)[2];
+    if (*k > PQ_MAX_CENTROIDS)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("codebook can have at most %d centroids per subspace, not %d", PQ_MAX_CENTROIDS, *k)));
+
+    return (float4*) ARR_DATA_PTR(codebook);
+}
+
+// the vector must have m * ds dimensions
+static float4* pq_vector(ArrayType* vector, int m, int ds) {
+    int     length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+
+    if (ARR_HASNULL(vector))
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("array must not contain NULLs")));
+    if (length != m * ds)
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("vector has %d dimensions, the codebook %d (%d x %d)", length, m * ds, m, ds)));
+
+    return (float4*) ARR_DATA_PTR(vector);
+}
+
+// a new real[m][k][ds]
+static ArrayType* pq_codebook_new(int m, int k, int ds) {
+    ArrayType*  r;
+    int         nbytes = ARR_OVERHEAD_NONULLS(3) + sizeof(float4) * m * k * ds;
+
+    r = (ArrayType*) palloc0(nbytes);
+    SET_VARSIZE(r, nbytes);
+    ARR_NDIM(r) = 3;
+    r->dataoffset = 0;          /* marker for no null bitmap */
+    ARR_ELEMTYPE(r) = FLOAT4OID;
+    ARR_DIMS(r)[0] = m;
+    ARR_DIMS(r)[1] = k;
+    ARR_DIMS(r)[2] = ds;
+    ARR_LBOUND(r)[0] = ARR_LBOUND(r)[1] = ARR_LBOUND(r)[2] = 1;
+
+    return r;
+}
+
+
+
+/****************************************************************************************************
+ * Training - pq_codebook(vector, m, k) aggregate
+ ****************************************************************************************************/
+
+typedef struct PqTrainState {
+    int         dim;
+    int         m;              // subspaces
+    int         k;              // centroids per subspace
+    int         count;          // sampled vectors
+    int         capacity;
+    double      seen;           // all the vectors
+    float4*     samples;        // count x dim
+} PqTrainState;
+
+
+PG_FUNCTION_INFO_V1(c_pq_train_accum);
+/****************************************************************************************************
+ * PQ codebook training transition - a reservoir sample of the vectors (k * 64 at most)
+ * @param state internal
+ * @param vector real[]
+ * @param m int4 - number of subspaces (must divide the dimension)
+ * @param k int4 - centroids per subspace (at most 256)
+ */
+Datum
+c_pq_train_accum(PG_FUNCTION_ARGS) {
+    MemoryContext   aggcontext;
+    PqTrainState*   state = PG_ARGISNULL(0) ? NULL : (PqTrainState*) PG_GETARG_POINTER(0);
+    ArrayType*      vector;
+    int             length;
+    int             slot;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("c_pq_train_accum called in non-aggregate context")));
+
+    if (PG_ARGISNULL(1)) PG_RETURN_POINTER(state);
+    vector = PG_GETARG_ARRAYTYPE_P(1);
+    length = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+
+    if (state == NULL) {
+        int m = PG_ARGISNULL(2) ? 0 : PG_GETARG_INT32(2);
+        int k = PG_ARGISNULL(3) ? 0 : PG_GETARG_INT32(3);
+
+        if (m < 1 || length % m != 0)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("number of subspaces must divide the dimension (%d)", length)));
+        if (k < 1 || k > PQ_MAX_CENTROIDS)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("number of centroids must be between 1 and %d", PQ_MAX_CENTROIDS)));
+
+        state = (PqTrainState*) MemoryContextAllocZero(aggcontext, sizeof(PqTrainState));
+        state->dim = length;
+        state->m = m;
+        state->k = k;
+        state->capacity = k * PQ_SAMPLES_PER_CENTROID;
+        state->samples = (float4*) MemoryContextAllocHuge(aggcontext, sizeof(float4) * (Size) state->capacity * length);
+    }
+
+    pq_vector(vector, state->m, state->dim / state->m);
+
+    // reservoir sampling (Algorithm R)
+    state->seen++;
+    if (state->count < state->capacity) slot = state->count++;
+    else {
+        slot = (int) floor((double) random() / ((double) MAX_RANDOM_VALUE + 1) * state->seen);
+        if (slot >= state->capacity) slot = -1;
+    }
+    if (slot >= 0) memcpy(state->samples + (Size) slot * state->dim, ARR_DATA_PTR(vector), sizeof(float4) * state->dim);
+
+    PG_RETURN_POINTER(state);
+}
+
+
+PG_FUNCTION_INFO_V1(c_pq_train_final);
+/****************************************************************************************************
+ * PQ codebook training final - k-means of each subspace
+ * @param state internal
+ * @return real[m][k][ds] (k is lower if there were fewer vectors)
+ */
+Datum
+c_pq_train_final(PG_FUNCTION_ARGS) {
+    PqTrainState*   state = PG_ARGISNULL(0) ? NULL : (PqTrainState*) PG_GETARG_POINTER(0);
+    ArrayType*      result;
+    float4*         centroids;
+    float4*         subvectors;
+    int             ds, k, s, j;
+
+    if (state == NULL || state->count == 0) PG_RETURN_NULL();
+
+    ds = state->dim / state->m;
+    k = MIN(state->k, state->count);
+    result = pq_codebook_new(state->m, k, ds);
+    centroids = (float4*) ARR_DATA_PTR(result);
+
+    // the subvectors of a subspace are not contiguous in the sample
+    subvectors = (float4*) palloc(sizeof(float4) * (Size) state->count * ds);
+    for (s = 0; s < state->m; s++) {
+        for (j = 0; j < state->count; j++) {
+            memcpy(subvectors + (Size) j * ds, state->samples + (Size) j * state->dim + s * ds, sizeof(float4) * ds);
+        }
+        kmeans_real(subvectors, state->count, ds, k, centroids + (Size) s * k * ds);
+    }
+    pfree(subvectors);
+
+    #ifdef _DEBUG
+        ereport(NOTICE, (111111, errmsg("c_pq_train_final m: %d, k: %d, ds: %d, samples: %d of %.0f", state->m, k, ds, state->count, state->seen)));
+    #endif
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+
+/****************************************************************************************************
+ * Encoding
+ ****************************************************************************************************/
+
+PG_FUNCTION_INFO_V1(c_pq_encode);
+/****************************************************************************************************
+ * PQ code of the vector - the nearest centroid of each subspace
+ * @param vector real[]
+ * @param codebook real[m][k][ds]
+ * @return bytea of m bytes
+ */
+Datum
+c_pq_encode(PG_FUNCTION_ARGS) {
+    ArrayType*  vector = PG_GETARG_ARRAYTYPE_P(0);
+    ArrayType*  codebook = PG_GETARG_ARRAYTYPE_P(1);
+    int         m, k, ds, s;
+    float4*     centroids = pq_codebook(codebook, &m, &k, &ds);
+    float4*     x = pq_vector(vector, m, ds);
+    bytea*      result = (bytea*) palloc(VARHDRSZ + m);
+    uint8*      code = (uint8*) VARDATA(result);
+
+    SET_VARSIZE(result, VARHDRSZ + m);
+    for (s = 0; s < m; s++) {
+        code[s] = (uint8) kmeans_nearest(centroids + (Size) s * k * ds, k, ds, x + s * ds);
+    }
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(c_pq_decode);
+/****************************************************************************************************
+ * Approximate vector of the PQ code - the centroids
+ * @param code bytea
+ * @param codebook real[m][k][ds]
+ * @return real[]
+ */
+Datum
+c_pq_decode(PG_FUNCTION_ARGS) {
+    bytea*      bcode = PG_GETARG_BYTEA_PP(0);
+    ArrayType*  codebook = PG_GETARG_ARRAYTYPE_P(1);
+    int         m, k, ds, s;
+    float4*     centroids = pq_codebook(codebook, &m, &k, &ds);
+    uint8*      code = (uint8*) VARDATA_ANY(bcode);
+    ArrayType*  result;
+
+    if (VARSIZE_ANY_EXHDR(bcode) != m)
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("code has %d bytes, the codebook %d subspaces", (int) VARSIZE_ANY_EXHDR(bcode), m)));
+
+    result = array_new_real(m * ds);
+    for (s = 0; s < m; s++) {
+        if (code[s] >= k)
+            ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                            errmsg("code %d is out of the codebook (%d centroids)", code[s], k)));
+        memcpy((float4*) ARR_DATA_PTR(result) + s * ds, centroids + ((Size) s * k + code[s]) * ds, sizeof(float4) * ds);
+    }
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+
+
+/****************************************************************************************************
+ * Asymmetric distance
+ ****************************************************************************************************/
+
+/*
+ * The lookup table of a query, kept in fn_extra for the series of calls (a query against many codes).
+ * A constant (stable) query and codebook are not even detoasted again, otherwise the table is rebuilt
+ * only when they change - told by the arguments as they are passed, not detoasted: a TOAST pointer
+ * identifies the stored value (a codebook of a table), an inline value is compared by its bytes.
+ */
+typedef struct PqDistanceCache {
+    int         m, k, ds;
+    bool        stable;         // the query and the codebook do not change during the scan
+    Size        query_size;     // the keys (not stable ~ compared on each call)
+    Size        codebook_size;
+    char*       query;
+    char*       codebook;
+    float4*     lut;            // m x k square distances of the query subvectors to the centroids
+} PqDistanceCache;
+
+// the key of an argument - the raw datum (an expanded or indirect one is flattened)
+static struct varlena* pq_key(Datum datum, Size* size) {
+    struct varlena* raw = (struct varlena*) DatumGetPointer(datum);
+
+    if (VARATT_IS_EXTERNAL(raw) && !VARATT_IS_EXTERNAL_ONDISK(raw)) raw = pg_detoast_datum_packed(raw);
+    *size = VARSIZE_ANY(raw);
+    return raw;
+}
+
+static PqDistanceCache* pq_distance_cache(FunctionCallInfo fcinfo) {
+    PqDistanceCache*    cache = (PqDistanceCache*) fcinfo->flinfo->fn_extra;
+    ArrayType*          vector;
+    ArrayType*          codebook;
+    struct varlena*     query_key;
+    struct varlena*     codebook_key;
+    Size                query_size, codebook_size;
+    float4*             query;
+    float4*             centroids;
+    int                 m, k, ds, s, c;
+    MemoryContext       oldcxt;
+
+    if (cache != NULL && cache->stable) return cache;
+
+    query_key = pq_key(PG_GETARG_DATUM(0), &query_size);
+    codebook_key = pq_key(PG_GETARG_DATUM(2), &codebook_size);
+    if (cache != NULL && cache->query_size == query_size && cache->codebook_size == codebook_size
+        && memcmp(cache->query, query_key, query_size) == 0 && memcmp(cache->codebook, codebook_key, codebook_size) == 0)
+        return cache;
+
+    vector = PG_GETARG_ARRAYTYPE_P(0);
+    codebook = PG_GETARG_ARRAYTYPE_P(2);
+    centroids = pq_codebook(codebook, &m, &k, &ds);
+    query = pq_vector(vector, m, ds);
+
+    if (cache != NULL) {
+        pfree(cache->query);
+        pfree(cache->codebook);
+        pfree(cache->lut);
+        pfree(cache);
+    }
+
+    oldcxt = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+    cache = (PqDistanceCache*) palloc0(sizeof(PqDistanceCache));
+    cache->m = m;
+    cache->k = k;
+    cache->ds = ds;
+    cache->stable = get_fn_expr_arg_stable(fcinfo->flinfo, 0) && get_fn_expr_arg_stable(fcinfo->flinfo, 2);
+    cache->query_size = query_size;
+    cache->codebook_size = codebook_size;
+    cache->query = (char*) palloc(query_size);
+    cache->codebook = (char*) palloc(codebook_size);
+    cache->lut = (float4*) palloc(sizeof(float4) * m * k);
+    MemoryContextSwitchTo(oldcxt);
+
+    memcpy(cache->query, query_key, query_size);
+    memcpy(cache->codebook, codebook_key, codebook_size);
+    for (s = 0; s < m; s++) {
+        for (c = 0; c < k; c++) {
+            cache->lut[s * k + c] = dense_square_real(query + s * ds, centroids + ((Size) s * k + c) * ds, ds);
+        }
+    }
+
+    fcinfo->flinfo->fn_extra = cache;
+    return cache;
+}
+
+
+PG_FUNCTION_INFO_V1(c_pq_distance);
+/****************************************************************************************************
+ * Asymmetric (the exact query, the quantized vector) square distance to the PQ code
+ * d(q, code) = Sum[ lut[s][code[s]] ] = Sum[ |qs - centroid(s, code[s])|^2 ]
+ * @param query real[]
+ * @param code bytea
+ * @param codebook real[m][k][ds]
+ */
+Datum
+c_pq_distance(PG_FUNCTION_ARGS) {
+    uint64              started = STATS_CLOCK();    // pgsiftorder.stats
+    PqDistanceCache*    cache = pq_distance_cache(fcinfo);
+    bytea*              bcode = PG_GETARG_BYTEA_PP(1);
+    uint64              detoasted = STATS_CLOCK();
+    uint8*              code = (uint8*) VARDATA_ANY(bcode);
+    const float4*       lut = cache->lut;
+    int                 m = cache->m;
+    int                 k = cache->k;
+    float4              distance = 0;
+    int                 s;
+
+    if (VARSIZE_ANY_EXHDR(bcode) != m)
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("code has %d bytes, the codebook %d subspaces", (int) VARSIZE_ANY_EXHDR(bcode), m)));
+
+    for (s = 0; s < m; s++, lut += k) {
+        if (code[s] >= k)
+            ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                            errmsg("code %d is out of the codebook (%d centroids)", code[s], k)));
+        distance += lut[code[s]];
+    }
+
+    STATS_COUNT(STAT_PQ_DISTANCE, started, detoasted, m, 0, 0);
+    PG_RETURN_FLOAT4(distance);
+}
@@ -0,0 +1,528 @@
+/*
+ * File:   pgsiftorder_search.c
+ * Author: chmelarp
+ *
+ * Ranked retrieval - sift_search(relation, ids_column, query, weights, k) returns the k rows of the best
+ * rating of the int[] column against the query, without scoring every row sharing a word with it.
+ *
+ * The posting lists of the query words are read from the GIN index of the column (a bitmap scan of
+ * column @> ARRAY[word] a word, work_mem shared by the words, the TIDs come in the heap order) and walked
+ * by WAND: each word has an upper bound of its contribution to the rating, the lists are kept ordered by
+ * their current TID and the pivot is the first TID whose lists' bounds may beat the k-th best rating so far.
+ * The lists behind the pivot skip to it (whole pages of the bitmap iterator, a binary search in the page),
+ * only the pivots are fetched from the heap and rated exactly - the common words alone never reach the
+ * threshold once the heap of the k best is full. A list is never materialized, a lossy page of the bitmap
+ * is walked offset by offset.
+ *
+ * The ratings are those of rating_cosine (the weights column given) and of rating_boolean (the query
+ * weights of the common ids - their number for the weights 1) - sparse_rating() and sparse_cosine() of
+ * both, the bounds |weight| / |query| and weight (summed over the repetitions of an id). The rows of NULL
+ * elements are skipped.
+ *
+ * See the README.txt for reference!
+ */
+
+#include <float.h>
+#include <math.h>
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>                    // set returning functions
+#include <miscadmin.h>                  // work_mem, GetUserId
+#include <access/genam.h>               // index_beginscan_bitmap, index_open
+#include <access/htup_details.h>        // MaxHeapTuplesPerPage, heap_form_tuple
+#include <access/skey.h>                // ScanKeyInit
+#include <access/table.h>
+#include <access/tableam.h>             // table_index_fetch_tuple
+#include <catalog/pg_am.h>              // GIN_AM_OID
+#include <catalog/pg_operator.h>        // OID_ARRAY_CONTAINS_OP
+#include <catalog/pg_type.h>
+#include <executor/tuptable.h>
+#include <nodes/tidbitmap.h>
+#include <utils/acl.h>
+#include <utils/array.h>
+#include <utils/builtins.h>             // format_type_be
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/rls.h>                  // check_enable_rls
+#include <utils/snapmgr.h>              // GetActiveSnapshot
+
+#include "abbrevs.h"
+#include "pgsiftorder.h"
+
+
+// a heap TID as one ascending number
+#define SEARCH_TID(block, offset)   (((uint64) (block) << 16) | (uint64) (offset))
+#define SEARCH_TID_END              UINT64_MAX
+
+
+/*
+ * The posting list of a query word - the bitmap and its iterator as the cursor
+ */
+typedef struct SearchList {
+    TIDBitmap*          tbm;
+    TBMIterator*        iterator;
+    TBMIterateResult*   page;       // the current page of the iterator, NULL at the end
+    int                 pos;        // in the page (an offset - 1 of a lossy page)
+    uint64              current;    // the TID at pos, SEARCH_TID_END at the end
+    uint64              postings;   // the TIDs of the pages read
+    float4              bound;      // the upper bound of the word's contribution
+} SearchList;
+
+#define SEARCH_CURRENT(list)    ((list)->current)
+
+// the TIDs of the page (all the offsets of a lossy one, the rating is exact anyway)
+#define SEARCH_PAGE_TUPLES(page)    (((page)->ntuples >= 0) ? (page)->ntuples : MaxHeapTuplesPerPage)
+
+typedef struct SearchResult {
+    float4      score;
+    uint64      tid;
+} SearchResult;
+
+
+/*
+ * The GIN index of the column supporting @> (not partial, valid) - opened, or an error
+ */
+static Relation search_index(Relation heap, AttrNumber attnum, StrategyNumber* strategy) {
+    List*       indexes = RelationGetIndexList(heap);
+    ListCell*   lc;
+
+    foreach(lc, indexes) {
+        Relation    index = index_open(lfirst_oid(lc), AccessShareLock);
+
+        if (index->rd_rel->relam == GIN_AM_OID && index->rd_index->indisvalid &&
+            IndexRelationGetNumberOfKeyAttributes(index) == 1 && index->rd_index->indkey.values[0] == attnum &&
+            RelationGetIndexPredicate(index) == NIL &&
+            (*strategy = get_op_opfamily_strategy(OID_ARRAY_CONTAINS_OP, index->rd_opfamily[0])) != InvalidStrategy) {
+            list_free(indexes);
+            return index;
+        }
+        index_close(index, AccessShareLock);
+    }
+
+    ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                    errmsg("there is no GIN index of \"%s\".\"%s\" supporting @>", RelationGetRelationName(heap),
+                           get_attname(RelationGetRelid(heap), attnum, false)),
+                    errhint("CREATE INDEX ON %s USING gin (%s);", RelationGetRelationName(heap),
+                            get_attname(RelationGetRelid(heap), attnum, false))));
+    return NULL;    // keep the compiler quiet
+}
+
+/*
+ * The TID at the position of the list, the next page of the iterator at the end of the page
+ */
+static void search_settle(SearchList* list) {
+    while (list->page != NULL && list->pos >= SEARCH_PAGE_TUPLES(list->page)) {
+        list->page = tbm_iterate(list->iterator);
+        list->pos = 0;
+        if (list->page != NULL) list->postings += SEARCH_PAGE_TUPLES(list->page);
+    }
+
+    if (list->page == NULL) list->current = SEARCH_TID_END;
+    else if (list->page->ntuples >= 0) list->current = SEARCH_TID(list->page->blockno, list->page->offsets[list->pos]);
+    else list->current = SEARCH_TID(list->page->blockno, FirstOffsetNumber + list->pos);
+}
+
+/*
+ * The posting list of a word - the bitmap scan of column @> ARRAY[word] of maxbytes, its cursor at the first TID
+ */
+static void search_postings(Relation index, Snapshot snapshot, StrategyNumber strategy, int32 term, long maxbytes,
+                            SearchList* list) {
+    Datum               element = Int32GetDatum(term);
+    ScanKeyData         key;
+    IndexScanDesc       scan;
+
+    ScanKeyInit(&key, 1, strategy, get_opcode(OID_ARRAY_CONTAINS_OP),
+                PointerGetDatum(construct_array(&element, 1, INT4OID, sizeof(int32), true, 'i')));
+
+    scan = index_beginscan_bitmap(index, snapshot, 1);
+    index_rescan(scan, &key, 1, NULL, 0);
+    list->tbm = tbm_create(maxbytes, NULL);
+    index_getbitmap(scan, list->tbm);
+    index_endscan(scan);
+
+    list->iterator = tbm_begin_iterate(list->tbm);
+    list->page = tbm_iterate(list->iterator);
+    list->pos = 0;
+    list->postings = (list->page != NULL) ? SEARCH_PAGE_TUPLES(list->page) : 0;
+    search_settle(list);
+}
+
+/*
+ * The list moves to its first TID >= tid - the pages of the blocks before skip whole, the offsets of the
+ * block by a binary search
+ */
+static void search_skip(SearchList* list, uint64 tid) {
+    BlockNumber     block = (BlockNumber) (tid >> 16);
+    OffsetNumber    offset = (OffsetNumber) (tid & 0xFFFF);
+
+    if (list->current >= tid) return;
+
+    while (list->page != NULL && list->page->blockno < block) {
+        list->page = tbm_iterate(list->iterator);
+        list->pos = 0;
+        if (list->page != NULL) list->postings += SEARCH_PAGE_TUPLES(list->page);
+    }
+
+    if (list->page != NULL && list->page->blockno == block) {
+        if (list->page->ntuples >= 0) {
+            int     lo = list->pos, hi = list->page->ntuples, mid;
+
+            while (lo < hi) {
+                mid = lo + ((hi - lo) >> 1);
+                if (list->page->offsets[mid] < offset) lo = mid + 1;
+                else                                   hi = mid;
+            }
+            list->pos = lo;
+        }
+        else list->pos = MAX(list->pos, (int) offset - FirstOffsetNumber);
+    }
+    search_settle(list);
+}
+
+// the next TID of the list
+static inline void search_next(SearchList* list) {
+    list->pos++;
+    search_settle(list);
+}
+
+static void search_end(SearchList* list) {
+    if (list->iterator != NULL) tbm_end_iterate(list->iterator);
+    if (list->tbm != NULL) tbm_free(list->tbm);
+}
+
+/*
+ * The k best - a min-heap (the worst on the top), ties by the smaller TID
+ */
+static inline bool search_worse(const SearchResult* a, const SearchResult* b) {
+    return (a->score < b->score) || (a->score == b->score && a->tid > b->tid);
+}
+
+static void search_push(SearchResult* heap, int* size, int k, const SearchResult* item) {
+    int     pos;
+
+    if (*size < k) {
+        for (pos = (*size)++; pos > 0 && search_worse(item, &heap[(pos - 1) / 2]); pos = (pos - 1) / 2)
+            heap[pos] = heap[(pos - 1) / 2];
+        heap[pos] = *item;
+        return;
+    }
+    if (!search_worse(&heap[0], item)) return;
+
+    for (pos = 0;;) {
+        int child = 2 * pos + 1;
+
+        if (child >= *size) break;
+        if (child + 1 < *size && search_worse(&heap[child + 1], &heap[child])) child++;
+        if (!search_worse(&heap[child], item)) break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = *item;
+}
+
+static int search_cmp(const void* a, const void* b) {
+    return search_worse((const SearchResult*) a, (const SearchResult*) b) ? 1
+         : (search_worse((const SearchResult*) b, (const SearchResult*) a) ? -1 : 0);
+}
+
+/*
+ * The query - ids sorted (repeated ids in their order, rated as rating_cosine pairs them), no NULLs
+ */
+typedef struct SearchTerm {
+    int32       id;
+    int         pos;
+    float4      weight;
+} SearchTerm;
+
+static int search_term_cmp(const void* a, const void* b) {
+    const SearchTerm* x = (const SearchTerm*) a;
+    const SearchTerm* y = (const SearchTerm*) b;
+
+    if (x->id != y->id) return (x->id > y->id) - (x->id < y->id);
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+static int search_query(ArrayType* query, ArrayType* weights, int32** ids, float4** values) {
+    int         length = ArrayGetNItems(ARR_NDIM(query), ARR_DIMS(query));
+    SearchTerm* terms;
+    int         pos;
+
+    if (ARR_HASNULL(query) || ARR_HASNULL(weights) || length != ArrayGetNItems(ARR_NDIM(weights), ARR_DIMS(weights))) {
+        ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                        errmsg("weight arrays must be of the same size as key arrays (without NULLs)")));
+    }
+
+    terms = (SearchTerm*) palloc(sizeof(SearchTerm) * (length + 1));
+    for (pos = 0; pos < length; pos++) {
+        terms[pos].id = ((int32*) ARR_DATA_PTR(query))[pos];
+        terms[pos].pos = pos;
+        terms[pos].weight = ((float4*) ARR_DATA_PTR(weights))[pos];
+    }
+    qsort(terms, length, sizeof(SearchTerm), search_term_cmp);
+
+    *ids = (int32*) palloc(sizeof(int32) * (length + 1));
+    *values = (float4*) palloc(sizeof(float4) * (length + 1));
+    for (pos = 0; pos < length; pos++) {
+        (*ids)[pos] = terms[pos].id;
+        (*values)[pos] = terms[pos].weight;
+    }
+    pfree(terms);
+    return length;
+}
+
+/*
+ * A column of the relation of the type, or an error
+ */
+static AttrNumber search_column(Oid relid, Name column, Oid type) {
+    AttrNumber  attnum = get_attnum(relid, NameStr(*column));
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+                        errmsg("column \"%s\" of relation \"%s\" does not exist", NameStr(*column), get_rel_name(relid))));
+    }
+    if (get_atttype(relid, attnum) != type) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                        errmsg("column \"%s\" must be of type %s", NameStr(*column), format_type_be(type))));
+    }
+    return attnum;
+}
+
+
+PG_FUNCTION_INFO_V1(c_sift_search);
+/****************************************************************************************************
+ * The k rows of the best rating of the int[] column against the query - WAND over the posting lists of
+ * the GIN index of the column.
+ * @param relation regclass
+ * @param ids_column name - int[] (sorted, distinct), a GIN index supporting @>
+ * @param query int4[]
+ * @param weights float4[] - of the query ids
+ * @param k int4
+ * @param weights_column name - real[] of the document weights (cosine), NULL (boolean)
+ * @return SETOF (ctid tid, score float4) ordered by the score descending
+ */
+Datum
+c_sift_search(PG_FUNCTION_ARGS) {
+    FuncCallContext*  funcctx;
+    SearchResult*     heap;
+
+    if (SRF_IS_FIRSTCALL()) {
+        MemoryContext       oldcontext;
+        TupleDesc           tupdesc;
+        Oid                 relid;
+        Relation            rel;
+        Relation            index;
+        StrategyNumber      strategy;
+        AttrNumber          ids_attnum;
+        AttrNumber          weights_attnum = InvalidAttrNumber;
+        Snapshot            snapshot = GetActiveSnapshot();
+        IndexFetchTableData* fetch;
+        TupleTableSlot*     slot;
+        AclResult           aclresult;
+        int32*              ids;
+        float4*             values;
+        SearchList*         lists;
+        SearchList**        order;
+        int*                match1;
+        int*                match2;
+        float8              norm = 0;       // of the query
+        int                 length, words, active, size = 0, capacity;
+        int                 k, i, j;
+        uint64              started = STATS_CLOCK();        // pgsiftorder.stats
+        uint64              detoasted;
+        uint64              postings = 0;
+        uint64              scored = 0;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("function returning record called in context that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        funcctx->max_calls = 0;
+
+        if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3) || PG_ARGISNULL(4) ||
+            (k = PG_GETARG_INT32(4)) <= 0) {
+            MemoryContextSwitchTo(oldcontext);
+            funcctx = SRF_PERCALL_SETUP();
+            SRF_RETURN_DONE(funcctx);
+        }
+
+        // the relation (SELECT privilege, no row level security), its columns and the GIN index
+        relid = PG_GETARG_OID(0);
+        aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+        if (aclresult != ACLCHECK_OK) aclcheck_error(aclresult, OBJECT_TABLE, get_rel_name(relid));
+        if (check_enable_rls(relid, InvalidOid, false) == RLS_ENABLED) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("sift_search does not support row level security (\"%s\")", get_rel_name(relid))));
+        }
+
+        rel = table_open(relid, AccessShareLock);
+        ids_attnum = search_column(relid, PG_GETARG_NAME(1), INT4ARRAYOID);
+        if (PG_NARGS() > 5 && !PG_ARGISNULL(5)) weights_attnum = search_column(relid, PG_GETARG_NAME(5), FLOAT4ARRAYOID);
+        index = search_index(rel, ids_attnum, &strategy);
+
+        length = search_query(PG_GETARG_ARRAYTYPE_P(2), PG_GETARG_ARRAYTYPE_P(3), &ids, &values);
+        norm = sqrt(sparse_sum_squares(values, length));
+        detoasted = STATS_CLOCK();
+
+        // the posting lists (their bitmaps share work_mem) and the bounds of the words (a repeated id may match
+        // as many times)
+        lists = (SearchList*) palloc0(sizeof(SearchList) * (length + 1));
+        order = (SearchList**) palloc(sizeof(SearchList*) * (length + 1));
+        for (i = 0, words = 0, active = 0; i < length; i = j, words++) {
+            float4  bound = 0;
+
+            for (j = i; j < length && ids[j] == ids[i]; j++)
+                bound += (weights_attnum != InvalidAttrNumber) ? fabsf(values[j]) : MAX(values[j], 0);
+            search_postings(index, snapshot, strategy, ids[i], work_mem * 1024L / length, &lists[words]);
+            lists[words].bound = (weights_attnum != InvalidAttrNumber) ? ((norm > 0) ? bound / norm : 0) : bound;
+            if (SEARCH_CURRENT(&lists[words]) != SEARCH_TID_END) order[active++] = &lists[words];
+        }
+        index_close(index, AccessShareLock);
+
+        // the heap of the k best grows with the rated rows
+        capacity = MIN(k, 1024);
+        heap = (SearchResult*) palloc(sizeof(SearchResult) * capacity);
+        match1 = (int*) palloc(sizeof(int) * (length + 1));
+        match2 = (int*) palloc(sizeof(int) * (length + 1));
+        fetch = table_index_fetch_begin(rel);
+        slot = table_slot_create(rel, NULL);
+
+        //
+        // WAND - the lists ordered by their current TIDs, the pivot is the first TID whose lists' bounds
+        // reach the k-th best score
+        //
+        while (active > 0) {
+            float4      threshold = (size < k) ? -FLT_MAX : heap[0].score;
+            float4      bound = 0;
+            uint64      pivot;
+            int         p;
+
+            CHECK_FOR_INTERRUPTS();
+
+            // insertion sort - the lists are almost ordered from the previous step
+            for (i = 1; i < active; i++) {
+                SearchList* list = order[i];
+
+                for (j = i; j > 0 && SEARCH_CURRENT(order[j - 1]) > SEARCH_CURRENT(list); j--) order[j] = order[j - 1];
+                order[j] = list;
+            }
+            while (active > 0 && SEARCH_CURRENT(order[active - 1]) == SEARCH_TID_END) active--;
+            if (active == 0) break;
+
+            for (p = 0; p < active; p++) {
+                bound += order[p]->bound;
+                if (bound >= threshold) break;
+            }
+            if (p == active) break;         // no row may enter the k best
+            pivot = SEARCH_CURRENT(order[p]);
+
+            if (SEARCH_CURRENT(order[0]) != pivot) {
+                // the rows before the pivot can't make it - skip the lists behind
+                for (i = 0; i < p; i++) search_skip(order[i], pivot);
+                continue;
+            }
+
+            // rate the pivot row exactly (its visible version, a HOT chain is followed)
+            {
+                ItemPointerData tid;
+                bool            call_again = false;
+                bool            all_dead = false;
+                bool            isnull;
+
+                ItemPointerSet(&tid, (BlockNumber) (pivot >> 16), (OffsetNumber) (pivot & 0xFFFF));
+                if (table_index_fetch_tuple(fetch, &tid, snapshot, slot, &call_again, &all_dead)) {
+                    Datum   datum = slot_getattr(slot, ids_attnum, &isnull);
+
+                    scored++;
+                    if (!isnull) {
+                        ArrayType*      vector = DatumGetArrayTypeP(datum);
+                        ArrayType*      weight = NULL;
+                        Datum           wdatum = (Datum) 0;
+                        int             dlength = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+                        int             matches = 0;
+                        float4          rating = 0;
+                        SearchResult    item;
+
+                        if (weights_attnum != InvalidAttrNumber) {
+                            wdatum = slot_getattr(slot, weights_attnum, &isnull);
+                            if (!isnull) weight = DatumGetArrayTypeP(wdatum);
+                        }
+
+                        // the rows of NULL ids or weights (elements) are not rated, as rating_cosine is STRICT
+                        if (ARR_HASNULL(vector) || (weights_attnum != InvalidAttrNumber && (weight == NULL || ARR_HASNULL(weight)))) {
+                            matches = 0;
+                        }
+                        else if (weight == NULL) {
+                            rating = sparse_rating(ids, values, length, (int32*) ARR_DATA_PTR(vector), NULL, dlength,
+                                                   match1, match2, &matches);
+                        }
+                        else {
+                            float4*     ptrw = (float4*) ARR_DATA_PTR(weight);
+
+                            if (dlength > ArrayGetNItems(ARR_NDIM(weight), ARR_DIMS(weight))) {
+                                ereport(ERROR, (errcode(ERRCODE_CARDINALITY_VIOLATION),
+                                               errmsg("weight arrays must be of the same size as key arrays")));
+                            }
+                            rating = sparse_rating(ids, values, length, (int32*) ARR_DATA_PTR(vector), ptrw, dlength,
+                                                   match1, match2, &matches);
+                            rating = sparse_cosine(rating, norm, sqrt(sparse_sum_squares(ptrw, dlength)));
+                        }
+
+                        if (matches > 0) {
+                            item.score = rating;
+                            item.tid = SEARCH_TID(ItemPointerGetBlockNumber(&slot->tts_tid), ItemPointerGetOffsetNumber(&slot->tts_tid));
+                            if (size == capacity && size < k) {
+                                capacity = (int) MIN((int64) k, 2 * (int64) capacity);
+                                heap = (SearchResult*) repalloc_huge(heap, sizeof(SearchResult) * capacity);
+                            }
+                            search_push(heap, &size, k, &item);
+                        }
+                        if (weight != NULL && (Pointer) weight != DatumGetPointer(wdatum)) pfree(weight);
+                        if ((Pointer) vector != DatumGetPointer(datum)) pfree(vector);
+                    }
+                }
+            }
+
+            // all the lists of the pivot move on
+            for (i = 0; i < active && SEARCH_CURRENT(order[i]) == pivot; i++) search_next(order[i]);
+        }
+
+        for (i = 0; i < words; i++) {
+            postings += lists[i].postings;
+            search_end(&lists[i]);
+        }
+        ExecDropSingleTupleTableSlot(slot);
+        table_index_fetch_end(fetch);
+        table_close(rel, AccessShareLock);
+
+        qsort(heap, size, sizeof(SearchResult), search_cmp);
+        STATS_COUNT(STAT_SIFT_SEARCH, started, detoasted, postings, scored, size);
+
+        funcctx->user_fctx = heap;
+        funcctx->max_calls = size;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    heap = (SearchResult*) funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        ItemPointer tid = (ItemPointer) palloc(sizeof(ItemPointerData));
+        Datum       values[2];
+        bool        nulls[2] = {false, false};
+        HeapTuple   tuple;
+
+        ItemPointerSet(tid, (BlockNumber) (heap[funcctx->call_cntr].tid >> 16), (OffsetNumber) (heap[funcctx->call_cntr].tid & 0xFFFF));
+        values[0] = ItemPointerGetDatum(tid);
+        values[1] = Float4GetDatum(heap[funcctx->call_cntr].score);
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
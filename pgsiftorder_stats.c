@@ -0,0 +1,338 @@
+/*
+ * File:   pgsiftorder_stats.c
+ * Author: chmelarp
+ *
+ * Runtime statistics of the pgsiftorder entry points (SELECT * FROM pgsiftorder_stats) - calls, elements,
+ * intersection hits and CPU cycles split into the detoasting and the rest (the kernels).
+ *
+ * The area lives in the shared memory, so the library must be loaded by shared_preload_libraries.
+ * A backend counts into its own (local) counters and adds them to the shared atomics every
+ * STATS_FLUSH_CALLS calls and at the transaction end - a call costs a few increments (and two
+ * clock reads with pgsiftorder.stats = cycles).
+ *
+ * See the README.txt for reference!
+ */
+
+#include <time.h>
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>                    // set returning functions
+#include <miscadmin.h>                  // process_shared_preload_libraries_in_progress
+#include <access/htup_details.h>        // heap_form_tuple
+#include <access/xact.h>                // RegisterXactCallback
+#include <port/atomics.h>
+#include <storage/ipc.h>                // shmem_startup_hook
+#include <storage/lwlock.h>             // AddinShmemInitLock
+#include <storage/shmem.h>
+#include <utils/builtins.h>             // cstring_to_text
+#include <utils/guc.h>
+#include <utils/timestamp.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder.h"
+
+
+#define STATS_FLUSH_CALLS   4096        // local calls added to the shared counters at once
+
+typedef enum {
+    STAT_CALLS,
+    STAT_ELEMENTS,                      // of both arguments
+    STAT_PROBES,                        // elements of the shorter side of an intersection
+    STAT_MATCHES,                       // common elements found
+    STAT_DETOAST_CYCLES,
+    STAT_CYCLES,                        // the whole call (detoasting included)
+    STAT_COUNTERS
+} StatCounter;
+
+// the SQL names of the entry points
+static const char* stats_names[STAT_FUNCTIONS] = {
+    [STAT_RATING_NORMALIZE_VECT] = "rating_normalize_vect(real[])",
+    [STAT_RATING_COSINE_NORM] = "rating_cosine_norm(int[],real[],real,int[],real[],real)",
+    [STAT_RATING_COSINE] = "rating_cosine(int[],real[],int[],real[])",
+    [STAT_RATING_BOOLEAN_INT] = "rating_boolean_int(int[],int[])",
+    [STAT_RATING_BOOLEAN] = "rating_boolean(anyarray,anyarray)",
+    [STAT_RATING_COSINE_NORM_INT8] = "rating_cosine_norm(bigint[],real[],real,bigint[],real[],real)",
+    [STAT_RATING_COSINE_INT8] = "rating_cosine(bigint[],real[],bigint[],real[])",
+    [STAT_RATING_BOOLEAN_INT8] = "rating_boolean_int8(bigint[],bigint[])",
+    [STAT_TERM_IDS] = "term_ids(text[])",
+    [STAT_RATING_COSINE_MULTI] = "rating_cosine_multi(int[],real[],sparsevec[])",
+    [STAT_RATING_BOOLEAN_MULTI] = "rating_boolean_multi(int[],int[])",
+    [STAT_DISTANCE_SQUARE_INT] = "distance_square_int(int[],int[])",
+    [STAT_DISTANCE_SQUARE_REAL] = "distance_square_real(real[],real[])",
+    [STAT_DISTANCE_SQUARE_BATCH] = "distance_square_batch(real[],real[])",
+    [STAT_DISTANCE_SQUARE_TOPK] = "distance_square_topk(real[],real[],int)",
+    [STAT_DISTANCE_SQUARE_BOUNDED_INT] = "distance_square_bounded(int[],int[],bigint)",
+    [STAT_DISTANCE_SQUARE_BOUNDED_REAL] = "distance_square_bounded(real[],real[],real)",
+    [STAT_DISTANCE_MANHATTAN_INT] = "distance_manhattan_int(int[],int[])",
+    [STAT_DISTANCE_MANHATTAN_REAL] = "distance_manhattan_real(real[],real[])",
+    [STAT_DISTANCE_CHESSBOARD_INT] = "distance_chessboard_int(int[],int[])",
+    [STAT_DISTANCE_COSINE_REAL] = "distance_cosine_real(real[],real[])",
+    [STAT_DISTANCE_MAHALANOBIS_INT] = "distance_mahalanobis_int(int[],int[],real[])",
+    [STAT_ARRAY_ACC_REAL] = "array_acc_real(real[],real[])",
+    [STAT_TOPK_ACCUM] = "topk(bigint,real,int)",
+    [STAT_FVEC_DISTANCE_SQUARE] = "distance_square_real(fvec,fvec)",
+    [STAT_FVEC_DISTANCE_SQUARE_BOUNDED] = "distance_square_bounded(fvec,fvec,real)",
+    [STAT_FVEC_DISTANCE_MANHATTAN] = "distance_manhattan_real(fvec,fvec)",
+    [STAT_FVEC_DISTANCE_CHESSBOARD] = "distance_chessboard_real(fvec,fvec)",
+    [STAT_FVEC_DISTANCE_COSINE] = "distance_cosine_real(fvec,fvec)",
+    [STAT_FVEC_DISTANCE_MAHALANOBIS] = "distance_mahalanobis_real(fvec,fvec,fvec)",
+    [STAT_BVEC_DISTANCE_SQUARE] = "distance_square_int(bvec,bvec)",
+    [STAT_BVEC_DISTANCE_MANHATTAN] = "distance_manhattan_int(bvec,bvec)",
+    [STAT_BVEC_DOT] = "rating_dot_int(bvec,bvec)",
+    [STAT_SPARSEVEC_COSINE] = "rating_cosine(sparsevec,sparsevec)",
+    [STAT_SPARSEVEC_DOT] = "rating_dot(sparsevec,sparsevec)",
+    [STAT_SPARSEVEC_BOOLEAN] = "rating_boolean(sparsevec,sparsevec)",
+    [STAT_SPARSEVEC_COSINE_MULTI] = "rating_cosine_multi(sparsevec,sparsevec[])",
+    [STAT_SPARSEVEC_BOOLEAN_MULTI] = "rating_boolean_multi(sparsevec,sparsevec[])",
+    [STAT_PQ_DISTANCE] = "pq_distance(real[],bytea,real[])",
+    [STAT_SIGNATURE] = "signature(real[],real[])",
+    [STAT_HAMMING_DISTANCE] = "hamming_distance(bytea,bytea)",
+    [STAT_HAMMING_DISTANCE_BATCH] = "hamming_distance_batch(bytea,bytea[])",
+    [STAT_HAMMING_TOPK] = "hamming_topk(bytea,bytea[],int)",
+    [STAT_IVF_SCAN] = "sift_ivf scan",
+    [STAT_SIFT_SEARCH] = "sift_search(regclass,name,int[],real[],int,name)",
+};
+
+typedef struct StatsShared {
+    pg_atomic_uint64    reset;          // TimestampTz of the last reset
+    pg_atomic_uint64    counters[STAT_FUNCTIONS][STAT_COUNTERS];
+} StatsShared;
+
+static const struct config_enum_entry stats_options[] = {
+    {"off", STATS_OFF, false},
+    {"counts", STATS_COUNTS, false},
+    {"cycles", STATS_CYCLES, false},
+    {NULL, 0, false}
+};
+
+int              stats_tracking = STATS_OFF;
+static int       stats_level = STATS_COUNTS;       // pgsiftorder.stats
+static bool      stats_preloaded = false;
+
+static StatsShared* stats_shared = NULL;
+static uint64    stats_local[STAT_FUNCTIONS][STAT_COUNTERS];
+static int       stats_pending = 0;                 // local calls not added to the shared counters
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+
+#if !(defined(__x86_64__) && defined(__GNUC__))
+uint64 stats_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+
+/*
+ * Add the local counters to the shared ones
+ */
+static void stats_flush(void) {
+    int f, c;
+
+    if (stats_shared != NULL) {
+        for (f = 0; f < STAT_FUNCTIONS; f++) {
+            for (c = 0; c < STAT_COUNTERS; c++) {
+                if (stats_local[f][c] == 0) continue;
+                pg_atomic_fetch_add_u64(&stats_shared->counters[f][c], (int64) stats_local[f][c]);
+            }
+        }
+    }
+    memset(stats_local, 0, sizeof(stats_local));
+    stats_pending = 0;
+}
+
+/*
+ * A call of an entry point (see STATS_COUNT) - started and detoasted are the clock at its start and when
+ * the arguments were ready (0 if the cycles are not tracked)
+ */
+void stats_count(StatFunction function, uint64 started, uint64 detoasted, uint64 elements, uint64 probes, uint64 matches) {
+    uint64* counters = stats_local[function];
+
+    counters[STAT_CALLS]++;
+    counters[STAT_ELEMENTS] += elements;
+    counters[STAT_PROBES] += probes;
+    counters[STAT_MATCHES] += matches;
+    if (started != 0) {
+        counters[STAT_CYCLES] += stats_clock() - started;
+        if (detoasted != 0) counters[STAT_DETOAST_CYCLES] += detoasted - started;
+    }
+
+    if (++stats_pending >= STATS_FLUSH_CALLS) stats_flush();
+}
+
+static void stats_xact_callback(XactEvent event, void* arg) {
+    if (stats_pending > 0 &&
+        (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT ||
+         event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PARALLEL_ABORT))
+        stats_flush();
+}
+
+
+/*
+ * The shared memory area
+ */
+#if PG_VERSION_NUM >= 150000
+static void stats_shmem_request(void) {
+    if (prev_shmem_request_hook) prev_shmem_request_hook();
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(StatsShared)));
+}
+#endif
+
+static void stats_shmem_startup(void) {
+    bool    found;
+    int     f, c;
+
+    if (prev_shmem_startup_hook) prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    stats_shared = (StatsShared*) ShmemInitStruct("pgsiftorder stats", sizeof(StatsShared), &found);
+    if (!found) {
+        pg_atomic_init_u64(&stats_shared->reset, (uint64) GetCurrentTimestamp());
+        for (f = 0; f < STAT_FUNCTIONS; f++) {
+            for (c = 0; c < STAT_COUNTERS; c++) pg_atomic_init_u64(&stats_shared->counters[f][c], 0);
+        }
+    }
+    LWLockRelease(AddinShmemInitLock);
+}
+
+static void stats_assign_hook(int newval, void* extra) {
+    stats_tracking = stats_preloaded ? newval : STATS_OFF;
+}
+
+
+/*
+ * Library load (_PG_init) - pgsiftorder.stats and, in shared_preload_libraries, the shared memory area
+ */
+void stats_init(void) {
+    stats_preloaded = process_shared_preload_libraries_in_progress;
+
+    DefineCustomEnumVariable("pgsiftorder.stats",
+                             "Runtime statistics of the pgsiftorder functions (the pgsiftorder_stats view).",
+                             "counts tracks the calls, elements and intersection hits, cycles adds the CPU cycles. "
+                             "Needs pgsiftorder in shared_preload_libraries.",
+                             &stats_level,
+                             STATS_COUNTS,
+                             stats_options,
+                             PGC_SUSET,
+                             0,
+                             NULL,
+                             stats_assign_hook,
+                             NULL);
+
+    if (!stats_preloaded) return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = stats_shmem_request;
+#else
+    RequestAddinShmemSpace(MAXALIGN(sizeof(StatsShared)));
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = stats_shmem_startup;
+
+    RegisterXactCallback(stats_xact_callback, NULL);
+}
+
+static void stats_check(void) {
+    if (stats_shared == NULL) {
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                        errmsg("pgsiftorder must be loaded via shared_preload_libraries to collect the statistics")));
+    }
+}
+
+
+PG_FUNCTION_INFO_V1(c_pgsiftorder_stats);
+/****************************************************************************************************
+ * The statistics of the entry points called since the last reset (of all the backends, this one up to now).
+ * @return SETOF (function text, calls int8, elements int8, matches int8, hit_rate float8,
+ *                detoast_cycles int8, cycles int8, cycles_per_call float8, stats_reset timestamptz)
+ */
+Datum
+c_pgsiftorder_stats(PG_FUNCTION_ARGS) {
+    FuncCallContext*  funcctx;
+    uint64          (*snapshot)[STAT_COUNTERS];
+
+    if (SRF_IS_FIRSTCALL()) {
+        MemoryContext   oldcontext;
+        TupleDesc       tupdesc;
+        int             f, c;
+
+        stats_check();
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("function returning record called in context that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        // this backend's calls so far as well
+        stats_flush();
+        snapshot = palloc(sizeof(uint64) * STAT_FUNCTIONS * STAT_COUNTERS);
+        for (f = 0; f < STAT_FUNCTIONS; f++) {
+            for (c = 0; c < STAT_COUNTERS; c++) snapshot[f][c] = pg_atomic_read_u64(&stats_shared->counters[f][c]);
+        }
+
+        funcctx->user_fctx = snapshot;
+        funcctx->max_calls = STAT_FUNCTIONS;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    snapshot = (uint64 (*)[STAT_COUNTERS]) funcctx->user_fctx;
+
+    // the functions not called are skipped
+    while (funcctx->call_cntr < funcctx->max_calls && snapshot[funcctx->call_cntr][STAT_CALLS] == 0) funcctx->call_cntr++;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        const uint64*   counters = snapshot[funcctx->call_cntr];
+        Datum           values[9];
+        bool            nulls[9] = {false, false, false, false, false, false, false, false, false};
+        HeapTuple       tuple;
+
+        values[0] = PointerGetDatum(cstring_to_text(stats_names[funcctx->call_cntr]));
+        values[1] = Int64GetDatum((int64) counters[STAT_CALLS]);
+        values[2] = Int64GetDatum((int64) counters[STAT_ELEMENTS]);
+        values[3] = Int64GetDatum((int64) counters[STAT_MATCHES]);
+        values[4] = Float8GetDatum(counters[STAT_PROBES] ? (float8) counters[STAT_MATCHES] / counters[STAT_PROBES] : 0);
+        nulls[4] = (counters[STAT_PROBES] == 0);          // not an intersection
+        values[5] = Int64GetDatum((int64) counters[STAT_DETOAST_CYCLES]);
+        values[6] = Int64GetDatum((int64) counters[STAT_CYCLES]);
+        values[7] = Float8GetDatum((float8) counters[STAT_CYCLES] / counters[STAT_CALLS]);
+        values[8] = TimestampTzGetDatum((TimestampTz) pg_atomic_read_u64(&stats_shared->reset));
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+
+PG_FUNCTION_INFO_V1(c_pgsiftorder_stats_reset);
+/****************************************************************************************************
+ * Zeroes the statistics (the counters of the other backends not added yet are kept).
+ */
+Datum
+c_pgsiftorder_stats_reset(PG_FUNCTION_ARGS) {
+    int f, c;
+
+    stats_check();
+
+    memset(stats_local, 0, sizeof(stats_local));
+    stats_pending = 0;
+    for (f = 0; f < STAT_FUNCTIONS; f++) {
+        for (c = 0; c < STAT_COUNTERS; c++) pg_atomic_write_u64(&stats_shared->counters[f][c], 0);
+    }
+    pg_atomic_write_u64(&stats_shared->reset, (uint64) GetCurrentTimestamp());
+
+    PG_RETURN_VOID();
+}
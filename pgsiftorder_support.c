@@ -0,0 +1,311 @@
+/*
+ * File:   pgsiftorder_support.c
+ * Author: chmelarp
+ *
+ * Planner support of the ratings (rating_boolean, rating_boolean_int, rating_cosine, rating_cosine_norm):
+ *
+ *  - rating_support(internal), the prosupport function - the per-call cost by the array lengths (the
+ *    constant query and the average width of the column), instead of a fixed COST;
+ *  - the index condition - WHERE rating_*(sift, ARRAY[...]) > 0 holds only for the rows sharing an element
+ *    with the query, so the index paths of the lossy sift && ARRAY[...] (pgsiftorder.rating_overlap) use
+ *    the GIN index of the column without writing the && by hand.
+ *
+ * Postgres asks the support function of a function for the index conditions only if the function is the
+ * boolean clause itself (PostGIS ST_Intersects), not an argument of the > operator - so the && is made by
+ * the set_rel_pathlist_hook, the rating functions are recognized by their support function. The && is
+ * only an index condition of the additional paths, the relation (its row estimate, the sequential scan)
+ * keeps the rating alone - the && implied by the rating would be counted twice and evaluated for nothing.
+ *
+ * See the README.txt for reference!
+ */
+
+#include <math.h>
+#include <postgres.h>
+#include <fmgr.h>
+#include <access/transam.h>             // FirstNormalObjectId
+#include <catalog/pg_operator.h>        // OID_ARRAY_OVERLAP_OP
+#include <catalog/pg_type.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/pathnodes.h>            // planner_rt_fetch
+#include <nodes/supportnodes.h>         // SupportRequestCost
+#include <optimizer/optimizer.h>        // eval_const_expressions, cpu_operator_cost
+#include <optimizer/paths.h>            // set_rel_pathlist_hook, create_index_paths
+#include <optimizer/restrictinfo.h>
+#include <parser/parsetree.h>
+#include <utils/array.h>
+#include <utils/builtins.h>             // numeric_float8
+#include <utils/guc.h>
+#include <utils/lsyscache.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder.h"
+
+
+#define RATING_DEFAULT_LENGTH   100     // elements of an array of unknown length (~100 term documents)
+
+static bool rating_overlap = true;      // pgsiftorder.rating_overlap
+static Oid rating_support_oid = InvalidOid;
+static set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+
+PG_FUNCTION_INFO_V1(c_rating_support);
+
+
+/*
+ * The elements of a rating argument - the constant (or the bound parameter) array, the average width
+ * of the column (ANALYZE) or the default
+ */
+static double rating_length(PlannerInfo* root, Node* arg) {
+    int16   typlen = get_typlen(get_element_type(exprType(arg)));
+
+    if (root != NULL) arg = estimate_expression_value(root, arg);
+
+    if (IsA(arg, Const)) {
+        ArrayType*  array;
+
+        if (((Const*) arg)->constisnull) return 0;
+        array = DatumGetArrayTypeP(((Const*) arg)->constvalue);
+        return ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+    }
+
+    if (IsA(arg, Var) && root != NULL && ((Var*) arg)->varlevelsup == 0) {
+        Var*            var = (Var*) arg;
+        RangeTblEntry*  rte = planner_rt_fetch(var->varno, root);
+        int32           width;
+
+        if (rte->rtekind == RTE_RELATION && (width = get_attavgwidth(rte->relid, var->varattno)) > 0) {
+            // the varlena elements (text tokens) are guessed 8 bytes
+            return MAX(1, (width - (int32) ARR_OVERHEAD_NONULLS(1)) / ((typlen > 0) ? typlen : 8));
+        }
+    }
+    return RATING_DEFAULT_LENGTH;
+}
+
+/*
+ * The intersection steps of the lengths (see sparse_intersect()) - a merge, or galloping of the shorter
+ * array in the SPARSE_GALLOP_RATIO times longer one
+ */
+static double rating_steps(double length1, double length2) {
+    double  shorter = MIN(length1, length2);
+    double  longer = MAX(length1, length2);
+
+    if (shorter < 1) return 1;
+    if (longer / SPARSE_GALLOP_RATIO >= shorter) return shorter * (1 + log2(longer));
+    return length1 + length2;
+}
+
+/*
+ * The two id arrays by the number of the arguments - rating_boolean(a, b), rating_cosine(a, wa, b, wb),
+ * rating_cosine_norm(a, wa, na, b, wb, nb) - of the same array type
+ */
+static bool rating_id_args(List* args, Node** ids1, Node** ids2) {
+    switch (list_length(args)) {
+        case 2: *ids1 = (Node*) linitial(args); *ids2 = (Node*) lsecond(args); break;
+        case 4: *ids1 = (Node*) linitial(args); *ids2 = (Node*) lthird(args); break;
+        case 6: *ids1 = (Node*) linitial(args); *ids2 = (Node*) lfourth(args); break;
+        default: return false;
+    }
+    return exprType(*ids1) == exprType(*ids2) && OidIsValid(get_element_type(exprType(*ids1)));
+}
+
+
+/****************************************************************************************************
+ * Support function rating_support(internal) of the rating functions.
+ * @param request internal (SupportRequestCost)
+ */
+Datum
+c_rating_support(PG_FUNCTION_ARGS) {
+    Node*   rawreq = (Node*) PG_GETARG_POINTER(0);
+
+    rating_support_oid = fcinfo->flinfo->fn_oid;
+
+    if (IsA(rawreq, SupportRequestCost)) {
+        SupportRequestCost* req = (SupportRequestCost*) rawreq;
+        Node*               ids1;
+        Node*               ids2;
+        Oid                 element_type;
+        double              factor;
+
+        if (req->node == NULL || !IsA(req->node, FuncExpr) || !rating_id_args(((FuncExpr*) req->node)->args, &ids1, &ids2))
+            PG_RETURN_POINTER(NULL);
+
+        // per element - the cosine gathers the weights, the generic rating_boolean calls the btree comparison
+        element_type = get_element_type(exprType(ids1));
+        if (list_length(((FuncExpr*) req->node)->args) > 2) factor = 0.1;
+        else if (get_typbyval(element_type)) factor = 0.05;
+        else factor = 0.25;
+
+        req->startup = 0;
+        req->per_tuple = cpu_operator_cost * (1 + factor * rating_steps(rating_length(req->root, ids1),
+                                                                         rating_length(req->root, ids2)));
+        PG_RETURN_POINTER(req);
+    }
+
+    PG_RETURN_POINTER(NULL);
+}
+
+
+/*
+ * Is the function a rating - its prosupport is rating_support (looked up once, fmgr_info of the C symbol)
+ */
+static bool rating_function(Oid funcid) {
+    Oid         prosupport = get_func_support(funcid);
+    FmgrInfo    flinfo;
+
+    if (!OidIsValid(prosupport)) return false;
+    if (prosupport == rating_support_oid) return true;
+
+    fmgr_info(prosupport, &flinfo);
+    if (flinfo.fn_addr != c_rating_support) return false;
+    rating_support_oid = prosupport;
+    return true;
+}
+
+/*
+ * The value of a numeric constant bound of the rating
+ */
+static bool rating_bound(Node* bound, double* value) {
+    Const*  c;
+
+    bound = eval_const_expressions(NULL, (Node*) copyObject(bound));
+    if (!IsA(bound, Const) || ((Const*) bound)->constisnull) return false;
+
+    c = (Const*) bound;
+    switch (c->consttype) {
+        case INT2OID:    *value = DatumGetInt16(c->constvalue); return true;
+        case INT4OID:    *value = DatumGetInt32(c->constvalue); return true;
+        case INT8OID:    *value = (double) DatumGetInt64(c->constvalue); return true;
+        case FLOAT4OID:  *value = DatumGetFloat4(c->constvalue); return true;
+        case FLOAT8OID:  *value = DatumGetFloat8(c->constvalue); return true;
+        case NUMERICOID: *value = DatumGetFloat8(DirectFunctionCall1(numeric_float8, c->constvalue)); return true;
+        default:         return false;
+    }
+}
+
+/*
+ * Is the column the key of an index of the relation supporting && (GIN array_ops and the like)
+ */
+static bool rating_indexed(RelOptInfo* rel, Node* column) {
+    ListCell*   lc;
+
+    foreach(lc, rel->indexlist) {
+        IndexOptInfo*   index = (IndexOptInfo*) lfirst(lc);
+        int             col;
+
+        for (col = 0; col < index->nkeycolumns; col++) {
+            if (match_index_to_operand(column, col, index) && op_in_opfamily(OID_ARRAY_OVERLAP_OP, index->opfamily[col]))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * The ids1 && ids2 implied by a clause rating_*(ids1, ..., ids2, ...) > k (k >= 0), >= k (k > 0) or the
+ * commuted < and <= - one side is the query (no Vars, not volatile), the other an indexed column, or NULL
+ */
+static Expr* rating_condition(RelOptInfo* rel, Node* clause) {
+    OpExpr*     op;
+    FuncExpr*   rating;
+    Node*       bound;
+    Node*       ids1;
+    Node*       ids2;
+    char*       name;
+    bool        strict;
+    double      value;
+
+    if (!IsA(clause, OpExpr) || list_length(((OpExpr*) clause)->args) != 2) return NULL;
+    op = (OpExpr*) clause;
+    if (op->opno >= FirstNormalObjectId || (name = get_opname(op->opno)) == NULL) return NULL;  // the built-in ones
+
+    if (IsA(linitial(op->args), FuncExpr) && rating_function(((FuncExpr*) linitial(op->args))->funcid)) {
+        rating = (FuncExpr*) linitial(op->args);
+        bound = (Node*) lsecond(op->args);
+        if (strcmp(name, ">") == 0) strict = true;
+        else if (strcmp(name, ">=") == 0) strict = false;
+        else return NULL;
+    }
+    else if (IsA(lsecond(op->args), FuncExpr) && rating_function(((FuncExpr*) lsecond(op->args))->funcid)) {
+        rating = (FuncExpr*) lsecond(op->args);
+        bound = (Node*) linitial(op->args);
+        if (strcmp(name, "<") == 0) strict = true;
+        else if (strcmp(name, "<=") == 0) strict = false;
+        else return NULL;
+    }
+    else return NULL;
+
+    // the rating is 0 without a common element
+    if (!rating_bound(bound, &value) || value < 0 || (!strict && value <= 0)) return NULL;
+
+    if (!rating_id_args(rating->args, &ids1, &ids2)) return NULL;
+    if (contain_var_clause(ids1) == contain_var_clause(ids2)) return NULL;
+    if (contain_volatile_functions(ids1) || contain_volatile_functions(ids2)) return NULL;
+    if (!rating_indexed(rel, contain_var_clause(ids1) ? ids1 : ids2)) return NULL;
+
+    return make_opclause(OID_ARRAY_OVERLAP_OP, BOOLOID, false, (Expr*) copyObject(ids1), (Expr*) copyObject(ids2),
+                         InvalidOid, exprCollation(ids1));
+}
+
+/*
+ * The index paths of the && of the rating restrictions - the && is a qual of the relation just while
+ * create_index_paths looks at it, the other paths and the row estimate do not see it
+ */
+static void rating_set_rel_pathlist(PlannerInfo* root, RelOptInfo* rel, Index rti, RangeTblEntry* rte) {
+    List*       conditions = NIL;
+    List*       quals;
+    ListCell*   lc;
+
+    if (prev_set_rel_pathlist_hook) prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+    if (!rating_overlap || !IS_SIMPLE_REL(rel) || rte->rtekind != RTE_RELATION || rel->indexlist == NIL) return;
+
+    foreach(lc, rel->baserestrictinfo) {
+        RestrictInfo*   rinfo = (RestrictInfo*) lfirst(lc);
+        Expr*           condition = rating_condition(rel, (Node*) rinfo->clause);
+        RestrictInfo*   overlap;
+        ListCell*       lc2;
+
+        if (condition == NULL) continue;
+
+        // the && written by hand has its paths already
+        foreach(lc2, rel->baserestrictinfo) {
+            if (equal(((RestrictInfo*) lfirst(lc2))->clause, condition)) break;
+        }
+        if (lc2 != NULL) continue;
+
+#if PG_VERSION_NUM >= 140000
+        overlap = make_simple_restrictinfo(root, condition);
+#else
+        overlap = make_simple_restrictinfo(condition);
+#endif
+        overlap->security_level = rinfo->security_level;
+        conditions = lappend(conditions, overlap);
+    }
+    if (conditions == NIL) return;
+
+    quals = rel->baserestrictinfo;
+    rel->baserestrictinfo = list_concat(list_copy(quals), conditions);
+    create_index_paths(root, rel);
+    rel->baserestrictinfo = quals;
+}
+
+
+/*
+ * Library load (called from _PG_init) - pgsiftorder.rating_overlap and the set_rel_pathlist_hook
+ */
+void support_init(void) {
+    DefineCustomBoolVariable("pgsiftorder.rating_overlap",
+                             "Adds the index paths of the array overlap (&&) implied by rating_*(column, query) > 0.",
+                             "The lossy && lets the planner use a GIN index of the column, the rating is kept as a filter.",
+                             &rating_overlap,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+    set_rel_pathlist_hook = rating_set_rel_pathlist;
+}
@@ -0,0 +1,649 @@
+/*
+ * File:   pgsiftorder_vecs.c
+ * Author: chmelarp
+ *
+ * Bulk import and export of the .fvecs, .bvecs and .ivecs datasets (SIFT1M, GIST1M, the ground truth).
+ *
+ * A file is a sequence of vectors, each of them an int32 dimension and the elements - float32 (.fvecs),
+ * uint8 (.bvecs) or int32 (.ivecs), all little-endian. The readers stream the rows of the server-side
+ * file (pread into a buffer, a file truncated meanwhile is an error) as real[], int[], fvec or bvec without
+ * the text round trip of array_in:
+ *
+ *     INSERT INTO sift_base SELECT id, vector FROM fvecs_read('/data/sift/sift_base.fvecs');
+ *
+ * The writers store the first column of a query (a cursor, fetched in batches) to such a file for the
+ * external tools (FAISS, the ann-benchmarks). Reading and writing server files takes the privileges of
+ * COPY - superuser or the pg_read_server_files / pg_write_server_files roles.
+ *
+ * See the README.txt for reference!
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>                    // set returning functions
+#include <miscadmin.h>                  // GetUserId
+#include <access/htup_details.h>        // heap_form_tuple
+#include <catalog/pg_authid.h>          // pg_read_server_files, pg_write_server_files
+#include <catalog/pg_type.h>
+#include <executor/spi.h>               // the query of the export
+#include <port/pg_bswap.h>
+#include <storage/fd.h>                 // OpenTransientFile, AllocateFile
+#include <utils/acl.h>                  // has_privs_of_role
+#include <utils/array.h>
+#include <utils/builtins.h>             // text_to_cstring
+#include <utils/lsyscache.h>            // getTypeInputInfo
+#include <utils/memutils.h>
+
+#include "abbrevs.h"
+#include "pgsiftorder.h"
+
+
+#define VECS_FETCH      1000            // rows of the export query fetched at once
+#define VECS_BUFFER     (1024 * 1024)   // of the read and the written file
+
+#if PG_VERSION_NUM >= 140000
+#define VECS_READ_ROLE  ROLE_PG_READ_SERVER_FILES
+#define VECS_WRITE_ROLE ROLE_PG_WRITE_SERVER_FILES
+#else
+#define VECS_READ_ROLE  DEFAULT_ROLE_READ_SERVER_FILES
+#define VECS_WRITE_ROLE DEFAULT_ROLE_WRITE_SERVER_FILES
+#endif
+
+// the files are little-endian
+#ifdef WORDS_BIGENDIAN
+#define VECS_INT32(x)   ((int32) pg_bswap32((uint32) (x)))
+#else
+#define VECS_INT32(x)   (x)
+#endif
+
+
+typedef enum {
+    VECS_FVECS,                         // float32 elements
+    VECS_BVECS,                         // uint8
+    VECS_IVECS                          // int32
+} VecsFormat;
+
+static const char* vecs_names[] = {"fvecs", "bvecs", "ivecs"};
+static const int vecs_sizes[] = {sizeof(float4), sizeof(uint8), sizeof(int32)};
+
+/*
+ * A file being read - its part [start, start + length) in the buffer
+ */
+typedef struct VecsFile {
+    char*       path;
+    uint8*      buffer;
+    Size        capacity;
+    Size        start;
+    Size        length;
+    Size        size;                   // at the open
+    Size        pos;                    // of the next vector
+    VecsFormat  format;
+    bool        native;                 // fvec / bvec instead of real[] / int[]
+    int32       dim;                    // of all the vectors (declared by the caller), 0 any
+    int64       id;                     // of the next vector (0 based, the ground truth ids)
+    int64       count;                  // vectors left to return, -1 all
+} VecsFile;
+
+
+/****************************************************************************************************
+ * Reading
+ ****************************************************************************************************/
+
+/*
+ * Opens the file (checks it only, every read reopens it) - in the current memory context
+ */
+static VecsFile* vecs_open(const char* path, VecsFormat format, bool native) {
+    VecsFile*   file = (VecsFile*) palloc0(sizeof(VecsFile));
+    struct stat st;
+    int         fd;
+
+    if (!has_privs_of_role(GetUserId(), VECS_READ_ROLE)) {
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                        errmsg("must be superuser or a member of the pg_read_server_files role to read a file")));
+    }
+
+    file->path = pstrdup(path);
+    file->format = format;
+    file->native = native;
+    file->count = -1;
+
+    fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+    if (fd < 0) {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open file \"%s\" for reading: %m", path)));
+    }
+    if (fstat(fd, &st) < 0) {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not stat file \"%s\": %m", path)));
+    }
+    if (!S_ISREG(st.st_mode)) {
+        ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                        errmsg("\"%s\" is not a regular file", path)));
+    }
+    CloseTransientFile(fd);
+
+    file->size = (Size) st.st_size;
+    file->capacity = MIN(file->size, VECS_BUFFER);
+    file->buffer = (uint8*) palloc(MAX(file->capacity, 1));
+
+    return file;
+}
+
+/*
+ * The bytes at pos of the file - from the buffer, read ahead (VECS_BUFFER at least) if not there
+ */
+static const uint8* vecs_fetch(VecsFile* file, Size pos, Size bytes) {
+    Size    length;
+    Size    done = 0;
+    int     fd;
+
+    if (pos >= file->start && pos + bytes <= file->start + file->length) return file->buffer + (pos - file->start);
+
+    if (bytes > file->capacity) {
+        file->buffer = (uint8*) repalloc(file->buffer, bytes);
+        file->capacity = bytes;
+    }
+    length = MIN(file->capacity, file->size - pos);
+
+    fd = OpenTransientFile(file->path, O_RDONLY | PG_BINARY);
+    if (fd < 0) {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open file \"%s\" for reading: %m", file->path)));
+    }
+    while (done < length) {
+        ssize_t got = pg_pread(fd, file->buffer + done, length - done, (off_t) (pos + done));
+
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not read file \"%s\": %m", file->path)));
+        }
+        if (got == 0) break;
+        done += got;
+    }
+    CloseTransientFile(fd);
+
+    file->start = pos;
+    file->length = done;
+    if (done < bytes) {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("%s file \"%s\" was truncated while read at vector " INT64_FORMAT, vecs_names[file->format], file->path, file->id)));
+    }
+    return file->buffer;
+}
+
+/*
+ * The dimension of the vector at pos, checked against the rest of the file (and the declared one)
+ */
+static int vecs_dim(VecsFile* file, Size pos) {
+    int32   dim;
+
+    if (file->size - pos < sizeof(int32)) {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("%s file \"%s\" is truncated at vector " INT64_FORMAT, vecs_names[file->format], file->path, file->id)));
+    }
+    memcpy(&dim, vecs_fetch(file, pos, sizeof(int32)), sizeof(int32));
+    dim = VECS_INT32(dim);
+
+    if (dim < 0 || (Size) dim > (file->size - pos - sizeof(int32)) / vecs_sizes[file->format]) {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("%s file \"%s\" is truncated or corrupted at vector " INT64_FORMAT " (dimension %d)",
+                               vecs_names[file->format], file->path, file->id, dim)));
+    }
+    if (file->dim > 0 && dim != file->dim) {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("%s file \"%s\" has dimension %d at vector " INT64_FORMAT ", not %d",
+                               vecs_names[file->format], file->path, dim, file->id, file->dim)));
+    }
+    return dim;
+}
+
+/*
+ * Skips the first vectors - a jump if the caller declared the dimension of the file, a walk through the
+ * headers otherwise (a mixed dimension file could not be jumped through)
+ */
+static void vecs_skip(VecsFile* file, int64 start) {
+    Size    record;
+
+    if (start <= 0 || file->size == 0) return;
+
+    if (file->dim > 0) {
+        vecs_dim(file, 0);
+        record = sizeof(int32) + (Size) file->dim * vecs_sizes[file->format];
+        if (file->size % record != 0) {
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("%s file \"%s\" is not of a single dimension %d (its size is not a multiple of the vector)",
+                                   vecs_names[file->format], file->path, file->dim)));
+        }
+        file->id = start;
+        if ((uint64) start >= file->size / record) {
+            file->pos = file->size;
+        }
+        else {
+            file->pos = (Size) start * record;
+            vecs_dim(file, file->pos);
+        }
+        return;
+    }
+
+    while (file->id < start && file->pos < file->size) {
+        file->pos += sizeof(int32) + (Size) vecs_dim(file, file->pos) * vecs_sizes[file->format];
+        file->id++;
+        if (file->id % VECS_FETCH == 0) CHECK_FOR_INTERRUPTS();
+    }
+}
+
+/*
+ * The next vector as real[], int[], fvec or bvec
+ */
+static Datum vecs_vector(VecsFile* file, const uint8* ptr, int dim) {
+    int         pos;
+
+    switch (file->format) {
+        case VECS_FVECS:
+            if (file->native) {
+                FVector*    vector;
+
+                if (dim < 1 || dim > FVEC_MAX_DIM) {
+                    ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                                    errmsg("fvec must have 1 to %d dimensions, vector " INT64_FORMAT " has %d", FVEC_MAX_DIM, file->id, dim)));
+                }
+                vector = (FVector*) palloc(FVEC_SIZE(dim));
+                SET_VARSIZE(vector, FVEC_SIZE(dim));
+                memcpy(vector->x, ptr, sizeof(float4) * dim);
+#ifdef WORDS_BIGENDIAN
+                for (pos = 0; pos < dim; pos++) ((uint32*) vector->x)[pos] = pg_bswap32(((uint32*) vector->x)[pos]);
+#endif
+                return PointerGetDatum(vector);
+            }
+            else {
+                ArrayType*  vector = array_new_real(dim);
+
+                memcpy(ARR_DATA_PTR(vector), ptr, sizeof(float4) * dim);
+#ifdef WORDS_BIGENDIAN
+                for (pos = 0; pos < dim; pos++) ((uint32*) ARR_DATA_PTR(vector))[pos] = pg_bswap32(((uint32*) ARR_DATA_PTR(vector))[pos]);
+#endif
+                return PointerGetDatum(vector);
+            }
+
+        case VECS_BVECS:
+            if (file->native) {
+                BVector*    vector;
+
+                if (dim < 1 || dim > BVEC_MAX_DIM) {
+                    ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                                    errmsg("bvec must have 1 to %d dimensions, vector " INT64_FORMAT " has %d", BVEC_MAX_DIM, file->id, dim)));
+                }
+                vector = (BVector*) palloc(BVEC_SIZE(dim));
+                SET_VARSIZE(vector, BVEC_SIZE(dim));
+                memcpy(vector->x, ptr, dim);
+                return PointerGetDatum(vector);
+            }
+            else {
+                ArrayType*  vector = array_new(dim, INT4OID);
+                int32*      data = (int32*) ARR_DATA_PTR(vector);
+
+                for (pos = 0; pos < dim; pos++) data[pos] = ptr[pos];
+                return PointerGetDatum(vector);
+            }
+
+        case VECS_IVECS:
+        default:
+            {
+                ArrayType*  vector = array_new(dim, INT4OID);
+
+                memcpy(ARR_DATA_PTR(vector), ptr, sizeof(int32) * dim);
+#ifdef WORDS_BIGENDIAN
+                for (pos = 0; pos < dim; pos++) ((int32*) ARR_DATA_PTR(vector))[pos] = VECS_INT32(((int32*) ARR_DATA_PTR(vector))[pos]);
+#endif
+                return PointerGetDatum(vector);
+            }
+    }
+}
+
+/*
+ * The rows (id, vector) of the file - the path, the first id, the count (NULL all) and the dimension of
+ * all the vectors (NULL any)
+ */
+static Datum vecs_read(FunctionCallInfo fcinfo, VecsFormat format, bool native) {
+    FuncCallContext*  funcctx;
+    VecsFile*         file;
+
+    if (SRF_IS_FIRSTCALL()) {
+        MemoryContext   oldcontext;
+        TupleDesc       tupdesc;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("function returning record called in context that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        if (PG_ARGISNULL(0)) {
+            MemoryContextSwitchTo(oldcontext);
+            funcctx = SRF_PERCALL_SETUP();
+            SRF_RETURN_DONE(funcctx);
+        }
+
+        file = vecs_open(text_to_cstring(PG_GETARG_TEXT_PP(0)), format, native);
+        if (PG_NARGS() > 3 && !PG_ARGISNULL(3)) {
+            file->dim = PG_GETARG_INT32(3);
+            if (file->dim < 1) {
+                ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                                errmsg("dimension must be positive, not %d", file->dim)));
+            }
+        }
+        if (PG_NARGS() > 1 && !PG_ARGISNULL(1)) vecs_skip(file, PG_GETARG_INT64(1));
+        if (PG_NARGS() > 2 && !PG_ARGISNULL(2)) file->count = MAX(PG_GETARG_INT64(2), 0);
+
+        funcctx->user_fctx = file;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    file = (VecsFile*) funcctx->user_fctx;
+
+    if (file->pos < file->size && file->count != 0) {
+        int         dim = vecs_dim(file, file->pos);
+        Datum       values[2];
+        bool        nulls[2] = {false, false};
+        HeapTuple   tuple;
+
+        values[0] = Int64GetDatum(file->id);
+        values[1] = vecs_vector(file, vecs_fetch(file, file->pos + sizeof(int32), (Size) dim * vecs_sizes[format]), dim);
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+        file->pos += sizeof(int32) + (Size) dim * vecs_sizes[format];
+        file->id++;
+        if (file->count > 0) file->count--;
+
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvecs_read);
+/****************************************************************************************************
+ * The vectors of a server-side .fvecs file as real[]
+ * @param path text
+ * @param start int8 - the first vector (0 based)
+ * @param count int8 - NULL for all
+ * @param dim int4 - of all the vectors (jumps to start), NULL for any
+ * @return SETOF (id int8, vector float4[])
+ */
+Datum
+c_fvecs_read(PG_FUNCTION_ARGS) {
+    return vecs_read(fcinfo, VECS_FVECS, false);
+}
+
+PG_FUNCTION_INFO_V1(c_fvecs_read_fvec);
+/*
+ * The vectors of a server-side .fvecs file as fvec
+ * @return SETOF (id int8, vector fvec)
+ */
+Datum
+c_fvecs_read_fvec(PG_FUNCTION_ARGS) {
+    return vecs_read(fcinfo, VECS_FVECS, true);
+}
+
+PG_FUNCTION_INFO_V1(c_bvecs_read);
+/*
+ * The vectors of a server-side .bvecs file as int[]
+ * @return SETOF (id int8, vector int4[])
+ */
+Datum
+c_bvecs_read(PG_FUNCTION_ARGS) {
+    return vecs_read(fcinfo, VECS_BVECS, false);
+}
+
+PG_FUNCTION_INFO_V1(c_bvecs_read_bvec);
+/*
+ * The vectors of a server-side .bvecs file as bvec
+ * @return SETOF (id int8, vector bvec)
+ */
+Datum
+c_bvecs_read_bvec(PG_FUNCTION_ARGS) {
+    return vecs_read(fcinfo, VECS_BVECS, true);
+}
+
+PG_FUNCTION_INFO_V1(c_ivecs_read);
+/*
+ * The vectors of a server-side .ivecs file (the ground truth ids) as int[]
+ * @return SETOF (id int8, vector int4[])
+ */
+Datum
+c_ivecs_read(PG_FUNCTION_ARGS) {
+    return vecs_read(fcinfo, VECS_IVECS, false);
+}
+
+
+/****************************************************************************************************
+ * Writing
+ ****************************************************************************************************/
+
+/*
+ * Is the type fvec / bvec? (their oids are not fixed, their input functions are ours)
+ */
+static bool vecs_is_type(Oid typid, PGFunction input) {
+    Oid         typinput;
+    Oid         typioparam;
+    FmgrInfo    flinfo;
+
+    getTypeInputInfo(typid, &typinput, &typioparam);
+    fmgr_info(typinput, &flinfo);
+    return flinfo.fn_addr == input;
+}
+
+/*
+ * One vector - the dimension and the elements
+ */
+static void vecs_put(FILE* out, const char* path, const void* data, int dim, int size) {
+    int32   header = VECS_INT32(dim);
+
+    if (fwrite(&header, sizeof(int32), 1, out) != 1 || fwrite(data, size, dim, out) != (size_t) dim) {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write to file \"%s\": %m", path)));
+    }
+}
+
+/*
+ * The elements of an int[] / real[] value (one-dimensional, no NULLs)
+ */
+static ArrayType* vecs_array(Datum value, int64 row, int* dim) {
+    ArrayType*  vector = DatumGetArrayTypeP(value);
+
+    if (ARR_NDIM(vector) > 1 || ARR_HASNULL(vector)) {
+        ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+                        errmsg("array must be one-dimensional and must not contain NULLs (row " INT64_FORMAT ")", row)));
+    }
+    *dim = ArrayGetNItems(ARR_NDIM(vector), ARR_DIMS(vector));
+    return vector;
+}
+
+/*
+ * Writes the first column of the query to the file, returns the number of vectors
+ */
+static Datum vecs_write(FunctionCallInfo fcinfo, VecsFormat format) {
+    char*           path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char*           query = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    MemoryContext   rowcontext;
+    MemoryContext   oldcontext;
+    FILE*           out;
+    SPIPlanPtr      plan;
+    Portal          portal;
+    Oid             typid = InvalidOid;
+    bool            native = false;
+    uint8*          buffer = NULL;          // of the converted elements
+    int             capacity = 0;
+    int64           rows = 0;
+    uint64          i;
+    int             pos;
+
+    if (!has_privs_of_role(GetUserId(), VECS_WRITE_ROLE)) {
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                        errmsg("must be superuser or a member of the pg_write_server_files role to write a file")));
+    }
+    if (!is_absolute_path(path)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_NAME),
+                        errmsg("relative path not allowed for a server-side file")));
+    }
+
+    rowcontext = AllocSetContextCreate(CurrentMemoryContext, "vecs_write rows", ALLOCSET_DEFAULT_SIZES);
+
+    out = AllocateFile(path, PG_BINARY_W);
+    if (out == NULL) {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open file \"%s\" for writing: %m", path)));
+    }
+    setvbuf(out, NULL, _IOFBF, VECS_BUFFER);
+
+    if (SPI_connect() != SPI_OK_CONNECT) elog(ERROR, "SPI_connect failed");
+
+    plan = SPI_prepare(query, 0, NULL);
+    if (plan == NULL) elog(ERROR, "SPI_prepare failed: %s", SPI_result_code_string(SPI_result));
+    portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+    for (;;) {
+        SPI_cursor_fetch(portal, true, VECS_FETCH);
+        if (SPI_processed == 0) break;
+
+        // the type of the first column (once)
+        if (typid == InvalidOid) {
+            typid = SPI_gettypeid(SPI_tuptable->tupdesc, 1);
+
+            if (format == VECS_FVECS && typid != FLOAT4ARRAYOID && typid != INT4ARRAYOID) {
+                if (!(native = vecs_is_type(typid, c_fvec_in))) {
+                    ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                                    errmsg("the first column of the query must be real[], int[] or fvec, not %s", format_type_be(typid))));
+                }
+            }
+            else if (format == VECS_BVECS && typid != INT4ARRAYOID) {
+                if (!(native = vecs_is_type(typid, c_bvec_in))) {
+                    ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                                    errmsg("the first column of the query must be int[] or bvec, not %s", format_type_be(typid))));
+                }
+            }
+            else if (format == VECS_IVECS && typid != INT4ARRAYOID) {
+                ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                                errmsg("the first column of the query must be int[], not %s", format_type_be(typid))));
+            }
+        }
+
+        for (i = 0; i < SPI_processed; i++, rows++) {
+            bool    isnull;
+            Datum   value = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull);
+            int     dim;
+
+            if (isnull) {
+                ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                                errmsg("the vector of row " INT64_FORMAT " is NULL", rows)));
+            }
+
+            oldcontext = MemoryContextSwitchTo(rowcontext);
+
+            if (native && format == VECS_FVECS) {
+                FVector*    vector = DatumGetFVector(value);
+
+                dim = FVEC_DIM(vector);
+#ifdef WORDS_BIGENDIAN
+                vector = (FVector*) PG_DETOAST_DATUM_COPY(value);
+                for (pos = 0; pos < dim; pos++) ((uint32*) vector->x)[pos] = pg_bswap32(((uint32*) vector->x)[pos]);
+#endif
+                vecs_put(out, path, vector->x, dim, sizeof(float4));
+            }
+            else if (native) {
+                BVector*    vector = DatumGetBVector(value);
+
+                vecs_put(out, path, BVEC_DATA(vector), BVEC_DIM(vector), sizeof(uint8));
+            }
+            else {
+                ArrayType*  vector = vecs_array(value, rows, &dim);
+                int32*      data = (int32*) ARR_DATA_PTR(vector);
+
+                if (dim > capacity) {
+                    MemoryContextSwitchTo(oldcontext);
+                    buffer = (buffer == NULL) ? (uint8*) palloc(sizeof(int32) * dim) : (uint8*) repalloc(buffer, sizeof(int32) * dim);
+                    capacity = dim;
+                    MemoryContextSwitchTo(rowcontext);
+                }
+
+                // int[] to float32 (.fvecs) and to uint8 (.bvecs), the rest as it is
+                if (format == VECS_FVECS && typid == INT4ARRAYOID) {
+                    for (pos = 0; pos < dim; pos++) ((float4*) buffer)[pos] = (float4) data[pos];
+                }
+                else if (format == VECS_BVECS) {
+                    for (pos = 0; pos < dim; pos++) {
+                        if (data[pos] < 0 || data[pos] > 255) {
+                            ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                                            errmsg("bvecs element %d out of range 0..255 (row " INT64_FORMAT ")", data[pos], rows)));
+                        }
+                        buffer[pos] = (uint8) data[pos];
+                    }
+                }
+                else memcpy(buffer, data, sizeof(int32) * dim);
+
+#ifdef WORDS_BIGENDIAN
+                if (format != VECS_BVECS) {
+                    for (pos = 0; pos < dim; pos++) ((uint32*) buffer)[pos] = pg_bswap32(((uint32*) buffer)[pos]);
+                }
+#endif
+                vecs_put(out, path, buffer, dim, vecs_sizes[format]);
+            }
+
+            MemoryContextSwitchTo(oldcontext);
+            MemoryContextReset(rowcontext);
+        }
+        SPI_freetuptable(SPI_tuptable);
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    SPI_cursor_close(portal);
+    SPI_finish();
+
+    if (FreeFile(out) != 0) {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not close file \"%s\": %m", path)));
+    }
+    MemoryContextDelete(rowcontext);
+
+    PG_RETURN_INT64(rows);
+}
+
+
+PG_FUNCTION_INFO_V1(c_fvecs_write);
+/****************************************************************************************************
+ * Writes the vectors of a query (its first column - real[], int[] or fvec) to a server-side .fvecs file
+ * @param path text - absolute, overwritten
+ * @param query text
+ * @return int8 - the number of vectors
+ */
+Datum
+c_fvecs_write(PG_FUNCTION_ARGS) {
+    return vecs_write(fcinfo, VECS_FVECS);
+}
+
+PG_FUNCTION_INFO_V1(c_bvecs_write);
+/*
+ * Writes the vectors of a query (int[] of 0..255 or bvec) to a server-side .bvecs file
+ */
+Datum
+c_bvecs_write(PG_FUNCTION_ARGS) {
+    return vecs_write(fcinfo, VECS_BVECS);
+}
+
+PG_FUNCTION_INFO_V1(c_ivecs_write);
+/*
+ * Writes the vectors of a query (int[]) to a server-side .ivecs file
+ */
+Datum
+c_ivecs_write(PG_FUNCTION_ARGS) {
+    return vecs_write(fcinfo, VECS_IVECS);
+}
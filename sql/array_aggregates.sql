@@ -0,0 +1,66 @@
+--
+-- array_accumulate, array_avg and array_std - the partial aggregates combined by array_acc_combine_real
+-- (parallel and partition-wise aggregation) equal the serial ones, also of 1-row partitions and of
+-- 4-dim rows ending in -1 or 7-dim rows ending in -2 (they look like an accumulator checksum)
+--
+SELECT array_acc_real('{}', '{1,2,3,-1}');
+SELECT array_acc_combine_real(array_acc_real('{}', '{1,2,3,-1}'), array_acc_real('{}', '{3,2,1,-1}'));
+SELECT array_acc_combine_real('{}', array_acc_real('{}', '{1,1,1,1,1,1,-2}'));
+SELECT array_acc_combine_real(array_acc_real('{}', '{1,2}'), array_acc_real('{}', '{1,2,3}'));
+CREATE TABLE acc_parts (p int, x real[]) PARTITION BY LIST (p);
+CREATE TABLE acc_parts1 PARTITION OF acc_parts FOR VALUES IN (1);
+CREATE TABLE acc_parts2 PARTITION OF acc_parts FOR VALUES IN (2);
+CREATE TABLE acc_parts3 PARTITION OF acc_parts FOR VALUES IN (3);
+CREATE TABLE acc_parts4 PARTITION OF acc_parts FOR VALUES IN (4);
+CREATE TABLE acc_parts5 PARTITION OF acc_parts FOR VALUES IN (5);
+CREATE TABLE acc_parts6 PARTITION OF acc_parts FOR VALUES IN (6);
+INSERT INTO acc_parts VALUES (1, '{1,2,3,-1}'), (1, '{3,2,1,-1}'), (2, '{1,2,3,-1}'), (3, '{3,2,1,-1}'),
+                             (4, '{1,1,1,1,1,1,-2}'), (5, '{3,3,3,3,3,3,-2}');
+CREATE TABLE acc_rows (x real[]);
+INSERT INTO acc_rows SELECT CASE WHEN i % 2 = 0 THEN '{1,2,3,-1}'::real[] ELSE '{3,2,1,-1}'::real[] END
+  FROM generate_series(1, 2000) i;
+ANALYZE acc_parts;
+ANALYZE acc_rows;
+-- serial
+SET max_parallel_workers_per_gather = 0;
+SET enable_partitionwise_aggregate = off;
+SELECT array_accumulate(x), array_avg(x), array_std(x) FROM acc_parts WHERE false;
+CREATE TABLE acc_serial AS
+SELECT array_length(x, 1) AS dim, array_accumulate(x) AS acc, array_avg(x) AS avg, array_std(x) AS std
+  FROM acc_parts GROUP BY 1;
+SELECT * FROM acc_serial ORDER BY dim;
+-- parallel and partition-wise - partial aggregates of the partitions (1 row, 2 rows, no rows) and the workers
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 4;
+SET enable_partitionwise_aggregate = on;
+ALTER TABLE acc_rows SET (parallel_workers = 4);
+-- the workers aggregate the rows in parallel (the speedup - no Partial Aggregate without the combine function,
+-- the wall time itself is not stable enough for the expected output)
+EXPLAIN (COSTS OFF) SELECT array_accumulate(x), array_avg(x), array_std(x) FROM acc_rows;
+DO $$ BEGIN
+  PERFORM set_config(CASE WHEN current_setting('server_version_num')::int >= 160000
+                          THEN 'debug_parallel_query' ELSE 'force_parallel_mode' END, 'on', false);
+END $$;
+SELECT s.dim, p.acc = s.acc AS acc, p.avg = s.avg AS avg, p.std = s.std AS std
+  FROM acc_serial s
+  JOIN (SELECT array_length(x, 1) AS dim, array_accumulate(x) AS acc, array_avg(x) AS avg, array_std(x) AS std
+          FROM acc_parts GROUP BY 1) p ON p.dim = s.dim
+ ORDER BY s.dim;
+SELECT array_accumulate(x), array_avg(x), array_std(x) FROM acc_parts WHERE p IN (2, 3);
+SELECT array_accumulate(x), array_avg(x), array_std(x) FROM acc_parts WHERE p IN (4, 5, 6);
+SELECT array_accumulate(x), array_avg(x), array_std(x) FROM acc_rows;
+SELECT array_accumulate(x), array_avg(x), array_std(x) FROM acc_rows WHERE false;
+DO $$ BEGIN
+  PERFORM set_config(CASE WHEN current_setting('server_version_num')::int >= 160000
+                          THEN 'debug_parallel_query' ELSE 'force_parallel_mode' END, 'off', false);
+END $$;
+RESET enable_partitionwise_aggregate;
+RESET max_parallel_workers_per_gather;
+RESET min_parallel_table_scan_size;
+RESET parallel_tuple_cost;
+RESET parallel_setup_cost;
+DROP TABLE acc_serial;
+DROP TABLE acc_rows;
+DROP TABLE acc_parts;
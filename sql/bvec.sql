@@ -0,0 +1,12 @@
+--
+-- bvec(n) - the text and binary I/O, the typmod, the casts and the quantization
+--
+SELECT '{1,5,255}'::bvec AS braces, '[0, 7]'::bvec(2) AS brackets;
+SELECT bvec_send('{1,255}');
+SELECT '{1,256}'::bvec;
+SELECT '{1,2}'::bvec(3);
+SELECT ARRAY[1,-1]::bvec;
+SELECT ARRAY[1,2,3]::bvec AS from_int, '{4,5}'::bvec::int[] AS to_int;
+SELECT quantize('{0,1.4,1.6,-5,300}'::real[]) AS quantized, dequantize('{0,128,255}'::bvec, 0, 510) AS dequantized;
+SELECT '{1,5,9}'::bvec <-> '{5,6,7}' AS square, '{1,5,9}'::bvec <+> '{5,6,7}' AS manhattan,
+       rating_dot_int('{1,5,9}'::bvec, '{5,6,7}'::bvec) AS dot;
@@ -0,0 +1,15 @@
+--
+-- the binary I/O of fvec, bvec and sparsevec - a client side COPY round trip (the file is written to the results
+-- directory of the regression run and removed with it)
+--
+CREATE TABLE vector_rows (id int, f fvec(3), b bvec(3), s sparsevec);
+INSERT INTO vector_rows VALUES
+    (1, '{1,2,3}', '{1,2,3}', '{2:1,5:0.5,1000000:-2}'),
+    (2, '[0.5,-1,0.001]', '{0,128,255}', '{}'),
+    (3, NULL, NULL, '{-5:1,2:3}');
+\copy vector_rows TO 'results/copy_binary.bin' (FORMAT binary)
+CREATE TABLE vector_copy (LIKE vector_rows);
+\copy vector_copy FROM 'results/copy_binary.bin' (FORMAT binary)
+SELECT c.*, sparsevec_norm(c.s) = sparsevec_norm(r.s) AS norm FROM vector_copy c JOIN vector_rows r ON r.id = c.id ORDER BY c.id;
+DROP TABLE vector_copy;
+DROP TABLE vector_rows;
@@ -0,0 +1,17 @@
+--
+-- fvec(n) - the text and binary I/O, the typmod and the casts
+--
+SELECT '{1,2.5,-3}'::fvec AS braces, '[1, 2.5, -3]'::fvec(3) AS brackets;
+SELECT fvec_send('{1,2}');
+SELECT '{1,2}'::fvec(3);
+SELECT '{1,x}'::fvec;
+SELECT '{1,2} 3'::fvec;
+SELECT ARRAY[1,NULL]::fvec;
+SELECT ARRAY[1,2,3]::fvec AS from_int, '{1.5,2}'::real[]::fvec AS from_real, '{1,2}'::fvec::real[] AS to_real;
+SELECT '{1,2}'::fvec <-> '{3,5}' AS square, '{1,2}'::fvec <+> '{3,5}' AS manhattan;
+SELECT '{1,2}'::fvec <-> '{1,2,3}';
+CREATE TABLE fvec_rows (id int, v fvec(3));
+INSERT INTO fvec_rows VALUES (1, '{1,2,3}'), (2, '[0.5,-1,0.001]');
+SELECT format_type(atttypid, atttypmod) FROM pg_attribute WHERE attrelid = 'fvec_rows'::regclass AND attname = 'v';
+INSERT INTO fvec_rows VALUES (3, '{1,2}');
+DROP TABLE fvec_rows;
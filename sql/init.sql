@@ -0,0 +1,11 @@
+--
+-- pgsiftorder - install the functions (install.sql) into the regression database, the library must be
+-- installed first: make install && make installcheck; an error of install.sql stops it and shows here
+--
+\setenv PGDATABASE :DBNAME
+\setenv PGHOST :HOST
+\setenv PGPORT :PORT
+\setenv PGUSER :USER
+\setenv PGOPTIONS '-c client_min_messages=warning'
+\! psql -X -q -v ON_ERROR_STOP=1 -f install.sql 2>&1 && echo install.sql: ok
+SELECT to_regproc('array_acc_real') IS NOT NULL AS installed;
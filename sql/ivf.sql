@@ -0,0 +1,67 @@
+--
+-- sift_ivf - an index scan visiting all the lists (probes = lists) returns the rows of the sequential scan,
+-- after the build, after inserts, of int[] (exact int8 order) and for an index built on an empty table
+--
+CREATE TABLE ivf_rows (id int, v real[]);
+INSERT INTO ivf_rows SELECT i, ARRAY[sin(i), cos(i * 7), sin(i * 13)]::real[] FROM generate_series(1, 500) i;
+CREATE TABLE ivf_queries (n int, q real[]);
+INSERT INTO ivf_queries VALUES (1, '{0,0,0}'), (2, '{0.5,-0.5,0.25}'), (3, '{1,1,1}'), (4, '{-0.9,0.1,0.7}');
+-- the 20 nearest rows of each query by the index and by the sequential scan (query ~ an expression of q)
+CREATE FUNCTION ivf_exact(rel regclass, op text, query text DEFAULT 'q') RETURNS TABLE (n int, exact boolean) AS $$
+DECLARE
+    q text;
+    t text;
+    indexed int[];
+    sequential int[];
+BEGIN
+    FOR n, q, t IN EXECUTE format('SELECT n, (%1$s)::text, pg_typeof(%1$s)::text FROM ivf_queries ORDER BY n', query) LOOP
+        PERFORM set_config('enable_seqscan', 'off', true);
+        EXECUTE format('SELECT array_agg(id) FROM (SELECT id FROM %s ORDER BY v %s %L::%s LIMIT 20) s', rel, op, q, t)
+           INTO indexed;
+        PERFORM set_config('enable_seqscan', 'on', true);
+        PERFORM set_config('enable_indexscan', 'off', true);
+        EXECUTE format('SELECT array_agg(id) FROM (SELECT id FROM %s ORDER BY v %s %L::%s, id LIMIT 20) s', rel, op, q, t)
+           INTO sequential;
+        PERFORM set_config('enable_indexscan', 'on', true);
+        exact := indexed = sequential;
+        RETURN NEXT;
+    END LOOP;
+END
+$$ LANGUAGE plpgsql;
+SELECT opcname, amvalidate(oid) FROM pg_opclass WHERE opcmethod = (SELECT oid FROM pg_am WHERE amname = 'sift_ivf')
+ ORDER BY opcname;
+CREATE INDEX ivf_rows_v_idx ON ivf_rows USING sift_ivf (v) WITH (lists = 10);
+ANALYZE ivf_rows;
+SET pgsiftorder.ivf_probes = 10;
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM ivf_rows ORDER BY v <-> '{0,0,0}' LIMIT 20;
+RESET enable_seqscan;
+SELECT * FROM ivf_exact('ivf_rows', '<->');
+SELECT * FROM ivf_exact('ivf_rows', '<+>');
+-- the inserted rows go to the nearest lists
+INSERT INTO ivf_rows SELECT i, ARRAY[sin(i), cos(i * 7), sin(i * 13)]::real[] FROM generate_series(501, 700) i;
+SELECT * FROM ivf_exact('ivf_rows', '<->');
+-- int[] of large elements (square distances far beyond 2^24)
+CREATE TABLE ivf_int (id int, v int[]);
+INSERT INTO ivf_int SELECT i, ARRAY[round(sin(i) * 1e7), round(cos(i * 7) * 1e7), round(sin(i * 13) * 1e7)]::int[]
+  FROM generate_series(1, 500) i;
+CREATE INDEX ivf_int_v_idx ON ivf_int USING sift_ivf (v) WITH (lists = 10);
+SELECT * FROM ivf_exact('ivf_int', '<->', 'array(SELECT round(x * 1e7)::int FROM unnest(q) x)');
+SELECT * FROM ivf_exact('ivf_int', '<+>', 'array(SELECT round(x * 1e7)::int FROM unnest(q) x)');
+-- fewer rows than lists - a warning, as many lists as rows
+CREATE TABLE ivf_small AS SELECT * FROM ivf_rows WHERE id <= 5;
+CREATE INDEX ivf_small_v_idx ON ivf_small USING sift_ivf (v) WITH (lists = 10);
+DROP TABLE ivf_small;
+-- an index of an empty table - a warning, the first insert makes the only list, REINDEX makes the lists
+CREATE TABLE ivf_fvec (id int, v fvec(3));
+CREATE INDEX ivf_fvec_v_idx ON ivf_fvec USING sift_ivf (v) WITH (lists = 10);
+INSERT INTO ivf_fvec SELECT id, v FROM ivf_rows;
+SELECT * FROM ivf_exact('ivf_fvec', '<->', 'q::fvec');
+REINDEX INDEX ivf_fvec_v_idx;
+SELECT * FROM ivf_exact('ivf_fvec', '<->', 'q::fvec');
+RESET pgsiftorder.ivf_probes;
+DROP FUNCTION ivf_exact(regclass, text, text);
+DROP TABLE ivf_fvec;
+DROP TABLE ivf_int;
+DROP TABLE ivf_queries;
+DROP TABLE ivf_rows;
@@ -0,0 +1,16 @@
+--
+-- pq_distance - the lookup table of the query is rebuilt exactly when the query or the codebook change
+-- (constant, or the arguments of the rows)
+--
+SELECT pq_encode('{1,19}', '{{{0},{10}},{{0},{20}}}') AS code,
+       pq_distance('{1,19}', '\x0001', '{{{0},{10}},{{0},{20}}}') AS distance;
+CREATE TABLE pq_books (id int, codebook real[]);
+INSERT INTO pq_books VALUES (1, '{{{0},{10}},{{0},{20}}}'), (2, '{{{5},{6}},{{7},{8}}}');
+CREATE TABLE pq_rows (id int, book int, query real[], code bytea);
+INSERT INTO pq_rows VALUES (1, 1, '{1,19}', '\x0001'), (2, 2, '{1,19}', '\x0001'), (3, 1, '{1,19}', '\x0100'),
+                           (4, 2, '{0,0}', '\x0000'), (5, 2, '{0,0}', '\x0000');
+SELECT r.id, pq_distance(r.query, r.code, b.codebook)
+  FROM pq_rows r JOIN pq_books b ON b.id = r.book
+ ORDER BY r.id;
+DROP TABLE pq_rows;
+DROP TABLE pq_books;
@@ -0,0 +1,16 @@
+--
+-- rating_boolean - the inline merges (int2 .. float8) and the comparison function of the type cache
+-- (the rest, e.g. text and numeric) count the common elements of two sorted arrays alike
+--
+SELECT rating_boolean('{1,2,3,5,8}'::int[], '{2,3,4,8}'::int[]) AS int4,
+       rating_boolean('{1,2,3,5,8}'::int8[], '{2,3,4,8}'::int8[]) AS int8,
+       rating_boolean('{0.5,1.5,2.5}'::real[], '{1.5}'::real[]) AS float4,
+       rating_boolean('{1.5,2,3}'::numeric[], '{2,3.0}'::numeric[]) AS "numeric",
+       rating_boolean(ARRAY['a','b','c'] COLLATE "C", ARRAY['b','c','d']) AS text;
+-- repeated elements match once a pair (never more than the shorter array)
+SELECT rating_boolean('{1,1,2}'::int[], '{1,2}'::int[]) AS int4,
+       rating_boolean(array_fill(5, ARRAY[40]), '{5}'::int[]) AS one,
+       rating_boolean(array_fill(5, ARRAY[40]), array_fill(5, ARRAY[40])) AS forty,
+       rating_boolean(array_fill(5::int8, ARRAY[40]), array_fill(5::int8, ARRAY[3])) AS int8,
+       rating_boolean(ARRAY['a','a','b'] COLLATE "C", ARRAY['a','b']) AS text;
+SELECT rating_boolean('{}'::int[], '{1,2}'::int[]) AS empty;
@@ -0,0 +1,33 @@
+--
+-- pgsiftorder.rating_overlap - rating_*(column, query) > 0 gets the index paths of column && query if
+-- the column has a GIN index, the row estimate (and a sequential scan) is of the rating alone
+--
+CREATE TABLE rating_docs (id int, ids int[]);
+INSERT INTO rating_docs SELECT i, ARRAY[i % 50, 50 + i % 37, 100 + i % 13] FROM generate_series(1, 1000) i;
+CREATE TABLE rating_plain AS SELECT * FROM rating_docs;
+CREATE INDEX rating_docs_ids_idx ON rating_docs USING gin (ids);
+ANALYZE rating_docs;
+ANALYZE rating_plain;
+CREATE FUNCTION rating_rows(query text) RETURNS float8 AS $$
+DECLARE
+    plan json;
+BEGIN
+    EXECUTE 'EXPLAIN (FORMAT JSON) ' || query INTO plan;
+    RETURN plan -> 0 -> 'Plan' ->> 'Plan Rows';
+END
+$$ LANGUAGE plpgsql;
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM rating_docs WHERE rating_boolean(ids, '{3,60}'::int[]) > 0;
+SELECT count(*) FROM rating_docs WHERE rating_boolean(ids, '{3,60}'::int[]) > 0;
+-- the default selectivity of the rating (1/3), not multiplied by that of the &&
+SELECT rating_rows($q$SELECT id FROM rating_docs WHERE rating_boolean(ids, '{3,60}'::int[]) > 0$q$) AS indexed,
+       rating_rows($q$SELECT id FROM rating_plain WHERE rating_boolean(ids, '{3,60}'::int[]) > 0$q$) AS plain;
+-- no index of the column - no &&
+EXPLAIN (COSTS OFF) SELECT id FROM rating_plain WHERE rating_boolean(ids, '{3,60}'::int[]) > 0;
+SET pgsiftorder.rating_overlap = off;
+EXPLAIN (COSTS OFF) SELECT id FROM rating_docs WHERE rating_boolean(ids, '{3,60}'::int[]) > 0;
+RESET pgsiftorder.rating_overlap;
+RESET enable_seqscan;
+DROP FUNCTION rating_rows(text);
+DROP TABLE rating_plain;
+DROP TABLE rating_docs;
@@ -0,0 +1,39 @@
+--
+-- sift_search - the k best of the WAND scan over the GIN posting lists equal the brute force
+-- ORDER BY rating_cosine (rating_boolean), also of a query repeating an id; rows of NULL elements are skipped
+--
+CREATE TABLE search_docs (id int, ids int[], w real[]);
+INSERT INTO search_docs
+SELECT i, array_agg(t ORDER BY t), array_agg(((i + t) % 7 + 1)::real ORDER BY t)
+  FROM generate_series(1, 300) i,
+       LATERAL (SELECT DISTINCT (i * j + j * j) % 60 AS t FROM generate_series(1, 8) j) s
+ GROUP BY i
+ ORDER BY i;
+INSERT INTO search_docs VALUES (301, '{3,NULL,42}', '{9,9,9}'), (302, '{3,10,42}', '{9,NULL,9}');
+CREATE INDEX search_docs_ids ON search_docs USING gin (ids);
+CREATE TABLE search_queries (ids int[], w real[]);
+INSERT INTO search_queries VALUES ('{3,3,10,17,42}', '{1,2,1,1,3}');
+-- the cosine, the query constant (the query cache of rating_cosine) and a column (the merge)
+WITH s AS (SELECT d.id, s.score
+             FROM sift_search('search_docs', 'ids', '{3,3,10,17,42}', '{1,2,1,1,3}', 10, 'w') s
+             JOIN search_docs d ON d.ctid = s.ctid),
+     b AS (SELECT id, rating_cosine(ids, w, '{3,3,10,17,42}', '{1,2,1,1,3}') AS score
+             FROM search_docs WHERE id <= 300 ORDER BY 2 DESC, id LIMIT 10),
+     m AS (SELECT d.id, rating_cosine(d.ids, d.w, q.ids, q.w) AS score
+             FROM search_docs d, search_queries q WHERE d.id <= 300 ORDER BY 2 DESC, d.id LIMIT 10)
+SELECT (SELECT count(*) FROM s) AS found,
+       (SELECT count(*) FROM (TABLE s EXCEPT TABLE b) x) AS differ,
+       (SELECT count(*) FROM (TABLE s EXCEPT TABLE m) x) AS differ_merge,
+       (SELECT count(*) FROM s WHERE id > 300) AS nulls;
+-- the weighted boolean (the number of the common ids for the weights 1)
+WITH s AS (SELECT d.id, s.score
+             FROM sift_search('search_docs', 'ids', '{3,3,10,17,42}', '{1,1,1,1,1}', 10) s
+             JOIN search_docs d ON d.ctid = s.ctid),
+     b AS (SELECT id, rating_boolean(ids, '{3,3,10,17,42}'::int[])::real AS score
+             FROM search_docs WHERE id <> 301 ORDER BY 2 DESC, id LIMIT 10)
+SELECT (SELECT count(*) FROM s) AS found,
+       (SELECT count(*) FROM (TABLE s EXCEPT TABLE b) x) AS differ,
+       (SELECT score FROM s WHERE id = 302) AS rated;
+SELECT count(*) FROM sift_search('search_docs', 'ids', '{1000}', '{1}', 10, 'w');
+DROP TABLE search_queries;
+DROP TABLE search_docs;
@@ -0,0 +1,13 @@
+--
+-- sparsevec - the text and binary I/O (sorted, varbyte coded ids), the empty vector and the accessors
+--
+SELECT '{5:0.5, 2:1,1000000:-2}'::sparsevec AS sorted, '{-5:1,2:3}'::sparsevec AS negative, sparsevec('{7,3}', '{1,2}') AS arrays;
+SELECT sparsevec_ids(v), sparsevec_weights(v), sparsevec_norm(v) FROM (SELECT '{3:4,1:3}'::sparsevec AS v) s;
+SELECT '{ }'::sparsevec AS empty, sparsevec_ids('{}') AS ids, sparsevec_weights('{}') AS weights,
+       sparsevec_ids('{}') = '{}' AS is_empty, array_ndims(sparsevec_weights('{}')) AS ndims;
+SELECT sparsevec_send('{1:1,300:0.5}');
+SELECT '{1:1,1:2}'::sparsevec;
+SELECT '{1 2}'::sparsevec;
+SELECT '{1:nan}'::sparsevec;
+SELECT rating_cosine('{1:3,2:4}'::sparsevec, '{2:1}'::sparsevec) AS cosine, rating_dot('{1:3,2:4}'::sparsevec, '{2:1}'::sparsevec) AS dot,
+       rating_boolean('{1:3,2:4}'::sparsevec, '{2:1}'::sparsevec) AS boolean;
@@ -0,0 +1,56 @@
+--
+-- topk and topk_distance - the k best ids (ties by the smaller id, NaN above all numbers, NULLs skipped),
+-- the partial states combined and serialized (partition-wise and parallel aggregation) as the serial ones
+--
+CREATE TABLE topk_rows (id bigint, score real);
+INSERT INTO topk_rows VALUES (1, 0.5), (2, 0.9), (3, 0.9), (4, 'NaN'), (5, NULL), (6, 0.1), (7, 0.7), (8, -1), (9, 0.9),
+                             (10, 0.2), (NULL, 1);
+SELECT topk(id, score, 3) AS best, topk_distance(id, score, 3) AS nearest, topk(id, score, 0) AS none,
+       topk(id, score, 20) AS everything
+  FROM topk_rows;
+SELECT id % 2 AS odd, topk(id, score, 2) FROM topk_rows WHERE id IS NOT NULL GROUP BY 1 ORDER BY 1;
+SELECT topk(id, score, 3) FROM topk_rows WHERE false;
+SELECT topk(id, score, NULL) FROM topk_rows;
+-- the heap grows with the rows, a k far above them costs no more memory than they do
+SELECT topk(id, score, 67108862) AS everything FROM topk_rows;
+SELECT topk(id, score, 67108863) FROM topk_rows;
+CREATE TABLE topk_parts (p int, id bigint, score real) PARTITION BY LIST (p);
+CREATE TABLE topk_parts1 PARTITION OF topk_parts FOR VALUES IN (1);
+CREATE TABLE topk_parts2 PARTITION OF topk_parts FOR VALUES IN (2);
+CREATE TABLE topk_parts3 PARTITION OF topk_parts FOR VALUES IN (3);
+INSERT INTO topk_parts VALUES (1, 1, 0.5), (2, 2, 0.9), (2, 3, 0.9);
+CREATE TABLE topk_many (id bigint, score real);
+INSERT INTO topk_many SELECT i, (i * 7919 % 1000) / 10.0 FROM generate_series(1, 20000) i;
+ANALYZE topk_parts;
+ANALYZE topk_many;
+-- parallel and partition-wise - partial states of the partitions (1 row, 2 rows, no rows) and the workers
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 4;
+SET enable_partitionwise_aggregate = on;
+ALTER TABLE topk_many SET (parallel_workers = 4);
+DO $$ BEGIN
+  PERFORM set_config(CASE WHEN current_setting('server_version_num')::int >= 160000
+                          THEN 'debug_parallel_query' ELSE 'force_parallel_mode' END, 'on', false);
+END $$;
+SELECT topk(id, score, 2) AS best, topk_distance(id, score, 2) AS nearest FROM topk_parts;
+SELECT topk(id, score, 2) AS best, topk_distance(id, score, 2) AS nearest FROM topk_parts WHERE p IN (1, 3);
+SELECT topk(id, score, 2) AS best, topk_distance(id, score, 2) AS nearest FROM topk_parts WHERE p = 3;
+SELECT topk(id, score, 25) = (SELECT array_agg(id ORDER BY score DESC, id)
+                                FROM (SELECT id, score FROM topk_many ORDER BY score DESC, id LIMIT 25) s) AS best,
+       topk_distance(id, score, 25) = (SELECT array_agg(id ORDER BY score, id)
+                                         FROM (SELECT id, score FROM topk_many ORDER BY score, id LIMIT 25) s) AS nearest
+  FROM topk_many;
+DO $$ BEGIN
+  PERFORM set_config(CASE WHEN current_setting('server_version_num')::int >= 160000
+                          THEN 'debug_parallel_query' ELSE 'force_parallel_mode' END, 'off', false);
+END $$;
+RESET enable_partitionwise_aggregate;
+RESET max_parallel_workers_per_gather;
+RESET min_parallel_table_scan_size;
+RESET parallel_tuple_cost;
+RESET parallel_setup_cost;
+DROP TABLE topk_many;
+DROP TABLE topk_parts;
+DROP TABLE topk_rows;
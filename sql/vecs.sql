@@ -0,0 +1,16 @@
+--
+-- fvecs_read / fvecs_write - the start of a mixed dimension file is walked to, the declared dimension
+-- jumps to it (and is checked)
+--
+SELECT fvecs_write('/tmp/pgsiftorder_regress_mixed.fvecs', $$SELECT v FROM (VALUES (0, '{1}'::int[]), (1, '{2,3,4}'), (2, '{5}'), (3, '{6}')) t(n, v) ORDER BY n$$);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_mixed.fvecs');
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_mixed.fvecs', 3);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_mixed.fvecs', 1, 2);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_mixed.fvecs', 1, NULL, 1);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_mixed.fvecs', 0, NULL, 2);
+SELECT fvecs_write('/tmp/pgsiftorder_regress_single.fvecs', $$SELECT v FROM (VALUES (0, '{1,2}'::real[]), (1, '{3,4}'), (2, '{5,6}')) t(n, v) ORDER BY n$$);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_single.fvecs', 2, NULL, 2);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_single.fvecs', 5, NULL, 2);
+SELECT * FROM fvecs_read('/tmp/pgsiftorder_regress_single.fvecs', 1, NULL, 3);
+SELECT * FROM bvecs_read('/tmp/pgsiftorder_regress_single.fvecs');
+\! rm -f /tmp/pgsiftorder_regress_mixed.fvecs /tmp/pgsiftorder_regress_single.fvecs